@@ -0,0 +1,279 @@
+/*
+File: attitude.c
+Author: Leonardo DaGraca
+
+Fixed-point Madgwick filter, see attitude.h. With q the orientation and a the
+unit accelerometer vector, the objective is the difference between gravity
+seen from q and a:
+  f = [2(q1q3 - q0q2) - ax, 2(q0q1 + q2q3) - ay, 2(0.5 - q1^2 - q2^2) - az]
+and the step direction is its gradient J^T f, normalised. The gyro part of
+the update is q += q * (0, w dt / 2). Unlike the original filter, which takes
+both parts from the previous q, the gradient is taken after the gyro step:
+comparing the new sample with the old orientation would leave the attitude
+lagging by the rotation of one sample period (~1 degree at 200 deg/s, 200 Hz).
+
+Vectors are normalised after scaling them into 15 bits, which keeps the sum
+of squares in 32 bits and costs one 32 bit square root; that is enough for
+directions (~3e-5). The quaternion itself is renormalised with one Newton step
+of 1/sqrt around 1 so it keeps full Q30 precision.
+
+The first sample sets roll and pitch directly from gravity (the device is
+usually at rest at power-up), so there is no high gain start-up
+phase whose large steps would also twist the heading.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "attitude.h"
+
+#define Q30_ONE (1 << 30)
+
+void attitude_init(Attitude *attitude) {
+    memset(attitude, 0, sizeof(*attitude));
+    attitude->q[0] = Q30_ONE;
+}
+
+void attitude_reset_peak(Attitude *attitude) {
+    attitude->peak_linear_sq = 0;
+}
+
+static uint32_t isqrt32(uint32_t value) {
+    uint32_t result = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+//scales v to unit length in Q30, returns its length in the units of v (0 for the zero vector)
+static uint32_t normalize(int32_t *v, int n) {
+    uint32_t max = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t mag = v[i] < 0 ? -(uint32_t)v[i] : (uint32_t)v[i];
+        if (mag > max) {
+            max = mag;
+        }
+    }
+    if (max == 0) {
+        return 0;
+    }
+
+    //bring the largest component to 14-15 bits, four squares then fit in 32 bits
+    int shift = 0;
+    while (max >= (1UL << 15)) {
+        max >>= 1;
+        shift++;
+    }
+    while (max < (1UL << 14)) {
+        max <<= 1;
+        shift--;
+    }
+
+    int32_t scaled[4];
+    uint32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        scaled[i] = shift >= 0 ? v[i] / (1 << shift) : v[i] * (1 << -shift);
+        sum += (uint32_t)(scaled[i] * scaled[i]);
+    }
+    int32_t norm = (int32_t)isqrt32(sum);
+
+    //|scaled| <= norm < 2^16, so each quotient fits 15 bits before the last shift
+    for (int i = 0; i < n; i++) {
+        v[i] = (scaled[i] * (1 << 15)) / norm * (1 << 15);
+    }
+    return shift >= 0 ? (uint32_t)norm << shift : (uint32_t)norm >> -shift;
+}
+
+//one Newton step of 1/sqrt(n) around n = 1: q *= (3 - n) / 2
+static void renormalize(int32_t *q) {
+    int64_t n = ((int64_t)q[0] * q[0] + (int64_t)q[1] * q[1] + (int64_t)q[2] * q[2] + (int64_t)q[3] * q[3]) >> 30;
+    int32_t scale = (int32_t)((3 * (int64_t)Q30_ONE - n) / 2);
+    for (int i = 0; i < 4; i++) {
+        q[i] = (int32_t)((int64_t)q[i] * scale >> 30);
+    }
+}
+
+//the shortest rotation that explains the unit gravity vector a, heading 0
+static void start_from_gravity(int32_t *q, const int32_t *a) {
+    if (a[2] < -Q30_ONE + (Q30_ONE >> 10)) {
+        //upside down, the shortest rotation is not defined: roll by 180 degrees
+        q[0] = 0;
+        q[1] = Q30_ONE;
+        q[2] = 0;
+        q[3] = 0;
+        return;
+    }
+    q[0] = Q30_ONE / 2 + a[2] / 2;
+    q[1] = a[1] / 2;
+    q[2] = -a[0] / 2;
+    q[3] = 0;
+    normalize(q, 4);
+    renormalize(q);
+}
+
+void attitude_update(Attitude *attitude, uint64_t time_us, int32_t ax, int32_t ay, int32_t az,
+                     int32_t gx, int32_t gy, int32_t gz) {
+    int32_t *q = attitude->q;
+
+    int32_t a[3] = {ax, ay, az};
+    uint32_t a_norm = normalize(a, 3);
+    bool gated = a_norm + ATTITUDE_ACCEL_GATE < ATTITUDE_ACCEL_1G || a_norm > ATTITUDE_ACCEL_1G + ATTITUDE_ACCEL_GATE;
+
+    if (attitude->samples == 0) {
+        attitude->last_time_us = time_us;
+        if (a_norm) {
+            start_from_gravity(q, a);
+        }
+    }
+    uint32_t dt_us = (uint32_t)(time_us - attitude->last_time_us);
+    if (time_us < attitude->last_time_us || dt_us > ATTITUDE_MAX_DT_US) {
+        dt_us = 0;
+    }
+    attitude->last_time_us = time_us;
+    attitude->samples++;
+
+    //rotation of this sample: q * (0, h) with h = w dt / 2
+    int32_t h[3] = {
+        (int32_t)((int64_t)gx * dt_us * ATTITUDE_GYRO_HALF_RAD_Q52 >> 22),
+        (int32_t)((int64_t)gy * dt_us * ATTITUDE_GYRO_HALF_RAD_Q52 >> 22),
+        (int32_t)((int64_t)gz * dt_us * ATTITUDE_GYRO_HALF_RAD_Q52 >> 22)
+    };
+    //normalising q + q * (0, h) turns by 2 atan|h| instead of 2|h|, h (1 + |h|^2 / 3) makes up for it
+    int32_t hh = (int32_t)(((int64_t)h[0] * h[0] + (int64_t)h[1] * h[1] + (int64_t)h[2] * h[2]) >> 30);
+    for (int i = 0; i < 3; i++) {
+        h[i] += (int32_t)((int64_t)h[i] * hh >> 30) / 3;
+    }
+    int32_t step[4] = {
+        (int32_t)(-((int64_t)q[1] * h[0] + (int64_t)q[2] * h[1] + (int64_t)q[3] * h[2]) >> 30),
+        (int32_t)(((int64_t)q[0] * h[0] + (int64_t)q[2] * h[2] - (int64_t)q[3] * h[1]) >> 30),
+        (int32_t)(((int64_t)q[0] * h[1] - (int64_t)q[1] * h[2] + (int64_t)q[3] * h[0]) >> 30),
+        (int32_t)(((int64_t)q[0] * h[2] + (int64_t)q[1] * h[1] - (int64_t)q[2] * h[0]) >> 30)
+    };
+    for (int i = 0; i < 4; i++) {
+        q[i] += step[i];
+    }
+
+    //gradient step from the rotated q towards the measured gravity direction
+    if (a_norm && !gated) {
+        //f in Q28, it spans -3..3
+        int32_t f0 = (int32_t)(((((int64_t)q[1] * q[3] - (int64_t)q[0] * q[2]) >> 29) - a[0]) >> 2);
+        int32_t f1 = (int32_t)(((((int64_t)q[0] * q[1] + (int64_t)q[2] * q[3]) >> 29) - a[1]) >> 2);
+        int32_t f2 = (int32_t)((Q30_ONE - (((int64_t)q[1] * q[1] + (int64_t)q[2] * q[2]) >> 29) - a[2]) >> 2);
+
+        //J^T f in Q26
+        int32_t s[4] = {
+            (int32_t)((-(int64_t)q[2] * f0 + (int64_t)q[1] * f1) >> 31),
+            (int32_t)((((int64_t)q[3] * f0 + (int64_t)q[0] * f1) >> 31) - ((int64_t)q[1] * f2 >> 30)),
+            (int32_t)((((int64_t)q[3] * f1 - (int64_t)q[0] * f0) >> 31) - ((int64_t)q[2] * f2 >> 30)),
+            (int32_t)(((int64_t)q[1] * f0 + (int64_t)q[2] * f1) >> 31)
+        };
+
+        if (normalize(s, 4)) {
+            //beta * dt in Q30, 2^62 / 1e9 turns rad/s * 1000 * us into Q30 radians
+            int32_t beta_dt = (int32_t)((uint64_t)(ATTITUDE_BETA_MILLI * dt_us) * 4611686018ULL >> 32);
+            for (int i = 0; i < 4; i++) {
+                q[i] -= (int32_t)((int64_t)beta_dt * s[i] >> 30);
+            }
+        }
+    }
+    if (gated) {
+        attitude->gated++;
+    }
+
+    renormalize(q);
+
+    //gravity seen from q in counts, what is left of the sample is linear acceleration
+    int32_t g[3] = {
+        (int32_t)((((int64_t)q[1] * q[3] - (int64_t)q[0] * q[2]) >> 29) * ATTITUDE_ACCEL_1G >> 30),
+        (int32_t)((((int64_t)q[0] * q[1] + (int64_t)q[2] * q[3]) >> 29) * ATTITUDE_ACCEL_1G >> 30),
+        (int32_t)((((int64_t)q[0] * q[0] - (int64_t)q[1] * q[1] - (int64_t)q[2] * q[2] + (int64_t)q[3] * q[3]) >> 30) *
+                  ATTITUDE_ACCEL_1G >> 30)
+    };
+    attitude->linear_mg[0] = (ax - g[0]) * 1000 / ATTITUDE_ACCEL_1G;
+    attitude->linear_mg[1] = (ay - g[1]) * 1000 / ATTITUDE_ACCEL_1G;
+    attitude->linear_mg[2] = (az - g[2]) * 1000 / ATTITUDE_ACCEL_1G;
+
+    uint32_t linear_sq = 0;
+    for (int i = 0; i < 3; i++) {
+        linear_sq += (uint32_t)(attitude->linear_mg[i] * attitude->linear_mg[i]);
+    }
+    if (linear_sq > attitude->peak_linear_sq) {
+        attitude->peak_linear_sq = linear_sq;
+    }
+}
+
+//atan(z) * 18000 / pi for z = 0..1 in Q15, coefficients in Q8, error < 0.001 degree
+static int32_t atan_cdeg_q15(int32_t z) {
+    static const int32_t coeffs[5] = {30560, -124871, 264226, -484474, 1466575};
+    int64_t z2 = (int64_t)z * z >> 15;
+    int64_t t = coeffs[0];
+    for (int i = 1; i < 5; i++) {
+        t = coeffs[i] + (t * z2 >> 15);
+    }
+    return (int32_t)((t * z >> 15) + 128) >> 8;
+}
+
+//atan2(y, x) in 0.01 degree, -18000..18000
+static int32_t atan2_cdeg(int64_t y, int64_t x) {
+    uint64_t ax = x < 0 ? -x : x;
+    uint64_t ay = y < 0 ? -y : y;
+    if (ax == 0 && ay == 0) {
+        return 0;
+    }
+
+    //the ratio of the smaller to the larger component only needs 16 bits of each
+    while ((ax | ay) >= (1UL << 16)) {
+        ax >>= 1;
+        ay >>= 1;
+    }
+    int32_t angle = ay <= ax ? atan_cdeg_q15((int32_t)((uint32_t)(ay << 15) / (uint32_t)ax))
+                             : 9000 - atan_cdeg_q15((int32_t)((uint32_t)(ax << 15) / (uint32_t)ay));
+    if (x < 0) {
+        angle = 18000 - angle;
+    }
+    return y < 0 ? -angle : angle;
+}
+
+void attitude_euler_cdeg(const Attitude *attitude, int32_t euler[3]) {
+    const int32_t *q = attitude->q;
+
+    //gravity in the sensor frame gives roll and pitch, Q29
+    int64_t gx = ((int64_t)q[1] * q[3] - (int64_t)q[0] * q[2]) >> 30;
+    int64_t gy = ((int64_t)q[0] * q[1] + (int64_t)q[2] * q[3]) >> 30;
+    int64_t gz = ((int64_t)q[0] * q[0] - (int64_t)q[1] * q[1] - (int64_t)q[2] * q[2] + (int64_t)q[3] * q[3]) >> 31;
+    uint32_t gyz = isqrt32((uint32_t)((gy >> 14) * (gy >> 14) + (gz >> 14) * (gz >> 14))) << 14;
+
+    euler[0] = atan2_cdeg(gy, gz);
+    euler[1] = atan2_cdeg(-gx, gyz);
+    euler[2] = atan2_cdeg(((int64_t)q[1] * q[2] + (int64_t)q[0] * q[3]) >> 30,
+                          ((int64_t)q[0] * q[0] + (int64_t)q[1] * q[1] - (int64_t)q[2] * q[2] - (int64_t)q[3] * q[3]) >> 31);
+}
+
+int attitude_format(const Attitude *attitude, uint64_t timestamp, char *buf, size_t size) {
+    int32_t euler[3];
+    attitude_euler_cdeg(attitude, euler);
+
+    //quaternion components in millionths, rounded
+    int32_t q_e6[4];
+    for (int i = 0; i < 4; i++) {
+        q_e6[i] = (int32_t)(((int64_t)attitude->q[i] * 1000000 + (attitude->q[i] < 0 ? -(Q30_ONE / 2) : Q30_ONE / 2)) / Q30_ONE);
+    }
+
+    return snprintf(buf, size, "%" PRIu64 ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32
+                    ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n",
+                    timestamp, q_e6[0], q_e6[1], q_e6[2], q_e6[3], euler[0], euler[1], euler[2],
+                    attitude->linear_mg[0], attitude->linear_mg[1], attitude->linear_mg[2],
+                    isqrt32(attitude->peak_linear_sq), attitude->samples, attitude->gated);
+}
@@ -0,0 +1,70 @@
+/*
+File: attitude.h
+Author: Leonardo DaGraca
+
+Streaming attitude estimator on the IMU path, compiled in with ATTITUDE_FILTER.
+Every offset-corrected MPU6050 sample goes through one step of Madgwick's
+gradient descent filter (IMU version, no magnetometer): the gyro rates are
+integrated into the orientation quaternion, then a step of beta * dt pulls it
+towards the orientation that explains the measured gravity direction. Gravity
+is then removed from the sample to give the linear acceleration in mg.
+
+Everything per sample is integer math (Q30 quaternion, 32x32->64 products and
+a 32 bit square root), the M0+ has no FPU. One update costs about 55 64 bit
+multiplies, two 16 step square roots and seven divisions on the hardware
+divider, estimated (not measured) at ~2500 cycles, 20us at 125MHz or 1% of
+core 0 at 500 Hz. Built with PROFILE_STAGES the board times every FIFO burst
+and counts the samples of bursts that took longer than ATTITUDE_BUDGET_US
+each, the count is in the profile report. attitude_test.c measures samples
+per second on the host.
+
+Roll and pitch are corrected by gravity. Yaw has no reference without a
+magnetometer and only integrates the gyro, so it drifts with the gyro bias
+left by the online calibration (imu_calibration.h). The conversion to roll/pitch/yaw needs atan2
+and is only done on demand (attitude_euler_cdeg), not per sample.
+*/
+#ifndef ATTITUDE_H
+#define ATTITUDE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mpu6050_scale.h"
+
+#define ATTITUDE_CYCLE_BUDGET 4000          //per sample on the M0+ at 125MHz
+#define ATTITUDE_BUDGET_US (ATTITUDE_CYCLE_BUDGET / 125)
+
+#define ATTITUDE_ACCEL_1G MPU6050_ACCEL_1G
+//half the rotation in radians per gyro count and microsecond, pi * 1000 / (180 * counts per 1000 deg/s * 2e6), Q52
+#define ATTITUDE_GYRO_HALF_RAD_Q52 (39301320845LL / MPU6050_GYRO_COUNTS_PER_KDPS)
+
+//filter gain in rad/s * 1000, how fast the attitude is pulled onto gravity
+#define ATTITUDE_BETA_MILLI 100
+
+//samples further than this from 1g are mostly linear acceleration and do not correct the attitude
+#define ATTITUDE_ACCEL_GATE (ATTITUDE_ACCEL_1G / 10)
+//longer gaps between samples (first sample, FIFO overflow) are not integrated
+#define ATTITUDE_MAX_DT_US 50000
+
+#define ATTITUDE_CSV_HEADER "Timestamp,q0_e6,q1_e6,q2_e6,q3_e6,Roll_cdeg,Pitch_cdeg,Yaw_cdeg,Lin_x_mg,Lin_y_mg,Lin_z_mg,Peak_lin_mg,Samples,Gated\n"
+
+typedef struct {
+    int32_t q[4];               //orientation w, x, y, z in Q30, earth frame relative to the sensor
+    int32_t linear_mg[3];       //acceleration of the last sample without gravity, sensor frame
+    uint32_t peak_linear_sq;    //largest |linear_mg|^2 since the last attitude_reset_peak()
+
+    uint64_t last_time_us;
+    uint32_t samples;
+    uint32_t gated;             //samples too far from 1g to correct the attitude
+} Attitude;
+
+void attitude_init(Attitude *attitude);
+void attitude_update(Attitude *attitude, uint64_t time_us, int32_t ax, int32_t ay, int32_t az,
+                     int32_t gx, int32_t gy, int32_t gz);
+void attitude_reset_peak(Attitude *attitude);
+//roll, pitch and yaw (ZYX) in 0.01 degree
+void attitude_euler_cdeg(const Attitude *attitude, int32_t euler[3]);
+//one ATTITUDE_CSV_HEADER row, returns the length like snprintf
+int attitude_format(const Attitude *attitude, uint64_t timestamp, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,432 @@
+/*
+File: attitude_test.c
+Author: Leonardo DaGraca
+
+Host check of the fixed-point attitude filter (attitude.c) on synthetic
+rotations. Each scenario integrates a known body rotation rate into the true
+orientation, turns it into MPU6050 counts (gravity plus linear acceleration,
+gyro rates, sensor noise and rounding) and feeds the samples to
+attitude_update() and to the same filter in double precision. It reports
+the tilt error (angle between true and estimated gravity), the error of the
+whole orientation where the scenario starts level (heading included), the
+linear acceleration error, how far the fixed-point filter is from the double
+one and how far attitude_euler_cdeg() is from atan2 in double, and fails if
+any of them is out of bounds.
+
+Then it times attitude_update() over the samples of all scenarios and prints
+samples per second.
+
+Usage: attitude_test [benchmark_samples]
+Build: cc -O2 -o attitude_test attitude_test.c attitude.c -lm
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include "attitude.h"
+
+#define SUBSTEPS 16                 //integration steps of the true orientation per sample
+#define GYRO_1DPS (MPU6050_GYRO_COUNTS_PER_KDPS / 1000.0)
+#define ACCEL_NOISE_COUNTS (0.0005 * ATTITUDE_ACCEL_1G) //~0.5mg, the MPU6050 datasheet gives 400ug/sqrt(Hz)
+#define GYRO_NOISE_COUNTS (0.008 * GYRO_1DPS)           //0.008 deg/s, 0.005 deg/s/sqrt(Hz) after the DLPF
+
+//limits for every scenario, the angle limits are per scenario
+#define MAX_LINEAR_MG 20.0
+#define MAX_EULER_CDEG 2
+
+typedef struct {
+    const char *name;
+    uint32_t rate_hz;
+    double seconds;
+    double roll0_deg, pitch0_deg;    //initial true tilt
+    void (*motion)(double t, double rate_dps[3], double linear_g[3]);
+    double max_tilt_deg;            //also the limit for the whole orientation and for fixed-point vs double
+} Scenario;
+
+typedef struct {
+    double max_tilt_deg;
+    double sum_tilt_sq;
+    double max_orientation_deg;
+    double max_linear_mg;
+    double max_fixed_vs_double_deg;
+    int32_t max_euler_cdeg;
+    uint32_t counted;
+} Scenario_Result;
+
+static void motion_still(double t, double rate[3], double linear[3]) {
+    (void)t;
+    rate[0] = rate[1] = rate[2] = 0.0;
+    linear[0] = linear[1] = linear[2] = 0.0;
+}
+
+static void motion_yaw_spin(double t, double rate[3], double linear[3]) {
+    motion_still(t, rate, linear);
+    rate[2] = 90.0;
+}
+
+//roll swings +-60 degrees at 0.5 Hz
+static void motion_roll_sweep(double t, double rate[3], double linear[3]) {
+    motion_still(t, rate, linear);
+    rate[0] = 60.0 * M_PI * cos(M_PI * t);
+}
+
+static void motion_tumble(double t, double rate[3], double linear[3]) {
+    motion_still(t, rate, linear);
+    rate[0] = 40.0 + 30.0 * sin(1.3 * t);
+    rate[1] = -25.0 + 45.0 * sin(0.7 * t + 1.0);
+    rate[2] = 70.0 * cos(0.4 * t);
+}
+
+//0.5g pushes along x for 200 ms of every second, level and not rotating
+static void motion_pushes(double t, double rate[3], double linear[3]) {
+    motion_still(t, rate, linear);
+    if (fmod(t, 1.0) >= 0.5 && fmod(t, 1.0) < 0.7) {
+        linear[0] = 0.5;
+    }
+}
+
+//running-like: 2.5 Hz vertical bounce of 0.4g with a slow turn and some body roll
+static void motion_running(double t, double rate[3], double linear[3]) {
+    motion_still(t, rate, linear);
+    rate[0] = 8.0 * 2.5 * 2 * M_PI * cos(2.5 * 2 * M_PI * t);
+    rate[2] = 15.0;
+    linear[2] = 0.4 * sin(2.5 * 2 * M_PI * t);
+}
+
+//the 25 Hz profile is only used while stationary, tumbling at that rate shows the cost of coarse gyro samples
+static const Scenario scenarios[] = {
+    {"static_tilt", 200, 6.0, 30.0, -20.0, motion_still, 0.25},
+    {"yaw_spin", 200, 8.0, 0.0, 0.0, motion_yaw_spin, 0.25},
+    {"roll_sweep", 200, 10.0, 0.0, 0.0, motion_roll_sweep, 0.25},
+    {"tumble", 200, 20.0, 0.0, 0.0, motion_tumble, 0.25},
+    {"tumble_500hz", 500, 20.0, 0.0, 0.0, motion_tumble, 0.25},
+    {"tumble_25hz", 25, 20.0, 0.0, 0.0, motion_tumble, 1.0},
+    {"pushes", 200, 6.0, 0.0, 0.0, motion_pushes, 0.25},
+    {"running", 200, 20.0, 10.0, 5.0, motion_running, 0.25},
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef struct {
+    uint64_t time_us;
+    int32_t ax, ay, az, gx, gy, gz;
+} Sample;
+
+//---- quaternions in double, the same convention as attitude.c ----
+
+static void quat_mul(const double a[4], const double b[4], double out[4]) {
+    double r[4] = {
+        a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3],
+        a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2],
+        a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1],
+        a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0]
+    };
+    memcpy(out, r, sizeof(r));
+}
+
+static void quat_normalize(double q[4]) {
+    double n = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int i = 0; i < 4; i++) {
+        q[i] /= n;
+    }
+}
+
+//earth frame vector w seen from the sensor: q* w q
+static void to_sensor(const double q[4], const double w[3], double out[3]) {
+    double conj[4] = {q[0], -q[1], -q[2], -q[3]};
+    double v[4] = {0.0, w[0], w[1], w[2]};
+    double t[4];
+    quat_mul(conj, v, t);
+    quat_mul(t, q, t);
+    out[0] = t[1];
+    out[1] = t[2];
+    out[2] = t[3];
+}
+
+//the earth-relative-to-sensor quaternion of a sensor rolled then pitched
+static void quat_from_tilt(double roll_deg, double pitch_deg, double q[4]) {
+    double r = roll_deg * M_PI / 360.0, p = pitch_deg * M_PI / 360.0;
+    double qr[4] = {cos(r), sin(r), 0.0, 0.0};
+    double qp[4] = {cos(p), 0.0, sin(p), 0.0};
+    quat_mul(qp, qr, q);
+}
+
+static double gravity_angle_deg(const double a[3], const double b[3]) {
+    double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    double na = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    double nb = sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+    double c = dot / (na * nb);
+    return acos(c > 1.0 ? 1.0 : c < -1.0 ? -1.0 : c) * 180.0 / M_PI;
+}
+
+static double quat_angle_deg(const double a[4], const double b[4]) {
+    double dot = fabs(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+    return 2.0 * acos(dot > 1.0 ? 1.0 : dot) * 180.0 / M_PI;
+}
+
+static double heading_deg(const double q[4]) {
+    return atan2(2.0 * (q[1] * q[2] + q[0] * q[3]), q[0] * q[0] + q[1] * q[1] - q[2] * q[2] - q[3] * q[3]) * 180.0 / M_PI;
+}
+
+//---- the filter in double precision, the reference for the fixed-point one ----
+
+typedef struct {
+    double q[4];
+    uint64_t last_us;
+    uint32_t samples;
+} Reference_Filter;
+
+static void reference_update(Reference_Filter *f, const Sample *s) {
+    double *q = f->q;
+    double a_norm = sqrt((double)s->ax * s->ax + (double)s->ay * s->ay + (double)s->az * s->az);
+    double ax = s->ax / a_norm, ay = s->ay / a_norm, az = s->az / a_norm;
+
+    if (f->samples++ == 0) {
+        f->last_us = s->time_us;
+        double start[4] = {1.0 + az, ay, -ax, 0.0};
+        memcpy(q, start, sizeof(start));
+        quat_normalize(q);
+    }
+    double dt = (s->time_us - f->last_us) / 1e6;
+    if (dt > ATTITUDE_MAX_DT_US / 1e6) {
+        dt = 0.0;
+    }
+    f->last_us = s->time_us;
+
+    double h[4] = {0.0, s->gx * M_PI / 180.0 / GYRO_1DPS * dt / 2, s->gy * M_PI / 180.0 / GYRO_1DPS * dt / 2,
+                   s->gz * M_PI / 180.0 / GYRO_1DPS * dt / 2};
+    double hh = h[1] * h[1] + h[2] * h[2] + h[3] * h[3];
+    for (int i = 1; i < 4; i++) {
+        h[i] *= 1.0 + hh / 3.0;
+    }
+    double step[4];
+    quat_mul(q, h, step);
+    for (int i = 0; i < 4; i++) {
+        q[i] += step[i];
+    }
+
+    if (a_norm > 0.0 && fabs(a_norm - ATTITUDE_ACCEL_1G) <= ATTITUDE_ACCEL_GATE) {
+        double f0 = 2.0 * (q[1] * q[3] - q[0] * q[2]) - ax;
+        double f1 = 2.0 * (q[0] * q[1] + q[2] * q[3]) - ay;
+        double f2 = 2.0 * (0.5 - q[1] * q[1] - q[2] * q[2]) - az;
+        double g[4] = {
+            -2.0 * q[2] * f0 + 2.0 * q[1] * f1,
+            2.0 * q[3] * f0 + 2.0 * q[0] * f1 - 4.0 * q[1] * f2,
+            -2.0 * q[0] * f0 + 2.0 * q[3] * f1 - 4.0 * q[2] * f2,
+            2.0 * q[1] * f0 + 2.0 * q[2] * f1
+        };
+        double n = sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2] + g[3] * g[3]);
+        if (n > 0.0) {
+            for (int i = 0; i < 4; i++) {
+                q[i] -= ATTITUDE_BETA_MILLI / 1000.0 * dt * g[i] / n;
+            }
+        }
+    }
+    quat_normalize(q);
+}
+
+//---- synthetic sensor data ----
+
+static double gaussian() {
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static int32_t to_counts(double value) {
+    double counts = round(value);
+    return counts > 32767 ? 32767 : counts < -32768 ? -32768 : (int32_t)counts;
+}
+
+//true orientation (earth relative to sensor) and linear acceleration of every sample
+static size_t generate(const Scenario *sc, Sample *samples, double (*truth_q)[4], double (*truth_linear)[3]) {
+    size_t count = (size_t)(sc->seconds * sc->rate_hz);
+    uint32_t period_us = 1000000 / sc->rate_hz;
+    double q[4];
+    quat_from_tilt(sc->roll0_deg, sc->pitch0_deg, q);
+    double t = 0.0;
+
+    for (size_t i = 0; i < count; i++) {
+        double rate[3], linear[3], mean_rate[3] = {0.0, 0.0, 0.0};
+        if (i > 0) {
+            //rotate through the sample period in small steps, q' = q * (0, w) / 2
+            double h = period_us / 1e6 / SUBSTEPS;
+            for (int k = 0; k < SUBSTEPS; k++) {
+                sc->motion(t + (k + 0.5) * h, rate, linear);
+                for (int axis = 0; axis < 3; axis++) {
+                    mean_rate[axis] += rate[axis] / SUBSTEPS;
+                }
+                double w[3] = {rate[0] * M_PI / 180.0, rate[1] * M_PI / 180.0, rate[2] * M_PI / 180.0};
+                double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]) * h;
+                if (angle > 0.0) {
+                    double s = sin(angle / 2) / (angle / h);
+                    double dq[4] = {cos(angle / 2), w[0] * s, w[1] * s, w[2] * s};
+                    quat_mul(q, dq, q);
+                }
+            }
+            quat_normalize(q);
+            t += period_us / 1e6;
+        }
+        sc->motion(t, rate, linear);
+        //the DLPF makes a gyro sample the mean rate over the sample period rather than the rate at its end
+        if (i > 0) {
+            memcpy(rate, mean_rate, sizeof(rate));
+        }
+
+        double up[3] = {0.0, 0.0, 1.0}, g[3], lin[3];
+        to_sensor(q, up, g);
+        to_sensor(q, linear, lin);
+
+        Sample *s = &samples[i];
+        s->time_us = 1000000 + (uint64_t)i * period_us;
+        s->ax = to_counts((g[0] + lin[0]) * ATTITUDE_ACCEL_1G + ACCEL_NOISE_COUNTS * gaussian());
+        s->ay = to_counts((g[1] + lin[1]) * ATTITUDE_ACCEL_1G + ACCEL_NOISE_COUNTS * gaussian());
+        s->az = to_counts((g[2] + lin[2]) * ATTITUDE_ACCEL_1G + ACCEL_NOISE_COUNTS * gaussian());
+        s->gx = to_counts(rate[0] * GYRO_1DPS + GYRO_NOISE_COUNTS * gaussian());
+        s->gy = to_counts(rate[1] * GYRO_1DPS + GYRO_NOISE_COUNTS * gaussian());
+        s->gz = to_counts(rate[2] * GYRO_1DPS + GYRO_NOISE_COUNTS * gaussian());
+
+        memcpy(truth_q[i], q, sizeof(q));
+        memcpy(truth_linear[i], lin, sizeof(lin));
+    }
+    return count;
+}
+
+static void run_scenario(const Scenario *sc, const Sample *samples, size_t count, double (*truth_q)[4],
+                         double (*truth_linear)[3], Scenario_Result *r) {
+    Attitude attitude;
+    attitude_init(&attitude);
+    Reference_Filter reference = {.samples = 0};
+    bool aligned = sc->roll0_deg == 0.0 && sc->pitch0_deg == 0.0;
+    memset(r, 0, sizeof(*r));
+
+    for (size_t i = 0; i < count; i++) {
+        const Sample *s = &samples[i];
+        attitude_update(&attitude, s->time_us, s->ax, s->ay, s->az, s->gx, s->gy, s->gz);
+        reference_update(&reference, s);
+
+        double q[4];
+        for (int k = 0; k < 4; k++) {
+            q[k] = attitude.q[k] / 1073741824.0;
+        }
+        double up[3] = {0.0, 0.0, 1.0}, g_est[3], g_true[3];
+        to_sensor(q, up, g_est);
+        to_sensor(truth_q[i], up, g_true);
+
+        double tilt = gravity_angle_deg(g_est, g_true);
+        r->max_tilt_deg = fmax(r->max_tilt_deg, tilt);
+        r->sum_tilt_sq += tilt * tilt;
+        if (aligned) {
+            r->max_orientation_deg = fmax(r->max_orientation_deg, quat_angle_deg(q, truth_q[i]));
+        }
+        for (int k = 0; k < 3; k++) {
+            r->max_linear_mg = fmax(r->max_linear_mg, fabs(attitude.linear_mg[k] - truth_linear[i][k] * 1000.0));
+        }
+        //both chatter around the truth by about beta * dt, compare what gravity corrects
+        double g_reference[3];
+        to_sensor(reference.q, up, g_reference);
+        r->max_fixed_vs_double_deg = fmax(r->max_fixed_vs_double_deg, gravity_angle_deg(g_est, g_reference));
+
+        //attitude_euler_cdeg against atan2 in double on the same quaternion
+        int32_t euler[3];
+        attitude_euler_cdeg(&attitude, euler);
+        double gx = 2.0 * (q[1] * q[3] - q[0] * q[2]);
+        double gy = 2.0 * (q[0] * q[1] + q[2] * q[3]);
+        double gz = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+        double expected[3] = {
+            atan2(gy, gz) * 18000.0 / M_PI,
+            atan2(-gx, sqrt(gy * gy + gz * gz)) * 18000.0 / M_PI,
+            heading_deg(q) * 100.0
+        };
+        for (int k = 0; k < 3; k++) {
+            int32_t diff = (int32_t)lround(fabs(remainder(euler[k] - expected[k], 36000.0)));
+            if (diff > r->max_euler_cdeg) {
+                r->max_euler_cdeg = diff;
+            }
+        }
+        r->counted++;
+    }
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t bench_samples = 10000000;
+    if (argc == 2) {
+        bench_samples = strtoull(argv[1], NULL, 10);
+    }
+    else if (argc > 2) {
+        fprintf(stderr, "Usage: %s [benchmark_samples]\n", argv[0]);
+        return 1;
+    }
+    srand(1);
+
+    size_t max_count = 0;
+    for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+        size_t count = (size_t)(scenarios[i].seconds * scenarios[i].rate_hz);
+        max_count += count;
+    }
+    Sample *samples = malloc(max_count * sizeof(Sample));
+    double (*truth_q)[4] = malloc(max_count * sizeof(*truth_q));
+    double (*truth_linear)[3] = malloc(max_count * sizeof(*truth_linear));
+    if (!samples || !truth_q || !truth_linear) {
+        perror("Unable to allocate samples");
+        return 1;
+    }
+
+    printf("Scenario,Rate_Hz,Samples,Max_tilt_deg,RMS_tilt_deg,Max_orientation_deg,Max_linear_mg,"
+           "Fixed_vs_double_deg,Euler_cdeg,Result\n");
+    int failures = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+        const Scenario *sc = &scenarios[i];
+        size_t count = generate(sc, samples + total, truth_q + total, truth_linear + total);
+        Scenario_Result r;
+        run_scenario(sc, samples + total, count, truth_q + total, truth_linear + total, &r);
+        total += count;
+
+        bool ok = r.max_tilt_deg < sc->max_tilt_deg && r.max_orientation_deg < sc->max_tilt_deg &&
+                  r.max_linear_mg < MAX_LINEAR_MG && r.max_fixed_vs_double_deg < sc->max_tilt_deg &&
+                  r.max_euler_cdeg <= MAX_EULER_CDEG;
+        failures += !ok;
+        printf("%s,%" PRIu32 ",%zu,%.3f,%.3f,%.3f,%.1f,%.4f,%" PRId32 ",%s\n", sc->name, sc->rate_hz, count,
+               r.max_tilt_deg, sqrt(r.sum_tilt_sq / (r.counted ? r.counted : 1)), r.max_orientation_deg,
+               r.max_linear_mg, r.max_fixed_vs_double_deg, r.max_euler_cdeg, ok ? "ok" : "FAIL");
+    }
+
+    //the timestamps of the concatenated scenarios jump back, which attitude_update treats as a gap
+    Attitude attitude;
+    attitude_init(&attitude);
+    double start = now_seconds();
+    for (uint64_t i = 0; i < bench_samples; i++) {
+        const Sample *s = &samples[i % total];
+        attitude_update(&attitude, s->time_us, s->ax, s->ay, s->az, s->gx, s->gy, s->gz);
+    }
+    double fixed_s = now_seconds() - start;
+
+    Reference_Filter reference = {.samples = 0};
+    start = now_seconds();
+    for (uint64_t i = 0; i < bench_samples; i++) {
+        reference_update(&reference, &samples[i % total]);
+    }
+    double double_s = now_seconds() - start;
+
+    printf("attitude_update: %.1f M samples/s (%.1f ns/sample), double reference %.1f M samples/s, q0 %" PRId32 " %.6f\n",
+           bench_samples / fixed_s / 1e6, fixed_s * 1e9 / bench_samples, bench_samples / double_s / 1e6,
+           attitude.q[0], reference.q[0]);
+
+    free(samples);
+    free(truth_q);
+    free(truth_linear);
+    if (failures) {
+        fprintf(stderr, "%d scenarios out of bounds\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+File: byte_ring.h
+Author: Leonardo DaGraca
+
+Lock-free single-producer/single-consumer byte ring buffer.
+The producer only ever writes head and the consumer only ever writes tail,
+so an interrupt handler can fill the ring while the main loop drains it
+without disabling interrupts. Indices run freely and are masked on access,
+which is why the capacity must be a power of two.
+*/
+#ifndef BYTE_RING_H
+#define BYTE_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct {
+    uint8_t *data;
+    uint32_t mask;              //capacity - 1
+    atomic_uint_least32_t head; //next write position (producer)
+    atomic_uint_least32_t tail; //next read position (consumer)
+} Byte_Ring;
+
+static inline void byte_ring_init(Byte_Ring *ring, uint8_t *storage, uint32_t capacity) {
+    ring->data = storage;
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+static inline uint32_t byte_ring_count(Byte_Ring *ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head - tail;
+}
+
+//producer side, returns false when the ring is full and the byte was not stored
+static inline bool byte_ring_push(Byte_Ring *ring, uint8_t byte) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail > ring->mask) {
+        return false;
+    }
+
+    ring->data[head & ring->mask] = byte;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+//consumer side, copies up to max_len bytes into dst without freeing them and returns how many were copied
+//the slots stay owned by the consumer until byte_ring_commit, so data kept next to the ring can still be read
+static inline size_t byte_ring_peek(Byte_Ring *ring, uint8_t *dst, size_t max_len) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t available = head - tail;
+    size_t count = available < max_len ? available : max_len;
+
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = ring->data[(tail + i) & ring->mask];
+    }
+    return count;
+}
+
+//consumer side, hands count peeked bytes back to the producer
+static inline void byte_ring_commit(Byte_Ring *ring, size_t count) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + (uint32_t)count, memory_order_release);
+}
+
+//consumer side, copies up to max_len bytes into dst and returns how many were copied
+static inline size_t byte_ring_pop(Byte_Ring *ring, uint8_t *dst, size_t max_len) {
+    size_t count = byte_ring_peek(ring, dst, max_len);
+    byte_ring_commit(ring, count);
+    return count;
+}
+
+#endif
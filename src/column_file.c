@@ -0,0 +1,327 @@
+/*
+File: column_file.c
+Author: Leonardo DaGraca
+
+Writer and reader of the columnar session files (see column_format.h).
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "column_file.h"
+
+#define VARINT_MAX_BYTES 10
+
+void col_column_init(Col_Column *column, uint8_t table, const char *name) {
+    memset(column, 0, sizeof(*column));
+    snprintf(column->name, sizeof(column->name), "%s", name);
+    column->table = table;
+}
+
+void col_column_push(Col_Column *column, int64_t value) {
+    if (column->count == column->capacity) {
+        column->capacity = column->capacity ? column->capacity * 2 : 1024;
+        column->values = realloc(column->values, column->capacity * sizeof(int64_t));
+        if (!column->values) {
+            perror("Unable to grow column");
+            exit(1);
+        }
+    }
+    column->values[column->count++] = value;
+}
+
+void col_column_clear(Col_Column *column) {
+    column->count = 0;
+}
+
+void col_column_free(Col_Column *column) {
+    free(column->values);
+    column->values = NULL;
+    column->count = 0;
+    column->capacity = 0;
+}
+
+static uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static size_t varint_size(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static size_t varint_put(uint8_t *dst, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        dst[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    dst[len++] = (uint8_t)value;
+    return len;
+}
+
+//returns the position after the varint, NULL if it runs past end
+static const uint8_t *varint_get(const uint8_t *src, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; src < end && shift < 64; shift += 7) {
+        uint8_t byte = *src++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return src;
+        }
+    }
+    return NULL;
+}
+
+//distinct values of the column, 0 when there are more than COL_DICT_MAX
+static size_t build_dictionary(const Col_Column *column, int64_t *dict) {
+    size_t dict_count = 0;
+
+    for (size_t i = 0; i < column->count; i++) {
+        size_t j = 0;
+        while (j < dict_count && dict[j] != column->values[i]) {
+            j++;
+        }
+        if (j == dict_count) {
+            if (dict_count == COL_DICT_MAX) {
+                return 0;
+            }
+            dict[dict_count++] = column->values[i];
+        }
+    }
+    return dict_count;
+}
+
+static size_t delta_size(const Col_Column *column) {
+    size_t size = 0;
+    int64_t prev = 0;
+    for (size_t i = 0; i < column->count; i++) {
+        size += varint_size(zigzag_encode(column->values[i] - prev));
+        prev = column->values[i];
+    }
+    return size;
+}
+
+//encodes the column into a new buffer, the caller frees it
+static uint8_t *encode_column(const Col_Column *column, uint8_t *encoding, size_t *size) {
+    int64_t dict[COL_DICT_MAX];
+    size_t dict_count = build_dictionary(column, dict);
+    size_t dict_size = 2 + column->count;
+    for (size_t i = 0; i < dict_count; i++) {
+        dict_size += varint_size(zigzag_encode(dict[i]));
+    }
+    size_t delta_bytes = delta_size(column);
+
+    if (dict_count > 0 && dict_size < delta_bytes) {
+        uint8_t *buf = malloc(dict_size);
+        if (!buf) {
+            return NULL;
+        }
+        size_t len = 0;
+        buf[len++] = (uint8_t)dict_count;
+        buf[len++] = (uint8_t)(dict_count >> 8);
+        for (size_t i = 0; i < dict_count; i++) {
+            len += varint_put(buf + len, zigzag_encode(dict[i]));
+        }
+        for (size_t i = 0; i < column->count; i++) {
+            uint8_t index = 0;
+            while (dict[index] != column->values[i]) {
+                index++;
+            }
+            buf[len++] = index;
+        }
+        *encoding = COL_ENCODING_DICT;
+        *size = len;
+        return buf;
+    }
+
+    uint8_t *buf = malloc(delta_bytes ? delta_bytes : 1);
+    if (!buf) {
+        return NULL;
+    }
+    size_t len = 0;
+    int64_t prev = 0;
+    for (size_t i = 0; i < column->count; i++) {
+        len += varint_put(buf + len, zigzag_encode(column->values[i] - prev));
+        prev = column->values[i];
+    }
+    *encoding = COL_ENCODING_DELTA;
+    *size = len;
+    return buf;
+}
+
+int col_write_file(const char *path, const Col_Column *columns, size_t count) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+
+    Col_Column_Entry *entries = calloc(count ? count : 1, sizeof(Col_Column_Entry));
+    if (!entries) {
+        fclose(file);
+        return 1;
+    }
+
+    Col_File_Header header = {.version = COL_FORMAT_VERSION};
+    memcpy(header.magic, COL_MAGIC, 4);
+    fwrite(&header, sizeof(header), 1, file);
+    uint64_t offset = sizeof(header);
+
+    int result = 0;
+    for (size_t i = 0; i < count; i++) {
+        Col_Column_Entry *entry = &entries[i];
+        size_t size;
+        uint8_t *chunk = encode_column(&columns[i], &entry->encoding, &size);
+        if (!chunk) {
+            result = 1;
+            break;
+        }
+        memcpy(entry->name, columns[i].name, COL_NAME_SIZE);
+        entry->table = columns[i].table;
+        entry->rows = (uint32_t)columns[i].count;
+        entry->offset = offset;
+        entry->size = size;
+
+        fwrite(chunk, 1, size, file);
+        offset += size;
+        free(chunk);
+    }
+
+    Col_File_Footer footer = {.directory_offset = offset, .column_count = (uint32_t)count,
+                              .version = COL_FORMAT_VERSION};
+    memcpy(footer.magic, COL_MAGIC, 4);
+    fwrite(entries, sizeof(Col_Column_Entry), count, file);
+    fwrite(&footer, sizeof(footer), 1, file);
+    free(entries);
+
+    if (ferror(file)) {
+        perror(path);
+        result = 1;
+    }
+    if (fclose(file) != 0) {
+        result = 1;
+    }
+    return result;
+}
+
+int col_reader_open(Col_Reader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Col_File_Header) + sizeof(Col_File_Footer)) {
+        fprintf(stderr, "%s: not a column file\n", path);
+        close(fd);
+        return 1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+    reader->data = data;
+    reader->size = (size_t)st.st_size;
+
+    Col_File_Footer footer;
+    memcpy(&footer, reader->data + reader->size - sizeof(footer), sizeof(footer));
+    size_t directory_size = (size_t)footer.column_count * sizeof(Col_Column_Entry);
+    if (memcmp(reader->data, COL_MAGIC, 4) != 0 || memcmp(footer.magic, COL_MAGIC, 4) != 0 ||
+        footer.version != COL_FORMAT_VERSION ||
+        footer.directory_offset + directory_size + sizeof(footer) != reader->size) {
+        fprintf(stderr, "%s: not a column file or unsupported version\n", path);
+        col_reader_close(reader);
+        return 1;
+    }
+
+    reader->entries = (const Col_Column_Entry *)(reader->data + footer.directory_offset);
+    reader->column_count = footer.column_count;
+    return 0;
+}
+
+void col_reader_close(Col_Reader *reader) {
+    if (reader->data) {
+        munmap((void *)reader->data, reader->size);
+    }
+    memset(reader, 0, sizeof(*reader));
+}
+
+const Col_Column_Entry *col_reader_find(const Col_Reader *reader, uint8_t table, const char *name) {
+    for (uint32_t i = 0; i < reader->column_count; i++) {
+        const Col_Column_Entry *entry = &reader->entries[i];
+        if (entry->table == table && strncmp(entry->name, name, COL_NAME_SIZE) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int col_reader_read(const Col_Reader *reader, const Col_Column_Entry *entry, int64_t *values) {
+    if (entry->offset + entry->size > reader->size) {
+        return 1;
+    }
+    const uint8_t *p = reader->data + entry->offset;
+    const uint8_t *end = p + entry->size;
+    uint64_t raw;
+
+    if (entry->encoding == COL_ENCODING_DELTA) {
+        int64_t prev = 0;
+        for (uint32_t i = 0; i < entry->rows; i++) {
+            p = varint_get(p, end, &raw);
+            if (!p) {
+                return 1;
+            }
+            prev += zigzag_decode(raw);
+            values[i] = prev;
+        }
+        return 0;
+    }
+
+    if (entry->encoding == COL_ENCODING_DICT) {
+        int64_t dict[COL_DICT_MAX];
+        if (end - p < 2) {
+            return 1;
+        }
+        size_t dict_count = p[0] | (size_t)p[1] << 8;
+        p += 2;
+        if (dict_count == 0 || dict_count > COL_DICT_MAX) {
+            return 1;
+        }
+        for (size_t i = 0; i < dict_count; i++) {
+            p = varint_get(p, end, &raw);
+            if (!p) {
+                return 1;
+            }
+            dict[i] = zigzag_decode(raw);
+        }
+        if ((size_t)(end - p) < entry->rows) {
+            return 1;
+        }
+        for (uint32_t i = 0; i < entry->rows; i++) {
+            if (p[i] >= dict_count) {
+                return 1;
+            }
+            values[i] = dict[p[i]];
+        }
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,46 @@
+/*
+File: column_file.h
+Author: Leonardo DaGraca
+
+Writer and reader of the columnar session files described in column_format.h.
+Host only, used by gps_batch.c (export) and gps_columns.c (queries).
+*/
+#ifndef COLUMN_FILE_H
+#define COLUMN_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "column_format.h"
+
+//growable column of values collected before the file is written
+typedef struct {
+    char name[COL_NAME_SIZE];
+    uint8_t table;
+    int64_t *values;
+    size_t count;
+    size_t capacity;
+} Col_Column;
+
+void col_column_init(Col_Column *column, uint8_t table, const char *name);
+void col_column_push(Col_Column *column, int64_t value);
+void col_column_clear(Col_Column *column);
+void col_column_free(Col_Column *column);
+
+//encodes each column with the smaller of the two encodings, returns 0 on success
+int col_write_file(const char *path, const Col_Column *columns, size_t count);
+
+//the file is memory-mapped, only the pages of the decoded columns are read
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    const Col_Column_Entry *entries;
+    uint32_t column_count;
+} Col_Reader;
+
+int col_reader_open(Col_Reader *reader, const char *path);
+void col_reader_close(Col_Reader *reader);
+const Col_Column_Entry *col_reader_find(const Col_Reader *reader, uint8_t table, const char *name);
+//decodes the column into values, which must hold entry->rows values, returns 0 on success
+int col_reader_read(const Col_Reader *reader, const Col_Column_Entry *entry, int64_t *values);
+
+#endif
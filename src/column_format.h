@@ -0,0 +1,65 @@
+/*
+File: column_format.h
+Author: Leonardo DaGraca
+
+Columnar session export written by gps_batch.c and read by gps_columns.c.
+A file holds the GPS fixes and the IMU samples of one session as two tables,
+one column per field, so a query only touches the bytes of the columns it needs.
+
+Layout: Col_File_Header, the column chunks back to back, a directory of
+Col_Column_Entry (one per column) and the Col_File_Footer at the very end.
+A reader starts from the footer like in Parquet, the directory gives the
+offset of each chunk.
+
+Every value is an integer (fixed-point like the rest of the logger) stored in
+one of two encodings, whichever is smaller for the column:
+- COL_ENCODING_DELTA: the difference to the previous row (the first row to 0)
+  as a zigzag LEB128 varint. Timestamps, positions and the IMU axes change
+  little from row to row and mostly fit in one or two bytes.
+- COL_ENCODING_DICT: a uint16 count and that many distinct values as zigzag
+  varints, then one uint8 index per row. Used for columns with at most
+  COL_DICT_MAX distinct values such as the fix status.
+All fields are little endian.
+*/
+#ifndef COLUMN_FORMAT_H
+#define COLUMN_FORMAT_H
+
+#include <stdint.h>
+
+#define COL_MAGIC "GTCL"
+#define COL_FORMAT_VERSION 1
+
+#define COL_TABLE_GPS 1     //one row per RMC fix
+#define COL_TABLE_IMU 2     //one row per IMU sample
+
+#define COL_ENCODING_DELTA 1
+#define COL_ENCODING_DICT 2
+
+#define COL_NAME_SIZE 16
+#define COL_DICT_MAX 256
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved[3];
+} Col_File_Header;
+
+typedef struct __attribute__((packed)) {
+    char name[COL_NAME_SIZE];   //nul padded
+    uint8_t table;
+    uint8_t encoding;
+    uint16_t reserved;
+    uint32_t rows;
+    uint64_t offset;            //from the start of the file
+    uint64_t size;
+} Col_Column_Entry;
+
+typedef struct __attribute__((packed)) {
+    uint64_t directory_offset;
+    uint32_t column_count;
+    uint8_t version;
+    uint8_t reserved[3];
+    char magic[4];
+} Col_File_Footer;
+
+#endif
@@ -0,0 +1,201 @@
+/*
+File: event_capture.c
+Author: Leonardo DaGraca
+
+Trigger engine and pre-trigger ring for the IMU burst capture, see event_capture.h.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "event_capture.h"
+#include "geo.h"
+
+//the FIFO never holds samples closer than 1ms (1kHz with the DLPF on), timestamps rebuilt
+//after a read that lost samples can be, so the jerk is never computed over less
+#define JERK_MIN_DT_US 1000
+
+void event_capture_init(Event_Capture *capture, const Event_Trigger_Config *config) {
+    memset(capture, 0, sizeof(*capture));
+
+    uint64_t accel = (uint64_t)config->accel_mg * EVENT_ACCEL_1G / 1000;
+    uint64_t jerk = (uint64_t)config->jerk_g_s * EVENT_ACCEL_1G;
+    uint64_t gyro = (uint64_t)config->gyro_dps * EVENT_GYRO_KDPS / 1000;
+    capture->accel_sq = accel * accel;
+    capture->jerk_sq = jerk * jerk;
+    capture->gyro_sq = gyro * gyro;
+}
+
+void event_capture_trigger(Event_Capture *capture, uint8_t triggers) {
+    capture->pending |= triggers;
+}
+
+//a fix closer in time to the trigger than the one attached replaces it
+static void attach_fix(Event_Burst *burst, uint64_t time_us, int32_t lat_e7, int32_t lon_e7, uint32_t speed_mm_s) {
+    uint64_t distance = time_us > burst->trigger_us ? time_us - burst->trigger_us : burst->trigger_us - time_us;
+    uint64_t attached = burst->fix_us > burst->trigger_us ? burst->fix_us - burst->trigger_us : burst->trigger_us - burst->fix_us;
+    if (burst->has_fix && distance >= attached) {
+        return;
+    }
+    burst->has_fix = true;
+    burst->fix_us = time_us;
+    burst->lat_e7 = lat_e7;
+    burst->lon_e7 = lon_e7;
+    burst->speed_mm_s = speed_mm_s;
+}
+
+void event_capture_add_fix(Event_Capture *capture, uint64_t time_us, int32_t lat_e7, int32_t lon_e7, uint32_t speed_mm_s) {
+    capture->has_fix = true;
+    capture->fix_us = time_us;
+    capture->lat_e7 = lat_e7;
+    capture->lon_e7 = lon_e7;
+    capture->speed_mm_s = speed_mm_s;
+
+    if (capture->capturing) {
+        attach_fix(&capture->burst, time_us, lat_e7, lon_e7, speed_mm_s);
+    }
+}
+
+static void update_peaks(Event_Burst *burst, uint64_t accel_sq, uint64_t jerk_sq, uint64_t gyro_sq) {
+    if (accel_sq > burst->peak_accel_sq) {
+        burst->peak_accel_sq = accel_sq;
+    }
+    if (jerk_sq > burst->peak_jerk_sq) {
+        burst->peak_jerk_sq = jerk_sq;
+    }
+    if (gyro_sq > burst->peak_gyro_sq) {
+        burst->peak_gyro_sq = gyro_sq;
+    }
+}
+
+//copy the ring oldest first and start the tail
+static void start_burst(Event_Capture *capture, uint64_t time_us, uint8_t triggers) {
+    Event_Burst *burst = &capture->burst;
+
+    burst->number = ++capture->events;
+    burst->trigger_us = time_us;
+    burst->triggers = triggers;
+    burst->merged = 0;
+    burst->peak_accel_sq = burst->peak_jerk_sq = burst->peak_gyro_sq = 0;
+    burst->has_fix = false;
+    if (capture->has_fix) {
+        attach_fix(burst, capture->fix_us, capture->lat_e7, capture->lon_e7, capture->speed_mm_s);
+    }
+
+    uint32_t first = (capture->history_head - capture->history_count) & (EVENT_PRE_SAMPLES - 1);
+    uint32_t run = EVENT_PRE_SAMPLES - first;
+    if (run > capture->history_count) {
+        run = capture->history_count;
+    }
+    memcpy(burst->samples, &capture->history[first], run * sizeof(Event_Sample));
+    memcpy(&burst->samples[run], capture->history, (capture->history_count - run) * sizeof(Event_Sample));
+    burst->pre_samples = capture->history_count;
+    burst->count = capture->history_count;
+
+    capture->capturing = true;
+    capture->post_left = EVENT_POST_SAMPLES;
+}
+
+bool event_capture_add(Event_Capture *capture, const IMU_Sample *sample) {
+    const IMU_Reading *r = &sample->read;
+    Event_Sample entry = {(uint32_t)sample->timestamp_us, {r->ax, r->ay, r->az, r->gx, r->gy, r->gz}};
+    capture->samples++;
+
+    uint64_t accel_sq = (uint64_t)((int32_t)r->ax * r->ax + (int32_t)r->ay * r->ay) + (uint64_t)((int32_t)r->az * r->az);
+    uint64_t gyro_sq = (uint64_t)((int32_t)r->gx * r->gx + (int32_t)r->gy * r->gy) + (uint64_t)((int32_t)r->gz * r->gz);
+    uint64_t jerk_sq = 0;
+    uint64_t dt = sample->timestamp_us - capture->prev_us;
+    if (capture->has_prev && sample->timestamp_us > capture->prev_us && dt <= EVENT_JERK_MAX_GAP_US) {
+        int64_t dx = r->ax - capture->prev_accel[0];
+        int64_t dy = r->ay - capture->prev_accel[1];
+        int64_t dz = r->az - capture->prev_accel[2];
+        uint64_t rate = 1000000 / (dt < JERK_MIN_DT_US ? JERK_MIN_DT_US : dt);
+        jerk_sq = (uint64_t)(dx * dx + dy * dy + dz * dz) * rate * rate;
+    }
+    capture->has_prev = true;
+    capture->prev_us = sample->timestamp_us;
+    capture->prev_accel[0] = r->ax;
+    capture->prev_accel[1] = r->ay;
+    capture->prev_accel[2] = r->az;
+
+    uint8_t fired = capture->pending;
+    capture->pending = 0;
+    if (capture->accel_sq && accel_sq > capture->accel_sq) {
+        fired |= EVENT_TRIGGER_ACCEL;
+    }
+    if (capture->jerk_sq && jerk_sq > capture->jerk_sq) {
+        fired |= EVENT_TRIGGER_JERK;
+    }
+    if (capture->gyro_sq && gyro_sq > capture->gyro_sq) {
+        fired |= EVENT_TRIGGER_GYRO;
+    }
+
+    bool complete = false;
+    if (!capture->capturing && fired) {
+        start_burst(capture, sample->timestamp_us, fired);
+    }
+    else if (capture->capturing && fired) {
+        capture->burst.merged++;
+    }
+    if (capture->capturing) {
+        Event_Burst *burst = &capture->burst;
+        burst->samples[burst->count++] = entry;
+        update_peaks(burst, accel_sq, jerk_sq, gyro_sq);
+        //the tail starts with the trigger sample
+        if (--capture->post_left == 0) {
+            capture->capturing = false;
+            complete = true;
+        }
+    }
+
+    //the ring always has the latest samples, also for an event right after this one
+    capture->history[capture->history_head] = entry;
+    capture->history_head = (capture->history_head + 1) & (EVENT_PRE_SAMPLES - 1);
+    if (capture->history_count < EVENT_PRE_SAMPLES) {
+        capture->history_count++;
+    }
+    return complete;
+}
+
+bool event_capture_flush(Event_Capture *capture) {
+    if (!capture->capturing) {
+        return false;
+    }
+    capture->capturing = false;
+    return true;
+}
+
+int event_burst_format_header(const Event_Burst *burst, char *buf, size_t size) {
+    //accel, jerk, gyro, external
+    static const char letters[] = "AJGX";
+    char triggers[5];
+    int n = 0;
+    for (int bit = 0; bit < 4; bit++) {
+        if (burst->triggers & (1 << bit)) {
+            triggers[n++] = letters[bit];
+        }
+    }
+    triggers[n] = '\0';
+
+    uint32_t accel_mg = (uint32_t)(geo_isqrt_u64(burst->peak_accel_sq) * 1000 / EVENT_ACCEL_1G);
+    uint32_t jerk_g_s = (uint32_t)(geo_isqrt_u64(burst->peak_jerk_sq) / EVENT_ACCEL_1G);
+    uint32_t gyro_dps = (uint32_t)(geo_isqrt_u64(burst->peak_gyro_sq) * 1000 / EVENT_GYRO_KDPS);
+
+    char fix[64] = ",,,";
+    if (burst->has_fix) {
+        char lat[16], lon[16];
+        geo_format_e7(burst->lat_e7, lat, sizeof(lat));
+        geo_format_e7(burst->lon_e7, lon, sizeof(lon));
+        snprintf(fix, sizeof(fix), "%" PRIu64 ",%s,%s,%" PRIu32, burst->fix_us, lat, lon, burst->speed_mm_s);
+    }
+
+    return snprintf(buf, size, "E,%" PRIu32 ",%" PRIu64 ",%s,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%s,%" PRIu32 ",%" PRIu32 "\n",
+                    burst->number, burst->trigger_us, triggers, accel_mg, jerk_g_s, gyro_dps, burst->merged,
+                    fix, burst->pre_samples, burst->count);
+}
+
+int event_burst_format_sample(const Event_Burst *burst, uint32_t i, char *buf, size_t size) {
+    const Event_Sample *s = &burst->samples[i];
+    int32_t offset_us = (int32_t)(s->time_us - (uint32_t)burst->trigger_us);
+    return snprintf(buf, size, "S,%" PRIu32 ",%" PRId32 ",%d,%d,%d,%d,%d,%d\n", burst->number, offset_us,
+                    s->axes[0], s->axes[1], s->axes[2], s->axes[3], s->axes[4], s->axes[5]);
+}
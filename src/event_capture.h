@@ -0,0 +1,132 @@
+/*
+File: event_capture.h
+Author: Leonardo DaGraca
+
+Event-triggered burst capture. Between fixes the IMU log only keeps the last
+five readings, so an impact or a fall is missed or reduced to a few points.
+Every IMU sample also goes through this trigger engine and into a ring of the
+last EVENT_PRE_SAMPLES samples. When a sample fires a trigger (acceleration
+magnitude, jerk or angular rate above its threshold, or an external trigger
+such as a confirmed sprint) the ring is copied into an Event_Burst and
+EVENT_POST_SAMPLES samples from the trigger on are appended, so every burst holds the lead-up
+and the tail of the event at the full sample rate. Triggers during the tail
+extend nothing, they are counted in the burst as merged.
+
+The GPS fix nearest in time to the trigger (the last one before it, or one that
+arrives during the tail if it is closer) is attached to the burst.
+
+All thresholds are compared squared in raw counts, so a sample costs a few
+integer multiplies and no square root. The completed burst is handed to core 1
+through a Record_Queue and written to imu_logs/events_N.csv there, so logging
+on core 0 goes on while the burst is formatted and written.
+*/
+#ifndef EVENT_CAPTURE_H
+#define EVENT_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mpu6050.h"
+
+//1.28s before and after the trigger at 200Hz, EVENT_PRE_SAMPLES must be a power of two
+#define EVENT_PRE_SAMPLES 256
+#define EVENT_POST_SAMPLES 256
+#define EVENT_BURST_SAMPLES (EVENT_PRE_SAMPLES + EVENT_POST_SAMPLES)
+
+#define EVENT_ACCEL_1G MPU6050_ACCEL_1G
+#define EVENT_GYRO_KDPS MPU6050_GYRO_COUNTS_PER_KDPS
+
+//default thresholds, each axis clips at 8g and 1000 deg/s
+#define EVENT_ACCEL_MG 3500         //as the motion scheduler's impact, a hard landing in a run peaks at ~3g
+#define EVENT_JERK_G_S 150          //a running stride stays below ~50 g/s, a collision is 2g in ~10ms
+#define EVENT_GYRO_DPS 200
+//samples further apart than this are a gap, not a change of acceleration
+#define EVENT_JERK_MAX_GAP_US 100000
+
+//Event_Burst triggers
+#define EVENT_TRIGGER_ACCEL 0x01
+#define EVENT_TRIGGER_JERK 0x02
+#define EVENT_TRIGGER_GYRO 0x04
+#define EVENT_TRIGGER_EXTERNAL 0x08 //event_capture_trigger(), e.g. a sprint
+
+#define EVENT_CSV_HEADER "#E,Event,Timestamp,Triggers,Peak_Accel_mg,Peak_Jerk_g_s,Peak_Gyro_dps,Merged,Fix_Timestamp,Latitude,Longitude,Speed_mm_s,Pre_Samples,Samples\n" \
+                         "#S,Event,Offset_us,ax,ay,az,gx,gy,gz\n"
+
+//thresholds, 0 turns a trigger off
+typedef struct {
+    uint32_t accel_mg;
+    uint32_t jerk_g_s;
+    uint32_t gyro_dps;
+} Event_Trigger_Config;
+
+typedef struct {
+    uint32_t time_us;           //low 32 bits of the sample time, offsets within a burst never wrap
+    int16_t axes[6];            //ax, ay, az, gx, gy, gz
+} Event_Sample;
+
+typedef struct {
+    uint32_t number;            //event in this session, from 1
+    uint64_t trigger_us;        //time of the sample that fired
+    uint8_t triggers;           //EVENT_TRIGGER_* that fired on it
+    uint32_t merged;            //triggers during the tail
+
+    //from the trigger to the end of the burst, squared raw counts
+    uint64_t peak_accel_sq;
+    uint64_t peak_jerk_sq;      //(counts/s)^2
+    uint64_t peak_gyro_sq;
+
+    bool has_fix;
+    uint64_t fix_us;
+    int32_t lat_e7;
+    int32_t lon_e7;
+    uint32_t speed_mm_s;
+
+    uint32_t pre_samples;       //samples before the trigger sample
+    uint32_t count;
+    Event_Sample samples[EVENT_BURST_SAMPLES];
+} Event_Burst;
+
+typedef struct {
+    //squared thresholds in counts, 0 = off
+    uint64_t accel_sq;
+    uint64_t jerk_sq;
+    uint64_t gyro_sq;
+
+    Event_Sample history[EVENT_PRE_SAMPLES];
+    uint32_t history_head;      //next slot to write
+    uint32_t history_count;
+
+    bool has_prev;
+    uint64_t prev_us;
+    int16_t prev_accel[3];
+    uint8_t pending;            //external triggers for the next sample
+
+    bool capturing;
+    uint32_t post_left;
+    Event_Burst burst;          //being filled, complete when event_capture_add() returns true
+
+    //latest valid fix
+    bool has_fix;
+    uint64_t fix_us;
+    int32_t lat_e7;
+    int32_t lon_e7;
+    uint32_t speed_mm_s;
+
+    uint32_t events;
+    uint32_t samples;
+} Event_Capture;
+
+void event_capture_init(Event_Capture *capture, const Event_Trigger_Config *config);
+//returns true when capture->burst is complete, it must be copied out before the next call
+bool event_capture_add(Event_Capture *capture, const IMU_Sample *sample);
+//fire on the next sample whatever the thresholds say
+void event_capture_trigger(Event_Capture *capture, uint8_t triggers);
+void event_capture_add_fix(Event_Capture *capture, uint64_t time_us, int32_t lat_e7, int32_t lon_e7, uint32_t speed_mm_s);
+//end of the session, returns true if a burst in progress was completed with the samples it has
+bool event_capture_flush(Event_Capture *capture);
+
+//the "E" row describing the burst and the "S" row of sample i
+int event_burst_format_header(const Event_Burst *burst, char *buf, size_t size);
+int event_burst_format_sample(const Event_Burst *burst, uint32_t i, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,427 @@
+/*
+File: event_test.c
+Author: Leonardo DaGraca
+
+Host test of the IMU burst capture (event_capture.h) on replayed data.
+
+The base signal is either a generated run (a 2.8Hz stride with ~0.7g of vertical
+load, arm swing on the gyro and sensor noise) or a full-rate imu_log_N.csv
+replayed as it was recorded. Events with a known onset are added on top every
+6 to 14 seconds: impacts (a 20ms half-sine of 2.5 to 4g), falls (0.4s of free
+fall ending in an impact) and spins (350 deg/s about z for 0.15s), plus decoys
+that must not fire: hard landings (1.4g over 150ms) and 150 deg/s turns.
+Every sample is clipped to the +-8g / +-1000 deg/s range of the sensor.
+
+The samples go through event_capture_add() with the firmware's default
+thresholds, then every burst is checked (trigger sample at the end of the
+pre-trigger history, timestamps increasing, full tail) and matched to the
+injected events. It prints the missed-event rate, the trigger latency from
+the onset of the impact or spin, whether the lead-up of each fall is in the
+burst, triggers outside any event, and the cost per sample. With -g the
+generated stream is also written as a full-rate IMU log for the simulator.
+
+Usage: event_test [-r rate_hz] [-m minutes] [-g imu_out.csv] [imu_log_N.csv]
+Build: cc -O2 -I. -Ihost -o event_test event_test.c event_capture.c geo.c -lm
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include "event_capture.h"
+#include "geo.h"
+
+#define ACCEL_1G EVENT_ACCEL_1G
+#define GYRO_1DPS (EVENT_GYRO_KDPS / 1000.0)
+#define MAX_EVENTS 100000
+
+typedef enum {
+    INJECT_IMPACT = 0,
+    INJECT_FALL,
+    INJECT_SPIN,
+    INJECT_LANDING,     //decoy
+    INJECT_TURN,        //decoy
+    INJECT_KIND_COUNT
+} Inject_Kind;
+
+static const char *kind_names[INJECT_KIND_COUNT] = {"impacts", "falls", "spins", "hard landings", "turns"};
+
+typedef struct {
+    Inject_Kind kind;
+    uint64_t start_us;      //first sample affected
+    uint64_t onset_us;      //what the trigger should react to (the impact at the end of a fall)
+    uint64_t end_us;
+    double peak;            //g or deg/s
+    double axis[3];         //unit direction
+    bool detected;
+} Injected;
+
+typedef struct {
+    uint64_t trigger_us;
+    uint64_t first_us;      //first sample of the pre-trigger history
+    bool matched;
+} Burst_Info;
+
+static IMU_Sample *samples;
+static size_t sample_count;
+static Injected events[MAX_EVENTS];
+static size_t event_count;
+static Burst_Info *bursts;
+static size_t burst_count;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double uniform(double low, double high) {
+    return low + (high - low) * rand() / (double)RAND_MAX;
+}
+
+static double noise(double rms) {
+    //sum of 3 uniforms, close enough to normal for sensor noise
+    return (uniform(-1, 1) + uniform(-1, 1) + uniform(-1, 1)) * rms;
+}
+
+static int16_t clip(double counts) {
+    if (counts > 32767) {
+        return 32767;
+    }
+    if (counts < -32768) {
+        return -32768;
+    }
+    return (int16_t)lround(counts);
+}
+
+static void generate_run(uint32_t rate_hz, uint32_t minutes) {
+    sample_count = (size_t)rate_hz * 60 * minutes;
+    samples = malloc(sample_count * sizeof(IMU_Sample));
+    if (!samples) {
+        perror("Unable to allocate samples");
+        exit(1);
+    }
+    uint64_t period_us = 1000000 / rate_hz;
+    for (size_t i = 0; i < sample_count; i++) {
+        double t = i * period_us / 1e6;
+        double stride = 2 * M_PI * 2.8 * t;
+        samples[i].timestamp_us = 1000000 + i * period_us;
+        samples[i].read.ax = clip(0.3 * ACCEL_1G * sin(stride / 2) + noise(55));
+        samples[i].read.ay = clip(0.2 * ACCEL_1G * cos(stride / 2) + noise(55));
+        samples[i].read.az = clip(ACCEL_1G * (1 + 0.7 * sin(stride)) + noise(55));
+        samples[i].read.gx = clip(40 * GYRO_1DPS * sin(stride / 2) + noise(5));
+        samples[i].read.gy = clip(30 * GYRO_1DPS * cos(stride / 2) + noise(5));
+        samples[i].read.gz = clip(20 * GYRO_1DPS * sin(stride / 4) + noise(5));
+    }
+}
+
+//full-rate log rows "Timestamp,ax,ay,az,gx,gy,gz"
+static int load_log(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Unable to open IMU log");
+        return 1;
+    }
+    size_t capacity = 1 << 20;
+    samples = malloc(capacity * sizeof(IMU_Sample));
+    char line[256];
+    while (samples && fgets(line, sizeof(line), file)) {
+        uint64_t time_us;
+        int v[6];
+        if (sscanf(line, "%" SCNu64 ",%d,%d,%d,%d,%d,%d", &time_us, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 7) {
+            continue;
+        }
+        if (sample_count == capacity) {
+            capacity *= 2;
+            samples = realloc(samples, capacity * sizeof(IMU_Sample));
+            if (!samples) {
+                break;
+            }
+        }
+        IMU_Sample *s = &samples[sample_count++];
+        s->timestamp_us = time_us;
+        s->read = (IMU_Reading){clip(v[0]), clip(v[1]), clip(v[2]), clip(v[3]), clip(v[4]), clip(v[5])};
+    }
+    fclose(file);
+    if (!samples || sample_count < 2) {
+        fprintf(stderr, "No full-rate samples in %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+//half-sine pulse of the given length, 0 outside it
+static double pulse(uint64_t time_us, uint64_t start_us, uint64_t length_us) {
+    if (time_us < start_us || time_us >= start_us + length_us) {
+        return 0;
+    }
+    return sin(M_PI * (time_us - start_us) / length_us);
+}
+
+static void random_axis(double axis[3], bool horizontal) {
+    double a = uniform(0, 2 * M_PI), b = horizontal ? 0 : uniform(-0.5, 0.8);
+    axis[0] = cos(a) * cos(b);
+    axis[1] = sin(a) * cos(b);
+    axis[2] = sin(b);
+}
+
+//what an event adds to a sample, or replaces it with for the free fall
+static void apply_event(const Injected *e, IMU_Sample *s) {
+    uint64_t t = s->timestamp_us;
+    double accel[3] = {s->read.ax, s->read.ay, s->read.az};
+    double gyro[3] = {s->read.gx, s->read.gy, s->read.gz};
+
+    switch (e->kind) {
+        case INJECT_FALL:
+            if (t < e->onset_us) {
+                for (int i = 0; i < 3; i++) {
+                    accel[i] = noise(0.03 * ACCEL_1G);
+                }
+                break;
+            }
+            //the fall ends in the impact
+            __attribute__((fallthrough));
+        case INJECT_IMPACT: {
+            double p = e->peak * ACCEL_1G * pulse(t, e->onset_us, 20000);
+            for (int i = 0; i < 3; i++) {
+                accel[i] += p * e->axis[i];
+            }
+            break;
+        }
+        case INJECT_LANDING:
+            accel[2] += e->peak * ACCEL_1G * pulse(t, e->onset_us, 150000);
+            break;
+        case INJECT_SPIN:
+        case INJECT_TURN: {
+            //ramps up and down over 50ms at each end
+            uint64_t length = e->end_us - e->onset_us;
+            double level = t < e->onset_us + 50000 ? (t - e->onset_us) / 50000.0 :
+                           (t > e->end_us - 50000 ? (e->end_us - t) / 50000.0 : 1.0);
+            if (t >= e->onset_us && t < e->onset_us + length) {
+                for (int i = 0; i < 3; i++) {
+                    gyro[i] += e->peak * GYRO_1DPS * level * e->axis[i];
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    s->read = (IMU_Reading){clip(accel[0]), clip(accel[1]), clip(accel[2]), clip(gyro[0]), clip(gyro[1]), clip(gyro[2])};
+}
+
+static void inject_events() {
+    uint64_t first_us = samples[0].timestamp_us, last_us = samples[sample_count - 1].timestamp_us;
+    uint64_t t = first_us + 3000000;
+    size_t next = 0;
+
+    while (t + 2000000 < last_us && event_count < MAX_EVENTS) {
+        Injected *e = &events[event_count++];
+        memset(e, 0, sizeof(*e));
+        int roll = rand() % 10;
+        e->kind = roll < 4 ? INJECT_IMPACT : roll < 6 ? INJECT_FALL : roll < 8 ? INJECT_SPIN :
+                  roll < 9 ? INJECT_LANDING : INJECT_TURN;
+        e->start_us = t;
+        switch (e->kind) {
+            case INJECT_IMPACT:
+                e->peak = uniform(2.5, 4.0);
+                random_axis(e->axis, false);
+                e->onset_us = t;
+                e->end_us = t + 20000;
+                break;
+            case INJECT_FALL:
+                e->peak = uniform(2.5, 4.0);
+                random_axis(e->axis, false);
+                e->onset_us = t + 400000;
+                e->end_us = e->onset_us + 20000;
+                break;
+            case INJECT_SPIN:
+                e->peak = 350;
+                e->axis[2] = 1;
+                e->onset_us = t;
+                e->end_us = t + 150000;
+                break;
+            case INJECT_LANDING:
+                e->peak = 1.4;
+                e->onset_us = t;
+                e->end_us = t + 150000;
+                break;
+            default:
+                e->peak = 150;
+                random_axis(e->axis, true);
+                e->onset_us = t;
+                e->end_us = t + 300000;
+                break;
+        }
+
+        while (next < sample_count && samples[next].timestamp_us < e->start_us) {
+            next++;
+        }
+        for (size_t i = next; i < sample_count && samples[i].timestamp_us < e->end_us; i++) {
+            apply_event(e, &samples[i]);
+        }
+        t += (uint64_t)(uniform(6, 14) * 1e6);
+    }
+}
+
+//every burst must end its history with the trigger sample and have strictly increasing timestamps
+static bool burst_well_formed(const Event_Burst *burst, size_t seen, bool flushed) {
+    uint32_t expected_pre = seen - 1 < EVENT_PRE_SAMPLES ? (uint32_t)(seen - 1) : EVENT_PRE_SAMPLES;
+    if (burst->pre_samples != expected_pre || burst->samples[burst->pre_samples].time_us != (uint32_t)burst->trigger_us) {
+        return false;
+    }
+    if (!flushed && burst->count != burst->pre_samples + EVENT_POST_SAMPLES) {
+        return false;
+    }
+    for (uint32_t i = 1; i < burst->count; i++) {
+        if ((int32_t)(burst->samples[i].time_us - burst->samples[i - 1].time_us) <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint32_t rate_hz = 200, minutes = 60;
+    const char *out_path = NULL, *log_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rate_hz = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            minutes = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        }
+        else if (argv[i][0] != '-') {
+            log_path = argv[i];
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-r rate_hz] [-m minutes] [-g imu_out.csv] [imu_log_N.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (rate_hz == 0 || minutes == 0) {
+        fprintf(stderr, "Rate and minutes must be positive\n");
+        return 1;
+    }
+
+    srand(7);
+    if (log_path) {
+        if (load_log(log_path) != 0) {
+            return 1;
+        }
+        printf("Replaying %zu samples of %s\n", sample_count, log_path);
+    }
+    else {
+        generate_run(rate_hz, minutes);
+        printf("Generated %u min of running at %u Hz, %zu samples\n", minutes, rate_hz, sample_count);
+    }
+    inject_events();
+
+    if (out_path) {
+        FILE *out = fopen(out_path, "w");
+        if (!out) {
+            perror("Unable to open output log");
+            return 1;
+        }
+        fputs("Timestamp,ax,ay,az,gx,gy,gz\n", out);
+        for (size_t i = 0; i < sample_count; i++) {
+            const IMU_Reading *r = &samples[i].read;
+            fprintf(out, "%" PRIu64 ",%d,%d,%d,%d,%d,%d\n", samples[i].timestamp_us, r->ax, r->ay, r->az, r->gx, r->gy, r->gz);
+        }
+        fclose(out);
+    }
+
+    //run the capture, timing only event_capture_add()
+    static Event_Capture capture;
+    Event_Trigger_Config config = {EVENT_ACCEL_MG, EVENT_JERK_G_S, EVENT_GYRO_DPS};
+    event_capture_init(&capture, &config);
+    bursts = malloc((sample_count / EVENT_POST_SAMPLES + 2) * sizeof(Burst_Info));
+    uint32_t malformed = 0, merged = 0;
+    double busy_s = 0;
+
+    for (size_t i = 0; i <= sample_count; i++) {
+        bool complete;
+        if (i < sample_count) {
+            double start = now_seconds();
+            complete = event_capture_add(&capture, &samples[i]);
+            busy_s += now_seconds() - start;
+        }
+        else {
+            complete = event_capture_flush(&capture);
+        }
+        if (!complete) {
+            continue;
+        }
+        const Event_Burst *burst = &capture.burst;
+        size_t last = i < sample_count ? i : sample_count - 1;
+        size_t trigger_index = last - (burst->count - burst->pre_samples - 1);
+        if (!burst_well_formed(burst, trigger_index + 1, i == sample_count)) {
+            malformed++;
+        }
+        merged += burst->merged;
+        Burst_Info *info = &bursts[burst_count++];
+        info->trigger_us = burst->trigger_us;
+        info->first_us = samples[trigger_index - burst->pre_samples].timestamp_us;
+        info->matched = false;
+    }
+
+    //match the first trigger at or after the start of each event, within 100ms of its end
+    uint32_t injected[INJECT_KIND_COUNT] = {0}, detected[INJECT_KIND_COUNT] = {0};
+    uint32_t falls_with_lead_up = 0;
+    uint64_t latency_sum = 0, latency_max = 0;
+    uint32_t latency_count = 0;
+    size_t b = 0;
+    for (size_t i = 0; i < event_count; i++) {
+        Injected *e = &events[i];
+        injected[e->kind]++;
+        while (b < burst_count && bursts[b].trigger_us < e->start_us) {
+            b++;
+        }
+        if (b < burst_count && bursts[b].trigger_us <= e->end_us + 100000) {
+            e->detected = true;
+            bursts[b].matched = true;
+            detected[e->kind]++;
+            if (e->kind <= INJECT_SPIN) {
+                uint64_t latency = bursts[b].trigger_us > e->onset_us ? bursts[b].trigger_us - e->onset_us : 0;
+                latency_sum += latency;
+                latency_count++;
+                if (latency > latency_max) {
+                    latency_max = latency;
+                }
+                if (e->kind == INJECT_FALL && bursts[b].first_us <= e->start_us) {
+                    falls_with_lead_up++;
+                }
+            }
+        }
+    }
+
+    uint32_t real = injected[INJECT_IMPACT] + injected[INJECT_FALL] + injected[INJECT_SPIN];
+    uint32_t found = detected[INJECT_IMPACT] + detected[INJECT_FALL] + detected[INJECT_SPIN];
+    uint32_t decoys = detected[INJECT_LANDING] + detected[INJECT_TURN];
+    uint32_t false_triggers = 0;
+    for (size_t i = 0; i < burst_count; i++) {
+        false_triggers += !bursts[i].matched;
+    }
+
+    printf("Injected %u events and %u decoys:\n", real, injected[INJECT_LANDING] + injected[INJECT_TURN]);
+    for (int k = 0; k < INJECT_KIND_COUNT; k++) {
+        printf("  %-14s %5u injected, %5u triggered\n", kind_names[k], injected[k], detected[k]);
+    }
+    printf("Missed events: %u of %u (%.2f%%)\n", real - found, real, real ? 100.0 * (real - found) / real : 0.0);
+    printf("Trigger latency from onset: mean %.1f ms, max %.1f ms\n",
+           latency_count ? latency_sum / 1000.0 / latency_count : 0.0, latency_max / 1000.0);
+    printf("Falls with the free fall inside the burst: %u of %u\n", falls_with_lead_up, detected[INJECT_FALL]);
+    printf("Decoys triggered: %u, other triggers outside events: %u\n", decoys, false_triggers);
+    printf("Bursts: %zu, %u malformed, %u more samples over a threshold inside a tail\n", burst_count, malformed, merged);
+    printf("Capture cost: %.1f ns/sample (%zu samples)\n", busy_s * 1e9 / sample_count, sample_count);
+
+    free(samples);
+    free(bursts);
+    return malformed == 0 ? 0 : 1;
+}
@@ -0,0 +1,924 @@
+/*
+File: fusion_test.c
+Author: Leonardo DaGraca
+
+Host check of the GPS/IMU fusion (track_fusion.c) behind the attitude filter
+(attitude.c), the same chain as the GPS_IMU_FUSION build.
+
+Without log files it generates a field session: a player who stands for 5s,
+then jogs, runs and sprints in segments of 2-8s with cuts of 30-150 degrees
+(at most FIELD_LATERAL_G sideways and FIELD_TANGENTIAL m/s^2 along the path),
+with a bouncing stride, a swaying torso and the sensor mounted at an angle to
+the running direction. The true path becomes MPU6050 counts (noise, bias and
+rounding, the gyro from the rotation between samples) and GPS fixes that are
+the true path downsampled to the fix rate, with a slowly wandering position
+error and velocity noise. Each scenario (fix rate, GPS error) then compares
+against the true path, at every IMU sample:
+- fused: the filter output, causal like on the device
+- hold: the last fix, which is all the logger knows between fixes without it
+- interp: linear interpolation between the fixes, which needs the next fix
+for the position, speed and course error (RMS and 95th percentile) and the
+delay until the course has turned half way through a cut. It fails if the
+fused track is not better than holding the fix or the heading offset is not
+found within FIELD_ALIGN_MAX_S.
+
+With a gps_log_N.csv and imu_log_N.csv pair (IMU_FULL_RATE CSV logs) only
+every k-th fix goes to the filter and the others are the reference: the same
+three are compared at the withheld fixes. -o writes the fused track.
+
+Then it times track_fusion_predict() and track_fusion_add_fix() and gives the
+M0+ estimate from the float operations counted in track_fusion.c.
+
+Usage: fusion_test [-m minutes] [-r imu_hz] [-g gps_out.csv imu_out.csv]
+       fusion_test [-d k] [-o fused.csv] gps_log_N.csv imu_log_N.csv
+Build: cc -O2 -I. -o fusion_test fusion_test.c track_fusion.c attitude.c geo.c nmea_parser.c -lm
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include "track_fusion.h"
+#include "attitude.h"
+#include "nmea_parser.h"
+
+#define STANDARD_GRAVITY 9.80665
+#define EARTH_RADIUS_M 6371000.0
+#define ORIGIN_LAT 48.0
+#define ORIGIN_LON 11.0
+
+#define SUBSTEPS 8                  //integration steps of the true path per IMU sample
+#define FIELD_STAND_S 5.0
+#define FIELD_LATERAL_G 1.2
+#define FIELD_TANGENTIAL 3.0        //m/s^2
+#define FIELD_MOUNT_DEG 25.0        //sensor x axis to the running direction
+#define FIELD_CUT_MIN_DEG 60.0      //heading changes counted as cuts
+#define FIELD_CUT_MIN_SPEED 3.0     //m/s
+#define FIELD_CUT_WINDOW_S 5.0
+#define FIELD_ALIGN_MAX_S 90.0
+
+#define GYRO_1DPS (MPU6050_GYRO_COUNTS_PER_KDPS / 1000.0)
+#define ACCEL_NOISE_COUNTS (0.0005 * ATTITUDE_ACCEL_1G)
+#define GYRO_NOISE_COUNTS (0.008 * GYRO_1DPS)
+#define GPS_ERROR_TAU_S 20.0        //correlation time of the position error
+#define GPS_VELOCITY_NOISE 0.1      //m/s per axis
+
+//float operations per call counted in track_fusion.c and the RP2040 ROM float library at ~60 cycles each
+#define PREDICT_FLOAT_OPS 167       //87 multiplies, 79 adds, one conversion
+#define ATTITUDE_ACCEL_FLOAT_OPS 26 //the rotation of the linear acceleration, per sample in main.c
+#define ADD_FIX_FLOAT_OPS 300       //four scalar updates, ~60 each, and the fix to metres
+#define ADD_FIX_TRIG 4              //sinf, cosf of the course and of the updated offset, ~400 cycles each
+#define M0_CYCLES_PER_FLOAT_OP 60
+#define M0_CYCLES_PER_TRIG 400
+#define M0_CLOCK_HZ 125000000.0
+
+typedef struct {
+    uint64_t time_us;
+    int32_t ax, ay, az, gx, gy, gz;
+} Sample;
+
+typedef struct {
+    uint64_t time_us;
+    int32_t lat_e7;
+    int32_t lon_e7;
+    uint32_t speed_mm_s;
+    uint32_t course_cdeg;
+    double east, north;             //of the fix, m from the origin
+    double ve, vn;
+} Fix;
+
+typedef struct {
+    double start_s;
+    double from;                    //true course before and after, rad clockwise from north
+    double to;
+} Cut;
+
+//the generated session, every array is per IMU sample
+typedef struct {
+    size_t count;
+    uint32_t rate_hz;
+    Sample *samples;
+    double (*position)[2];          //east, north m
+    double (*velocity)[2];
+    Cut *cuts;
+    size_t cut_count;
+} Session;
+
+typedef struct {
+    const char *name;
+    uint32_t fix_hz;
+    double position_sigma;          //m, 0 for fixes on the true path
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"1Hz GPS, 1.5m error", 1, 1.5},
+    {"1Hz GPS, no error", 1, 0.0},
+    {"5Hz GPS, 1.5m error", 5, 1.5},
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+#define METHOD_COUNT 3
+static const char *method_names[METHOD_COUNT] = {"fused", "hold", "interp"};
+
+typedef struct {
+    double *values;
+    size_t count;
+    size_t capacity;
+    double sum_sq;
+} Error_Stats;
+
+typedef struct {
+    Error_Stats position;
+    Error_Stats speed;
+    Error_Stats course;
+    Error_Stats cut_delay;
+} Method_Stats;
+
+//---- small helpers ----
+
+static double gaussian() {
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static double uniform(double low, double high) {
+    return low + (high - low) * rand() / (double)RAND_MAX;
+}
+
+static double wrap_pi(double angle) {
+    while (angle > M_PI) {
+        angle -= 2.0 * M_PI;
+    }
+    while (angle < -M_PI) {
+        angle += 2.0 * M_PI;
+    }
+    return angle;
+}
+
+static double clamp(double value, double limit) {
+    return value > limit ? limit : value < -limit ? -limit : value;
+}
+
+static int32_t to_counts(double value) {
+    double counts = round(value);
+    return counts > 32767 ? 32767 : counts < -32768 ? -32768 : (int32_t)counts;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void stats_add(Error_Stats *stats, double value) {
+    if (stats->count == stats->capacity) {
+        stats->capacity = stats->capacity ? stats->capacity * 2 : 1024;
+        stats->values = realloc(stats->values, stats->capacity * sizeof(double));
+        if (!stats->values) {
+            perror("Unable to allocate error samples");
+            exit(1);
+        }
+    }
+    stats->values[stats->count++] = value;
+    stats->sum_sq += value * value;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double stats_rms(const Error_Stats *stats) {
+    return stats->count ? sqrt(stats->sum_sq / stats->count) : 0.0;
+}
+
+static double stats_percentile(Error_Stats *stats, double fraction) {
+    if (stats->count == 0) {
+        return 0.0;
+    }
+    qsort(stats->values, stats->count, sizeof(double), compare_double);
+    return stats->values[(size_t)(fraction * (stats->count - 1))];
+}
+
+static double stats_mean(const Error_Stats *stats) {
+    double sum = 0.0;
+    for (size_t i = 0; i < stats->count; i++) {
+        sum += stats->values[i];
+    }
+    return stats->count ? sum / stats->count : 0.0;
+}
+
+static void stats_free(Method_Stats *stats) {
+    free(stats->position.values);
+    free(stats->speed.values);
+    free(stats->course.values);
+    free(stats->cut_delay.values);
+    memset(stats, 0, sizeof(*stats));
+}
+
+//positions on the same sphere as geo.c, the origin is close enough to every fix for a flat earth
+static void to_lat_lon(double east, double north, int32_t *lat_e7, int32_t *lon_e7) {
+    double lat = ORIGIN_LAT + north / EARTH_RADIUS_M * 180.0 / M_PI;
+    double lon = ORIGIN_LON + east / (EARTH_RADIUS_M * cos(ORIGIN_LAT * M_PI / 180.0)) * 180.0 / M_PI;
+    *lat_e7 = (int32_t)llround(lat * 1e7);
+    *lon_e7 = (int32_t)llround(lon * 1e7);
+}
+
+static void from_lat_lon(int32_t lat_e7, int32_t lon_e7, double origin_lat, double origin_lon, double *east,
+                         double *north) {
+    *north = (lat_e7 / 1e7 - origin_lat) * M_PI / 180.0 * EARTH_RADIUS_M;
+    *east = (lon_e7 / 1e7 - origin_lon) * M_PI / 180.0 * EARTH_RADIUS_M * cos(origin_lat * M_PI / 180.0);
+}
+
+static void fix_velocity(uint32_t speed_mm_s, uint32_t course_cdeg, double *ve, double *vn) {
+    double course = course_cdeg / 100.0 * M_PI / 180.0;
+    *ve = speed_mm_s / 1000.0 * sin(course);
+    *vn = speed_mm_s / 1000.0 * cos(course);
+}
+
+//---- quaternions in double, the same convention as attitude.c ----
+
+static void quat_mul(const double a[4], const double b[4], double out[4]) {
+    double r[4] = {
+        a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3],
+        a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2],
+        a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1],
+        a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0]
+    };
+    memcpy(out, r, sizeof(r));
+}
+
+//earth frame vector w seen from the sensor: q* w q
+static void to_sensor(const double q[4], const double w[3], double out[3]) {
+    double conj[4] = {q[0], -q[1], -q[2], -q[3]};
+    double v[4] = {0.0, w[0], w[1], w[2]};
+    double t[4];
+    quat_mul(conj, v, t);
+    quat_mul(t, q, t);
+    out[0] = t[1];
+    out[1] = t[2];
+    out[2] = t[3];
+}
+
+//yaw about up, then pitch, then roll (ZYX), in the east/north/up frame
+static void quat_from_euler(double yaw, double pitch, double roll, double q[4]) {
+    double qz[4] = {cos(yaw / 2), 0.0, 0.0, sin(yaw / 2)};
+    double qy[4] = {cos(pitch / 2), 0.0, sin(pitch / 2), 0.0};
+    double qx[4] = {cos(roll / 2), sin(roll / 2), 0.0, 0.0};
+    quat_mul(qz, qy, q);
+    quat_mul(q, qx, q);
+}
+
+//---- the generated field session ----
+
+static void session_free(Session *session) {
+    free(session->samples);
+    free(session->position);
+    free(session->velocity);
+    free(session->cuts);
+    memset(session, 0, sizeof(*session));
+}
+
+static void generate_session(Session *session, double minutes, uint32_t rate_hz) {
+    size_t count = (size_t)(minutes * 60.0 * rate_hz);
+    memset(session, 0, sizeof(*session));
+    session->count = count;
+    session->rate_hz = rate_hz;
+    session->samples = malloc(count * sizeof(Sample));
+    session->position = malloc(count * sizeof(*session->position));
+    session->velocity = malloc(count * sizeof(*session->velocity));
+    session->cuts = malloc((size_t)(minutes * 60.0) * sizeof(Cut));
+    if (!session->samples || !session->position || !session->velocity || !session->cuts) {
+        perror("Unable to allocate the session");
+        exit(1);
+    }
+
+    const double period = 1.0 / rate_hz;
+    const double h = period / SUBSTEPS;
+    const double mount = FIELD_MOUNT_DEG * M_PI / 180.0;
+    //what the online calibration leaves, ~3mg and ~0.02 deg/s, in counts
+    const double accel_bias[3] = {0.0037 * ATTITUDE_ACCEL_1G, -0.0027 * ATTITUDE_ACCEL_1G, 0.0018 * ATTITUDE_ACCEL_1G};
+    const double gyro_bias[3] = {0.023 * GYRO_1DPS, -0.015 * GYRO_1DPS, 0.031 * GYRO_1DPS};
+
+    double east = 0.0, north = 0.0, speed = 0.0, course = uniform(-M_PI, M_PI), phase = 0.0;
+    double target_speed = 0.0, target_course = course;
+    double segment_end = FIELD_STAND_S;
+    double t = 0.0;
+    double q[4], q_last[4];
+    double accel_e = 0.0, accel_n = 0.0, bounce = 0.0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            for (int k = 0; k < SUBSTEPS; k++) {
+                if (t >= segment_end) {
+                    //the next segment: stand, jog, run or sprint, often behind a cut
+                    double choice = uniform(0.0, 1.0);
+                    target_speed = choice < 0.1 ? 0.0 : choice < 0.5 ? uniform(2.0, 3.0) :
+                                   choice < 0.8 ? uniform(4.0, 5.0) : uniform(6.5, 7.5);
+                    double turn = uniform(0.0, 1.0) < 0.6 ? uniform(30.0, 150.0) : uniform(0.0, 20.0);
+                    double from = target_course;
+                    target_course = wrap_pi(target_course + (rand() & 1 ? 1 : -1) * turn * M_PI / 180.0);
+                    if (turn >= FIELD_CUT_MIN_DEG && speed >= FIELD_CUT_MIN_SPEED) {
+                        session->cuts[session->cut_count++] = (Cut){t, from, target_course};
+                    }
+                    segment_end = t + uniform(2.0, 8.0);
+                }
+
+                double speed_rate = clamp((target_speed - speed) / h, FIELD_TANGENTIAL);
+                double max_turn = FIELD_LATERAL_G * STANDARD_GRAVITY / (speed > 1.0 ? speed : 1.0);
+                double turn_rate = clamp(wrap_pi(target_course - course) / 0.25, max_turn);
+
+                accel_e = speed_rate * sin(course) + speed * turn_rate * cos(course);
+                accel_n = speed_rate * cos(course) - speed * turn_rate * sin(course);
+                speed += speed_rate * h;
+                course = wrap_pi(course + turn_rate * h);
+                east += speed * sin(course) * h;
+                north += speed * cos(course) * h;
+
+                double stride_hz = speed < 0.3 ? 0.0 : 1.8 + 0.2 * speed;
+                phase += 2.0 * M_PI * stride_hz * h;
+                t += h;
+            }
+        }
+
+        //a bouncing stride, the torso leans into the run and sways with the steps
+        double effort = speed / 4.0 > 1.0 ? 1.0 : speed / 4.0;
+        bounce = 0.5 * STANDARD_GRAVITY * effort * sin(phase);
+        double pitch = (8.0 * speed / 7.5 + 2.0 * effort * sin(phase)) * M_PI / 180.0;
+        double roll = 4.0 * effort * sin(phase / 2) * M_PI / 180.0;
+        double yaw = M_PI / 2 - course + mount + 3.0 * effort * sin(phase / 2) * M_PI / 180.0;
+        quat_from_euler(yaw, pitch, roll, q);
+
+        //the gyro measures the mean rate over the sample period, taken from the rotation between the samples
+        double rate[3] = {0.0, 0.0, 0.0};
+        if (i > 0) {
+            double conj[4] = {q_last[0], -q_last[1], -q_last[2], -q_last[3]};
+            double dq[4];
+            quat_mul(conj, q, dq);
+            if (dq[0] < 0.0) {
+                for (int k = 0; k < 4; k++) {
+                    dq[k] = -dq[k];
+                }
+            }
+            double s = sqrt(dq[1] * dq[1] + dq[2] * dq[2] + dq[3] * dq[3]);
+            double angle = 2.0 * atan2(s, dq[0]);
+            for (int k = 0; k < 3; k++) {
+                rate[k] = s > 0.0 ? dq[k + 1] / s * angle / period * 180.0 / M_PI : 0.0;
+            }
+        }
+        memcpy(q_last, q, sizeof(q));
+
+        double specific[3] = {accel_e / STANDARD_GRAVITY, accel_n / STANDARD_GRAVITY,
+                              1.0 + bounce / STANDARD_GRAVITY};
+        double sensor[3];
+        to_sensor(q, specific, sensor);
+
+        Sample *s = &session->samples[i];
+        s->time_us = 1000000 + (uint64_t)i * (1000000 / rate_hz);
+        s->ax = to_counts(sensor[0] * ATTITUDE_ACCEL_1G + accel_bias[0] + ACCEL_NOISE_COUNTS * gaussian());
+        s->ay = to_counts(sensor[1] * ATTITUDE_ACCEL_1G + accel_bias[1] + ACCEL_NOISE_COUNTS * gaussian());
+        s->az = to_counts(sensor[2] * ATTITUDE_ACCEL_1G + accel_bias[2] + ACCEL_NOISE_COUNTS * gaussian());
+        s->gx = to_counts(rate[0] * GYRO_1DPS + gyro_bias[0] + GYRO_NOISE_COUNTS * gaussian());
+        s->gy = to_counts(rate[1] * GYRO_1DPS + gyro_bias[1] + GYRO_NOISE_COUNTS * gaussian());
+        s->gz = to_counts(rate[2] * GYRO_1DPS + gyro_bias[2] + GYRO_NOISE_COUNTS * gaussian());
+
+        session->position[i][0] = east;
+        session->position[i][1] = north;
+        session->velocity[i][0] = speed * sin(course);
+        session->velocity[i][1] = speed * cos(course);
+    }
+}
+
+//the true path downsampled to the fix rate, with a position error that wanders like a receiver's
+static size_t generate_fixes(const Session *session, const Scenario *scenario, Fix *fixes) {
+    uint32_t step = session->rate_hz / scenario->fix_hz;
+    double decay = exp(-1.0 / scenario->fix_hz / GPS_ERROR_TAU_S);
+    double drive = scenario->position_sigma * sqrt(1.0 - decay * decay);
+    double error[2] = {scenario->position_sigma * gaussian(), scenario->position_sigma * gaussian()};
+    double velocity_noise = scenario->position_sigma > 0.0 ? GPS_VELOCITY_NOISE : 0.0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < session->count; i += step) {
+        error[0] = error[0] * decay + drive * gaussian();
+        error[1] = error[1] * decay + drive * gaussian();
+        Fix *fix = &fixes[count++];
+        fix->time_us = session->samples[i].time_us;
+        to_lat_lon(session->position[i][0] + error[0], session->position[i][1] + error[1], &fix->lat_e7,
+                   &fix->lon_e7);
+
+        double ve = session->velocity[i][0] + velocity_noise * gaussian();
+        double vn = session->velocity[i][1] + velocity_noise * gaussian();
+        double course_cdeg = atan2(ve, vn) * 18000.0 / M_PI;
+        fix->speed_mm_s = (uint32_t)llround(sqrt(ve * ve + vn * vn) * 1000.0);
+        fix->course_cdeg = (uint32_t)llround(course_cdeg < 0.0 ? course_cdeg + 36000.0 : course_cdeg) % 36000;
+
+        //what the logger sees, after the rounding
+        from_lat_lon(fix->lat_e7, fix->lon_e7, ORIGIN_LAT, ORIGIN_LON, &fix->east, &fix->north);
+        fix_velocity(fix->speed_mm_s, fix->course_cdeg, &fix->ve, &fix->vn);
+    }
+    return count;
+}
+
+//NMEA sentences of the fixes and the IMU samples as the IMU_FULL_RATE CSV logs, for the simulator
+static void write_logs(const Session *session, const Fix *fixes, size_t fix_count, const char *gps_path,
+                       const char *imu_path) {
+    FILE *gps = fopen(gps_path, "w");
+    FILE *imu = fopen(imu_path, "w");
+    if (!gps || !imu) {
+        perror("Unable to write the generated logs");
+        exit(1);
+    }
+
+    fprintf(gps, "Timestamp,NMEA\n");
+    for (size_t i = 0; i < fix_count; i++) {
+        const Fix *fix = &fixes[i];
+        uint32_t ms = (uint32_t)((fix->time_us - 1000000) / 1000 + 12 * 3600000) % 86400000;
+        uint32_t lat = (uint32_t)(fix->lat_e7 < 0 ? -fix->lat_e7 : fix->lat_e7);
+        uint32_t lon = (uint32_t)(fix->lon_e7 < 0 ? -fix->lon_e7 : fix->lon_e7);
+        //1e-7 degrees to degrees and 1e-5 minutes
+        uint32_t lat_minutes_e5 = (uint32_t)(((uint64_t)(lat % 10000000) * 60 + 50) / 100);
+        uint32_t lon_minutes_e5 = (uint32_t)(((uint64_t)(lon % 10000000) * 60 + 50) / 100);
+        double knots = fix->speed_mm_s / 1000.0 * 3600.0 / 1852.0;
+
+        char bodies[2][NMEA_MAX_SENTENCE];
+        snprintf(bodies[0], sizeof(bodies[0]),
+                 "GPRMC,%02u%02u%02u.%02u,A,%02u%02u.%05u,%c,%03u%02u.%05u,%c,%.3f,%.2f,010124,,,A",
+                 ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms / 10 % 100, lat / 10000000,
+                 lat_minutes_e5 / 100000, lat_minutes_e5 % 100000, fix->lat_e7 < 0 ? 'S' : 'N', lon / 10000000,
+                 lon_minutes_e5 / 100000, lon_minutes_e5 % 100000, fix->lon_e7 < 0 ? 'W' : 'E', knots,
+                 fix->course_cdeg / 100.0);
+        snprintf(bodies[1], sizeof(bodies[1]), "GPVTG,%.2f,T,,M,%.3f,N,%.3f,K,A", fix->course_cdeg / 100.0, knots,
+                 fix->speed_mm_s * 3.6 / 1000.0);
+        for (int b = 0; b < 2; b++) {
+            uint8_t checksum = 0;
+            for (const char *c = bodies[b]; *c; c++) {
+                checksum ^= (uint8_t)*c;
+            }
+            fprintf(gps, "%" PRIu64 ",%s*%02X\n", fix->time_us, bodies[b], checksum);
+        }
+    }
+
+    fprintf(imu, "Timestamp,ax,ay,az,gx,gy,gz\n");
+    for (size_t i = 0; i < session->count; i++) {
+        const Sample *s = &session->samples[i];
+        fprintf(imu, "%" PRIu64 ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "\n",
+                s->time_us, s->ax, s->ay, s->az, s->gx, s->gy, s->gz);
+    }
+    fclose(gps);
+    fclose(imu);
+}
+
+//---- the three estimates against the true path ----
+
+static void add_errors(Method_Stats *stats, double east, double north, double ve, double vn, const double position[2],
+                       const double velocity[2]) {
+    stats_add(&stats->position, hypot(east - position[0], north - position[1]));
+    double true_speed = hypot(velocity[0], velocity[1]);
+    stats_add(&stats->speed, fabs(hypot(ve, vn) - true_speed));
+    if (true_speed >= FIELD_CUT_MIN_SPEED) {
+        stats_add(&stats->course, fabs(wrap_pi(atan2(ve, vn) - atan2(velocity[0], velocity[1]))) * 180.0 / M_PI);
+    }
+}
+
+//first sample from start at which a course has turned half way from cut->from to cut->to
+static double half_turn_s(const Cut *cut, const float *course, size_t start, size_t count, uint32_t rate_hz) {
+    double half = wrap_pi(cut->to - cut->from) / 2;
+    size_t end = start + (size_t)(FIELD_CUT_WINDOW_S * rate_hz);
+    for (size_t i = start; i < end && i < count; i++) {
+        double turned = wrap_pi(course[i] - cut->from);
+        if ((half > 0.0 && turned >= half) || (half < 0.0 && turned <= half)) {
+            return (double)(i - start) / rate_hz;
+        }
+    }
+    return FIELD_CUT_WINDOW_S;
+}
+
+static bool run_scenario(const Session *session, const Scenario *scenario, Fix *fixes) {
+    size_t fix_count = generate_fixes(session, scenario, fixes);
+    uint32_t step = session->rate_hz / scenario->fix_hz;
+    //course of each estimate and the true one at every sample
+    float *courses[METHOD_COUNT + 1];
+    for (int m = 0; m <= METHOD_COUNT; m++) {
+        courses[m] = calloc(session->count, sizeof(float));
+        if (!courses[m]) {
+            perror("Unable to allocate the courses");
+            exit(1);
+        }
+    }
+
+    Attitude attitude;
+    attitude_init(&attitude);
+    Track_Fusion fusion;
+    track_fusion_init(&fusion);
+    Method_Stats stats[METHOD_COUNT];
+    memset(stats, 0, sizeof(stats));
+    double aligned_s = -1.0;
+
+    for (size_t i = 0; i < session->count; i++) {
+        const Sample *s = &session->samples[i];
+        attitude_update(&attitude, s->time_us, s->ax, s->ay, s->az, s->gx, s->gy, s->gz);
+        float accel[2];
+        track_fusion_attitude_accel(&attitude, accel);
+        track_fusion_predict(&fusion, s->time_us, accel);
+
+        size_t k = i / step;
+        if (i % step == 0 && k < fix_count) {
+            const Fix *fix = &fixes[k];
+            track_fusion_add_fix(&fusion, fix->time_us, fix->lat_e7, fix->lon_e7, fix->speed_mm_s, fix->course_cdeg);
+            if (fusion.aligned && aligned_s < 0.0) {
+                aligned_s = (s->time_us - session->samples[0].time_us) / 1e6;
+            }
+        }
+
+        Track_Fusion_Point point;
+        track_fusion_point(&fusion, &point);
+        double east, north;
+        from_lat_lon(point.lat_e7, point.lon_e7, ORIGIN_LAT, ORIGIN_LON, &east, &north);
+        double ve = point.east_mm_s / 1000.0, vn = point.north_mm_s / 1000.0;
+        add_errors(&stats[0], east, north, ve, vn, session->position[i], session->velocity[i]);
+        courses[0][i] = (float)atan2(ve, vn);
+
+        const Fix *last = &fixes[k < fix_count ? k : fix_count - 1];
+        add_errors(&stats[1], last->east, last->north, last->ve, last->vn, session->position[i], session->velocity[i]);
+        courses[1][i] = (float)atan2(last->ve, last->vn);
+
+        //between this fix and the next, at the speed and course of the chord
+        if (k + 1 < fix_count) {
+            const Fix *next = &fixes[k + 1];
+            double f = (double)(i % step) / step;
+            double dt = (next->time_us - last->time_us) / 1e6;
+            double chord_e = (next->east - last->east) / dt, chord_n = (next->north - last->north) / dt;
+            add_errors(&stats[2], last->east + f * (next->east - last->east), last->north + f * (next->north - last->north),
+                       chord_e, chord_n, session->position[i], session->velocity[i]);
+            courses[2][i] = (float)atan2(chord_e, chord_n);
+        }
+        else {
+            courses[2][i] = courses[1][i];
+        }
+    }
+
+    //delay of each estimate behind the true course through the cuts
+    float *truth = courses[METHOD_COUNT];
+    for (size_t i = 0; i < session->count; i++) {
+        truth[i] = (float)atan2(session->velocity[i][0], session->velocity[i][1]);
+    }
+    for (size_t c = 0; c < session->cut_count; c++) {
+        const Cut *cut = &session->cuts[c];
+        size_t start = (size_t)(cut->start_s * session->rate_hz);
+        double true_s = half_turn_s(cut, truth, start, session->count, session->rate_hz);
+        for (int m = 0; m < METHOD_COUNT; m++) {
+            stats_add(&stats[m].cut_delay, half_turn_s(cut, courses[m], start, session->count, session->rate_hz) - true_s);
+        }
+    }
+
+    printf("\n%s: %zu fixes, %zu cuts, heading offset found after %.0f s, %" PRIu32 " rejected, %" PRIu32 " restarts\n",
+           scenario->name, fix_count, session->cut_count, aligned_s, fusion.rejected, fusion.restarts);
+    printf("%-8s %9s %9s %11s %11s %12s %12s %10s %10s\n", "", "Pos_RMS_m", "Pos_95_m", "Speed_RMS", "Speed_95",
+           "Course_RMS", "Course_95", "Cut_mean_s", "Cut_max_s");
+    for (int m = 0; m < METHOD_COUNT; m++) {
+        Method_Stats *r = &stats[m];
+        double cut_mean = stats_mean(&r->cut_delay);
+        printf("%-8s %9.2f %9.2f %9.2f/s %9.2f/s %10.1fdeg %10.1fdeg %10.2f %10.2f\n", method_names[m],
+               stats_rms(&r->position), stats_percentile(&r->position, 0.95), stats_rms(&r->speed),
+               stats_percentile(&r->speed, 0.95), stats_rms(&r->course), stats_percentile(&r->course, 0.95),
+               cut_mean, stats_percentile(&r->cut_delay, 1.0));
+    }
+
+    bool ok = aligned_s >= 0.0 && aligned_s <= FIELD_ALIGN_MAX_S &&
+              stats_rms(&stats[0].position) < stats_rms(&stats[1].position) &&
+              stats_rms(&stats[0].course) < stats_rms(&stats[1].course) &&
+              stats_mean(&stats[0].cut_delay) < stats_mean(&stats[1].cut_delay);
+    if (!ok) {
+        printf("FAILED: the fused track is not better than the last fix or the heading offset was not found\n");
+    }
+    for (int m = 0; m < METHOD_COUNT; m++) {
+        stats_free(&stats[m]);
+    }
+    for (int m = 0; m <= METHOD_COUNT; m++) {
+        free(courses[m]);
+    }
+    return ok;
+}
+
+//---- cost per call ----
+
+static void benchmark(const Session *session, const Fix *fixes) {
+    Attitude attitude;
+    attitude_init(&attitude);
+    Track_Fusion fusion;
+    track_fusion_init(&fusion);
+    float (*accel)[2] = malloc(session->count * sizeof(*accel));
+    if (!accel) {
+        perror("Unable to allocate the accelerations");
+        exit(1);
+    }
+    for (size_t i = 0; i < session->count; i++) {
+        const Sample *s = &session->samples[i];
+        attitude_update(&attitude, s->time_us, s->ax, s->ay, s->az, s->gx, s->gy, s->gz);
+        track_fusion_attitude_accel(&attitude, accel[i]);
+    }
+    track_fusion_add_fix(&fusion, fixes[0].time_us, fixes[0].lat_e7, fixes[0].lon_e7, fixes[0].speed_mm_s,
+                         fixes[0].course_cdeg);
+    //the aligned path, which runs for the rest of a session
+    fusion.aligned = true;
+
+    //predictions only, the covariance grows but stays far from the float range
+    uint64_t calls = 10000000;
+    uint64_t time_us = fusion.time_us;
+    uint32_t period_us = 1000000 / session->rate_hz;
+    double start = now_seconds();
+    for (uint64_t i = 0; i < calls; i++) {
+        time_us += period_us;
+        track_fusion_predict(&fusion, time_us, accel[i % session->count]);
+    }
+    double predict_ns = (now_seconds() - start) * 1e9 / calls;
+
+    //the same fix over and over at the time of the state, every call runs the four updates
+    Track_Fusion_Point point;
+    track_fusion_point(&fusion, &point);
+    uint64_t fix_calls = 1000000;
+    start = now_seconds();
+    for (uint64_t i = 0; i < fix_calls; i++) {
+        track_fusion_add_fix(&fusion, fusion.time_us, point.lat_e7, point.lon_e7, 3000, (uint32_t)(i % 36000));
+    }
+    double fix_ns = (now_seconds() - start) * 1e9 / fix_calls;
+
+    uint32_t predict_cycles = (PREDICT_FLOAT_OPS + ATTITUDE_ACCEL_FLOAT_OPS) * M0_CYCLES_PER_FLOAT_OP;
+    uint32_t fix_cycles = ADD_FIX_FLOAT_OPS * M0_CYCLES_PER_FLOAT_OP + ADD_FIX_TRIG * M0_CYCLES_PER_TRIG;
+    printf("\ntrack_fusion_predict: %.1f ns/sample on this host, M0+ estimate ~%" PRIu32 " cycles (%.0f us, %.1f%% of "
+           "core 0 at %" PRIu32 " Hz)\n", predict_ns, predict_cycles, predict_cycles / M0_CLOCK_HZ * 1e6,
+           predict_cycles / M0_CLOCK_HZ * session->rate_hz * 100.0, session->rate_hz);
+    printf("track_fusion_add_fix: %.1f ns/fix on this host, M0+ estimate ~%" PRIu32 " cycles (%.0f us)\n", fix_ns,
+           fix_cycles, fix_cycles / M0_CLOCK_HZ * 1e6);
+    free(accel);
+}
+
+//---- replay of logged sessions ----
+
+static size_t read_fixes(const char *path, Fix **out) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Unable to open the GPS log");
+        exit(1);
+    }
+    size_t count = 0, capacity = 1024;
+    Fix *fixes = malloc(capacity * sizeof(Fix));
+    NMEA_Parser parser;
+    nmea_parser_init(&parser);
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char *comma = strchr(line, ',');
+        if (!comma || line[0] < '0' || line[0] > '9') {
+            continue;
+        }
+        uint64_t time_us = strtoull(line, NULL, 10);
+        NMEA_Sentence sentence;
+        bool done = nmea_parser_feed(&parser, '$', &sentence);
+        for (const char *c = comma + 1; *c && *c != '\n' && *c != '\r'; c++) {
+            done = nmea_parser_feed(&parser, *c, &sentence);
+        }
+        done = nmea_parser_feed(&parser, '\r', &sentence) || done;
+        done = nmea_parser_feed(&parser, '\n', &sentence) || done;
+        if (!done || sentence.type != NMEA_TYPE_RMC || !sentence.rmc.valid) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            fixes = realloc(fixes, capacity * sizeof(Fix));
+        }
+        if (!fixes) {
+            perror("Unable to allocate the fixes");
+            exit(1);
+        }
+        Fix *fix = &fixes[count++];
+        memset(fix, 0, sizeof(*fix));
+        fix->time_us = time_us;
+        fix->lat_e7 = sentence.rmc.lat_e7;
+        fix->lon_e7 = sentence.rmc.lon_e7;
+        fix->speed_mm_s = sentence.rmc.speed_mm_s;
+        fix->course_cdeg = sentence.rmc.course_cdeg;
+    }
+    fclose(file);
+    *out = fixes;
+    return count;
+}
+
+static size_t read_samples(const char *path, Sample **out) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Unable to open the IMU log");
+        exit(1);
+    }
+    size_t count = 0, capacity = 65536;
+    Sample *samples = malloc(capacity * sizeof(Sample));
+    char line[160];
+    while (samples && fgets(line, sizeof(line), file)) {
+        unsigned long long time_us;
+        int v[6];
+        if (sscanf(line, "%llu,%d,%d,%d,%d,%d,%d", &time_us, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 7) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            samples = realloc(samples, capacity * sizeof(Sample));
+            if (!samples) {
+                break;
+            }
+        }
+        samples[count++] = (Sample){time_us, v[0], v[1], v[2], v[3], v[4], v[5]};
+    }
+    fclose(file);
+    if (!samples) {
+        perror("Unable to allocate the IMU samples");
+        exit(1);
+    }
+    *out = samples;
+    return count;
+}
+
+static int replay(const char *gps_path, const char *imu_path, uint32_t keep_every, const char *out_path) {
+    Fix *fixes;
+    Sample *samples;
+    size_t fix_count = read_fixes(gps_path, &fixes);
+    size_t sample_count = read_samples(imu_path, &samples);
+    if (fix_count < 2 * keep_every || sample_count == 0) {
+        fprintf(stderr, "Need at least %" PRIu32 " valid fixes and one IMU sample, got %zu and %zu\n", 2 * keep_every,
+                fix_count, sample_count);
+        return 1;
+    }
+    FILE *out = NULL;
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            perror("Unable to open the output");
+            return 1;
+        }
+        fputs(FUSION_CSV_HEADER, out);
+    }
+
+    double origin_lat = fixes[0].lat_e7 / 1e7, origin_lon = fixes[0].lon_e7 / 1e7;
+    for (size_t i = 0; i < fix_count; i++) {
+        from_lat_lon(fixes[i].lat_e7, fixes[i].lon_e7, origin_lat, origin_lon, &fixes[i].east, &fixes[i].north);
+        fix_velocity(fixes[i].speed_mm_s, fixes[i].course_cdeg, &fixes[i].ve, &fixes[i].vn);
+    }
+
+    Attitude attitude;
+    attitude_init(&attitude);
+    Track_Fusion fusion;
+    track_fusion_init(&fusion);
+    Method_Stats stats[METHOD_COUNT];
+    memset(stats, 0, sizeof(stats));
+    size_t next_fix = 0, points = 0;
+
+    for (size_t i = 0; i <= sample_count; i++) {
+        uint64_t sample_time = i < sample_count ? samples[i].time_us : UINT64_MAX;
+        while (next_fix < fix_count && fixes[next_fix].time_us <= sample_time) {
+            const Fix *fix = &fixes[next_fix];
+            size_t used = next_fix / keep_every * keep_every;
+            if (next_fix % keep_every == 0) {
+                track_fusion_add_fix(&fusion, fix->time_us, fix->lat_e7, fix->lon_e7, fix->speed_mm_s,
+                                     fix->course_cdeg);
+            }
+            else if (fusion.aligned) {
+                //a withheld fix is the reference for the three estimates at its time
+                Track_Fusion_Point point;
+                track_fusion_point(&fusion, &point);
+                double east, north;
+                from_lat_lon(point.lat_e7, point.lon_e7, origin_lat, origin_lon, &east, &north);
+                double reference[2] = {fix->east, fix->north}, velocity[2] = {fix->ve, fix->vn};
+                add_errors(&stats[0], east, north, point.east_mm_s / 1000.0, point.north_mm_s / 1000.0, reference,
+                           velocity);
+                const Fix *last = &fixes[used];
+                add_errors(&stats[1], last->east, last->north, last->ve, last->vn, reference, velocity);
+                if (used + keep_every < fix_count) {
+                    const Fix *next = &fixes[used + keep_every];
+                    double dt = (next->time_us - last->time_us) / 1e6;
+                    double f = (fix->time_us - last->time_us) / 1e6 / dt;
+                    add_errors(&stats[2], last->east + f * (next->east - last->east),
+                               last->north + f * (next->north - last->north), (next->east - last->east) / dt,
+                               (next->north - last->north) / dt, reference, velocity);
+                }
+            }
+            next_fix++;
+        }
+        if (i == sample_count) {
+            break;
+        }
+
+        const Sample *s = &samples[i];
+        attitude_update(&attitude, s->time_us, s->ax, s->ay, s->az, s->gx, s->gy, s->gz);
+        float accel[2];
+        track_fusion_attitude_accel(&attitude, accel);
+        track_fusion_predict(&fusion, s->time_us, accel);
+
+        Track_Fusion_Point point;
+        if (out && track_fusion_point(&fusion, &point)) {
+            char row[128];
+            track_fusion_format(&point, row, sizeof(row));
+            fputs(row, out);
+            points++;
+        }
+    }
+
+    printf("%zu fixes, every %" PRIu32 " used, %zu IMU samples, heading offset %s, %" PRIu32 " rejected, %" PRIu32
+           " restarts, %" PRIu32 " gaps\n", fix_count, keep_every, sample_count, fusion.aligned ? "found" : "not found",
+           fusion.rejected, fusion.restarts, fusion.gaps);
+    printf("%-8s %9s %9s %11s %11s %12s %12s\n", "", "Pos_RMS_m", "Pos_95_m", "Speed_RMS", "Speed_95", "Course_RMS",
+           "Course_95");
+    for (int m = 0; m < METHOD_COUNT; m++) {
+        Method_Stats *r = &stats[m];
+        printf("%-8s %9.2f %9.2f %9.2f/s %9.2f/s %10.1fdeg %10.1fdeg\n", method_names[m], stats_rms(&r->position),
+               stats_percentile(&r->position, 0.95), stats_rms(&r->speed), stats_percentile(&r->speed, 0.95),
+               stats_rms(&r->course), stats_percentile(&r->course, 0.95));
+        stats_free(r);
+    }
+    if (out) {
+        fclose(out);
+        printf("%zu fused points written to %s\n", points, out_path);
+    }
+    free(fixes);
+    free(samples);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-m minutes] [-r imu_hz] [-g gps_out.csv imu_out.csv]\n"
+                    "       %s [-d k] [-o fused.csv] gps_log_N.csv imu_log_N.csv\n", name, name);
+}
+
+int main(int argc, char *argv[]) {
+    double minutes = 10.0;
+    uint32_t rate_hz = 200;
+    uint32_t keep_every = 2;
+    const char *gps_out = NULL, *imu_out = NULL, *fused_out = NULL;
+    const char *logs[2];
+    int log_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            minutes = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rate_hz = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 2 < argc) {
+            gps_out = argv[++i];
+            imu_out = argv[++i];
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            keep_every = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            fused_out = argv[++i];
+        }
+        else if (argv[i][0] != '-' && log_count < 2) {
+            logs[log_count++] = argv[i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (log_count == 2) {
+        return replay(logs[0], logs[1], keep_every < 2 ? 2 : keep_every, fused_out);
+    }
+    if (log_count != 0 || minutes <= 0.0 || rate_hz < 10 || rate_hz % 5 != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    Session session;
+    generate_session(&session, minutes, rate_hz);
+    Fix *fixes = malloc((session.count / (rate_hz / 5) + 1) * sizeof(Fix));
+    if (!fixes) {
+        perror("Unable to allocate the fixes");
+        return 1;
+    }
+    printf("Field session: %.1f min at %" PRIu32 " Hz IMU, %zu cuts\n", minutes, rate_hz, session.cut_count);
+
+    int failures = 0;
+    for (size_t s = 0; s < SCENARIO_COUNT; s++) {
+        failures += !run_scenario(&session, &scenarios[s], fixes);
+    }
+    if (gps_out) {
+        //the first scenario, for GPS_SIM_NMEA and GPS_SIM_IMU
+        srand(2);
+        size_t fix_count = generate_fixes(&session, &scenarios[0], fixes);
+        write_logs(&session, fixes, fix_count, gps_out, imu_out);
+        printf("\nWrote %zu fixes to %s and %zu samples to %s\n", fix_count, gps_out, session.count, imu_out);
+    }
+    benchmark(&session, fixes);
+
+    session_free(&session);
+    free(fixes);
+    if (failures) {
+        fprintf(stderr, "%d scenarios failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
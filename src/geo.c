@@ -0,0 +1,218 @@
+/*
+File: geo.c
+Author: Leonardo DaGraca
+
+Geodesic helpers shared by the firmware and the host tools.
+
+The RP2040's Cortex-M0+ has no FPU, so the double precision sin/cos/atan2/sqrt
+in haversine_distance() are very slow there. geo_distance_mm_fast() works on
+fixed-point 1e-7 degree positions with integer math only: an equirectangular
+(local tangent plane) projection at the mean latitude, with cos() from a 257
+entry Q30 table and linear interpolation, and an integer square root.
+
+Error versus the double haversine, measured over 2 million random segments
+up to 80 degrees latitude (gps_metrics -c checks it on a recorded or generated track):
+- segments of 100 m to 1 km: < 3e-5 relative
+- segments under 100 m: < 3 mm
+The cos table alone contributes < 5e-6 (0.35 degree steps with interpolation).
+For GPS segments between fixes this is far below the GPS noise.
+Segments longer than ~2000 km lose precision and should use the double version.
+*/
+#include <stdio.h>
+#include <inttypes.h>
+#include <math.h>
+#include "geo.h"
+
+//function to convert lat or long from "degrees and minutes" to decimal degrees
+double convert_to_decimal_degrees(double degrees_minutes, char direction) {
+    int degrees = (int)(degrees_minutes / 100);
+    double minutes = degrees_minutes - (degrees * 100);
+    double decimal_degrees = degrees + (minutes / 60.0);
+
+    if (direction == 'S' || direction == 'W') {
+        decimal_degrees = -decimal_degrees;
+    }
+
+    return decimal_degrees;
+}
+
+//haversine formula that calculates dist between two points on Earth's surface (km)
+double haversine_distance(double lat1, double long1, double lat2, double long2) {
+    double dlat = (lat2 - lat1) * M_PI / 180.0;
+    double dlong = (long2 - long1) * M_PI / 180.0;
+
+    lat1 = lat1 * M_PI / 180.0;
+    lat2 = lat2 * M_PI / 180.0;
+
+    double a = sin(dlat / 2) * sin(dlat / 2) +
+               cos(lat1) * cos(lat2) * sin(dlong / 2) * sin(dlong / 2);
+    double c = 2 * atan2(sqrt(a), sqrt(1 - a));
+
+    return EARTH_RADIUS_KM * c;
+}
+
+//distance in millimetres between two fixed-point (1e-7 degree) positions, double haversine
+uint32_t geo_distance_mm(int32_t lat1_e7, int32_t lon1_e7, int32_t lat2_e7, int32_t lon2_e7) {
+    double km = haversine_distance(lat1_e7 / 1e7, lon1_e7 / 1e7, lat2_e7 / 1e7, lon2_e7 / 1e7);
+    return (uint32_t)llround(km * 1e6);
+}
+
+//cos(i * 90 / 256 degrees) in Q30
+static const uint32_t cos_table_q30[GEO_COS_TABLE_SIZE + 1] = {
+    1073741824, 1073721611, 1073660973, 1073559913, 1073418433, 1073236540,
+    1073014240, 1072751542, 1072448455, 1072104991, 1071721163, 1071296985,
+    1070832474, 1070327646, 1069782521, 1069197120, 1068571464, 1067905576,
+    1067199483, 1066453210, 1065666786, 1064840240, 1063973603, 1063066909,
+    1062120190, 1061133483, 1060106826, 1059040255, 1057933813, 1056787540,
+    1055601479, 1054375676, 1053110176, 1051805027, 1050460278, 1049075980,
+    1047652185, 1046188946, 1044686319, 1043144360, 1041563127, 1039942680,
+    1038283080, 1036584389, 1034846671, 1033069992, 1031254418, 1029400018,
+    1027506862, 1025575020, 1023604567, 1021595575, 1019548121, 1017462281,
+    1015338134, 1013175761, 1010975242, 1008736660, 1006460100, 1004145648,
+    1001793390, 999403415, 996975812, 994510675, 992008094, 989468165,
+    986890984, 984276646, 981625251, 978936898, 976211688, 973449725,
+    970651112, 967815955, 964944360, 962036435, 959092290, 956112036,
+    953095785, 950043650, 946955747, 943832191, 940673101, 937478595,
+    934248793, 930983817, 927683790, 924348837, 920979082, 917574653,
+    914135678, 910662286, 907154608, 903612776, 900036924, 896427186,
+    892783698, 889106597, 885396022, 881652112, 877875009, 874064853,
+    870221790, 866345964, 862437520, 858496606, 854523370, 850517961,
+    846480531, 842411232, 838310216, 834177638, 830013654, 825818421,
+    821592095, 817334838, 813046808, 808728167, 804379079, 799999706,
+    795590213, 791150767, 786681534, 782182683, 777654384, 773096806,
+    768510122, 763894504, 759250125, 754577161, 749875788, 745146182,
+    740388522, 735602987, 730789757, 725949013, 721080937, 716185713,
+    711263525, 706314559, 701339000, 696337036, 691308855, 686254647,
+    681174602, 676068911, 670937767, 665781362, 660599890, 655393548,
+    650162530, 644907034, 639627258, 634323400, 628995660, 623644239,
+    618269338, 612871159, 607449906, 602005783, 596538995, 591049748,
+    585538248, 580004702, 574449320, 568872310, 563273883, 557654248,
+    552013618, 546352205, 540670223, 534967884, 529245404, 523502998,
+    517740883, 511959275, 506158392, 500338453, 494499676, 488642281,
+    482766489, 476872522, 470960600, 465030947, 459083786, 453119340,
+    447137835, 441139496, 435124548, 429093217, 423045732, 416982319,
+    410903207, 404808624, 398698801, 392573967, 386434353, 380280190,
+    374111709, 367929144, 361732726, 355522689, 349299266, 343062693,
+    336813204, 330551034, 324276419, 317989595, 311690799, 305380268,
+    299058239, 292724951, 286380643, 280025552, 273659918, 267283981,
+    260897982, 254502159, 248096755, 241682010, 235258165, 228825464,
+    222384147, 215934457, 209476638, 203010932, 196537583, 190056834,
+    183568930, 177074115, 170572633, 164064728, 157550647, 151030634,
+    144504935, 137973796, 131437462, 124896179, 118350194, 111799753,
+    105245103, 98686491, 92124163, 85558366, 78989349, 72417357,
+    65842639, 59265442, 52686014, 46104602, 39521455, 32936819,
+    26350943, 19764076, 13176464, 6588356, 0
+};
+
+//cosine of a latitude in 1e-7 degrees, Q30
+uint32_t geo_cos_q30(int32_t lat_e7) {
+    uint64_t pos = (uint64_t)(lat_e7 < 0 ? -(int64_t)lat_e7 : lat_e7) * GEO_COS_TABLE_SIZE;
+    uint32_t index = (uint32_t)(pos / GEO_E7_90_DEG);
+    uint64_t frac = pos % GEO_E7_90_DEG;
+
+    if (index >= GEO_COS_TABLE_SIZE) {
+        return cos_table_q30[GEO_COS_TABLE_SIZE];
+    }
+
+    uint64_t step = cos_table_q30[index] - cos_table_q30[index + 1];
+    return cos_table_q30[index] - (uint32_t)((step * frac + GEO_E7_90_DEG / 2) / GEO_E7_90_DEG);
+}
+
+//integer square root, rounded down
+uint64_t geo_isqrt_u64(uint64_t value) {
+    uint64_t result = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+//distance in millimetres between two fixed-point (1e-7 degree) positions, integer only
+uint32_t geo_distance_mm_fast(int32_t lat1_e7, int32_t lon1_e7, int32_t lat2_e7, int32_t lon2_e7) {
+    int64_t dlat = (int64_t)lat2_e7 - lat1_e7;
+    int64_t dlon = (int64_t)lon2_e7 - lon1_e7;
+
+    //take the short way across the antimeridian
+    if (dlon > GEO_E7_180_DEG) {
+        dlon -= 2 * (int64_t)GEO_E7_180_DEG;
+    }
+    else if (dlon < -(int64_t)GEO_E7_180_DEG) {
+        dlon += 2 * (int64_t)GEO_E7_180_DEG;
+    }
+
+    int32_t mean_lat = (int32_t)(((int64_t)lat1_e7 + lat2_e7) / 2);
+    //keep 8 fractional bits of the scaled longitude difference, a whole 1e-7 degree is 11 mm
+    int64_t x_e7_q8 = (dlon * (int64_t)geo_cos_q30(mean_lat)) / (1 << 22);
+    int64_t x_mm = x_e7_q8 * GEO_MM_PER_E7_Q16 / (1 << 24);
+    int64_t y_mm = dlat * GEO_MM_PER_E7_Q16 / (1 << 16);
+
+    uint64_t ax = x_mm < 0 ? -x_mm : x_mm;
+    uint64_t ay = y_mm < 0 ? -y_mm : y_mm;
+
+    //keep the sum of squares inside 64 bits for very long segments
+    int shift = 0;
+    while ((ax | ay) > 0x7FFFFFFFULL) {
+        ax >>= 1;
+        ay >>= 1;
+        shift++;
+    }
+
+    uint64_t distance = geo_isqrt_u64(ax * ax + ay * ay) << shift;
+    return distance > UINT32_MAX ? UINT32_MAX : (uint32_t)distance;
+}
+
+//east (x) and north (y) offset in millimetres of a position from an origin, on the local plane at the
+//origin's latitude (cos_q30 = geo_cos_q30(origin_lat_e7)), same scaling as geo_distance_mm_fast()
+void geo_offset_mm(int32_t origin_lat_e7, int32_t origin_lon_e7, uint32_t cos_q30,
+                   int32_t lat_e7, int32_t lon_e7, int64_t *x_mm, int64_t *y_mm) {
+    int64_t dlat = (int64_t)lat_e7 - origin_lat_e7;
+    int64_t dlon = (int64_t)lon_e7 - origin_lon_e7;
+
+    if (dlon > GEO_E7_180_DEG) {
+        dlon -= 2 * (int64_t)GEO_E7_180_DEG;
+    }
+    else if (dlon < -(int64_t)GEO_E7_180_DEG) {
+        dlon += 2 * (int64_t)GEO_E7_180_DEG;
+    }
+
+    int64_t x_e7_q8 = (dlon * (int64_t)cos_q30) / (1 << 22);
+    *x_mm = x_e7_q8 * GEO_MM_PER_E7_Q16 / (1 << 24);
+    *y_mm = dlat * GEO_MM_PER_E7_Q16 / (1 << 16);
+}
+
+//inverse of geo_offset_mm(), for offsets up to ~1000 km
+void geo_position_from_offset(int32_t origin_lat_e7, int32_t origin_lon_e7, uint32_t cos_q30,
+                              int64_t x_mm, int64_t y_mm, int32_t *lat_e7, int32_t *lon_e7) {
+    int64_t dlat = y_mm * (1 << 16) / GEO_MM_PER_E7_Q16;
+    int64_t x_e7 = x_mm * (1 << 16) / GEO_MM_PER_E7_Q16;
+    int64_t dlon = cos_q30 ? x_e7 * (1 << 30) / cos_q30 : 0;
+
+    int64_t lon = origin_lon_e7 + dlon;
+    if (lon > GEO_E7_180_DEG) {
+        lon -= 2 * (int64_t)GEO_E7_180_DEG;
+    }
+    else if (lon < -(int64_t)GEO_E7_180_DEG) {
+        lon += 2 * (int64_t)GEO_E7_180_DEG;
+    }
+    *lat_e7 = (int32_t)(origin_lat_e7 + dlat);
+    *lon_e7 = (int32_t)lon;
+}
+
+//a 1e-7 degree value as decimal degrees, without going through floating point
+int geo_format_e7(int32_t value_e7, char *buf, size_t size) {
+    uint32_t magnitude = value_e7 < 0 ? -(uint32_t)value_e7 : (uint32_t)value_e7;
+    return snprintf(buf, size, "%s%" PRIu32 ".%07" PRIu32, value_e7 < 0 ? "-" : "",
+                    magnitude / 10000000, magnitude % 10000000);
+}
@@ -0,0 +1,31 @@
+#ifndef GEO_H
+#define GEO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EARTH_RADIUS_KM 6371.0
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+//fixed-point kernels, positions in 1e-7 degrees
+#define GEO_E7_90_DEG 900000000
+#define GEO_E7_180_DEG 1800000000
+#define GEO_COS_TABLE_SIZE 256
+#define GEO_MM_PER_E7_Q16 728727    //millimetres per 1e-7 degree of arc on the 6371 km sphere, Q16
+
+double convert_to_decimal_degrees(double degrees_minutes, char direction);
+double haversine_distance(double lat1, double long1, double lat2, double long2);
+uint32_t geo_distance_mm(int32_t lat1_e7, int32_t lon1_e7, int32_t lat2_e7, int32_t lon2_e7);
+uint32_t geo_cos_q30(int32_t lat_e7);
+uint32_t geo_distance_mm_fast(int32_t lat1_e7, int32_t lon1_e7, int32_t lat2_e7, int32_t lon2_e7);
+uint64_t geo_isqrt_u64(uint64_t value);
+void geo_offset_mm(int32_t origin_lat_e7, int32_t origin_lon_e7, uint32_t cos_q30,
+                   int32_t lat_e7, int32_t lon_e7, int64_t *x_mm, int64_t *y_mm);
+void geo_position_from_offset(int32_t origin_lat_e7, int32_t origin_lon_e7, uint32_t cos_q30,
+                              int64_t x_mm, int64_t y_mm, int32_t *lat_e7, int32_t *lon_e7);
+int geo_format_e7(int32_t value_e7, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,645 @@
+/*
+File: gps_batch.c
+Author: Leonardo DaGraca
+
+Host tool that computes the session metrics of whole SD card archives in parallel.
+Every gps_logs/gps_log_N.csv found under the given directories is a session,
+joined with imu_logs/imu_log_N.csv when it exists. Files are memory-mapped and
+split with a hand-rolled tokenizer, the NMEA sentences go through the same
+parser and metrics engine as the firmware (see gps_metrics.c for one session),
+and sessions are spread over a pool of worker threads, largest first.
+
+GPS and IMU rows are joined on the shared timestamp: an IMU buffer row is
+written with the timestamp of its fix, so its readings are fed to the metrics
+just before that fix. Full-rate IMU rows are fed in timestamp order between
+the fixes.
+
+Prints one CSV row per session plus a total row on stdout, and the
+throughput (MB/s, sessions/s) on stderr. With -x every session is also
+exported to <export_dir>/<sd_dir name>_N.col in the columnar format of
+column_format.h (query it with gps_columns.c).
+
+Usage: gps_batch [-j threads] [-x export_dir] <sd_dir>...
+       gps_batch -g <out_dir> <sessions> <minutes>   generate a synthetic corpus
+Build: cc -O2 -pthread -o gps_batch gps_batch.c column_file.c track_metrics.c geo.c nmea_parser.c -lm
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nmea_parser.h"
+#include "track_metrics.h"
+#include "column_file.h"
+
+#define MAX_THREADS 256
+#define MAX_ROW_READINGS 16      //the logger writes 5 readings per IMU buffer row
+#define BATCH_HEADER "Session,Fixes,Distance_m,Moving_s,Avg_kmh,Max_kmh,Pace_s_per_km,Sprints,IMU_Samples,Intensity_mg,Intensity_per_min," \
+                     "GPS_Rows,IMU_Rows,Joined_IMU_Rows,Unmatched_IMU_Rows,Checksum_Errors,Bytes\n"
+
+typedef struct {
+    const char *data;
+    size_t size;
+} Mapped_File;
+
+typedef struct {
+    char name[PATH_MAX];
+    char gps_path[PATH_MAX];
+    char imu_path[PATH_MAX];    //empty when the session has no IMU log
+    char export_path[PATH_MAX];
+    int dir_index;
+    int number;
+    uint64_t bytes;
+
+    //results, written by the worker that processed the session
+    Track_Summary summary;
+    uint32_t gps_rows;
+    uint32_t imu_rows;
+    uint32_t joined_imu_rows;
+    uint32_t unmatched_imu_rows;
+    uint32_t checksum_errors;
+    int error;
+} Session;
+
+typedef struct {
+    const char *line;
+    const char *end;
+} Line_Cursor;
+
+//columns of the export, GPS fixes first
+enum {
+    COLUMN_GPS_TIME,
+    COLUMN_GPS_UTC,
+    COLUMN_GPS_LAT,
+    COLUMN_GPS_LON,
+    COLUMN_GPS_SPEED,
+    COLUMN_GPS_COURSE,
+    COLUMN_GPS_VALID,
+    COLUMN_IMU_TIME,
+    COLUMN_IMU_AX,      //ax, ay, az, gx, gy, gz in order
+    COLUMN_COUNT = COLUMN_IMU_AX + 6
+};
+
+static const char *column_names[COLUMN_COUNT] = {
+    "timestamp_us", "utc_time_ms", "lat_e7", "lon_e7", "speed_mm_s", "course_cdeg", "valid",
+    "timestamp_us", "ax", "ay", "az", "gx", "gy", "gz"
+};
+
+static Session *sessions = NULL;
+static size_t session_count = 0;
+static size_t session_capacity = 0;
+static Session **work_order = NULL;
+static atomic_size_t next_work = 0;
+static const char *export_dir = NULL;
+
+static int map_file(const char *path, Mapped_File *file) {
+    file->data = NULL;
+    file->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    file->data = data;
+    file->size = (size_t)st.st_size;
+    return 0;
+}
+
+static void unmap_file(Mapped_File *file) {
+    if (file->data) {
+        munmap((void *)file->data, file->size);
+    }
+}
+
+//next line of the file without its terminator, false at the end
+static bool next_line(Line_Cursor *cursor, const char **start, const char **stop) {
+    if (cursor->line >= cursor->end) {
+        return false;
+    }
+
+    const char *newline = memchr(cursor->line, '\n', (size_t)(cursor->end - cursor->line));
+    *start = cursor->line;
+    *stop = newline ? newline : cursor->end;
+    cursor->line = newline ? newline + 1 : cursor->end;
+
+    if (*stop > *start && (*stop)[-1] == '\r') {
+        (*stop)--;
+    }
+    return true;
+}
+
+static const char *parse_u64(const char *p, const char *end, uint64_t *value, bool *ok) {
+    uint64_t result = 0;
+    const char *start = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        result = result * 10 + (uint64_t)(*p - '0');
+        p++;
+    }
+    *ok = p > start;
+    *value = result;
+    return p;
+}
+
+static const char *parse_int(const char *p, const char *end, int32_t *value, bool *ok) {
+    bool negative = p < end && *p == '-';
+    if (negative) {
+        p++;
+    }
+    uint64_t magnitude;
+    p = parse_u64(p, end, &magnitude, ok);
+    *value = negative ? -(int32_t)magnitude : (int32_t)magnitude;
+    return p;
+}
+
+//one IMU row: "Timestamp,IMU: ax,ay,az,gx,gy,gz;..." or full-rate "Timestamp,ax,ay,az,gx,gy,gz"
+typedef struct {
+    uint64_t timestamp;
+    int32_t readings[MAX_ROW_READINGS][6];
+    int count;
+    bool buffer_row;            //a per-fix IMU buffer row rather than a full-rate sample
+} IMU_Row;
+
+static bool parse_imu_row(const char *p, const char *end, IMU_Row *row) {
+    bool ok;
+    p = parse_u64(p, end, &row->timestamp, &ok);
+    if (!ok || p >= end || *p != ',') {
+        return false;
+    }
+    p++;
+
+    row->buffer_row = end - p >= 5 && memcmp(p, "IMU: ", 5) == 0;
+    if (row->buffer_row) {
+        p += 5;
+    }
+
+    row->count = 0;
+    while (row->count < MAX_ROW_READINGS) {
+        for (int axis = 0; axis < 6; axis++) {
+            p = parse_int(p, end, &row->readings[row->count][axis], &ok);
+            if (!ok) {
+                return row->count > 0;
+            }
+            if (axis < 5) {
+                if (p >= end || *p != ',') {
+                    return row->count > 0;
+                }
+                p++;
+            }
+        }
+        row->count++;
+        if (p >= end || *p != ';') {
+            break;
+        }
+        p++;
+    }
+    return row->count > 0;
+}
+
+//feed IMU rows up to gps_time to the metrics, rows stamped exactly gps_time belong to that fix
+static void join_imu_rows(Session *session, Line_Cursor *imu, IMU_Row *pending, bool *has_pending,
+                          uint64_t gps_time, Track_Metrics *metrics, Col_Column *columns) {
+    const char *start, *stop;
+
+    while (true) {
+        if (!*has_pending) {
+            if (!next_line(imu, &start, &stop)) {
+                return;
+            }
+            if (!parse_imu_row(start, stop, pending)) {
+                continue; //header or damaged row
+            }
+            *has_pending = true;
+            session->imu_rows++;
+        }
+
+        if (pending->timestamp > gps_time) {
+            return;
+        }
+
+        if (!pending->buffer_row || pending->timestamp == gps_time) {
+            session->joined_imu_rows++;
+        }
+        else {
+            session->unmatched_imu_rows++;
+        }
+        for (int i = 0; i < pending->count; i++) {
+            track_metrics_add_imu(metrics, pending->readings[i][0], pending->readings[i][1], pending->readings[i][2]);
+            if (columns) {
+                col_column_push(&columns[COLUMN_IMU_TIME], (int64_t)pending->timestamp);
+                for (int axis = 0; axis < 6; axis++) {
+                    col_column_push(&columns[COLUMN_IMU_AX + axis], pending->readings[i][axis]);
+                }
+            }
+        }
+        *has_pending = false;
+    }
+}
+
+static void process_session(Session *session) {
+    Mapped_File gps, imu = {NULL, 0};
+
+    if (map_file(session->gps_path, &gps) != 0) {
+        session->error = 1;
+        return;
+    }
+    if (session->imu_path[0] && map_file(session->imu_path, &imu) != 0) {
+        unmap_file(&gps);
+        session->error = 1;
+        return;
+    }
+
+    Col_Column export_columns[COLUMN_COUNT];
+    Col_Column *columns = NULL;
+    if (export_dir) {
+        columns = export_columns;
+        for (int i = 0; i < COLUMN_COUNT; i++) {
+            col_column_init(&columns[i], i < COLUMN_IMU_TIME ? COL_TABLE_GPS : COL_TABLE_IMU, column_names[i]);
+        }
+    }
+
+    Track_Metrics metrics;
+    track_metrics_init(&metrics);
+    NMEA_Parser parser;
+    nmea_parser_init(&parser);
+
+    Line_Cursor gps_cursor = {gps.data, gps.data + gps.size};
+    Line_Cursor imu_cursor = {imu.data, imu.data + imu.size};
+    IMU_Row pending;
+    bool has_pending = false;
+    const char *start, *stop;
+
+    while (next_line(&gps_cursor, &start, &stop)) {
+        uint64_t timestamp;
+        bool ok;
+        const char *p = parse_u64(start, stop, &timestamp, &ok);
+        if (!ok || p >= stop || *p != ',') {
+            continue; //header
+        }
+        session->gps_rows++;
+
+        join_imu_rows(session, &imu_cursor, &pending, &has_pending, timestamp, &metrics, columns);
+
+        NMEA_Sentence sentence;
+        size_t consumed;
+        nmea_parser_feed(&parser, '$', &sentence);
+        p++;
+        while (p < stop) {
+            if (nmea_parser_feed_span(&parser, p, (size_t)(stop - p), &consumed, &sentence) &&
+                sentence.type == NMEA_TYPE_RMC) {
+                track_metrics_add_fix(&metrics, timestamp, &sentence.rmc);
+                if (columns) {
+                    const NMEA_RMC *rmc = &sentence.rmc;
+                    col_column_push(&columns[COLUMN_GPS_TIME], (int64_t)timestamp);
+                    col_column_push(&columns[COLUMN_GPS_UTC], rmc->time_ms);
+                    col_column_push(&columns[COLUMN_GPS_LAT], rmc->lat_e7);
+                    col_column_push(&columns[COLUMN_GPS_LON], rmc->lon_e7);
+                    col_column_push(&columns[COLUMN_GPS_SPEED], rmc->speed_mm_s);
+                    col_column_push(&columns[COLUMN_GPS_COURSE], rmc->course_cdeg);
+                    col_column_push(&columns[COLUMN_GPS_VALID], rmc->valid);
+                }
+            }
+            p += consumed;
+        }
+    }
+    //full-rate samples after the last fix
+    join_imu_rows(session, &imu_cursor, &pending, &has_pending, UINT64_MAX, &metrics, columns);
+
+    if (columns) {
+        if (col_write_file(session->export_path, columns, COLUMN_COUNT) != 0) {
+            session->error = 1;
+        }
+        for (int i = 0; i < COLUMN_COUNT; i++) {
+            col_column_free(&columns[i]);
+        }
+    }
+
+    session->summary = metrics.summary;
+    session->checksum_errors = parser.checksum_errors;
+    unmap_file(&gps);
+    unmap_file(&imu);
+}
+
+static void *worker(void *arg) {
+    while (true) {
+        size_t index = atomic_fetch_add(&next_work, 1);
+        if (index >= session_count) {
+            return NULL;
+        }
+        process_session(work_order[index]);
+    }
+}
+
+static void add_session(const char *dir, int dir_index, int number) {
+    if (session_count == session_capacity) {
+        session_capacity = session_capacity ? session_capacity * 2 : 64;
+        sessions = realloc(sessions, session_capacity * sizeof(Session));
+        if (!sessions) {
+            perror("Unable to allocate sessions");
+            exit(1);
+        }
+    }
+
+    Session *session = &sessions[session_count++];
+    memset(session, 0, sizeof(*session));
+    session->dir_index = dir_index;
+    session->number = number;
+    snprintf(session->name, sizeof(session->name), "%s/%d", dir, number);
+    snprintf(session->gps_path, sizeof(session->gps_path), "%s/gps_logs/gps_log_%d.csv", dir, number);
+    snprintf(session->imu_path, sizeof(session->imu_path), "%s/imu_logs/imu_log_%d.csv", dir, number);
+    if (export_dir) {
+        const char *base = strrchr(dir, '/');
+        //the name of the SD card directory keeps sessions of different archives apart
+        snprintf(session->export_path, sizeof(session->export_path), "%s/%s_%d.col",
+                 export_dir, base && base[1] ? base + 1 : dir, number);
+    }
+
+    struct stat st;
+    if (stat(session->gps_path, &st) == 0) {
+        session->bytes += (uint64_t)st.st_size;
+    }
+    if (stat(session->imu_path, &st) == 0) {
+        session->bytes += (uint64_t)st.st_size;
+    }
+    else {
+        session->imu_path[0] = '\0';
+    }
+}
+
+static int find_sessions(const char *dir, int dir_index) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/gps_logs", dir);
+
+    DIR *gps_dir = opendir(path);
+    if (!gps_dir) {
+        perror(path);
+        return 1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(gps_dir)) != NULL) {
+        int number;
+        char ext[8];
+        if (sscanf(entry->d_name, "gps_log_%d.%7s", &number, ext) == 2 && strcmp(ext, "csv") == 0) {
+            add_session(dir, dir_index, number);
+        }
+    }
+    closedir(gps_dir);
+    return 0;
+}
+
+static int compare_output_order(const void *a, const void *b) {
+    const Session *x = a, *y = b;
+    if (x->dir_index != y->dir_index) {
+        return x->dir_index - y->dir_index;
+    }
+    return x->number - y->number;
+}
+
+static int compare_largest_first(const void *a, const void *b) {
+    const Session *x = *(Session *const *)a, *y = *(Session *const *)b;
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+static void print_row(const char *name, const Track_Summary *summary, uint32_t gps_rows, uint32_t imu_rows,
+                      uint32_t joined, uint32_t unmatched, uint32_t errors, uint64_t bytes) {
+    char row[200];
+    int len = track_metrics_format(summary, row, sizeof(row));
+    if (len > 0 && row[len - 1] == '\n') {
+        row[len - 1] = '\0';
+    }
+    printf("%s,%s,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu64 "\n",
+           name, row, gps_rows, imu_rows, joined, unmatched, errors, bytes);
+}
+
+//sum of the sessions, speeds and rates recomputed from the totals
+static void print_total() {
+    Track_Summary total;
+    memset(&total, 0, sizeof(total));
+    uint32_t gps_rows = 0, imu_rows = 0, joined = 0, unmatched = 0, errors = 0;
+    uint64_t bytes = 0;
+
+    for (size_t i = 0; i < session_count; i++) {
+        const Session *session = &sessions[i];
+        const Track_Summary *s = &session->summary;
+        total.fixes += s->fixes;
+        total.distance_mm += s->distance_mm;
+        total.moving_time_us += s->moving_time_us;
+        total.elapsed_us += s->elapsed_us;
+        total.sprints += s->sprints;
+        total.imu_samples += s->imu_samples;
+        total.intensity_mg += s->intensity_mg;
+        if (s->max_speed_mm_s > total.max_speed_mm_s) {
+            total.max_speed_mm_s = s->max_speed_mm_s;
+        }
+        gps_rows += session->gps_rows;
+        imu_rows += session->imu_rows;
+        joined += session->joined_imu_rows;
+        unmatched += session->unmatched_imu_rows;
+        errors += session->checksum_errors;
+        bytes += session->bytes;
+    }
+
+    if (total.moving_time_us > 0) {
+        total.avg_speed_mm_s = (uint32_t)(total.distance_mm * 1000000 / total.moving_time_us);
+    }
+    if (total.distance_mm > 0) {
+        total.pace_s_per_km = (uint32_t)(total.moving_time_us / total.distance_mm);
+    }
+    if (total.elapsed_us > 0) {
+        total.intensity_per_min = (uint32_t)(total.intensity_mg * 60000000 / total.elapsed_us);
+    }
+    print_row("total", &total, gps_rows, imu_rows, joined, unmatched, errors, bytes);
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void nmea_checksum_line(FILE *file, uint64_t timestamp, const char *body) {
+    uint8_t checksum = 0;
+    for (const char *c = body; *c; c++) {
+        checksum ^= (uint8_t)*c;
+    }
+    fprintf(file, "%" PRIu64 ",%s*%02X\n", timestamp, body, checksum);
+}
+
+//synthetic sessions in the logger's CSV layout: a 1Hz track with RMC, VTG and an IMU buffer row per fix
+static int generate_corpus(const char *dir, int count, int minutes) {
+    char path[PATH_MAX];
+    mkdir(dir, 0777);
+    snprintf(path, sizeof(path), "%s/gps_logs", dir);
+    mkdir(path, 0777);
+    snprintf(path, sizeof(path), "%s/imu_logs", dir);
+    mkdir(path, 0777);
+
+    srand(1);
+    for (int n = 1; n <= count; n++) {
+        snprintf(path, sizeof(path), "%s/gps_logs/gps_log_%d.csv", dir, n);
+        FILE *gps = fopen(path, "w");
+        snprintf(path, sizeof(path), "%s/imu_logs/imu_log_%d.csv", dir, n);
+        FILE *imu = fopen(path, "w");
+        if (!gps || !imu) {
+            perror("Unable to create corpus file");
+            return 1;
+        }
+        fputs("Timestamp,NMEA\n", gps);
+        fputs("Timestamp,IMU_Readings\n", imu);
+
+        double lat = 48.0 + (rand() % 1000) / 10000.0;
+        double lon = 11.0 + (rand() % 1000) / 10000.0;
+        double course = rand() % 360;
+        uint64_t timestamp = 5000000 + (uint64_t)(rand() % 1000000);
+
+        for (int fix = 0; fix < minutes * 60; fix++) {
+            double speed_mps = 1.0 + 4.0 * (rand() % 1000) / 1000.0;
+            course += (rand() % 21) - 10;
+            if (course < 0) {
+                course += 360;
+            }
+            if (course >= 360) {
+                course -= 360;
+            }
+            lat += speed_mps * cos(course * M_PI / 180.0) / 111320.0;
+            lon += speed_mps * sin(course * M_PI / 180.0) / (111320.0 * cos(lat * M_PI / 180.0));
+
+            int seconds = fix % 86400;
+            double lat_min = (lat - (int)lat) * 60.0;
+            double lon_min = (lon - (int)lon) * 60.0;
+            double knots = speed_mps * 1.943844;
+            char body[NMEA_MAX_SENTENCE];
+
+            snprintf(body, sizeof(body), "GPRMC,%02d%02d%02d.00,A,%02d%08.5f,N,%03d%08.5f,E,%.3f,%.1f,010124,,,A",
+                     seconds / 3600, seconds / 60 % 60, seconds % 60, (int)lat, lat_min, (int)lon, lon_min, knots, course);
+            nmea_checksum_line(gps, timestamp, body);
+            snprintf(body, sizeof(body), "GPVTG,%.1f,T,,M,%.3f,N,%.3f,K,A", course, knots, speed_mps * 3.6);
+            nmea_checksum_line(gps, timestamp, body);
+
+            fprintf(imu, "%" PRIu64 ",IMU: ", timestamp);
+            for (int i = 0; i < 5; i++) {
+                fprintf(imu, "%s%d,%d,%d,%d,%d,%d", i ? ";" : "", rand() % 4000 - 2000, rand() % 4000 - 2000,
+                        16384 + rand() % 4000 - 2000, rand() % 500 - 250, rand() % 500 - 250, rand() % 500 - 250);
+            }
+            fputc('\n', imu);
+
+            timestamp += 1000000 + (uint64_t)(rand() % 2000);
+        }
+        fclose(gps);
+        fclose(imu);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int arg = 1;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (argc >= 5 && strcmp(argv[1], "-g") == 0) {
+        return generate_corpus(argv[2], atoi(argv[3]), atoi(argv[4]));
+    }
+    while (arg + 1 < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-j") == 0) {
+            threads = atol(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-x") == 0) {
+            export_dir = argv[arg + 1];
+            mkdir(export_dir, 0777);
+        }
+        else {
+            break;
+        }
+        arg += 2;
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "Usage: %s [-j threads] [-x export_dir] <sd_dir>...\n", argv[0]);
+        fprintf(stderr, "       %s -g <out_dir> <sessions> <minutes>\n", argv[0]);
+        return 1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+
+    for (int i = arg; i < argc; i++) {
+        find_sessions(argv[i], i);
+    }
+    if (session_count == 0) {
+        fprintf(stderr, "No gps_logs/gps_log_N.csv sessions found\n");
+        return 1;
+    }
+
+    qsort(sessions, session_count, sizeof(Session), compare_output_order);
+    work_order = malloc(session_count * sizeof(Session *));
+    if (!work_order) {
+        perror("Unable to allocate work list");
+        return 1;
+    }
+    uint64_t total_bytes = 0;
+    for (size_t i = 0; i < session_count; i++) {
+        work_order[i] = &sessions[i];
+        total_bytes += sessions[i].bytes;
+    }
+    //largest sessions first so one long session does not end up alone at the end
+    qsort(work_order, session_count, sizeof(Session *), compare_largest_first);
+
+    double start = now_seconds();
+    pthread_t pool[MAX_THREADS];
+    for (long i = 0; i < threads; i++) {
+        pthread_create(&pool[i], NULL, worker, NULL);
+    }
+    for (long i = 0; i < threads; i++) {
+        pthread_join(pool[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    printf(BATCH_HEADER);
+    for (size_t i = 0; i < session_count; i++) {
+        const Session *s = &sessions[i];
+        if (s->error) {
+            fprintf(stderr, "Unable to process session %s\n", s->name);
+            continue;
+        }
+        print_row(s->name, &s->summary, s->gps_rows, s->imu_rows, s->joined_imu_rows,
+                  s->unmatched_imu_rows, s->checksum_errors, s->bytes);
+    }
+    print_total();
+
+    fprintf(stderr, "Processed %zu sessions, %.1f MB in %.2f s with %ld threads: %.1f MB/s, %.1f sessions/s\n",
+            session_count, total_bytes / 1e6, elapsed, threads,
+            elapsed > 0 ? total_bytes / 1e6 / elapsed : 0.0, elapsed > 0 ? session_count / elapsed : 0.0);
+
+    free(work_order);
+    free(sessions);
+    return 0;
+}
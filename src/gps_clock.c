@@ -0,0 +1,119 @@
+/*
+File: gps_clock.c
+Author: Leonardo DaGraca
+
+Estimates the mapping from the Pico clock (time_us_64) to GPS UTC.
+Each valid RMC sentence gives one observation: the local time its '$' arrived
+(or the local time of the PPS edge when a PPS pin is wired) paired with the
+UTC time it reports. A weighted least squares line through the last ~100
+observations gives the clock offset and the drift of the Pico's crystal, which
+are logged so IMU samples can be interpolated onto fix times afterwards.
+
+Without PPS the receiver's constant output delay is part of the offset,
+only the PPS edge is aligned with the true top of the second.
+
+Observations far from the fit (a sentence held up on its way) are left out.
+A run of them that agree with each other is a step of the offset instead, the
+output delay after startup is not the steady one, and the fit starts over
+from them rather than rejecting everything from then on. gps_clock_test.c
+checks offset and drift against synthetic fixes.
+*/
+#include <string.h>
+#include <math.h>
+#include "gps_clock.h"
+
+void gps_clock_init(GPS_Clock *clock) {
+    memset(clock, 0, sizeof(*clock));
+}
+
+static double predict(const GPS_Clock *clock, double x) {
+    return clock->offset_us + clock->drift * 1e6 * x;
+}
+
+//forget the fit, the next observation starts a new one
+static void reseed(GPS_Clock *clock) {
+    uint32_t outliers = clock->outliers;
+    uint32_t restarts = clock->restarts;
+    gps_clock_init(clock);
+    clock->outliers = outliers;
+    clock->restarts = restarts + 1;
+}
+
+//returns false when the observation was rejected as an outlier
+bool gps_clock_add(GPS_Clock *clock, uint64_t local_us, uint64_t utc_us) {
+    int64_t offset = (int64_t)(utc_us - local_us);
+
+    if (clock->observations > 0) {
+        //until the fit has settled its drift means little, the first observation is the reference
+        double x = (double)(int64_t)(local_us - clock->ref_local_us) / 1e6;
+        double y = (double)(offset - clock->ref_offset_us);
+        double residual = clock->observations >= GPS_CLOCK_MIN_OBSERVATIONS ? y - predict(clock, x) : y;
+        if (fabs(residual) > GPS_CLOCK_OUTLIER_US) {
+            if (clock->outliers_in_row == 0 || fabs(residual - clock->row_residual_us) > GPS_CLOCK_OUTLIER_US) {
+                clock->outliers_in_row = 0;
+                clock->row_residual_us = residual;
+            }
+            if (++clock->outliers_in_row < GPS_CLOCK_RESEED_OUTLIERS) {
+                clock->outliers++;
+                return false;
+            }
+            //the offset stepped (e.g. the receiver's output delay after startup), the old fit never recovers
+            reseed(clock);
+        }
+    }
+    clock->outliers_in_row = 0;
+
+    if (clock->observations == 0) {
+        clock->ref_local_us = local_us;
+        clock->ref_offset_us = offset;
+    }
+
+    double x = (double)(int64_t)(local_us - clock->ref_local_us) / 1e6;
+    double y = (double)(offset - clock->ref_offset_us);
+
+    clock->sw = clock->sw * GPS_CLOCK_FORGET + 1.0;
+    clock->sx = clock->sx * GPS_CLOCK_FORGET + x;
+    clock->sy = clock->sy * GPS_CLOCK_FORGET + y;
+    clock->sxx = clock->sxx * GPS_CLOCK_FORGET + x * x;
+    clock->sxy = clock->sxy * GPS_CLOCK_FORGET + x * y;
+    clock->syy = clock->syy * GPS_CLOCK_FORGET + y * y;
+    clock->observations++;
+
+    double denom = clock->sw * clock->sxx - clock->sx * clock->sx;
+    double slope = 0.0;
+    if (clock->observations > 1 && denom > 1e-9) {
+        slope = (clock->sw * clock->sxy - clock->sx * clock->sy) / denom;
+    }
+    clock->drift = slope / 1e6;
+    clock->offset_us = (clock->sy - slope * clock->sx) / clock->sw;
+
+    double sse = clock->syy - clock->offset_us * clock->sy - slope * clock->sxy;
+    clock->residual_us = sse > 0 ? sqrt(sse / clock->sw) : 0.0;
+    return true;
+}
+
+//utc - local in microseconds at the given local time
+int64_t gps_clock_offset_at(const GPS_Clock *clock, uint64_t local_us) {
+    double x = (double)(int64_t)(local_us - clock->ref_local_us) / 1e6;
+    return clock->ref_offset_us + (int64_t)llround(predict(clock, x));
+}
+
+//days since 1970-01-01 for a civil date (Howard Hinnant's algorithm)
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+//UTC microseconds since the Unix epoch from the RMC date (ddmmyy) and time fields
+uint64_t gps_utc_from_rmc(const NMEA_RMC *rmc) {
+    unsigned day = rmc->date / 10000;
+    unsigned month = rmc->date / 100 % 100;
+    unsigned year = 2000 + rmc->date % 100;
+
+    int64_t days = days_from_civil(year, month, day);
+    return (uint64_t)days * 86400000000ULL + (uint64_t)rmc->time_ms * 1000;
+}
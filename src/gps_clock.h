@@ -0,0 +1,40 @@
+#ifndef GPS_CLOCK_H
+#define GPS_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nmea_parser.h"
+
+//weight of older observations, 0.99 per fix is roughly a 100 second window at 1Hz
+#define GPS_CLOCK_FORGET 0.99
+//observations further than this from the fit are ignored, from the first one until the fit has settled
+#define GPS_CLOCK_OUTLIER_US 50000
+#define GPS_CLOCK_MIN_OBSERVATIONS 5
+//this many rejected observations in a row that agree with each other are a step of the offset
+//(or a first observation that was the outlier), the fit starts over from them
+#define GPS_CLOCK_RESEED_OUTLIERS 5
+
+//fitted mapping: utc_us = local_us + offset_us + drift * (local_us - ref_local_us)
+typedef struct {
+    uint64_t ref_local_us;      //local time of the first observation
+    int64_t ref_offset_us;      //utc - local at the first observation
+    uint32_t observations;      //in the current fit
+    uint32_t outliers;
+    uint32_t outliers_in_row;   //rejected in a row within GPS_CLOCK_OUTLIER_US of each other
+    double row_residual_us;     //residual of the first of them
+    uint32_t restarts;          //fits started over after a step
+
+    //exponentially weighted least squares sums, x in seconds since ref, y in us relative to ref_offset_us
+    double sw, sx, sy, sxx, sxy, syy;
+
+    double offset_us;           //fitted offset at ref_local_us, relative to ref_offset_us
+    double drift;               //local clock rate error in seconds per second
+    double residual_us;         //RMS residual of the fit
+} GPS_Clock;
+
+void gps_clock_init(GPS_Clock *clock);
+bool gps_clock_add(GPS_Clock *clock, uint64_t local_us, uint64_t utc_us);
+int64_t gps_clock_offset_at(const GPS_Clock *clock, uint64_t local_us);
+uint64_t gps_utc_from_rmc(const NMEA_RMC *rmc);
+
+#endif
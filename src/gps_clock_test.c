@@ -0,0 +1,143 @@
+/*
+File: gps_clock_test.c
+Author: Leonardo DaGraca
+
+Host check of the GPS clock fit (gps_clock.h) on synthetic fixes.
+
+The Pico clock runs fast or slow by a few tens of ppm against UTC. Every fix
+is observed at the local time its '$' arrives: the top of the UTC second (or
+of the 100ms epoch at 10Hz) plus the receiver's output delay plus arrival
+jitter, a few us for a PPS edge and a few ms for a sentence behind the UART.
+Some fixes arrive late by hundreds of ms (outliers), and after a while the
+output delay steps, as it does when the receiver settles after startup.
+
+After every observation the fitted offset is compared with the true one,
+UTC - local with the output delay in force, and the fitted drift with the
+true rate error. It prints the RMS and worst offset error, the RMS drift
+error, the outliers rejected, the times the fit started over and the time
+it takes to get back within 1ms after the step. A fit is scored from a
+minute after the start and after the step. It fails when the RMS offset
+error is not below 1ms, the worst above 3ms, the RMS drift error above
+20ppm, or the fit never gets back within 1ms after the step.
+
+Usage: gps_clock_test [-m minutes]
+Build: cc -O2 -I. -o gps_clock_test gps_clock_test.c gps_clock.c -lm
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include "gps_clock.h"
+
+#define UTC_START_US 1790000000000000ULL   //2026
+#define LOCAL_START_US 3000000ULL           //time_us_64 at the first fix, after boot
+#define SETTLE_US 60000000ULL               //the fit is not scored for a minute after the start and the step
+#define MAX_RMS_OFFSET_US 1000.0            //the sub-millisecond goal
+#define MAX_OFFSET_ERROR_US 3000.0          //~3 sigma of the busiest scenario
+#define MAX_RMS_DRIFT_PPM 20.0
+#define RECOVERED_US 1000.0
+
+typedef struct {
+    const char *name;
+    uint32_t period_ms;
+    double drift_ppm;           //local clock rate error, positive runs fast
+    double delay_us;            //receiver output delay before the step
+    double jitter_us;           //standard deviation of the arrival time
+    double outlier_share;
+    double step_us;             //change of the output delay halfway through
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"pps",        1000, 35.0,      0.0,    2.0, 0.00,     0.0},
+    {"nmea_1hz",   1000, 35.0, 120000.0, 2000.0, 0.02,  80000.0},
+    {"nmea_10hz",   100, -20.0, 45000.0, 2000.0, 0.02, -30000.0},
+    {"nmea_busy",  1000, 80.0, 250000.0, 3000.0, 0.05, 150000.0},
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static double gaussian() {
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static double uniform(double low, double high) {
+    return low + (high - low) * rand() / (double)RAND_MAX;
+}
+
+static bool run(const Scenario *s, uint32_t minutes) {
+    GPS_Clock clock;
+    gps_clock_init(&clock);
+
+    double rate = 1.0 + s->drift_ppm * 1e-6;
+    uint32_t fixes = minutes * 60000 / s->period_ms;
+    uint64_t step_at_us = (uint64_t)fixes / 2 * s->period_ms * 1000;
+
+    double sum_sq = 0.0, worst = 0.0, drift_sum_sq = 0.0;
+    uint32_t scored = 0;
+    int64_t recovery_us = -1;
+
+    for (uint32_t i = 0; i < fixes; i++) {
+        uint64_t elapsed_us = (uint64_t)i * s->period_ms * 1000;
+        double delay = s->delay_us + (elapsed_us >= step_at_us ? s->step_us : 0.0);
+        double late = rand() < s->outlier_share * RAND_MAX ? uniform(200000.0, 900000.0) : 0.0;
+        double arrival = elapsed_us + delay + s->jitter_us * gaussian() + late;
+        uint64_t local_us = LOCAL_START_US + (uint64_t)llround(arrival * rate);
+        uint64_t utc_us = UTC_START_US + elapsed_us;
+        gps_clock_add(&clock, local_us, utc_us);
+
+        //UTC - local when a fix with the current delay and no jitter arrives at this local time
+        double true_offset = (double)UTC_START_US - LOCAL_START_US + (local_us - LOCAL_START_US) / rate -
+                             (double)(local_us - LOCAL_START_US) - delay;
+        double error = (double)gps_clock_offset_at(&clock, local_us) - true_offset;
+        double drift_error = clock.drift - (1.0 / rate - 1.0);
+
+        if (elapsed_us >= step_at_us && recovery_us < 0 && fabs(error) < RECOVERED_US) {
+            recovery_us = (int64_t)(elapsed_us - step_at_us);
+        }
+        bool settled = elapsed_us >= SETTLE_US &&
+                       (elapsed_us < step_at_us || elapsed_us >= step_at_us + SETTLE_US);
+        if (settled) {
+            sum_sq += error * error;
+            drift_sum_sq += drift_error * drift_error;
+            scored++;
+            if (fabs(error) > worst) {
+                worst = fabs(error);
+            }
+        }
+    }
+    double rms = scored ? sqrt(sum_sq / scored) : 0.0;
+    double drift_rms_ppm = scored ? sqrt(drift_sum_sq / scored) * 1e6 : 0.0;
+    bool ok = scored > 0 && rms < MAX_RMS_OFFSET_US && worst < MAX_OFFSET_ERROR_US &&
+              drift_rms_ppm < MAX_RMS_DRIFT_PPM && recovery_us >= 0;
+    printf("%s,%u,%" PRIu32 ",%.1f,%.1f,%.2f,%" PRIu32 ",%" PRIu32 ",%.1f,%s\n", s->name, 1000 / s->period_ms, fixes,
+           rms, worst, drift_rms_ppm, clock.outliers, clock.restarts, recovery_us / 1e6, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    uint32_t minutes = 20;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            minutes = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-m minutes]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (minutes < 4) {
+        minutes = 4;
+    }
+
+    srand(1);
+    printf("Scenario,Rate_Hz,Fixes,RMS_offset_us,Max_offset_us,RMS_drift_ppm,Outliers,Restarts,Recovery_s,Result\n");
+    bool ok = true;
+    for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+        ok &= run(&scenarios[i], minutes);
+    }
+
+    printf(ok ? "OK\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+/*
+File: gps_columns.c
+Author: Leonardo DaGraca
+
+Host tool for the columnar session files exported by gps_batch -x
+(see column_format.h).
+
+Without options it lists the columns of a file with their encoding and size.
+With -b it runs the same query (fix count, max speed and mean acceleration
+per axis) on the columnar file and on the CSV logs of the session, the way
+gps_metrics.c reads them, and prints the time per query and the bytes each
+path had to read.
+
+Usage: gps_columns <session.col>
+       gps_columns -b [iterations] <session.col> <gps_log_N.csv> <imu_log_N.csv>
+Build: cc -O2 -o gps_columns gps_columns.c column_file.c nmea_parser.c
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "nmea_parser.h"
+#include "column_file.h"
+
+typedef struct {
+    uint64_t fixes;
+    uint64_t max_speed_mm_s;
+    uint64_t imu_samples;
+    int64_t accel_sum[3];
+    uint64_t bytes_read;
+} Query_Result;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int list_columns(const char *path) {
+    Col_Reader reader;
+    if (col_reader_open(&reader, path) != 0) {
+        return 1;
+    }
+
+    printf("Table,Column,Encoding,Rows,Bytes,Bytes_per_row\n");
+    for (uint32_t i = 0; i < reader.column_count; i++) {
+        const Col_Column_Entry *e = &reader.entries[i];
+        printf("%s,%.*s,%s,%" PRIu32 ",%" PRIu64 ",%.2f\n",
+               e->table == COL_TABLE_GPS ? "gps" : "imu", COL_NAME_SIZE, e->name,
+               e->encoding == COL_ENCODING_DICT ? "dict" : "delta", e->rows, e->size,
+               e->rows ? (double)e->size / e->rows : 0.0);
+    }
+    printf("File size: %zu bytes\n", reader.size);
+    col_reader_close(&reader);
+    return 0;
+}
+
+//decodes a column into a new buffer, the caller frees it
+static int64_t *read_column(const Col_Reader *reader, uint8_t table, const char *name,
+                            uint32_t *rows, Query_Result *result) {
+    const Col_Column_Entry *entry = col_reader_find(reader, table, name);
+    if (!entry) {
+        fprintf(stderr, "Column %s not found\n", name);
+        return NULL;
+    }
+    int64_t *values = malloc((entry->rows ? entry->rows : 1) * sizeof(int64_t));
+    if (!values || col_reader_read(reader, entry, values) != 0) {
+        fprintf(stderr, "Unable to decode column %s\n", name);
+        free(values);
+        return NULL;
+    }
+    *rows = entry->rows;
+    result->bytes_read += entry->size;
+    return values;
+}
+
+//only the speed and accelerometer columns are decoded, the rest of the file is never touched
+static int query_columns(const char *path, Query_Result *result) {
+    Col_Reader reader;
+    if (col_reader_open(&reader, path) != 0) {
+        return 1;
+    }
+    memset(result, 0, sizeof(*result));
+    result->bytes_read = sizeof(Col_File_Header) + reader.column_count * sizeof(Col_Column_Entry) + sizeof(Col_File_Footer);
+
+    uint32_t rows;
+    int64_t *speed = read_column(&reader, COL_TABLE_GPS, "speed_mm_s", &rows, result);
+    if (!speed) {
+        col_reader_close(&reader);
+        return 1;
+    }
+    result->fixes = rows;
+    for (uint32_t i = 0; i < rows; i++) {
+        if ((uint64_t)speed[i] > result->max_speed_mm_s) {
+            result->max_speed_mm_s = (uint64_t)speed[i];
+        }
+    }
+    free(speed);
+
+    static const char *axes[3] = {"ax", "ay", "az"};
+    for (int axis = 0; axis < 3; axis++) {
+        int64_t *values = read_column(&reader, COL_TABLE_IMU, axes[axis], &rows, result);
+        if (!values) {
+            col_reader_close(&reader);
+            return 1;
+        }
+        result->imu_samples = rows;
+        for (uint32_t i = 0; i < rows; i++) {
+            result->accel_sum[axis] += values[i];
+        }
+        free(values);
+    }
+
+    col_reader_close(&reader);
+    return 0;
+}
+
+//the CSV path has to read and split every row of both logs for the same answer
+static int query_csv(const char *gps_path, const char *imu_path, Query_Result *result) {
+    memset(result, 0, sizeof(*result));
+
+    FILE *file = fopen(gps_path, "r");
+    if (!file) {
+        perror("Unable to open GPS log");
+        return 1;
+    }
+    char line[512];
+    NMEA_Parser parser;
+    nmea_parser_init(&parser);
+    while (fgets(line, sizeof(line), file)) {
+        result->bytes_read += strlen(line);
+        char *comma = strchr(line, ',');
+        if (!comma) {
+            continue;
+        }
+        NMEA_Sentence sentence;
+        nmea_parser_feed(&parser, '$', &sentence);
+        for (char *c = comma + 1; *c && *c != '\n' && *c != '\r'; c++) {
+            if (nmea_parser_feed(&parser, *c, &sentence) && sentence.type == NMEA_TYPE_RMC) {
+                result->fixes++;
+                if (sentence.rmc.speed_mm_s > result->max_speed_mm_s) {
+                    result->max_speed_mm_s = sentence.rmc.speed_mm_s;
+                }
+            }
+        }
+    }
+    fclose(file);
+
+    file = fopen(imu_path, "r");
+    if (!file) {
+        perror("Unable to open IMU log");
+        return 1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        result->bytes_read += strlen(line);
+        char *reading = strchr(line, ',');
+        if (!reading) {
+            continue;
+        }
+        reading++;
+        if (strncmp(reading, "IMU: ", 5) == 0) {
+            reading += 5;
+        }
+
+        while (reading) {
+            int ax, ay, az, gx, gy, gz;
+            if (sscanf(reading, "%d,%d,%d,%d,%d,%d", &ax, &ay, &az, &gx, &gy, &gz) != 6) {
+                break;
+            }
+            result->imu_samples++;
+            result->accel_sum[0] += ax;
+            result->accel_sum[1] += ay;
+            result->accel_sum[2] += az;
+
+            reading = strchr(reading, ';');
+            if (reading) {
+                reading++;
+            }
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+static void print_result(const char *label, const Query_Result *r, double seconds) {
+    double samples = r->imu_samples ? (double)r->imu_samples : 1.0;
+    printf("%-8s %.3f ms/query, %" PRIu64 " bytes read: %" PRIu64 " fixes, max %.2f km/h, "
+           "%" PRIu64 " IMU samples, mean accel %.1f,%.1f,%.1f\n",
+           label, seconds * 1000.0, r->bytes_read, r->fixes, r->max_speed_mm_s * 0.0036, r->imu_samples,
+           r->accel_sum[0] / samples, r->accel_sum[1] / samples, r->accel_sum[2] / samples);
+}
+
+static int benchmark(int iterations, const char *col_path, const char *gps_path, const char *imu_path) {
+    Query_Result csv, columns;
+
+    double start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        if (query_csv(gps_path, imu_path, &csv) != 0) {
+            return 1;
+        }
+    }
+    double csv_s = (now_seconds() - start) / iterations;
+
+    start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        if (query_columns(col_path, &columns) != 0) {
+            return 1;
+        }
+    }
+    double columns_s = (now_seconds() - start) / iterations;
+
+    print_result("CSV:", &csv, csv_s);
+    print_result("Columns:", &columns, columns_s);
+    printf("Speedup: %.1fx, %.1fx fewer bytes read\n", csv_s / columns_s,
+           (double)csv.bytes_read / columns.bytes_read);
+
+    if (csv.fixes != columns.fixes || csv.max_speed_mm_s != columns.max_speed_mm_s ||
+        csv.imu_samples != columns.imu_samples ||
+        memcmp(csv.accel_sum, columns.accel_sum, sizeof(csv.accel_sum)) != 0) {
+        fprintf(stderr, "Results differ between the CSV and the columnar file\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2) {
+        return list_columns(argv[1]);
+    }
+
+    if (argc >= 5 && strcmp(argv[1], "-b") == 0) {
+        int arg = 2;
+        int iterations = 20;
+        if (argc == 6) {
+            iterations = atoi(argv[arg++]);
+            if (iterations < 1) {
+                iterations = 1;
+            }
+        }
+        if (argc - arg == 3) {
+            return benchmark(iterations, argv[arg], argv[arg + 1], argv[arg + 2]);
+        }
+    }
+
+    fprintf(stderr, "Usage: %s <session.col>\n", argv[0]);
+    fprintf(stderr, "       %s -b [iterations] <session.col> <gps_log_N.csv> <imu_log_N.csv>\n", argv[0]);
+    return 1;
+}
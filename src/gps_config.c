@@ -0,0 +1,221 @@
+/*
+File: gps_config.c
+Author: Leonardo DaGraca
+
+Baud rate, message filter and navigation rate negotiation with the GPS receiver, see gps_config.h.
+*/
+#include <stdio.h>
+#include <inttypes.h>
+#include "gps_config.h"
+#include "ubx.h"
+#include "nmea_rx.h"
+#include "hal.h"
+
+//CFG-PRT port id of the receiver's UART 1, the one wired to the Pico
+#define RECEIVER_UART_PORT 1
+//turning GSV off is acknowledged in any state and is wanted anyway, it probes whether the receiver answers
+#define PROBE_MESSAGE 3
+
+//NMEA messages the receiver sends by default and their typical size with '$' and "\r\n"
+static const struct {
+    uint8_t id;
+    const char *name;
+    uint16_t bytes;
+} nmea_messages[GPS_CONFIG_NMEA_COUNT] = {
+    {UBX_NMEA_GGA, "GGA", 72},
+    {UBX_NMEA_GLL, "GLL", 51},
+    {UBX_NMEA_GSA, "GSA", 64},
+    {UBX_NMEA_GSV, "GSV", 210},    //three sentences with 9-12 satellites in view
+    {UBX_NMEA_RMC, "RMC", 70},
+    {UBX_NMEA_VTG, "VTG", 38},
+};
+
+static UBX_Parser ubx_parser;
+
+//1 for an ACK, -1 for a NAK of msg_class/msg_id, 0 after the timeout
+static int wait_ack(uint8_t msg_class, uint8_t msg_id, uint32_t timeout_ms) {
+    uint64_t deadline = hal_time_us() + (uint64_t)timeout_ms * 1000;
+    char chunk[64];
+
+    while (hal_time_us() < deadline) {
+        size_t len = nmea_rx_read(chunk, NULL, sizeof(chunk));
+        for (size_t i = 0; i < len; i++) {
+            if (!ubx_parser_feed(&ubx_parser, (uint8_t)chunk[i])) {
+                continue;
+            }
+            if (ubx_parser.msg_class != UBX_CLASS_ACK || ubx_parser.len < 2 ||
+                ubx_parser.payload[0] != msg_class || ubx_parser.payload[1] != msg_id) {
+                continue;
+            }
+            return ubx_parser.msg_id == UBX_ACK_ACK ? 1 : -1;
+        }
+        if (len < sizeof(chunk)) {
+            hal_sleep_ms(1);
+        }
+    }
+    return 0;
+}
+
+//send a CFG frame until it is answered, true if it was acknowledged
+static bool send_command(uint32_t uart_index, const uint8_t *frame, size_t len, uint32_t attempts,
+                         GPS_Config_Result *result) {
+    for (uint32_t attempt = 0; attempt < attempts; attempt++) {
+        hal_uart_write(uart_index, frame, len);
+        result->commands++;
+
+        int answer = wait_ack(frame[2], frame[3], GPS_CONFIG_ACK_TIMEOUT_MS);
+        if (answer > 0) {
+            result->acks++;
+            result->ubx = true;
+            return true;
+        }
+        if (answer < 0) {
+            //the receiver understood and refused, sending it again changes nothing
+            result->naks++;
+            result->ubx = true;
+            return false;
+        }
+        result->timeouts++;
+    }
+    return false;
+}
+
+//switch the UART and drop whatever arrived at the old rate
+static void set_baud_rate(uint32_t uart_index, uint32_t baud_rate) {
+    hal_uart_set_baud_rate(uart_index, baud_rate);
+    char chunk[64];
+    while (nmea_rx_read(chunk, NULL, sizeof(chunk)) > 0) {
+    }
+    ubx_parser_init(&ubx_parser);
+}
+
+static bool set_message(uint32_t uart_index, int index, bool on, uint32_t attempts, GPS_Config_Result *result) {
+    uint8_t frame[UBX_CFG_MSG_FRAME_SIZE];
+    size_t len = ubx_cfg_msg(frame, UBX_CLASS_NMEA, nmea_messages[index].id, on ? 1 : 0);
+    if (!send_command(uart_index, frame, len, attempts, result)) {
+        return false;
+    }
+    if (on) {
+        result->nmea_on |= (uint8_t)(1 << index);
+    }
+    else {
+        result->nmea_on &= (uint8_t)~(1 << index);
+    }
+    return true;
+}
+
+static bool receiver_answers(uint32_t uart_index, uint32_t attempts, GPS_Config_Result *result) {
+    return set_message(uart_index, PROBE_MESSAGE, false, attempts, result);
+}
+
+static uint32_t epoch_bytes(uint8_t nmea_on) {
+    uint32_t bytes = 0;
+    for (int i = 0; i < GPS_CONFIG_NMEA_COUNT; i++) {
+        if (nmea_on & (1 << i)) {
+            bytes += nmea_messages[i].bytes;
+        }
+    }
+    return bytes;
+}
+
+//10 bits per byte on the line (start, 8 data, stop)
+static bool link_fits(uint32_t baud_rate, uint32_t bytes, uint16_t period_ms) {
+    return (uint64_t)bytes * 10 * 1000 * 100 <= (uint64_t)baud_rate * period_ms * GPS_CONFIG_LINK_PERCENT;
+}
+
+bool gps_config_run(uint32_t uart_index, GPS_Config_Result *result) {
+    uint64_t start = hal_time_us();
+    *result = (GPS_Config_Result){0};
+    result->baud_rate = GPS_CONFIG_DEFAULT_BAUD_RATE;
+    result->period_ms = 1000;
+    result->nmea_on = (1 << GPS_CONFIG_NMEA_COUNT) - 1;
+
+    //1. find the rate the receiver talks at
+    const uint32_t probe_rates[] = {GPS_CONFIG_BAUD_RATE, GPS_CONFIG_DEFAULT_BAUD_RATE};
+    bool found = false;
+    for (int i = 0; i < 2 && !found; i++) {
+        if (i > 0 && probe_rates[i] == probe_rates[0]) {
+            break;
+        }
+        set_baud_rate(uart_index, probe_rates[i]);
+        result->baud_rate = probe_rates[i];
+        found = receiver_answers(uart_index, GPS_CONFIG_RETRIES, result);
+    }
+    if (!found) {
+        set_baud_rate(uart_index, GPS_CONFIG_DEFAULT_BAUD_RATE);
+        result->baud_rate = GPS_CONFIG_DEFAULT_BAUD_RATE;
+        result->epoch_bytes = epoch_bytes(result->nmea_on);
+        result->elapsed_ms = (uint32_t)((hal_time_us() - start) / 1000);
+        return false;
+    }
+
+    //2. only RMC and VTG, a message that is not confirmed off still counts against the link
+    for (int i = 0; i < GPS_CONFIG_NMEA_COUNT; i++) {
+        set_message(uart_index, i, (GPS_CONFIG_NMEA_WANTED >> i) & 1, GPS_CONFIG_RETRIES, result);
+    }
+
+    //3. move both ends to the fast rate, the old one is kept unless the receiver answers at the new one
+    if (result->baud_rate != GPS_CONFIG_BAUD_RATE) {
+        uint32_t old_rate = result->baud_rate;
+        uint8_t frame[UBX_CFG_PRT_FRAME_SIZE];
+        size_t len = ubx_cfg_prt_uart(frame, RECEIVER_UART_PORT, GPS_CONFIG_BAUD_RATE, UBX_PROTO_UBX | UBX_PROTO_NMEA,
+                                      UBX_PROTO_UBX | UBX_PROTO_NMEA);
+        hal_uart_write(uart_index, frame, len);
+        result->commands++;
+
+        //the ACK often gets lost in the switch, only a NAK says the receiver stays where it is
+        int answer = wait_ack(UBX_CLASS_CFG, UBX_CFG_PRT, GPS_CONFIG_SWITCH_MS);
+        if (answer > 0) {
+            result->acks++;
+        }
+        else if (answer < 0) {
+            result->naks++;
+        }
+        if (answer >= 0) {
+            set_baud_rate(uart_index, GPS_CONFIG_BAUD_RATE);
+            if (receiver_answers(uart_index, GPS_CONFIG_RETRIES, result)) {
+                result->baud_rate = GPS_CONFIG_BAUD_RATE;
+            }
+            else {
+                set_baud_rate(uart_index, old_rate);
+                receiver_answers(uart_index, GPS_CONFIG_RETRIES, result);
+            }
+        }
+    }
+
+    //4. the fastest navigation rate the link carries
+    result->epoch_bytes = epoch_bytes(result->nmea_on);
+    const uint16_t periods[] = GPS_CONFIG_PERIODS_MS;
+    for (size_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+        if (!link_fits(result->baud_rate, result->epoch_bytes, periods[i]) && periods[i] < 1000) {
+            continue;
+        }
+        uint8_t frame[UBX_CFG_RATE_FRAME_SIZE];
+        size_t len = ubx_cfg_rate(frame, periods[i]);
+        if (send_command(uart_index, frame, len, GPS_CONFIG_RETRIES, result)) {
+            result->period_ms = periods[i];
+            break;
+        }
+    }
+
+    result->elapsed_ms = (uint32_t)((hal_time_us() - start) / 1000);
+    return true;
+}
+
+int gps_config_format(const GPS_Config_Result *result, char *buf, size_t size) {
+    char messages[32];
+    int n = 0;
+    messages[0] = '\0';
+    for (int i = 0; i < GPS_CONFIG_NMEA_COUNT; i++) {
+        if (result->nmea_on & (1 << i)) {
+            n += snprintf(messages + n, sizeof(messages) - n, "%s%s", n ? " " : "", nmea_messages[i].name);
+        }
+    }
+
+    return snprintf(buf, size,
+                    "%s, %" PRIu32 " baud, fix every %u ms, %s on (%" PRIu32 " bytes per fix), %" PRIu32 " commands: "
+                    "%" PRIu32 " acks, %" PRIu32 " naks, %" PRIu32 " timeouts in %" PRIu32 " ms",
+                    result->ubx ? "UBX" : "no UBX answer", result->baud_rate, result->period_ms, messages,
+                    result->epoch_bytes, result->commands, result->acks, result->naks, result->timeouts,
+                    result->elapsed_ms);
+}
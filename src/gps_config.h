@@ -0,0 +1,72 @@
+/*
+File: gps_config.h
+Author: Leonardo DaGraca
+
+Startup configuration of the GT-U7 (a u-blox 7) over UBX. Out of the box the
+receiver talks at 9600 baud and sends GGA, GLL, GSA, three GSV, RMC and VTG
+once a second, ~500 bytes per fix of which the logger only uses RMC and VTG.
+The link is then more than half full at 1Hz and cannot carry a faster rate.
+
+gps_config_run() is called once after nmea_rx_init() and before logging:
+1. finds the rate the receiver talks at, GPS_CONFIG_BAUD_RATE first (it keeps
+   a changed rate as long as it has backup power) then the 9600 factory rate,
+   by sending a CFG-MSG at each and waiting for its ACK
+2. turns off every NMEA message except RMC and VTG (CFG-MSG)
+3. moves the receiver port to GPS_CONFIG_BAUD_RATE (CFG-PRT), re-inits the
+   UART to match and checks that the receiver still answers there, otherwise
+   goes back to the previous rate
+4. sets the shortest navigation period of GPS_CONFIG_PERIODS_MS (CFG-RATE)
+   that the link can carry with the messages that are still on, a NAK tries
+   the next one
+
+A command without an answer is sent again up to GPS_CONFIG_RETRIES times.
+A receiver that never answers is left at 9600 baud and 1Hz and the parser
+skips the unused sentences as before. The answers are read through nmea_rx,
+the NMEA sentences received meanwhile are dropped.
+*/
+#ifndef GPS_CONFIG_H
+#define GPS_CONFIG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define GPS_CONFIG_DEFAULT_BAUD_RATE 9600
+#ifndef GPS_CONFIG_BAUD_RATE
+#define GPS_CONFIG_BAUD_RATE 115200
+#endif
+
+//navigation periods tried in order, 10Hz is the fastest the u-blox 7 computes
+#define GPS_CONFIG_PERIODS_MS {100, 200, 1000}
+
+//the receiver answers within ~50ms unless its output is backed up behind a second of NMEA
+#define GPS_CONFIG_ACK_TIMEOUT_MS 300
+#define GPS_CONFIG_RETRIES 3
+//longest wait for the answer to CFG-PRT at the old rate before both sides switch
+#define GPS_CONFIG_SWITCH_MS 100
+//share of the link the NMEA output may use, the rest is margin for bursts and commands
+#define GPS_CONFIG_LINK_PERCENT 75
+
+//NMEA messages handled by the configuration, in the order of the masks below
+#define GPS_CONFIG_NMEA_COUNT 6
+#define GPS_CONFIG_NMEA_WANTED 0x30 //RMC and VTG
+
+typedef struct {
+    bool ubx;                   //the receiver answered at least one UBX command
+    uint32_t baud_rate;         //the UART and the receiver run at this rate now
+    uint16_t period_ms;         //navigation period, 1000 if it could not be set
+    uint8_t nmea_on;            //bit per GPS_CONFIG_NMEA message, as far as the receiver confirmed
+    uint32_t epoch_bytes;       //expected NMEA bytes per fix with those messages
+
+    uint32_t commands;          //frames sent, retries included
+    uint32_t acks;
+    uint32_t naks;
+    uint32_t timeouts;
+    uint32_t elapsed_ms;
+} GPS_Config_Result;
+
+bool gps_config_run(uint32_t uart_index, GPS_Config_Result *result);
+//one line for the console, e.g. "UBX, 115200 baud, fix every 100 ms, RMC VTG on (108 bytes per fix), ..."
+int gps_config_format(const GPS_Config_Result *result, char *buf, size_t size);
+
+#endif
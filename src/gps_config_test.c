@@ -0,0 +1,475 @@
+/*
+File: gps_config_test.c
+Author: Leonardo DaGraca
+
+Host test of the GPS receiver configuration (gps_config.h) against a fake
+u-blox receiver, on a simulated clock so every run is the same.
+
+The test supplies the few hal.h functions gps_config.c and nmea_rx.c use. The
+fake receiver sits on the other end of the UART: it answers CFG-MSG, CFG-RATE
+and CFG-PRT with ACK-ACK / ACK-NAK after 10ms, sends its enabled NMEA messages
+every navigation period, and shifts every byte out at its own baud rate behind
+whatever it is still sending. Bytes sent while the two ends run at different
+rates arrive as framing errors, and a message that does not fit in the
+receiver's 2KB output buffer is dropped, as the u-blox firmware does.
+
+Each scenario (factory settings, settings kept from the last session, a port
+that refuses CFG-PRT, a 5Hz receiver, an ACK lost in the baud switch, a noisy
+line, a receiver without UBX) runs gps_config_run(), then logs for a while
+through nmea_rx and the NMEA parser like the main loop. It prints the outcome
+of the negotiation, the valid RMC fixes per second, the bytes received per fix
+and the link load, against the unconfigured 9600 baud / 1Hz receiver, and fails
+if a scenario does not end at the expected baud rate and navigation period.
+
+Usage: gps_config_test [-s seconds]
+Build: cc -O2 -I. -o gps_config_test gps_config_test.c gps_config.c nmea_rx.c ubx.c nmea_parser.c
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "gps_config.h"
+#include "ubx.h"
+#include "nmea_rx.h"
+#include "nmea_parser.h"
+#include "hal.h"
+
+#define RECEIVER_TX_BUFFER 2048
+#define RECEIVER_RESPONSE_US 10000
+#define LINE_QUEUE_SIZE 16384    //bytes on their way to the Pico, power of two
+#define MAX_PENDING 16
+
+//NMEA messages in the order of the gps_config masks
+#define NMEA_GGA 0x01
+#define NMEA_GLL 0x02
+#define NMEA_GSA 0x04
+#define NMEA_GSV 0x08
+#define NMEA_RMC 0x10
+#define NMEA_VTG 0x20
+#define NMEA_ALL 0x3F
+
+typedef struct {
+    const char *name;
+    bool ubx;                   //answers UBX commands
+    uint32_t baud_rate;         //at power-up
+    uint16_t period_ms;
+    uint8_t nmea_on;
+    uint16_t min_period_ms;     //CFG-RATE below this is refused
+    bool port_locked;           //CFG-PRT is refused
+    bool switch_before_ack;     //the CFG-PRT ACK goes out at the new rate and is lost
+    uint32_t loss_per_mille;    //bytes lost on the line in each direction
+
+    //expected outcome, the baseline runs without gps_config_run()
+    bool baseline;
+    uint32_t expect_baud_rate;
+    uint16_t expect_period_ms;
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"unconfigured (today)", true, 9600, 1000, NMEA_ALL, 100, false, false, 0, true, 9600, 1000},
+    {"factory settings", true, 9600, 1000, NMEA_ALL, 100, false, false, 0, false, 115200, 100},
+    {"kept from last session", true, 115200, 100, NMEA_RMC | NMEA_VTG, 100, false, false, 0, false, 115200, 100},
+    {"CFG-PRT refused", true, 9600, 1000, NMEA_ALL, 100, true, false, 0, false, 9600, 200},
+    {"5Hz receiver", true, 9600, 1000, NMEA_ALL, 200, false, false, 0, false, 115200, 200},
+    {"CFG-PRT ACK lost", true, 9600, 1000, NMEA_ALL, 100, false, true, 0, false, 115200, 100},
+    {"2% bytes lost", true, 9600, 1000, NMEA_ALL, 100, false, false, 20, false, 115200, 100},
+    {"no UBX (NMEA only)", false, 9600, 1000, NMEA_ALL, 100, false, false, 0, false, 9600, 1000},
+};
+
+typedef struct {
+    uint64_t time_us;           //when the last bit arrives
+    uint32_t baud_rate;         //rate it was sent at
+    uint8_t byte;
+} Line_Byte;
+
+//a command the receiver has fully received and acts on at time_us
+typedef struct {
+    uint64_t time_us;
+    uint8_t msg_class;
+    uint8_t msg_id;
+    uint16_t len;
+    uint8_t payload[UBX_PARSER_PAYLOAD];
+} Pending;
+
+static uint64_t now_us = 0;
+static uint32_t host_baud_rate = 9600;
+static HAL_UART_Rx_Handler rx_handler;
+static uint32_t random_state = 1;
+
+static struct {
+    Scenario setup;
+    uint32_t baud_rate;
+    uint16_t period_ms;
+    uint8_t nmea_on;
+    uint64_t next_epoch_us;
+    uint32_t epochs;
+    UBX_Parser parser;
+
+    Line_Byte line[LINE_QUEUE_SIZE];
+    uint32_t line_head;
+    uint32_t line_tail;
+    uint64_t line_free_us;      //when the transmitter is done with the bytes queued so far
+    uint64_t busy_us;
+    Pending pending[MAX_PENDING];
+    uint32_t pending_count;
+
+    uint32_t sentences_sent;
+    uint32_t sentences_dropped;
+} receiver;
+
+static uint32_t next_random() {
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 16) & 0x7FFF;
+}
+
+static bool byte_lost() {
+    return receiver.setup.loss_per_mille && next_random() % 1000 < receiver.setup.loss_per_mille;
+}
+
+static uint64_t byte_time_us(uint32_t baud_rate) {
+    return 10 * 1000000ULL / baud_rate;
+}
+
+//queue bytes behind what the receiver is still sending, false if they do not fit in its buffer
+static bool receiver_send(const uint8_t *data, size_t len, uint64_t at_us, bool droppable) {
+    uint32_t queued = receiver.line_head - receiver.line_tail;
+    if (droppable && queued + len > RECEIVER_TX_BUFFER) {
+        return false;
+    }
+    if (queued + len > LINE_QUEUE_SIZE) {
+        return false;
+    }
+
+    uint64_t t = receiver.line_free_us > at_us ? receiver.line_free_us : at_us;
+    uint64_t per_byte = byte_time_us(receiver.baud_rate);
+    for (size_t i = 0; i < len; i++) {
+        t += per_byte;
+        Line_Byte *b = &receiver.line[receiver.line_head++ & (LINE_QUEUE_SIZE - 1)];
+        b->time_us = t;
+        b->baud_rate = receiver.baud_rate;
+        b->byte = data[i];
+    }
+    receiver.busy_us += len * per_byte;
+    receiver.line_free_us = t;
+    return true;
+}
+
+static void send_sentence(const char *body, uint64_t at_us) {
+    uint8_t checksum = 0;
+    for (const char *c = body; *c; c++) {
+        checksum ^= (uint8_t)*c;
+    }
+    char sentence[NMEA_MAX_SENTENCE + 4];
+    int len = snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+
+    receiver.sentences_sent++;
+    if (!receiver_send((const uint8_t *)sentence, (size_t)len, at_us, true)) {
+        receiver.sentences_dropped++;
+    }
+}
+
+//one navigation solution with the messages that are on, sizes as the GT-U7 sends them
+static void send_epoch(uint64_t at_us) {
+    uint32_t ms = (uint32_t)(at_us / 1000 % 86400000);
+    char utc[16];
+    snprintf(utc, sizeof(utc), "%02u%02u%02u.%02u", ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms / 10 % 100);
+    //walking north at 1.5m/s
+    uint32_t north_e5 = 3803800 + receiver.epochs * receiver.period_ms * 81 / 100000;
+    char lat[16];
+    snprintf(lat, sizeof(lat), "48%02u.%05u", north_e5 / 100000, north_e5 % 100000);
+    char body[NMEA_MAX_SENTENCE];
+
+    if (receiver.nmea_on & NMEA_GGA) {
+        snprintf(body, sizeof(body), "GPGGA,%s,%s,N,01131.00000,E,1,09,0.94,545.4,M,46.9,M,,", utc, lat);
+        send_sentence(body, at_us);
+    }
+    if (receiver.nmea_on & NMEA_GSA) {
+        send_sentence("GPGSA,A,3,04,05,09,12,17,23,24,25,29,,,,1.71,0.94,1.43", at_us);
+    }
+    if (receiver.nmea_on & NMEA_GSV) {
+        send_sentence("GPGSV,3,1,11,04,23,184,31,05,37,302,42,09,12,046,28,12,71,115,45", at_us);
+        send_sentence("GPGSV,3,2,11,17,18,262,33,23,09,316,24,24,48,101,40,25,52,215,44", at_us);
+        send_sentence("GPGSV,3,3,11,29,33,058,38,31,06,144,,32,04,020,", at_us);
+    }
+    if (receiver.nmea_on & NMEA_GLL) {
+        snprintf(body, sizeof(body), "GPGLL,%s,N,01131.00000,E,%s,A,A", lat, utc);
+        send_sentence(body, at_us);
+    }
+    if (receiver.nmea_on & NMEA_RMC) {
+        snprintf(body, sizeof(body), "GPRMC,%s,A,%s,N,01131.00000,E,2.916,,161026,,,A", utc, lat);
+        send_sentence(body, at_us);
+    }
+    if (receiver.nmea_on & NMEA_VTG) {
+        send_sentence("GPVTG,,T,,M,2.916,N,5.400,K,A", at_us);
+    }
+    receiver.epochs++;
+}
+
+static void send_ack(const Pending *command, bool ack, uint64_t at_us) {
+    uint8_t payload[2] = {command->msg_class, command->msg_id};
+    uint8_t frame[UBX_FRAME_OVERHEAD + 2];
+    size_t len = ubx_build(frame, UBX_CLASS_ACK, ack ? UBX_ACK_ACK : UBX_ACK_NAK, payload, sizeof(payload));
+    receiver_send(frame, len, at_us, false);
+}
+
+static void receiver_execute(const Pending *command) {
+    if (command->msg_class != UBX_CLASS_CFG) {
+        return;
+    }
+    uint64_t t = command->time_us;
+
+    if (command->msg_id == UBX_CFG_MSG && command->len == 3 && command->payload[0] == UBX_CLASS_NMEA) {
+        static const uint8_t ids[6] = {UBX_NMEA_GGA, UBX_NMEA_GLL, UBX_NMEA_GSA, UBX_NMEA_GSV, UBX_NMEA_RMC, UBX_NMEA_VTG};
+        for (int i = 0; i < 6; i++) {
+            if (ids[i] != command->payload[1]) {
+                continue;
+            }
+            if (command->payload[2]) {
+                receiver.nmea_on |= (uint8_t)(1 << i);
+            }
+            else {
+                receiver.nmea_on &= (uint8_t)~(1 << i);
+            }
+        }
+        send_ack(command, true, t);
+    }
+    else if (command->msg_id == UBX_CFG_RATE && command->len == 6) {
+        uint16_t period = (uint16_t)(command->payload[0] | command->payload[1] << 8);
+        if (period < receiver.setup.min_period_ms) {
+            send_ack(command, false, t);
+            return;
+        }
+        receiver.period_ms = period;
+        //solutions stay aligned to the top of the second
+        receiver.next_epoch_us = (t / 1000 / period + 1) * period * 1000;
+        send_ack(command, true, t);
+    }
+    else if (command->msg_id == UBX_CFG_PRT && command->len == 20) {
+        if (receiver.setup.port_locked) {
+            send_ack(command, false, t);
+            return;
+        }
+        uint32_t baud = command->payload[8] | command->payload[9] << 8 | (uint32_t)command->payload[10] << 16 |
+                        (uint32_t)command->payload[11] << 24;
+        if (receiver.setup.switch_before_ack) {
+            receiver.baud_rate = baud;
+            send_ack(command, true, t);
+        }
+        else {
+            send_ack(command, true, t);
+            receiver.baud_rate = baud;
+        }
+    }
+    else {
+        send_ack(command, false, t);
+    }
+}
+
+//run the receiver up to time_us and hand the Pico every byte that has arrived by then
+static void advance(uint64_t time_us) {
+    while (true) {
+        uint64_t next = receiver.next_epoch_us;
+        int command = -1;
+        for (uint32_t i = 0; i < receiver.pending_count; i++) {
+            if (receiver.pending[i].time_us <= next) {
+                next = receiver.pending[i].time_us;
+                command = (int)i;
+            }
+        }
+        if (next > time_us) {
+            break;
+        }
+        if (command >= 0) {
+            Pending p = receiver.pending[command];
+            receiver.pending[command] = receiver.pending[--receiver.pending_count];
+            receiver_execute(&p);
+        }
+        else {
+            send_epoch(next);
+            receiver.next_epoch_us += (uint64_t)receiver.period_ms * 1000;
+        }
+    }
+
+    while (receiver.line_tail != receiver.line_head) {
+        const Line_Byte *b = &receiver.line[receiver.line_tail & (LINE_QUEUE_SIZE - 1)];
+        if (b->time_us > time_us) {
+            break;
+        }
+        receiver.line_tail++;
+        if (byte_lost()) {
+            continue;
+        }
+        rx_handler(b->byte, b->baud_rate == host_baud_rate ? 0 : HAL_UART_ERROR);
+    }
+    now_us = time_us;
+}
+
+//hal.h, as far as gps_config.c and nmea_rx.c use it
+uint64_t hal_time_us() {
+    return now_us;
+}
+
+uint32_t hal_time_us_32() {
+    return (uint32_t)now_us;
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    advance(now_us + (uint64_t)ms * 1000);
+}
+
+void hal_uart_init(uint32_t index, uint32_t baud_rate, uint32_t tx_pin, uint32_t rx_pin,
+                   HAL_UART_Rx_Handler handler) {
+    host_baud_rate = baud_rate;
+    rx_handler = handler;
+}
+
+void hal_uart_set_baud_rate(uint32_t index, uint32_t baud_rate) {
+    host_baud_rate = baud_rate;
+}
+
+//the receiver only understands the bytes if both ends run at the same rate
+void hal_uart_write(uint32_t index, const uint8_t *src, size_t len) {
+    advance(now_us);
+    uint64_t arrival = now_us + len * byte_time_us(host_baud_rate);
+    now_us = arrival;
+    advance(now_us);
+    if (!receiver.setup.ubx || host_baud_rate != receiver.baud_rate) {
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        if (byte_lost() || !ubx_parser_feed(&receiver.parser, src[i])) {
+            continue;
+        }
+        if (receiver.pending_count == MAX_PENDING) {
+            continue;
+        }
+        Pending *p = &receiver.pending[receiver.pending_count++];
+        p->time_us = arrival + RECEIVER_RESPONSE_US;
+        p->msg_class = receiver.parser.msg_class;
+        p->msg_id = receiver.parser.msg_id;
+        p->len = receiver.parser.len;
+        memcpy(p->payload, receiver.parser.payload, sizeof(p->payload));
+    }
+}
+
+static void receiver_init(const Scenario *setup) {
+    memset(&receiver, 0, sizeof(receiver));
+    receiver.setup = *setup;
+    receiver.baud_rate = setup->baud_rate;
+    receiver.period_ms = setup->period_ms;
+    receiver.nmea_on = setup->nmea_on;
+    ubx_parser_init(&receiver.parser);
+    //power-up in the middle of a second
+    now_us = 10500000;
+    receiver.next_epoch_us = 11000000;
+    receiver.line_free_us = now_us;
+    random_state = 1;
+}
+
+typedef struct {
+    GPS_Config_Result config;
+    bool configured;
+    uint32_t fixes;
+    uint32_t bytes;
+    uint64_t max_gap_us;
+    double load;
+    uint32_t dropped;
+} Outcome;
+
+//log like the main loop: drain the ring every 10ms and count the valid RMC fixes
+static void run_scenario(const Scenario *setup, uint32_t seconds, Outcome *out) {
+    memset(out, 0, sizeof(*out));
+    receiver_init(setup);
+    nmea_rx_init(1, 9600, 4, 5);
+
+    if (!setup->baseline) {
+        out->configured = gps_config_run(1, &out->config);
+    }
+
+    NMEA_Parser parser;
+    nmea_parser_init(&parser);
+    NMEA_RX_Stats before;
+    nmea_rx_get_stats(&before);
+    uint64_t start = now_us;
+    uint64_t busy_before = receiver.busy_us;
+    uint32_t dropped_before = receiver.sentences_dropped;
+    uint64_t last_fix = 0;
+
+    while (now_us - start < (uint64_t)seconds * 1000000) {
+        advance(now_us + 10000);
+        char chunk[256];
+        size_t len;
+        while ((len = nmea_rx_read(chunk, NULL, sizeof(chunk))) > 0) {
+            for (size_t i = 0; i < len; i++) {
+                NMEA_Sentence sentence;
+                if (!nmea_parser_feed(&parser, chunk[i], &sentence)) {
+                    continue;
+                }
+                if (sentence.type == NMEA_TYPE_RMC && sentence.rmc.valid) {
+                    out->fixes++;
+                    if (last_fix && now_us - last_fix > out->max_gap_us) {
+                        out->max_gap_us = now_us - last_fix;
+                    }
+                    last_fix = now_us;
+                }
+            }
+        }
+    }
+
+    NMEA_RX_Stats after;
+    nmea_rx_get_stats(&after);
+    out->bytes = after.received - before.received;
+    uint32_t baud = setup->baseline ? setup->baud_rate : out->config.baud_rate;
+    out->load = (double)(receiver.busy_us - busy_before) / ((double)seconds * 1e6) * (receiver.baud_rate == baud ? 1 : 0);
+    out->dropped = receiver.sentences_dropped - dropped_before;
+}
+
+int main(int argc, char **argv) {
+    uint32_t seconds = 60;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seconds = (uint32_t)atoi(argv[++i]);
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-s seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (seconds == 0) {
+        fprintf(stderr, "Seconds must be positive\n");
+        return 1;
+    }
+
+    int failures = 0;
+    printf("%-24s %8s %9s %8s %9s %6s %7s %8s\n", "Scenario", "Baud", "Period", "Fixes/s", "Bytes/fix", "Load", "Dropped", "Setup");
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        const Scenario *setup = &scenarios[s];
+        Outcome out;
+        run_scenario(setup, seconds, &out);
+
+        uint32_t baud = setup->baseline ? setup->baud_rate : out.config.baud_rate;
+        uint16_t period = setup->baseline ? setup->period_ms : out.config.period_ms;
+        //the receiver must have ended where the logger thinks it is, a lossy line also loses fixes
+        bool ok = baud == setup->expect_baud_rate && period == setup->expect_period_ms &&
+                  receiver.baud_rate == baud && receiver.period_ms == period &&
+                  (setup->loss_per_mille || out.fixes >= seconds * 1000 / period - 1);
+
+        printf("%-24s %8" PRIu32 " %6u ms %8.2f %9.1f %5.1f%% %7" PRIu32 " %5" PRIu32 " ms%s\n", setup->name, baud, period,
+               (double)out.fixes / seconds, out.fixes ? (double)out.bytes / out.fixes : 0.0, out.load * 100, out.dropped,
+               out.config.elapsed_ms, ok ? "" : "  FAILED");
+        if (!setup->baseline) {
+            char line[200];
+            gps_config_format(&out.config, line, sizeof(line));
+            printf("    %s\n", line);
+        }
+        if (!ok) {
+            printf("    expected %" PRIu32 " baud and %u ms, the receiver runs at %" PRIu32 " baud and %u ms\n",
+                   setup->expect_baud_rate, setup->expect_period_ms, receiver.baud_rate, receiver.period_ms);
+            failures++;
+        }
+    }
+
+    printf("%d of %zu scenarios failed\n", failures, sizeof(scenarios) / sizeof(scenarios[0]));
+    return failures ? 1 : 0;
+}
@@ -1,82 +1,413 @@
+/*
+File: gps_metrics.c
+Author: Leonardo DaGraca
+
+Host tool that computes session metrics from the logs on the SD card.
+The rows are run through the same NMEA parser and metrics engine
+(track_metrics.c) the firmware uses, so the numbers match what the tracker
+computed live for the same input.
+
+The simplify mode runs the valid fixes through both track simplifiers
+(track_simplify.h), Douglas-Peucker and the streaming window the firmware
+uses, and prints the fixes kept, the compression ratio, the time per fix and
+the largest distance of a dropped fix from the simplified track, checked in
+double precision independently of the integer kernel. The Douglas-Peucker
+track can be written out as a CSV of decimal degrees. The benchmark mode does
+the same on a generated track of any number of 1 Hz fixes.
+
+The compare mode times the fixed-point distance kernel of geo.c against the
+double haversine and checks its error on every segment up to 1 km against the
+bound geo.c states (3 mm plus 3e-5 of the length); it fails beyond it. With
+-b it runs on the generated track instead of a log.
+
+Usage: gps_metrics [-c] [-s <tolerance_m> [-o track.csv]] <gps_log_N.csv> [imu_log_N.csv]
+       gps_metrics -b <fixes> [-c] [-s <tolerance_m>]
+  -c  compare the fixed-point distance kernel with the double haversine on the track
+  -s  simplify the track to within tolerance_m metres (2 by default with -b)
+  -o  write the simplified track
+  -b  benchmark the simplifiers, or the distance kernels with -c, on a generated track
+Build: cc -O2 -o gps_metrics gps_metrics.c track_metrics.c track_simplify.c geo.c nmea_parser.c -lm
+*/
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <math.h>
+#include <time.h>
+#include "nmea_parser.h"
+#include "track_metrics.h"
+#include "track_simplify.h"
+#include "geo.h"
 
-#define EARTH_RADIUS_KM 6371.0
+#define MAX_FIXES 2000000
 
-//function to convert lat or long from "degrees and minutes" to decimal degrees
-double convert_to_decimal_degrees(double degrees_minutes, char direction) {
-    int degrees = (int)(degrees_minutes / 100);
-    double minutes = degrees_minutes - (degrees * 100);
-    double decimal_degrees = degrees + (minutes / 60.0);
+//error bound of geo_distance_mm_fast() against the double haversine, see geo.c
+#define KERNEL_MAX_ERROR_MM 3.0
+#define KERNEL_MAX_RELATIVE 3e-5
+#define KERNEL_CHECKED_MM 1e6
 
-    if (direction == 'S' || direction == 'W') {
-        decimal_degrees = -decimal_degrees;
+//valid fixes of the track, collected for -c and -s
+static Track_Point *fixes = NULL;
+static size_t fix_count = 0;
+
+//feed the GPS rows ("Timestamp,GPRMC,...*CS") through the parser
+static int process_gps_log(const char *path, Track_Metrics *metrics) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Unable to open GPS log");
+        return 1;
     }
 
-    return decimal_degrees;
-}
+    char line[256];
+    NMEA_Parser parser;
+    nmea_parser_init(&parser);
 
-//haversine formula that calculates dist between two points on Earth's surface
-double haversine_distance(double lat1, double long1, double lat2, double long2) {
-    double dlat = (lat2 - lat1) * M_PI / 180.0;
-    double dlong = (long2 - long1) * M_PI / 180.0;
+    while (fgets(line, sizeof(line), file)) {
+        char *comma = strchr(line, ',');
+        if (!comma) {
+            continue;
+        }
+        uint64_t timestamp = strtoull(line, NULL, 10);
 
-    lat1 = lat1 * M_PI / 180.0;
-    lat2 = lat2 * M_PI / 180.0;
+        NMEA_Sentence sentence;
+        nmea_parser_feed(&parser, '$', &sentence);
+        for (char *c = comma + 1; *c && *c != '\n' && *c != '\r'; c++) {
+            if (nmea_parser_feed(&parser, *c, &sentence) && sentence.type == NMEA_TYPE_RMC) {
+                track_metrics_add_fix(metrics, timestamp, &sentence.rmc);
 
-    double a = sin(dlat / 2) * sin(dlat / 2) +
-               cos(lat1) * cos(lat2) * sin(dlong / 2) * sin(dlong / 2);
-    double c = 2 * atan2(sqrt(a), sqrt(1 - a));
+                if (fixes && sentence.rmc.valid && fix_count < MAX_FIXES) {
+                    fixes[fix_count].time_us = timestamp;
+                    fixes[fix_count].lat_e7 = sentence.rmc.lat_e7;
+                    fixes[fix_count].lon_e7 = sentence.rmc.lon_e7;
+                    fix_count++;
+                }
+            }
+        }
+    }
 
-    return EARTH_RADIUS_KM * c;
+    fclose(file);
+    printf("Parsed %" PRIu32 " sentences (%" PRIu32 " checksum errors)\n", parser.sentences, parser.checksum_errors);
+    return 0;
 }
 
-int main() {
-    FILE *file = fopen("gps_log.txt", "r");
-    if(!file) {
-        perror("Unable to open file");
+//IMU rows are either "Timestamp,IMU: ax,ay,az,gx,gy,gz;..." or full-rate "Timestamp,ax,ay,az,gx,gy,gz"
+static int process_imu_log(const char *path, Track_Metrics *metrics) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Unable to open IMU log");
         return 1;
     }
 
-    char line[256];
-    double total_distance = 0.0;
-    double prev_lat = 0.0, prev_long = 0.0;
-    int prev_time = 0;
-    int is_first_valid_entry = 1;
-
+    char line[512];
     while (fgets(line, sizeof(line), file)) {
-        double time, lat, longt;
-        char lat_dir, long_dir;
-        int fix;
-
-        //parse line
-        int fields_read = sscanf(line, "%lf,%lf,%c,%lf,%c,%d", &time, &lat, &lat_dir, &longt, &long_dir, &fix);
-        //check if line has valid data
-        if (fields_read < 6 || fix == 0 || lat == 0 || longt == 0) {
+        char *reading = strchr(line, ',');
+        if (!reading) {
             continue;
         }
+        reading++;
+        if (strncmp(reading, "IMU: ", 5) == 0) {
+            reading += 5;
+        }
 
-        double lat_decimal = convert_to_decimal_degrees(lat, lat_dir);
-        double long_decimal = convert_to_decimal_degrees(longt, long_dir);
+        while (reading) {
+            int ax, ay, az, gx, gy, gz;
+            if (sscanf(reading, "%d,%d,%d,%d,%d,%d", &ax, &ay, &az, &gx, &gy, &gz) != 6) {
+                break;
+            }
+            track_metrics_add_imu(metrics, ax, ay, az);
 
-        if(!is_first_valid_entry) {
-            //calculate distance from previous point
-            double distance = haversine_distance(prev_lat, prev_long, lat_decimal, long_decimal);
-            total_distance += distance;
+            reading = strchr(reading, ';');
+            if (reading) {
+                reading++;
+            }
         }
-
-        //update values
-        prev_lat = lat_decimal;
-        prev_long = long_decimal;
-        prev_time = (int)time;
-        is_first_valid_entry = 0;
     }
-    
+
     fclose(file);
+    return 0;
+}
 
-    printf("Total Distance: %.2f km\n", total_distance);
+//distance of every segment with both kernels: totals, worst error and time per call. The error of
+//the fixed-point kernel is also checked on the chords across 10 and 100 fixes, up to the 1 km its
+//bound in geo.c covers; it fails if a segment is off by more than that bound
+static int compare_kernels(const Track_Point *points, size_t count) {
+    if (count < 2) {
+        printf("Not enough valid fixes to compare\n");
+        return 0;
+    }
 
-    return 0;
+    double total_double = 0.0, max_abs = 0.0, max_rel = 0.0;
+    uint64_t total_fast = 0;
+
+    clock_t start = clock();
+    for (size_t i = 1; i < count; i++) {
+        total_double += geo_distance_mm(points[i - 1].lat_e7, points[i - 1].lon_e7,
+                                        points[i].lat_e7, points[i].lon_e7);
+    }
+    double double_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (size_t i = 1; i < count; i++) {
+        total_fast += geo_distance_mm_fast(points[i - 1].lat_e7, points[i - 1].lon_e7,
+                                           points[i].lat_e7, points[i].lon_e7);
+    }
+    double fast_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    static const size_t strides[] = {1, 10, 100};
+    size_t checked = 0, over_bound = 0;
+    for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); s++) {
+        for (size_t i = strides[s]; i < count; i++) {
+            const Track_Point *a = &points[i - strides[s]], *b = &points[i];
+            double ref = haversine_distance(a->lat_e7 / 1e7, a->lon_e7 / 1e7, b->lat_e7 / 1e7, b->lon_e7 / 1e7) * 1e6;
+            if (ref > KERNEL_CHECKED_MM) {
+                continue;
+            }
+            double err = fabs(geo_distance_mm_fast(a->lat_e7, a->lon_e7, b->lat_e7, b->lon_e7) - ref);
+            if (err > max_abs) {
+                max_abs = err;
+            }
+            if (ref > 1000.0 && err / ref > max_rel) {
+                max_rel = err / ref;
+            }
+            if (err > KERNEL_MAX_ERROR_MM + KERNEL_MAX_RELATIVE * ref && over_bound++ < 5) {
+                printf("  %.1f mm off on a segment of %.3f m at fix %zu\n", err, ref / 1000.0, i);
+            }
+            checked++;
+        }
+    }
+
+    size_t segments = count - 1;
+    printf("Kernel comparison over %zu segments:\n", segments);
+    printf("  double haversine: %.3f m, %.1f ns/segment\n", total_double / 1000.0, double_s * 1e9 / segments);
+    printf("  fixed-point:      %.3f m, %.1f ns/segment\n", total_fast / 1000.0, fast_s * 1e9 / segments);
+    printf("  max error over %zu segments up to %.0f m: %.1f mm, max relative error (segments > 1 m): %.2e\n",
+           checked, KERNEL_CHECKED_MM / 1000.0, max_abs, max_rel);
+    printf("  bound %.0f mm + %.0e of the length: %s\n", KERNEL_MAX_ERROR_MM, KERNEL_MAX_RELATIVE,
+           over_bound ? "FAIL" : "OK");
+    return over_bound > 0;
+}
+
+//distance of p from the segment a-b in metres, double precision on the local plane at a
+static double segment_error_m(const Track_Point *a, const Track_Point *b, const Track_Point *p) {
+    double k = EARTH_RADIUS_KM * 1000.0 * M_PI / 180.0 / 1e7;
+    double cos_lat = cos(a->lat_e7 / 1e7 * M_PI / 180.0);
+    double bx = (b->lon_e7 - (double)a->lon_e7) * k * cos_lat, by = (b->lat_e7 - (double)a->lat_e7) * k;
+    double px = (p->lon_e7 - (double)a->lon_e7) * k * cos_lat, py = (p->lat_e7 - (double)a->lat_e7) * k;
+
+    double length_sq = bx * bx + by * by;
+    double t = length_sq > 0 ? (px * bx + py * by) / length_sq : 0;
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    return hypot(px - t * bx, py - t * by);
+}
+
+//largest distance of a dropped fix from the segment between the kept fixes around it
+static double max_error_m(const Track_Point *points, size_t count, const uint8_t *keep) {
+    double max_error = 0;
+    size_t first = 0;
+    for (size_t i = 1; i < count; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        for (size_t j = first + 1; j < i; j++) {
+            double error = segment_error_m(&points[first], &points[i], &points[j]);
+            if (error > max_error) {
+                max_error = error;
+            }
+        }
+        first = i;
+    }
+    return max_error;
+}
+
+//run both simplifiers and report the kept fixes, compression ratio, speed and worst error
+static int simplify_track(const Track_Point *points, size_t count, uint32_t tolerance_mm, const char *out_path) {
+    if (count < 2) {
+        printf("Not enough valid fixes to simplify\n");
+        return 0;
+    }
+    uint8_t *keep = malloc(count);
+    if (!keep) {
+        perror("Unable to allocate keep flags");
+        return 1;
+    }
+
+    clock_t start = clock();
+    size_t dp_kept = track_simplify_dp(points, count, tolerance_mm, keep);
+    double dp_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+    double dp_error = max_error_m(points, count, keep);
+
+    if (out_path) {
+        FILE *out = fopen(out_path, "w");
+        if (!out) {
+            perror("Unable to open simplified track");
+            free(keep);
+            return 1;
+        }
+        fputs(TRACK_CSV_HEADER, out);
+        for (size_t i = 0; i < count; i++) {
+            if (keep[i]) {
+                char row[64];
+                track_point_format(&points[i], row, sizeof(row));
+                fputs(row, out);
+            }
+        }
+        fclose(out);
+    }
+
+    //the firmware's streaming simplifier, a kept fix is the first one or the one before the fix just added
+    Track_Simplifier simplifier;
+    track_simplifier_init(&simplifier, tolerance_mm);
+    memset(keep, 0, count);
+    Track_Point kept;
+    start = clock();
+    for (size_t i = 0; i < count; i++) {
+        if (track_simplifier_add(&simplifier, &points[i], &kept)) {
+            keep[i == 0 ? 0 : i - 1] = 1;
+        }
+    }
+    if (track_simplifier_finish(&simplifier, &kept)) {
+        keep[count - 1] = 1;
+    }
+    double window_s = (double)(clock() - start) / CLOCKS_PER_SEC;
+    double window_error = max_error_m(points, count, keep);
+
+    printf("Track simplification of %zu fixes to %.2f m:\n", count, tolerance_mm / 1000.0);
+    printf("  Douglas-Peucker:  %zu fixes kept, ratio %.1f:1, %.1f ns/fix, max error %.3f m\n",
+           dp_kept, (double)count / dp_kept, dp_s * 1e9 / count, dp_error);
+    printf("  streaming window: %" PRIu32 " fixes kept, ratio %.1f:1, %.1f ns/fix, max error %.3f m\n",
+           simplifier.points_out, (double)count / simplifier.points_out, window_s * 1e9 / count, window_error);
+    if (out_path) {
+        printf("  simplified track written to %s\n", out_path);
+    }
+
+    free(keep);
+    //the integer kernel may round a few mm either way of the double check
+    return dp_error > tolerance_mm / 1000.0 + 0.01 || window_error > tolerance_mm / 1000.0 + 0.01;
+}
+
+//1 Hz fixes of a run: speed and heading wander, a turn now and then, ~1.5 m of GPS noise
+static void generate_track(Track_Point *points, size_t count) {
+    double lat = 51.5, lon = -0.12, heading = 0.0, speed = 3.0;
+    double m_per_deg = EARTH_RADIUS_KM * 1000.0 * M_PI / 180.0;
+    srand(2024);
+
+    for (size_t i = 0; i < count; i++) {
+        double noise_n = ((rand() % 2001) - 1000) / 1000.0 * 1.5;
+        double noise_e = ((rand() % 2001) - 1000) / 1000.0 * 1.5;
+        points[i].time_us = 1000000ULL * (i + 1);
+        points[i].lat_e7 = (int32_t)lround((lat + noise_n / m_per_deg) * 1e7);
+        points[i].lon_e7 = (int32_t)lround((lon + noise_e / (m_per_deg * cos(lat * M_PI / 180.0))) * 1e7);
+
+        heading += ((rand() % 2001) - 1000) / 1000.0 * 0.05;
+        if (rand() % 60 == 0) {
+            heading += ((rand() % 2001) - 1000) / 1000.0 * M_PI / 2;
+        }
+        speed += ((rand() % 2001) - 1000) / 1000.0 * 0.2;
+        speed = speed < 0.5 ? 0.5 : (speed > 7.0 ? 7.0 : speed);
+        lat += speed * cos(heading) / m_per_deg;
+        lon += speed * sin(heading) / (m_per_deg * cos(lat * M_PI / 180.0));
+    }
+}
+
+static int benchmark(size_t count, int compare, uint32_t tolerance_mm) {
+    Track_Point *points = malloc(count * sizeof(Track_Point));
+    if (!points) {
+        perror("Unable to allocate track");
+        return 1;
+    }
+    generate_track(points, count);
+    printf("Generated track of %zu fixes (%.1f hours at 1 Hz)\n", count, count / 3600.0);
+    int result = 0;
+    if (compare) {
+        result |= compare_kernels(points, count);
+    }
+    if (!compare || tolerance_mm > 0) {
+        result |= simplify_track(points, count, tolerance_mm > 0 ? tolerance_mm : 2000, NULL);
+    }
+    free(points);
+    return result;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-c] [-s <tolerance_m> [-o track.csv]] <gps_log_N.csv> [imu_log_N.csv]\n", name);
+    fprintf(stderr, "       %s -b <fixes> [-c] [-s <tolerance_m>]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    int arg = 1;
+    int compare = 0;
+    double tolerance_m = 0;
+    const char *out_path = NULL;
+    size_t bench_fixes = 0;
+
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-c") == 0) {
+            compare = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            tolerance_m = atof(argv[arg + 1]);
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+            out_path = argv[arg + 1];
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+            bench_fixes = strtoull(argv[arg + 1], NULL, 10);
+            arg += 2;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (bench_fixes > 0) {
+        return benchmark(bench_fixes, compare, (uint32_t)lround(tolerance_m * 1000));
+    }
+    if (argc - arg < 1 || argc - arg > 2 || tolerance_m < 0 || (out_path && tolerance_m == 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (compare || tolerance_m > 0) {
+        fixes = malloc(MAX_FIXES * sizeof(Track_Point));
+        if (!fixes) {
+            perror("Unable to allocate fix buffer");
+            return 1;
+        }
+    }
+
+    Track_Metrics metrics;
+    track_metrics_init(&metrics);
+
+    if (process_gps_log(argv[arg], &metrics) != 0) {
+        return 1;
+    }
+    if (argc - arg == 2 && process_imu_log(argv[arg + 1], &metrics) != 0) {
+        return 1;
+    }
+
+    const Track_Summary *s = &metrics.summary;
+    char row[200];
+    track_metrics_format(s, row, sizeof(row));
+
+    printf("Total Distance: %.2f km\n", s->distance_mm / 1e6);
+    printf("Moving Time: %" PRIu64 " s\n", s->moving_time_us / 1000000);
+    printf("Average Speed: %.2f km/h, Max Speed: %.2f km/h\n", s->avg_speed_mm_s * 0.0036, s->max_speed_mm_s * 0.0036);
+    printf("Sprints: %" PRIu32 "\n", s->sprints);
+    printf("Intensity: %" PRIu64 " mg (%" PRIu32 " per min)\n", s->intensity_mg, s->intensity_per_min);
+    printf("Summary row: %s", row);
+
+    int result = 0;
+    if (compare) {
+        result |= compare_kernels(fixes, fix_count);
+    }
+    if (tolerance_m > 0) {
+        result |= simplify_track(fixes, fix_count, (uint32_t)lround(tolerance_m * 1000), out_path);
+    }
+    free(fixes);
+
+    return result;
 }
@@ -0,0 +1,65 @@
+/*
+File: hal.h
+Author: Leonardo DaGraca
+
+Thin hardware abstraction layer between the logger and the board.
+Only what the application actually uses is covered: the clock, the GPS UART,
+the I2C bus of the MPU6050, the VSYS ADC, the PPS input, the second core and
+the SD card driver. The files themselves are accessed through the FatFs API.
+
+hal_pico.c implements it with the Pico SDK for the firmware. hal_host.c is the
+Linux backend of the simulator build (GPS_TRACKER_HOST_SIM): it replays a
+recorded NMEA log through the UART, emulates the MPU6050 on the I2C bus and
+stores the files in a directory through host/ff.h.
+*/
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//error flags passed to the UART receive handler with each byte
+#define HAL_UART_OVERRUN 0x01   //bytes were lost in the hardware FIFO before this one
+#define HAL_UART_ERROR 0x02     //framing, parity or break error, the byte is not valid
+
+//called from the UART interrupt (or the replay thread) for every received byte
+typedef void (*HAL_UART_Rx_Handler)(uint8_t byte, uint32_t errors);
+
+void hal_init();
+bool hal_running();
+
+//microseconds since boot
+uint64_t hal_time_us();
+uint32_t hal_time_us_32();
+void hal_sleep_ms(uint32_t ms);
+//sleep until an interrupt or at most max_us, returns the time actually slept
+uint32_t hal_idle_us(uint32_t max_us);
+
+//free running microsecond counter for profiling, never scaled by the simulator speed
+uint32_t hal_perf_time_us();
+
+void hal_i2c_init(uint32_t index, uint32_t baud_rate, uint32_t sda_pin, uint32_t scl_pin);
+int hal_i2c_write(uint32_t index, uint8_t addr, const uint8_t *src, size_t len, bool nostop);
+int hal_i2c_read(uint32_t index, uint8_t addr, uint8_t *dst, size_t len, bool nostop);
+
+void hal_uart_init(uint32_t index, uint32_t baud_rate, uint32_t tx_pin, uint32_t rx_pin,
+                   HAL_UART_Rx_Handler handler);
+void hal_uart_write(uint32_t index, const uint8_t *src, size_t len);
+//waits for the bytes already written to go out, then changes the rate of both directions
+void hal_uart_set_baud_rate(uint32_t index, uint32_t baud_rate);
+
+void hal_adc_init(uint32_t gpio);
+uint16_t hal_adc_read(uint32_t input);
+
+void hal_pps_init(uint32_t gpio, void (*on_edge)(void));
+
+//second core, hal_event_signal() wakes hal_event_wait() like __sev() / __wfe()
+void hal_core1_launch(void (*entry)(void));
+void hal_core1_join();
+void hal_event_signal();
+void hal_event_wait();
+
+bool hal_storage_init();
+
+#endif
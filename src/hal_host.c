@@ -0,0 +1,472 @@
+/*
+File: hal_host.c
+Author: Leonardo DaGraca
+
+Linux backend of hal.h for the host simulator build (GPS_TRACKER_HOST_SIM).
+The logger runs unchanged on top of it:
+- UART: a thread replays a recorded NMEA stream at the GPS baud rate
+- I2C: an emulated MPU6050 fills its FIFO at the configured sample rate,
+  from a recorded full-rate IMU log or as a stationary sensor
+- clock: the monotonic clock, optionally sped up for long tracks
+- core 1: a second thread, hal_event_signal/wait behave like __sev/__wfe
+- SD card: a directory, through host/ff.h
+
+Configured with environment variables:
+  GPS_SIM_NMEA     gps_log_N.csv written by the logger, or raw NMEA lines (required)
+  GPS_SIM_IMU      imu_log_N.csv written in IMU_FULL_RATE mode (optional)
+  GPS_SIM_SD       directory used as the SD card (default sim_sd)
+  GPS_SIM_SPEED    simulated seconds per wall clock second (default 1)
+  GPS_SIM_VSYS_MV  battery voltage reported by the ADC (default 5000)
+
+The simulation ends one second after the last NMEA sentence was replayed.
+There is no PPS signal on the host, hal_pps_init() never calls back.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "hal.h"
+#include "mpu6050.h"
+#include "nmea_parser.h"
+#include "ff.h"
+
+//raw NMEA files have no timestamps, space the fixes one second apart
+#define RAW_NMEA_FIX_INTERVAL_US 1000000ULL
+#define REPLAY_TAIL_US 1000000ULL
+
+static double sim_speed = 1.0;
+static struct timespec start_time;
+static const char *nmea_path;
+static const char *imu_path;
+static uint32_t vsys_mv = 5000;
+static atomic_bool replay_done = false;
+static uint32_t replay_bytes = 0;
+static uint32_t tx_bytes = 0;
+
+static pthread_t uart_thread;
+static pthread_t core1_thread;
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+static bool event_pending = false;
+
+static HAL_UART_Rx_Handler rx_handler;
+static uint32_t uart_byte_us;
+
+//replay starts with hal_uart_init(), recorded time replay_origin_us plays at replay_start_us
+static bool replay_started = false;
+static bool replay_has_origin = false;
+static uint64_t replay_start_us;
+static uint64_t replay_origin_us;
+
+//emulated MPU6050
+static uint8_t mpu_regs[128];
+static uint8_t mpu_reg_ptr;
+static uint8_t mpu_fifo[MPU6050_FIFO_SIZE];
+static uint32_t mpu_fifo_head;
+static uint32_t mpu_fifo_count;
+static uint8_t mpu_sample[14];  //accel xyz, temperature, gyro xyz, big endian
+static uint64_t mpu_next_sample_us;
+static FILE *mpu_source;
+
+static double wall_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1e9;
+}
+
+static void on_exit_report() {
+    double wall = wall_seconds();
+    double simulated = hal_time_us() / 1e6;
+    printf("Simulated %.1f s in %.2f s wall clock (%.1fx), %u NMEA bytes replayed, %u bytes sent to the GPS\n",
+           simulated, wall, wall > 0 ? simulated / wall : 0.0, (unsigned)replay_bytes, (unsigned)tx_bytes);
+}
+
+void hal_init() {
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    nmea_path = getenv("GPS_SIM_NMEA");
+    imu_path = getenv("GPS_SIM_IMU");
+    const char *sd_path = getenv("GPS_SIM_SD");
+    const char *speed = getenv("GPS_SIM_SPEED");
+    const char *vsys = getenv("GPS_SIM_VSYS_MV");
+
+    if (!nmea_path) {
+        fprintf(stderr, "GPS_SIM_NMEA must name a recorded gps_log_N.csv or NMEA file\n");
+        exit(1);
+    }
+    if (speed && atof(speed) > 0) {
+        sim_speed = atof(speed);
+    }
+    if (vsys) {
+        vsys_mv = (uint32_t)atoi(vsys);
+    }
+    ff_host_set_root(sd_path ? sd_path : "sim_sd");
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    atexit(on_exit_report);
+}
+
+bool hal_running() {
+    return !atomic_load(&replay_done);
+}
+
+uint64_t hal_time_us() {
+    return (uint64_t)(wall_seconds() * sim_speed * 1e6);
+}
+
+uint32_t hal_time_us_32() {
+    return (uint32_t)hal_time_us();
+}
+
+//sleep in simulated time
+static void sleep_us(uint64_t us) {
+    double real = us / sim_speed;
+    struct timespec ts = {(time_t)(real / 1e6), (long)((uint64_t)real % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    sleep_us((uint64_t)ms * 1000);
+}
+
+//the replayed UART data waits in the ring, a plain sleep is enough
+uint32_t hal_idle_us(uint32_t max_us) {
+    uint64_t start = hal_time_us();
+    sleep_us(max_us);
+    return (uint32_t)(hal_time_us() - start);
+}
+
+uint32_t hal_perf_time_us() {
+    return (uint32_t)(wall_seconds() * 1e6);
+}
+
+static void wait_until(uint64_t time_us) {
+    uint64_t now = hal_time_us();
+    if (now < time_us) {
+        sleep_us(time_us - now);
+    }
+}
+
+static bool mpu_read_row(int16_t row[7], uint64_t *row_time) {
+    char line[160];
+    while (mpu_source && fgets(line, sizeof(line), mpu_source)) {
+        unsigned long long time_us;
+        int ax, ay, az, gx, gy, gz;
+        if (sscanf(line, "%llu,%d,%d,%d,%d,%d,%d", &time_us, &ax, &ay, &az, &gx, &gy, &gz) == 7) {
+            int16_t values[7] = {(int16_t)ax, (int16_t)ay, (int16_t)az, 0, (int16_t)gx, (int16_t)gy, (int16_t)gz};
+            memcpy(row, values, sizeof(values));
+            *row_time = time_us;
+            return true;
+        }
+    }
+    return false;
+}
+
+//recorded row at or before the sample time, so the replay keeps its pace at any sample rate
+//a stationary sensor before the replay starts and after the last row
+static void mpu_values_at(uint64_t sample_us, int16_t values[7]) {
+    static const int16_t stationary[7] = {0, 0, MPU6050_ACCEL_1G, 0, 0, 0, 0};
+    static int16_t current[7] = {0, 0, MPU6050_ACCEL_1G, 0, 0, 0, 0};
+    static int16_t next[7];
+    static uint64_t next_time;
+    static bool has_next = false;
+    static bool opened = false;
+
+    if (!replay_started || sample_us < replay_start_us) {
+        memcpy(values, stationary, sizeof(stationary));
+        return;
+    }
+    if (!opened) {
+        opened = true;
+        has_next = mpu_read_row(next, &next_time);
+        if (!replay_has_origin) {
+            replay_origin_us = next_time;
+        }
+    }
+
+    //both logs come from the same clock, so the rows line up with the replayed fixes
+    int64_t elapsed = (int64_t)(sample_us - replay_start_us);
+    while (has_next && (int64_t)(next_time - replay_origin_us) <= elapsed) {
+        memcpy(current, next, sizeof(current));
+        has_next = mpu_read_row(next, &next_time);
+        if (!has_next) {
+            memcpy(current, stationary, sizeof(current));
+        }
+    }
+    memcpy(values, current, sizeof(current));
+}
+
+//advance the emulated sensor to the current time, queueing samples in its FIFO
+static void mpu_update() {
+    uint64_t now = hal_time_us();
+    uint64_t period_us = 1000 * (1 + mpu_regs[MPU6050_REG_SMPLRT_DIV]);
+    bool fifo_enabled = (mpu_regs[MPU6050_REG_USER_CTRL] & MPU6050_USER_CTRL_FIFO_EN) &&
+                        (mpu_regs[MPU6050_REG_FIFO_EN] & MPU6050_FIFO_EN_ACCEL_GYRO);
+
+    //a stall this long always overflows the FIFO, skip ahead instead of generating every sample
+    if (now > mpu_next_sample_us + 1000000) {
+        if (fifo_enabled) {
+            mpu_regs[MPU6050_REG_INT_STATUS] |= MPU6050_INT_FIFO_OFLOW;
+        }
+        mpu_next_sample_us = now;
+    }
+
+    while (mpu_next_sample_us <= now) {
+        int16_t values[7];
+        mpu_values_at(mpu_next_sample_us, values);
+        for (int i = 0; i < 7; i++) {
+            mpu_sample[2 * i] = (uint8_t)(values[i] >> 8);
+            mpu_sample[2 * i + 1] = (uint8_t)values[i];
+        }
+
+        if (fifo_enabled) {
+            //accel xyz then gyro xyz, the temperature is not queued
+            for (int i = 0; i < 14; i++) {
+                if (i == 6 || i == 7) {
+                    continue;
+                }
+                if (mpu_fifo_count == MPU6050_FIFO_SIZE) {
+                    //like the sensor, overwrite the oldest byte and flag the overflow
+                    mpu_fifo_head = (mpu_fifo_head + 1) % MPU6050_FIFO_SIZE;
+                    mpu_fifo_count--;
+                    mpu_regs[MPU6050_REG_INT_STATUS] |= MPU6050_INT_FIFO_OFLOW;
+                }
+                mpu_fifo[(mpu_fifo_head + mpu_fifo_count) % MPU6050_FIFO_SIZE] = mpu_sample[i];
+                mpu_fifo_count++;
+            }
+        }
+        mpu_next_sample_us += period_us;
+    }
+}
+
+void hal_i2c_init(uint32_t index, uint32_t baud_rate, uint32_t sda_pin, uint32_t scl_pin) {
+    memset(mpu_regs, 0, sizeof(mpu_regs));
+    mpu_regs[MPU6050_REG_PWR_MGMT_1] = 0x40; //sleep bit set at power up
+    mpu_regs[0x75] = MPU6050_ADDR;           //WHO_AM_I
+    mpu_next_sample_us = hal_time_us();
+
+    if (imu_path) {
+        mpu_source = fopen(imu_path, "r");
+        if (!mpu_source) {
+            perror("Unable to open GPS_SIM_IMU");
+        }
+    }
+}
+
+int hal_i2c_write(uint32_t index, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    if (addr != MPU6050_ADDR || len == 0) {
+        return -1;
+    }
+    mpu_update();
+
+    mpu_reg_ptr = src[0] & 0x7F;
+    for (size_t i = 1; i < len; i++) {
+        uint8_t reg = mpu_reg_ptr;
+        mpu_regs[reg] = src[i];
+        if (reg == MPU6050_REG_USER_CTRL && (src[i] & MPU6050_USER_CTRL_FIFO_RESET)) {
+            mpu_fifo_head = 0;
+            mpu_fifo_count = 0;
+            mpu_regs[reg] &= ~MPU6050_USER_CTRL_FIFO_RESET;
+        }
+        mpu_reg_ptr = (mpu_reg_ptr + 1) & 0x7F;
+    }
+    return (int)len;
+}
+
+int hal_i2c_read(uint32_t index, uint8_t addr, uint8_t *dst, size_t len, bool nostop) {
+    if (addr != MPU6050_ADDR) {
+        return -1;
+    }
+    mpu_update();
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t reg = mpu_reg_ptr;
+        if (reg == MPU6050_REG_FIFO_R_W) {
+            //FIFO reads do not advance the register pointer
+            if (mpu_fifo_count > 0) {
+                dst[i] = mpu_fifo[mpu_fifo_head];
+                mpu_fifo_head = (mpu_fifo_head + 1) % MPU6050_FIFO_SIZE;
+                mpu_fifo_count--;
+            }
+            else {
+                dst[i] = 0;
+            }
+            continue;
+        }
+
+        if (reg >= MPU6050_REG_ACCEL_XOUT_H && reg < MPU6050_REG_ACCEL_XOUT_H + 14) {
+            dst[i] = mpu_sample[reg - MPU6050_REG_ACCEL_XOUT_H];
+        }
+        else if (reg == MPU6050_REG_FIFO_COUNTH) {
+            dst[i] = (uint8_t)(mpu_fifo_count >> 8);
+        }
+        else if (reg == MPU6050_REG_FIFO_COUNTH + 1) {
+            dst[i] = (uint8_t)mpu_fifo_count;
+        }
+        else {
+            dst[i] = mpu_regs[reg];
+        }
+
+        //INT_STATUS is cleared by reading it
+        if (reg == MPU6050_REG_INT_STATUS) {
+            mpu_regs[reg] = 0;
+        }
+        mpu_reg_ptr = (mpu_reg_ptr + 1) & 0x7F;
+    }
+    return (int)len;
+}
+
+//deliver one sentence a byte at a time at the baud rate, starting at time_us
+static void replay_sentence(const char *body, uint64_t time_us) {
+    char sentence[NMEA_MAX_SENTENCE + 4];
+    int len = snprintf(sentence, sizeof(sentence), "$%s\r\n", body);
+    if (len <= 0 || len >= (int)sizeof(sentence)) {
+        return;
+    }
+
+    for (int i = 0; i < len; i++) {
+        wait_until(time_us + (uint64_t)i * uart_byte_us);
+        rx_handler((uint8_t)sentence[i], 0);
+    }
+    replay_bytes += len;
+}
+
+static void *uart_replay(void *arg) {
+    FILE *file = fopen(nmea_path, "r");
+    if (!file) {
+        perror("Unable to open GPS_SIM_NMEA");
+        atomic_store(&replay_done, true);
+        return NULL;
+    }
+
+    char line[256];
+    uint64_t base = replay_start_us;
+    uint64_t raw_time = 0;
+    bool raw_started = false;
+    uint64_t last_time = base;
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        uint64_t time_us;
+        const char *body;
+        if (line[0] == '$') {
+            //raw NMEA, a new fix starts with every RMC sentence
+            if (strncmp(line + 3, "RMC", 3) == 0 && raw_started) {
+                raw_time += RAW_NMEA_FIX_INTERVAL_US;
+            }
+            raw_started = true;
+            time_us = base + raw_time;
+            body = line + 1;
+        }
+        else if (isdigit((unsigned char)line[0])) {
+            //gps_log_N.csv row: timestamp,sentence without the '$'
+            char *comma = strchr(line, ',');
+            if (!comma) {
+                continue;
+            }
+            uint64_t stamp = strtoull(line, NULL, 10);
+            time_us = stamp > replay_origin_us ? base + (stamp - replay_origin_us) : base;
+            body = comma + 1;
+        }
+        else {
+            continue; //header
+        }
+
+        //the logger stamps RMC and VTG of a fix alike, keep the later one behind the first
+        if (time_us < last_time) {
+            time_us = last_time;
+        }
+        replay_sentence(body, time_us);
+        last_time = hal_time_us();
+    }
+    fclose(file);
+
+    wait_until(hal_time_us() + REPLAY_TAIL_US);
+    atomic_store(&replay_done, true);
+    return NULL;
+}
+
+void hal_uart_init(uint32_t index, uint32_t baud_rate, uint32_t tx_pin, uint32_t rx_pin,
+                   HAL_UART_Rx_Handler handler) {
+    rx_handler = handler;
+    uart_byte_us = 10 * 1000000 / baud_rate; //start, 8 data and stop bit
+
+    //the first timestamp of a gps_log_N.csv is the time origin of both replays
+    FILE *file = fopen(nmea_path, "r");
+    char line[256];
+    while (file && fgets(line, sizeof(line), file)) {
+        if (isdigit((unsigned char)line[0])) {
+            replay_origin_us = strtoull(line, NULL, 10);
+            replay_has_origin = true;
+            break;
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+
+    replay_start_us = hal_time_us();
+    replay_started = true;
+    pthread_create(&uart_thread, NULL, uart_replay, NULL);
+    pthread_detach(uart_thread);
+}
+
+//configuration commands to the receiver are counted, the replay does not react to them
+void hal_uart_write(uint32_t index, const uint8_t *src, size_t len) {
+    tx_bytes += len;
+}
+
+//the replay goes on at the new rate, as if the receiver had followed
+void hal_uart_set_baud_rate(uint32_t index, uint32_t baud_rate) {
+    uart_byte_us = 10 * 1000000 / baud_rate;
+}
+
+void hal_adc_init(uint32_t gpio) {
+}
+
+//VSYS is read through a 1/3 divider against 3.3V
+uint16_t hal_adc_read(uint32_t input) {
+    return (uint16_t)(vsys_mv * 4096 / (3 * 3300));
+}
+
+void hal_pps_init(uint32_t gpio, void (*on_edge)(void)) {
+}
+
+static void *core1_start(void *entry) {
+    ((void (*)(void))entry)();
+    return NULL;
+}
+
+void hal_core1_launch(void (*entry)(void)) {
+    pthread_create(&core1_thread, NULL, core1_start, (void *)entry);
+}
+
+void hal_core1_join() {
+    pthread_join(core1_thread, NULL);
+}
+
+void hal_event_signal() {
+    pthread_mutex_lock(&event_lock);
+    event_pending = true;
+    pthread_cond_signal(&event_cond);
+    pthread_mutex_unlock(&event_lock);
+}
+
+//like __wfe() the event is latched, a signal sent before the wait is not lost
+void hal_event_wait() {
+    pthread_mutex_lock(&event_lock);
+    while (!event_pending) {
+        pthread_cond_wait(&event_cond, &event_lock);
+    }
+    event_pending = false;
+    pthread_mutex_unlock(&event_lock);
+}
+
+bool hal_storage_init() {
+    return true;
+}
@@ -0,0 +1,165 @@
+/*
+File: hal_pico.c
+Author: Leonardo DaGraca
+
+Pico SDK backend of hal.h used by the firmware build.
+*/
+#include "hal.h"
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/adc.h"
+#include "sd_card.h"
+
+static uart_inst_t *rx_uart;
+static HAL_UART_Rx_Handler rx_handler;
+static void (*pps_handler)(void);
+static void (*core1_entry)(void);
+
+static i2c_inst_t *i2c_port(uint32_t index) {
+    return index ? i2c1 : i2c0;
+}
+
+void hal_init() {
+    stdio_init_all();
+}
+
+//the firmware logs until it is powered off
+bool hal_running() {
+    return true;
+}
+
+uint64_t hal_time_us() {
+    return time_us_64();
+}
+
+uint32_t hal_time_us_32() {
+    return time_us_32();
+}
+
+void hal_sleep_ms(uint32_t ms) {
+    sleep_ms(ms);
+}
+
+//the core sleeps in __wfe and wakes for the UART interrupt, a timer alarm or an event from core 1
+uint32_t hal_idle_us(uint32_t max_us) {
+    uint32_t start = time_us_32();
+    best_effort_wfe_or_timeout(make_timeout_time_us(max_us));
+    return time_us_32() - start;
+}
+
+//the M0+ has no cycle counter, the 1MHz system timer is the finest clock available
+uint32_t hal_perf_time_us() {
+    return time_us_32();
+}
+
+void hal_i2c_init(uint32_t index, uint32_t baud_rate, uint32_t sda_pin, uint32_t scl_pin) {
+    i2c_init(i2c_port(index), baud_rate);
+    gpio_set_function(sda_pin, GPIO_FUNC_I2C);
+    gpio_set_function(scl_pin, GPIO_FUNC_I2C);
+    gpio_pull_up(sda_pin);
+    gpio_pull_up(scl_pin);
+}
+
+int hal_i2c_write(uint32_t index, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    return i2c_write_blocking(i2c_port(index), addr, src, len, nostop);
+}
+
+int hal_i2c_read(uint32_t index, uint8_t addr, uint8_t *dst, size_t len, bool nostop) {
+    return i2c_read_blocking(i2c_port(index), addr, dst, len, nostop);
+}
+
+static void on_uart_rx() {
+    uart_hw_t *hw = uart_get_hw(rx_uart);
+
+    while (uart_is_readable(rx_uart)) {
+        //read the data register directly to get the error flags with the byte
+        uint32_t dr = hw->dr;
+        uint32_t errors = 0;
+
+        if (dr & UART_UARTDR_OE_BITS) {
+            errors |= HAL_UART_OVERRUN;
+        }
+        if (dr & (UART_UARTDR_BE_BITS | UART_UARTDR_PE_BITS | UART_UARTDR_FE_BITS)) {
+            errors |= HAL_UART_ERROR;
+        }
+        rx_handler((uint8_t)(dr & UART_UARTDR_DATA_BITS), errors);
+    }
+}
+
+void hal_uart_init(uint32_t index, uint32_t baud_rate, uint32_t tx_pin, uint32_t rx_pin,
+                   HAL_UART_Rx_Handler handler) {
+    rx_uart = index ? uart1 : uart0;
+    rx_handler = handler;
+
+    uart_init(rx_uart, baud_rate);
+    gpio_set_function(tx_pin, GPIO_FUNC_UART);
+    gpio_set_function(rx_pin, GPIO_FUNC_UART);
+    uart_set_fifo_enabled(rx_uart, true);
+
+    int uart_irq = index ? UART1_IRQ : UART0_IRQ;
+    irq_set_exclusive_handler(uart_irq, on_uart_rx);
+    irq_set_enabled(uart_irq, true);
+    uart_set_irq_enables(rx_uart, true, false);
+}
+
+void hal_uart_write(uint32_t index, const uint8_t *src, size_t len) {
+    uart_write_blocking(index ? uart1 : uart0, src, len);
+}
+
+void hal_uart_set_baud_rate(uint32_t index, uint32_t baud_rate) {
+    uart_inst_t *uart = index ? uart1 : uart0;
+    uart_tx_wait_blocking(uart);
+    uart_set_baudrate(uart, baud_rate);
+}
+
+void hal_adc_init(uint32_t gpio) {
+    adc_init();
+    adc_gpio_init(gpio);
+}
+
+uint16_t hal_adc_read(uint32_t input) {
+    adc_select_input(input);
+    return adc_read();
+}
+
+static void on_gpio_edge(uint gpio, uint32_t events) {
+    pps_handler();
+}
+
+void hal_pps_init(uint32_t gpio, void (*on_edge)(void)) {
+    pps_handler = on_edge;
+    gpio_init(gpio);
+    gpio_set_dir(gpio, GPIO_IN);
+    gpio_set_irq_enabled_with_callback(gpio, GPIO_IRQ_EDGE_RISE, true, on_gpio_edge);
+}
+
+//tell core 0 through the inter-core FIFO when the entry function returns
+static void core1_trampoline() {
+    core1_entry();
+    multicore_fifo_push_blocking(0);
+}
+
+void hal_core1_launch(void (*entry)(void)) {
+    core1_entry = entry;
+    multicore_launch_core1(core1_trampoline);
+}
+
+void hal_core1_join() {
+    multicore_fifo_pop_blocking();
+}
+
+void hal_event_signal() {
+    __sev();
+}
+
+void hal_event_wait() {
+    __wfe();
+}
+
+bool hal_storage_init() {
+    return sd_init_driver();
+}
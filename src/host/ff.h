@@ -0,0 +1,104 @@
+/*
+File: host/ff.h
+Author: Leonardo DaGraca
+
+Subset of the FatFs API for the host simulator build, backed by POSIX files.
+It shadows the FatFs header of the SD card library so the logger compiles
+unchanged; paths are resolved under the directory passed to ff_host_set_root()
+(the simulated SD card). Only the calls and flags used by the logger exist.
+
+It also counts the sectors FatFs would program on the card: a data sector once
+it is complete, a partial one whenever a sync or a seek flushes the sector
+buffer, and the directory entry and FAT sectors a sync rewrites.
+*/
+#ifndef FF_H
+#define FF_H
+
+#include <stdint.h>
+
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef char TCHAR;
+typedef uint64_t FSIZE_t;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER
+} FRESULT;
+
+#define FA_READ 0x01
+#define FA_WRITE 0x02
+#define FA_OPEN_EXISTING 0x00
+#define FA_CREATE_NEW 0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS 0x10
+#define FA_OPEN_APPEND 0x30
+
+typedef struct {
+    int mounted;
+} FATFS;
+
+typedef struct {
+    int fd;
+    FSIZE_t fptr;
+    uint8_t modified;       //written since the last sync, the directory entry is stale
+    uint8_t sector_dirty;   //the partial sector at fptr sits in the sector buffer
+    uint8_t fat_dirty;      //clusters were allocated since the last sync
+} FIL;
+
+//sector size and the cluster size of a FAT32 formatted SDHC card
+#define FF_HOST_SECTOR_SIZE 512
+#define FF_HOST_CLUSTER_SIZE 32768
+
+typedef struct {
+    uint32_t writes;        //f_write calls
+    uint32_t syncs;         //f_sync calls
+    uint32_t data_sectors;  //file data sectors programmed
+    uint32_t meta_sectors;  //directory entry and FAT sectors programmed
+} FF_Host_Stats;
+
+void ff_host_set_root(const char *path);
+//power loss injection: after budget more bytes reach the card the sector being written is torn
+//and every later write or sync fails, a negative budget restores power
+void ff_host_cut_power_after(int64_t budget);
+int ff_host_powered();
+//largest contiguous free run f_expand finds on the simulated card, a negative size removes the limit
+void ff_host_set_free_run(int64_t bytes);
+void ff_host_get_stats(FF_Host_Stats *stats);
+void ff_host_reset_stats();
+
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt);
+FRESULT f_unmount(const TCHAR *path);
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode);
+FRESULT f_close(FIL *fp);
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br);
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs);
+FRESULT f_truncate(FIL *fp);
+FRESULT f_sync(FIL *fp);
+FRESULT f_expand(FIL *fp, FSIZE_t fsz, BYTE opt);
+FRESULT f_mkdir(const TCHAR *path);
+TCHAR *f_gets(TCHAR *buff, int len, FIL *fp);
+FSIZE_t f_size(FIL *fp);
+
+#define f_tell(fp) ((fp)->fptr)
+
+#endif
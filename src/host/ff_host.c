@@ -0,0 +1,288 @@
+/*
+File: host/ff_host.c
+Author: Leonardo DaGraca
+
+POSIX implementation of the FatFs subset in host/ff.h.
+f_sync() really calls fsync(), so SD card sync costs show up in simulator timings.
+ff_host_cut_power_after() simulates a power loss in the middle of a write:
+the bytes up to the cut reach the file, the rest of that sector is filled
+with garbage like a half programmed flash page and the card stops responding.
+The sector counts follow FatFs with its one sector buffer per file.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ff.h"
+
+static char root[256] = ".";
+static int64_t power_budget = -1;
+static int powered = 1;
+static int64_t free_run = -1;
+static FF_Host_Stats stats;
+
+void ff_host_cut_power_after(int64_t budget) {
+    power_budget = budget;
+    powered = 1;
+}
+
+int ff_host_powered() {
+    return powered;
+}
+
+void ff_host_set_free_run(int64_t bytes) {
+    free_run = bytes;
+}
+
+void ff_host_get_stats(FF_Host_Stats *dst) {
+    *dst = stats;
+}
+
+void ff_host_reset_stats() {
+    memset(&stats, 0, sizeof(stats));
+}
+
+//what FatFs writes when it syncs: the buffered partial sector, the directory entry and the FAT
+static void count_sync(FIL *fp) {
+    if (!fp->modified) {
+        return;
+    }
+    stats.data_sectors += fp->sector_dirty;
+    stats.meta_sectors += 1 + fp->fat_dirty;
+    fp->modified = 0;
+    fp->sector_dirty = 0;
+    fp->fat_dirty = 0;
+}
+
+//sectors completed by a write go to the card, a partial last one stays in the sector buffer
+static void count_write(FIL *fp, FSIZE_t size, UINT btw) {
+    FSIZE_t end = fp->fptr + btw;
+    stats.writes++;
+    if (btw == 0) {
+        return;
+    }
+    stats.data_sectors += (uint32_t)(end / FF_HOST_SECTOR_SIZE - fp->fptr / FF_HOST_SECTOR_SIZE);
+    fp->sector_dirty = end % FF_HOST_SECTOR_SIZE != 0;
+    if ((end + FF_HOST_CLUSTER_SIZE - 1) / FF_HOST_CLUSTER_SIZE > (size + FF_HOST_CLUSTER_SIZE - 1) / FF_HOST_CLUSTER_SIZE) {
+        fp->fat_dirty = 1;
+    }
+    fp->modified = 1;
+}
+
+void ff_host_set_root(const char *path) {
+    snprintf(root, sizeof(root), "%s", path);
+}
+
+static void full_path(char *dst, size_t size, const TCHAR *path) {
+    //drop a drive prefix such as "0:"
+    const char *colon = strchr(path, ':');
+    if (colon) {
+        path = colon + 1;
+    }
+    while (*path == '/') {
+        path++;
+    }
+    snprintf(dst, size, "%s/%s", root, path);
+}
+
+static FRESULT from_errno(int err) {
+    switch (err) {
+        case ENOENT: return FR_NO_FILE;
+        case ENOTDIR: return FR_NO_PATH;
+        case EEXIST: return FR_EXIST;
+        case EACCES:
+        case EPERM: return FR_DENIED;
+        case EROFS: return FR_WRITE_PROTECTED;
+        case EMFILE:
+        case ENFILE: return FR_TOO_MANY_OPEN_FILES;
+        case ENAMETOOLONG: return FR_INVALID_NAME;
+        default: return FR_DISK_ERR;
+    }
+}
+
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt) {
+    struct stat st;
+    if (mkdir(root, 0777) != 0 && (stat(root, &st) != 0 || !S_ISDIR(st.st_mode))) {
+        return FR_NOT_READY;
+    }
+    fs->mounted = 1;
+    return FR_OK;
+}
+
+FRESULT f_unmount(const TCHAR *path) {
+    return FR_OK;
+}
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode) {
+    char name[512];
+    full_path(name, sizeof(name), path);
+
+    int flags = (mode & FA_WRITE) ? ((mode & FA_READ) ? O_RDWR : O_WRONLY) : O_RDONLY;
+    if (mode & FA_CREATE_ALWAYS) {
+        flags |= O_CREAT | O_TRUNC;
+    }
+    else if (mode & FA_CREATE_NEW) {
+        flags |= O_CREAT | O_EXCL;
+    }
+    else if (mode & FA_OPEN_ALWAYS) {
+        flags |= O_CREAT;
+    }
+
+    fp->fd = open(name, flags, 0666);
+    if (fp->fd < 0) {
+        return from_errno(errno);
+    }
+
+    fp->fptr = 0;
+    fp->modified = 0;
+    fp->sector_dirty = 0;
+    fp->fat_dirty = 0;
+    if ((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND) {
+        fp->fptr = (FSIZE_t)lseek(fp->fd, 0, SEEK_END);
+    }
+    return FR_OK;
+}
+
+FRESULT f_close(FIL *fp) {
+    if (fp->fd < 0) {
+        return FR_INVALID_OBJECT;
+    }
+    count_sync(fp);
+    int rc = close(fp->fd);
+    fp->fd = -1;
+    return rc == 0 ? FR_OK : from_errno(errno);
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+    ssize_t n = pread(fp->fd, buff, btr, (off_t)fp->fptr);
+    if (n < 0) {
+        return from_errno(errno);
+    }
+    fp->fptr += (FSIZE_t)n;
+    if (br) {
+        *br = (UINT)n;
+    }
+    return FR_OK;
+}
+
+//writes what fits in the power budget, then tears the rest of the sector
+static FRESULT write_until_power_loss(FIL *fp, const void *buff, UINT btw, UINT *bw) {
+    UINT written = (UINT)power_budget;
+    if (written > 0 && pwrite(fp->fd, buff, written, (off_t)fp->fptr) != (ssize_t)written) {
+        return from_errno(errno);
+    }
+
+    uint8_t garbage[512];
+    UINT torn = 512 - (UINT)((fp->fptr + written) % 512);
+    if (torn > btw - written) {
+        torn = btw - written;
+    }
+    for (UINT i = 0; i < torn; i++) {
+        garbage[i] = (uint8_t)rand();
+    }
+    pwrite(fp->fd, garbage, torn, (off_t)(fp->fptr + written));
+
+    powered = 0;
+    power_budget = 0;
+    if (bw) {
+        *bw = written;
+    }
+    fp->fptr += written;
+    return FR_DISK_ERR;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw) {
+    //like FatFs, a failed write reports the bytes it got through
+    if (bw) {
+        *bw = 0;
+    }
+    if (!powered) {
+        return FR_NOT_READY;
+    }
+    if (power_budget >= 0) {
+        if ((int64_t)btw > power_budget) {
+            return write_until_power_loss(fp, buff, btw, bw);
+        }
+        power_budget -= btw;
+    }
+
+    count_write(fp, f_size(fp), btw);
+    ssize_t n = pwrite(fp->fd, buff, btw, (off_t)fp->fptr);
+    if (n < 0) {
+        return from_errno(errno);
+    }
+    fp->fptr += (FSIZE_t)n;
+    if (bw) {
+        *bw = (UINT)n;
+    }
+    return FR_OK;
+}
+
+//like FatFs, seeking past the end of a writable file extends it
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs) {
+    if (fp->sector_dirty && ofs / FF_HOST_SECTOR_SIZE != fp->fptr / FF_HOST_SECTOR_SIZE) {
+        stats.data_sectors++;
+        fp->sector_dirty = 0;
+    }
+    fp->fptr = ofs;
+    if (ofs > f_size(fp) && ftruncate(fp->fd, (off_t)ofs) != 0) {
+        return from_errno(errno);
+    }
+    return FR_OK;
+}
+
+FRESULT f_truncate(FIL *fp) {
+    return ftruncate(fp->fd, (off_t)fp->fptr) == 0 ? FR_OK : from_errno(errno);
+}
+
+FRESULT f_sync(FIL *fp) {
+    if (!powered) {
+        return FR_NOT_READY;
+    }
+    stats.syncs++;
+    count_sync(fp);
+    return fsync(fp->fd) == 0 ? FR_OK : from_errno(errno);
+}
+
+//like FatFs the file must be empty and the space one contiguous run (opt 1), the new space reads as
+//zeros here instead of old card content
+FRESULT f_expand(FIL *fp, FSIZE_t fsz, BYTE opt) {
+    if (f_size(fp) != 0 || (free_run >= 0 && fsz > (FSIZE_t)free_run)) {
+        return FR_DENIED;
+    }
+    fp->fat_dirty = 1;
+    fp->modified = 1;
+    return ftruncate(fp->fd, (off_t)fsz) == 0 ? FR_OK : from_errno(errno);
+}
+
+FRESULT f_mkdir(const TCHAR *path) {
+    char name[512];
+    full_path(name, sizeof(name), path);
+    return mkdir(name, 0777) == 0 ? FR_OK : from_errno(errno);
+}
+
+TCHAR *f_gets(TCHAR *buff, int len, FIL *fp) {
+    int n = 0;
+    while (n < len - 1) {
+        char c;
+        UINT got = 0;
+        if (f_read(fp, &c, 1, &got) != FR_OK || got == 0) {
+            break;
+        }
+        buff[n++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    buff[n] = '\0';
+    return n ? buff : NULL;
+}
+
+FSIZE_t f_size(FIL *fp) {
+    struct stat st;
+    return fstat(fp->fd, &st) == 0 ? (FSIZE_t)st.st_size : 0;
+}
@@ -0,0 +1,308 @@
+/*
+File: imu_calibration.c
+Author: Leonardo DaGraca
+
+Online IMU offset calibration, see imu_calibration.h.
+Per sample this is one integer Welford step per axis (a hardware divide, no
+floating point on the M0+). The double math of the sphere fit only runs when
+a still window closes, at most once per second.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include "imu_calibration.h"
+#include "journal.h"
+
+//nearest whole count of a value in 1/256 counts
+static int16_t round_q8(int32_t value) {
+    return (int16_t)((value >= 0 ? value + 128 : value - 128) / 256);
+}
+
+static void reset_window(IMU_Calibration *cal, uint64_t now_us) {
+    cal->window_start_us = now_us;
+    cal->window_samples = 0;
+    memset(cal->axis, 0, sizeof(cal->axis));
+}
+
+void imu_calibration_init(IMU_Calibration *cal, uint64_t now_us) {
+    memset(cal, 0, sizeof(*cal));
+    cal->last_save_us = now_us;
+    reset_window(cal, now_us);
+}
+
+static bool record_valid(const IMU_Cal_Record *record) {
+    return record->magic == IMU_CAL_MAGIC &&
+           record->crc == journal_crc32(record, offsetof(IMU_Cal_Record, crc));
+}
+
+bool imu_calibration_load(IMU_Calibration *cal) {
+    FIL file;
+    IMU_Cal_Record slots[2];
+    UINT read = 0;
+
+    if (f_open(&file, IMU_CAL_PATH, FA_READ) != FR_OK) {
+        return false;
+    }
+    memset(slots, 0, sizeof(slots));
+    f_read(&file, slots, sizeof(slots), &read);
+    f_close(&file);
+
+    const IMU_Cal_Record *best = NULL;
+    for (int i = 0; i < 2; i++) {
+        if ((i + 1) * sizeof(IMU_Cal_Record) <= read && record_valid(&slots[i]) &&
+            (!best || slots[i].sequence > best->sequence)) {
+            best = &slots[i];
+        }
+    }
+    if (!best) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        cal->applied_accel[i] = best->accel[i];
+        cal->applied_gyro[i] = best->gyro[i];
+        cal->accel_q8[i] = best->accel[i] * 256;
+        cal->gyro_q8[i] = best->gyro[i] * 256;
+    }
+    //a saved gyro bias is a good start but the sensor may be at another temperature now
+    cal->gyro_samples = best->gyro_samples < IMU_CAL_GYRO_LOADED_SAMPLES ? best->gyro_samples : IMU_CAL_GYRO_LOADED_SAMPLES;
+    cal->accel_windows = best->accel_windows;
+    cal->sequence = best->sequence;
+    return true;
+}
+
+//solve the 4x4 normal equations by Gaussian elimination with partial pivoting
+static bool solve4(double a[4][4], double b[4], double x[4]) {
+    for (int col = 0; col < 4; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < 4; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) {
+                pivot = row;
+            }
+        }
+        if (fabs(a[pivot][col]) < 1e-9) {
+            return false;
+        }
+        if (pivot != col) {
+            for (int k = 0; k < 4; k++) {
+                double t = a[col][k];
+                a[col][k] = a[pivot][k];
+                a[pivot][k] = t;
+            }
+            double t = b[col];
+            b[col] = b[pivot];
+            b[pivot] = t;
+        }
+        for (int row = col + 1; row < 4; row++) {
+            double f = a[row][col] / a[col][col];
+            for (int k = col; k < 4; k++) {
+                a[row][k] -= f * a[col][k];
+            }
+            b[row] -= f * b[col];
+        }
+    }
+    for (int row = 3; row >= 0; row--) {
+        double sum = b[row];
+        for (int k = row + 1; k < 4; k++) {
+            sum -= a[row][k] * x[k];
+        }
+        x[row] = sum / a[row][row];
+    }
+    return true;
+}
+
+//add the mean of a still window (raw counts) to the sphere fit and refit once the orientations allow it
+static void fit_accel(IMU_Calibration *cal, const int32_t mean_q8[3]) {
+    //in g, so the normal equations stay well scaled
+    double p[4];
+    for (int i = 0; i < 3; i++) {
+        p[i] = mean_q8[i] / (256.0 * MPU6050_ACCEL_1G);
+        int32_t counts = mean_q8[i] / 256;
+        if (counts > IMU_CAL_DIRECTION_COUNTS) {
+            cal->directions |= 1 << (2 * i);
+        }
+        else if (counts < -IMU_CAL_DIRECTION_COUNTS) {
+            cal->directions |= 1 << (2 * i + 1);
+        }
+    }
+    p[3] = 1.0;
+    double rhs = p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            cal->fit_ata[r][c] += p[r] * p[c];
+        }
+        cal->fit_atb[r] += p[r] * rhs;
+    }
+    cal->fit_windows++;
+
+    int count = 0;
+    for (int bit = 0; bit < 6; bit++) {
+        count += (cal->directions >> bit) & 1;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        if (!(cal->directions & (3 << (2 * axis)))) {
+            return;
+        }
+    }
+    if (count < IMU_CAL_MIN_DIRECTIONS) {
+        return;
+    }
+
+    double a[4][4], b[4], x[4];
+    memcpy(a, cal->fit_ata, sizeof(a));
+    memcpy(b, cal->fit_atb, sizeof(b));
+    if (!solve4(a, b, x)) {
+        return;
+    }
+
+    //|p|^2 = 2 c.p + r^2 - |c|^2
+    double centre[3] = {x[0] / 2, x[1] / 2, x[2] / 2};
+    double radius_sq = x[3] + centre[0] * centre[0] + centre[1] * centre[1] + centre[2] * centre[2];
+    double tolerance = (double)IMU_CAL_RADIUS_TOLERANCE / MPU6050_ACCEL_1G;
+    if (radius_sq < (1 - tolerance) * (1 - tolerance) || radius_sq > (1 + tolerance) * (1 + tolerance)) {
+        return;
+    }
+    int32_t offset_q8[3];
+    for (int i = 0; i < 3; i++) {
+        double counts = centre[i] * MPU6050_ACCEL_1G;
+        if (counts > IMU_CAL_MAX_ACCEL_OFFSET || counts < -IMU_CAL_MAX_ACCEL_OFFSET) {
+            return;
+        }
+        offset_q8[i] = (int32_t)(counts * 256 + (counts < 0 ? -0.5 : 0.5));
+    }
+
+    memcpy(cal->accel_q8, offset_q8, sizeof(offset_q8));
+    cal->accel_windows = cal->fit_windows;
+    cal->unsaved = true;
+}
+
+static void close_window(IMU_Calibration *cal) {
+    if (cal->window_samples < IMU_CAL_MIN_SAMPLES) {
+        return;
+    }
+
+    int64_t accel_sq = 0;
+    for (int i = 0; i < 6; i++) {
+        int64_t variance = (cal->axis[i].m2_q16 / cal->window_samples) >> 16;
+        if (variance > (i < 3 ? IMU_CAL_ACCEL_STILL_VAR : IMU_CAL_GYRO_STILL_VAR)) {
+            cal->moving_windows++;
+            return;
+        }
+        if (i < 3) {
+            int64_t mean = cal->axis[i].mean_q8 / 256 - cal->accel_q8[i] / 256;
+            accel_sq += mean * mean;
+        }
+        else if (cal->axis[i].mean_q8 > IMU_CAL_GYRO_MAX_OFFSET * 256 || cal->axis[i].mean_q8 < -IMU_CAL_GYRO_MAX_OFFSET * 256) {
+            cal->moving_windows++;
+            return;
+        }
+    }
+    int64_t low = MPU6050_ACCEL_1G - IMU_CAL_ACCEL_GATE, high = MPU6050_ACCEL_1G + IMU_CAL_ACCEL_GATE;
+    if (accel_sq < low * low || accel_sq > high * high) {
+        cal->moving_windows++;
+        return;
+    }
+    cal->still_windows++;
+
+    //weighted mean of the previous estimate and this window, the weight is capped so the bias can drift
+    uint32_t weight = cal->gyro_samples;
+    uint32_t total = weight + cal->window_samples;
+    for (int i = 0; i < 3; i++) {
+        int64_t sum = (int64_t)cal->gyro_q8[i] * weight + (int64_t)cal->axis[3 + i].mean_q8 * cal->window_samples;
+        cal->gyro_q8[i] = (int32_t)(sum / total);
+    }
+    cal->gyro_samples = total < IMU_CAL_GYRO_MAX_SAMPLES ? total : IMU_CAL_GYRO_MAX_SAMPLES;
+    cal->unsaved = true;
+
+    int32_t accel_mean_q8[3] = {cal->axis[0].mean_q8, cal->axis[1].mean_q8, cal->axis[2].mean_q8};
+    fit_accel(cal, accel_mean_q8);
+
+    for (int i = 0; i < 3; i++) {
+        if (round_q8(cal->gyro_q8[i]) != cal->applied_gyro[i] || round_q8(cal->accel_q8[i]) != cal->applied_accel[i]) {
+            cal->changed = true;
+        }
+    }
+}
+
+bool imu_calibration_add(IMU_Calibration *cal, uint64_t time_us, const IMU_Reading *read) {
+    //back to raw counts, the estimate must not depend on the offsets in use
+    int32_t raw[6] = {
+        read->ax + cal->applied_accel[0], read->ay + cal->applied_accel[1], read->az + cal->applied_accel[2],
+        read->gx + cal->applied_gyro[0], read->gy + cal->applied_gyro[1], read->gz + cal->applied_gyro[2]
+    };
+
+    cal->window_samples++;
+    for (int i = 0; i < 6; i++) {
+        IMU_Cal_Axis *axis = &cal->axis[i];
+        int32_t value_q8 = raw[i] * 256;
+        int32_t delta = value_q8 - axis->mean_q8;
+        axis->mean_q8 += delta / (int32_t)cal->window_samples;
+        axis->m2_q16 += (int64_t)delta * (value_q8 - axis->mean_q8);
+    }
+
+    if (time_us - cal->window_start_us < IMU_CAL_WINDOW_US) {
+        return false;
+    }
+    close_window(cal);
+    reset_window(cal, time_us);
+    return true;
+}
+
+bool imu_calibration_take(IMU_Calibration *cal, int16_t accel[3], int16_t gyro[3]) {
+    if (!cal->changed) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        cal->applied_accel[i] = round_q8(cal->accel_q8[i]);
+        cal->applied_gyro[i] = round_q8(cal->gyro_q8[i]);
+        accel[i] = cal->applied_accel[i];
+        gyro[i] = cal->applied_gyro[i];
+    }
+    cal->changed = false;
+    return true;
+}
+
+bool imu_calibration_save_due(IMU_Calibration *cal, uint64_t now_us, bool force, IMU_Cal_Record *record) {
+    if (!cal->unsaved || (!force && now_us - cal->last_save_us < IMU_CAL_SAVE_INTERVAL_US)) {
+        return false;
+    }
+
+    memset(record, 0, sizeof(*record));
+    record->magic = IMU_CAL_MAGIC;
+    record->sequence = ++cal->sequence;
+    for (int i = 0; i < 3; i++) {
+        record->accel[i] = round_q8(cal->accel_q8[i]);
+        record->gyro[i] = round_q8(cal->gyro_q8[i]);
+    }
+    record->gyro_samples = cal->gyro_samples;
+    record->accel_windows = cal->accel_windows;
+    record->crc = journal_crc32(record, offsetof(IMU_Cal_Record, crc));
+
+    cal->last_save_us = now_us;
+    cal->unsaved = false;
+    return true;
+}
+
+//overwrite the older of the two slots, the newer one survives a power loss during the write
+FRESULT imu_calibration_save(const IMU_Cal_Record *record) {
+    FIL file;
+    FRESULT fr = f_open(&file, IMU_CAL_PATH, FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+    if (fr != FR_OK) {
+        return fr;
+    }
+
+    UINT written = 0;
+    fr = f_lseek(&file, (record->sequence & 1) * sizeof(IMU_Cal_Record));
+    if (fr == FR_OK) {
+        fr = f_write(&file, record, sizeof(*record), &written);
+    }
+    if (fr == FR_OK && written != sizeof(*record)) {
+        fr = FR_DISK_ERR;
+    }
+    if (fr == FR_OK) {
+        fr = f_sync(&file);
+    }
+    f_close(&file);
+    return fr;
+}
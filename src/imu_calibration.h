@@ -0,0 +1,121 @@
+/*
+File: imu_calibration.h
+Author: Leonardo DaGraca
+
+Online MPU6050 offset calibration, replacing the blocking 2000 sample routine
+that ran at every power-up. The offsets saved by the previous session are
+applied at boot, so logging starts as soon as the SD card is mounted, and
+they are refined in the background from the samples the logger reads anyway.
+
+Samples are grouped into IMU_CAL_WINDOW_US windows with running (Welford)
+mean and variance per axis. A window counts as still when every axis stays
+below its noise limit. The gyro offsets are the mean rate of the still
+windows, weighted over the last IMU_CAL_GYRO_MAX_SAMPLES so they follow the
+bias as the sensor warms up. The accelerometer offsets need no assumption
+about which way is up: the mean of every still window lies on a sphere of
+radius 1g around the offset, and a least squares sphere fit finds its centre
+once the device has rested in enough different orientations.
+
+The estimate is saved to IMU_CAL_PATH (two alternating checksummed slots, so
+a power loss during the write keeps the previous one) at most every
+IMU_CAL_SAVE_INTERVAL_US and at the end of the session.
+*/
+#ifndef IMU_CALIBRATION_H
+#define IMU_CALIBRATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ff.h"
+#include "mpu6050.h"
+
+#define IMU_CAL_PATH "imu_calibration.dat"
+#define IMU_CAL_MAGIC 0x4C414349    //"ICAL"
+
+#define IMU_CAL_WINDOW_US 1000000
+#define IMU_CAL_MIN_SAMPLES 20      //a window at the 25Hz stationary rate still qualifies
+
+//still limits on the per-window variance, in counts^2 (mpu6050_scale.h)
+//sensor noise at the 44Hz DLPF bandwidth is ~3.4mg and ~0.04 deg/s RMS
+#define IMU_CAL_ACCEL_STILL_SD (MPU6050_ACCEL_1G * 7 / 1000)                 //~7mg
+#define IMU_CAL_ACCEL_STILL_VAR (IMU_CAL_ACCEL_STILL_SD * IMU_CAL_ACCEL_STILL_SD)
+#define IMU_CAL_GYRO_STILL_SD (MPU6050_GYRO_COUNTS_PER_KDPS * 15 / 100000)   //~0.15 deg/s
+#define IMU_CAL_GYRO_STILL_VAR (IMU_CAL_GYRO_STILL_SD * IMU_CAL_GYRO_STILL_SD)
+//a still window further than this from 1g is not resting (free fall, a lift)
+#define IMU_CAL_ACCEL_GATE (MPU6050_ACCEL_1G / 10)
+//the datasheet zero rate offset is +-20 deg/s, a steady rotation faster than this is not bias
+#define IMU_CAL_GYRO_MAX_OFFSET (MPU6050_GYRO_COUNTS_PER_KDPS / 50)
+
+//still samples the gyro offsets are averaged over, ~30s at 200Hz
+#define IMU_CAL_GYRO_MAX_SAMPLES 6000
+//a saved gyro estimate starts with the weight of 2s of still samples, new ones soon take over
+#define IMU_CAL_GYRO_LOADED_SAMPLES 400
+
+//the sphere fit needs resting orientations along all three axes and at least this many of the six directions
+#define IMU_CAL_MIN_DIRECTIONS 4
+//a window counts for a direction when gravity is within ~45 deg of that axis
+#define IMU_CAL_DIRECTION_COUNTS (MPU6050_ACCEL_1G * 708 / 1000)
+#define IMU_CAL_MAX_ACCEL_OFFSET (MPU6050_ACCEL_1G / 5)         //0.2g, anything larger is a bad fit
+#define IMU_CAL_RADIUS_TOLERANCE (MPU6050_ACCEL_1G / 20)        //fitted 1g within 5% (sensitivity tolerance is 3%)
+
+#define IMU_CAL_SAVE_INTERVAL_US (60 * 1000000ULL)
+
+//per-axis running statistics of one window, the mean is kept in 1/256 counts
+typedef struct {
+    int32_t mean_q8;
+    int64_t m2_q16;             //sum of squared deviations
+} IMU_Cal_Axis;
+
+//saved calibration, one slot of IMU_CAL_PATH
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;          //the slot with the higher sequence is the newer one
+    int16_t accel[3];           //raw counts subtracted from every sample
+    int16_t gyro[3];
+    uint32_t gyro_samples;      //still samples behind the gyro offsets, 0 = never estimated
+    uint32_t accel_windows;     //still windows behind the accel offsets, 0 = never fitted
+    uint32_t crc;
+} IMU_Cal_Record;
+
+typedef struct {
+    //offsets the driver currently subtracts, the samples passed in are corrected with them
+    int16_t applied_accel[3];
+    int16_t applied_gyro[3];
+
+    //current estimate in 1/256 counts
+    int32_t gyro_q8[3];
+    uint32_t gyro_samples;
+    int32_t accel_q8[3];
+    uint32_t accel_windows;
+    bool changed;               //estimate differs from applied_*, see imu_calibration_take()
+
+    //window being collected
+    uint64_t window_start_us;
+    uint32_t window_samples;
+    IMU_Cal_Axis axis[6];       //accel xyz, gyro xyz
+
+    //sphere fit normal equations over the still window means (x, y, z, 1) . (2cx, 2cy, 2cz, r^2 - |c|^2) = |p|^2
+    double fit_ata[4][4];
+    double fit_atb[4];
+    uint8_t directions;         //+x -x +y -y +z -z seen at rest
+    uint32_t fit_windows;
+
+    uint32_t still_windows;
+    uint32_t moving_windows;
+
+    uint32_t sequence;          //of the last saved record
+    uint64_t last_save_us;
+    bool unsaved;
+} IMU_Calibration;
+
+void imu_calibration_init(IMU_Calibration *cal, uint64_t now_us);
+//load the newer valid slot of IMU_CAL_PATH, returns false on the first boot
+bool imu_calibration_load(IMU_Calibration *cal);
+//offset-corrected sample as read from the FIFO, returns true when a window closed
+bool imu_calibration_add(IMU_Calibration *cal, uint64_t time_us, const IMU_Reading *read);
+//copy new offsets for the driver, returns false if the estimate has not changed since the last call
+bool imu_calibration_take(IMU_Calibration *cal, int16_t accel[3], int16_t gyro[3]);
+//record to save, returns false if nothing new or IMU_CAL_SAVE_INTERVAL_US has not passed (unless forced)
+bool imu_calibration_save_due(IMU_Calibration *cal, uint64_t now_us, bool force, IMU_Cal_Record *record);
+FRESULT imu_calibration_save(const IMU_Cal_Record *record);
+
+#endif
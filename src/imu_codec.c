@@ -0,0 +1,202 @@
+/*
+File: imu_codec.c
+Author: Leonardo DaGraca
+
+Delta + zigzag + varint coding of the IMU log in blocks, see imu_codec.h.
+*/
+#include <string.h>
+#include "imu_codec.h"
+#include "profile.h"
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static uint32_t put_varint(uint8_t *dst, uint64_t value) {
+    uint32_t len = 0;
+    while (value >= 0x80) {
+        dst[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    dst[len++] = (uint8_t)value;
+    return len;
+}
+
+static bool get_varint(IMU_Decoder *decoder, uint64_t *value) {
+    uint64_t result = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        if (decoder->pos >= decoder->length) {
+            return false;
+        }
+        uint8_t byte = decoder->data[decoder->pos++];
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void start_block(IMU_Encoder *encoder) {
+    encoder->fill = sizeof(IMU_Codec_Block_Header);
+    encoder->rows = 0;
+    encoder->time_us = 0;
+    encoder->step_us = 0;
+    encoder->newest_us = 0;
+    memset(encoder->counts, 0, sizeof(encoder->counts));
+}
+
+static FRESULT write_block(IMU_Encoder *encoder) {
+    IMU_Codec_Block_Header header = {
+        .length = (uint16_t)(encoder->fill - sizeof(IMU_Codec_Block_Header)),
+        .rows = encoder->rows
+    };
+    memcpy(encoder->block, &header, sizeof(header));
+    encoder->blocks++;
+    encoder->bytes_out += encoder->fill;
+
+    //committed with the newest time in the block, so an index entry never points before a row it covers
+    FRESULT fr = sd_writer_write(encoder->writer, encoder->block, encoder->fill);
+    FRESULT commit_fr = sd_writer_commit(encoder->writer, encoder->newest_us);
+    start_block(encoder);
+    return fr != FR_OK ? fr : commit_fr;
+}
+
+FRESULT imu_encoder_init(IMU_Encoder *encoder, SD_Writer *writer, uint8_t readings) {
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->writer = writer;
+    encoder->readings = readings > IMU_CODEC_MAX_READINGS ? IMU_CODEC_MAX_READINGS : readings;
+    start_block(encoder);
+
+    IMU_Codec_Header header;
+    memcpy(header.magic, IMU_CODEC_MAGIC, sizeof(header.magic));
+    header.version = IMU_CODEC_VERSION;
+    header.readings = encoder->readings;
+    header.block_size = IMU_CODEC_BLOCK_SIZE;
+    return sd_writer_write(writer, &header, sizeof(header));
+}
+
+FRESULT imu_encoder_add(IMU_Encoder *encoder, uint64_t time_us, const int16_t *counts) {
+    PROFILE_START(timer);
+    uint8_t *dst = encoder->block + encoder->fill;
+    uint32_t len = 0;
+
+    int64_t step_us = (int64_t)(time_us - encoder->time_us);
+    len += put_varint(dst + len, zigzag(step_us - encoder->step_us));
+    encoder->time_us = time_us;
+    encoder->step_us = step_us;
+    if (time_us > encoder->newest_us) {
+        encoder->newest_us = time_us;
+    }
+
+    for (uint32_t r = 0; r < encoder->readings; r++) {
+        for (uint32_t axis = 0; axis < IMU_CODEC_AXES; axis++) {
+            int16_t count = counts[r * IMU_CODEC_AXES + axis];
+            len += put_varint(dst + len, zigzag((int32_t)count - encoder->counts[axis]));
+            encoder->counts[axis] = count;
+        }
+    }
+    encoder->fill += len;
+    encoder->rows++;
+    encoder->rows_in++;
+    PROFILE_STOP(PROFILE_FORMAT, timer);
+
+    //out as soon as the next row might not fit
+    if (encoder->fill + IMU_CODEC_MAX_ROW(encoder->readings) > IMU_CODEC_BLOCK_SIZE) {
+        return write_block(encoder);
+    }
+    return FR_OK;
+}
+
+FRESULT imu_encoder_flush(IMU_Encoder *encoder) {
+    if (encoder->rows == 0) {
+        return FR_OK;
+    }
+    return write_block(encoder);
+}
+
+void imu_decoder_start(IMU_Decoder *decoder, const uint8_t *data, uint16_t length, uint16_t rows, uint8_t readings) {
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->data = data;
+    decoder->length = length;
+    decoder->rows_left = rows;
+    decoder->readings = readings > IMU_CODEC_MAX_READINGS ? IMU_CODEC_MAX_READINGS : readings;
+}
+
+bool imu_decoder_next(IMU_Decoder *decoder, uint64_t *time_us, int16_t *counts) {
+    uint64_t value;
+    if (decoder->rows_left == 0 || !get_varint(decoder, &value)) {
+        return false;
+    }
+    decoder->step_us += unzigzag(value);
+    decoder->time_us += (uint64_t)decoder->step_us;
+
+    for (uint32_t r = 0; r < decoder->readings; r++) {
+        for (uint32_t axis = 0; axis < IMU_CODEC_AXES; axis++) {
+            if (!get_varint(decoder, &value)) {
+                return false;
+            }
+            decoder->counts[axis] = (int16_t)(decoder->counts[axis] + unzigzag(value));
+            counts[r * IMU_CODEC_AXES + axis] = decoder->counts[axis];
+        }
+    }
+    decoder->rows_left--;
+    *time_us = decoder->time_us;
+    return true;
+}
+
+const char *imu_codec_csv_header(uint8_t readings) {
+    return readings == 1 ? "Timestamp,ax,ay,az,gx,gy,gz\n" : "Timestamp,IMU_Readings\n";
+}
+
+//decimal digits of value at dst, without snprintf to keep the decoder fast
+static int put_decimal(char *dst, uint64_t value, bool negative) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    int len = 0;
+    if (negative) {
+        dst[len++] = '-';
+    }
+    while (count > 0) {
+        dst[len++] = digits[--count];
+    }
+    return len;
+}
+
+int imu_codec_format_row(uint64_t time_us, const int16_t *counts, uint8_t readings, char *buf, size_t size) {
+    //a time of 20 digits and 7 characters per count, "IMU: " and the separators fit easily
+    if (size < IMU_CODEC_MAX_TEXT) {
+        return 0;
+    }
+    int len = put_decimal(buf, time_us, false);
+    buf[len++] = ',';
+    if (readings != 1) {
+        memcpy(buf + len, "IMU: ", 5);
+        len += 5;
+    }
+    for (uint32_t r = 0; r < readings; r++) {
+        if (r > 0) {
+            buf[len++] = ';';
+        }
+        for (uint32_t axis = 0; axis < IMU_CODEC_AXES; axis++) {
+            int32_t count = counts[r * IMU_CODEC_AXES + axis];
+            if (axis > 0) {
+                buf[len++] = ',';
+            }
+            len += put_decimal(buf + len, (uint64_t)(count < 0 ? -count : count), count < 0);
+        }
+    }
+    buf[len++] = '\n';
+    buf[len] = '\0';
+    return len;
+}
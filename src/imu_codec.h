@@ -0,0 +1,111 @@
+/*
+File: imu_codec.h
+Author: Leonardo DaGraca
+
+Lossless compression of the IMU log, compiled in with IMU_COMPRESS. The CSV
+rows of the IMU log spend ~6 characters on every int16 count and repeat the
+leading digits of the timestamp on every row, while consecutive counts of an
+axis mostly differ by a few tens. The encoder stores each row as varints
+(7 bits per byte, high bit = more bytes follow):
+- the timestamp as the zigzag change of the time step, one byte while the
+  samples come at a steady rate
+- each count as the zigzag difference to the previous count of the same axis
+  (the previous reading of the row, or the last one of the previous row)
+
+Rows collect in one IMU_CODEC_BLOCK_SIZE block in RAM. A full block goes to
+the SD_Writer with its IMU_Codec_Block_Header and is committed with its
+newest time, so the sync budget, the journal and the time index (log_index.h)
+see whole blocks only. Each block starts over from zero, so a reader can
+start at any block: the index entries point at block starts and a torn last
+block is dropped without losing the ones before it. The blocks replace the
+snprintf of the rows (timed as PROFILE_FORMAT) and the encoder needs ~600
+bytes of RAM.
+
+The file is an IMU_Codec_Header followed by the blocks. log_convert.c
+expands it back into exactly the CSV the logger writes without IMU_COMPRESS,
+and log_extract.c reads time ranges from it.
+*/
+#ifndef IMU_CODEC_H
+#define IMU_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ff.h"
+#include "sd_writer.h"
+
+#define IMU_CODEC_MAGIC "GTIZ"
+#define IMU_CODEC_VERSION 1
+#define IMU_CODEC_AXES 6
+#define IMU_CODEC_MAX_READINGS 5        //per row, matches MAX_IMU_READINGS
+
+//encoded bytes per block, header included; at ~10 bytes per full-rate row a block holds ~0.25s at 200Hz
+#ifndef IMU_CODEC_BLOCK_SIZE
+#define IMU_CODEC_BLOCK_SIZE 512
+#endif
+
+//longest encoded row: a 10 byte time and 3 bytes per count
+#define IMU_CODEC_MAX_ROW(readings) (10 + 3 * IMU_CODEC_AXES * (readings))
+
+//longest CSV row of imu_codec_format_row()
+#define IMU_CODEC_MAX_TEXT 400
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t readings;           //per row: MAX_IMU_READINGS for the per-fix rows, 1 in IMU_FULL_RATE mode
+    uint16_t block_size;
+} IMU_Codec_Header;
+
+typedef struct __attribute__((packed)) {
+    uint16_t length;            //encoded rows that follow, in bytes
+    uint16_t rows;
+} IMU_Codec_Block_Header;
+
+typedef struct {
+    SD_Writer *writer;
+    uint8_t readings;
+    uint8_t block[IMU_CODEC_BLOCK_SIZE];
+    uint32_t fill;              //block header included
+    uint16_t rows;
+
+    //prediction, reset at every block
+    uint64_t time_us;
+    int64_t step_us;
+    int16_t counts[IMU_CODEC_AXES];
+    uint64_t newest_us;         //highest time in the block
+
+    uint32_t blocks;
+    uint32_t rows_in;
+    uint64_t bytes_out;         //blocks with their headers
+} IMU_Encoder;
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t length;
+    uint32_t pos;
+    uint16_t rows_left;
+    uint8_t readings;
+
+    uint64_t time_us;
+    int64_t step_us;
+    int16_t counts[IMU_CODEC_AXES];
+} IMU_Decoder;
+
+//writes the file header to the writer
+FRESULT imu_encoder_init(IMU_Encoder *encoder, SD_Writer *writer, uint8_t readings);
+//counts holds readings * IMU_CODEC_AXES values, ax, ay, az, gx, gy, gz per reading, oldest first
+FRESULT imu_encoder_add(IMU_Encoder *encoder, uint64_t time_us, const int16_t *counts);
+//writes and commits the partial block
+FRESULT imu_encoder_flush(IMU_Encoder *encoder);
+
+//the payload of one block, as the block header says
+void imu_decoder_start(IMU_Decoder *decoder, const uint8_t *data, uint16_t length, uint16_t rows, uint8_t readings);
+//false after the last row, or at a damaged row with rows_left still above 0
+bool imu_decoder_next(IMU_Decoder *decoder, uint64_t *time_us, int16_t *counts);
+
+//the CSV header and rows the logger writes without IMU_COMPRESS (write_imu_buffer / write_imu_sample)
+const char *imu_codec_csv_header(uint8_t readings);
+int imu_codec_format_row(uint64_t time_us, const int16_t *counts, uint8_t readings, char *buf, size_t size);
+
+#endif
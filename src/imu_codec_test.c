@@ -0,0 +1,485 @@
+/*
+File: imu_codec_test.c
+Author: Leonardo DaGraca
+
+Host check and benchmark of the IMU log compression (imu_codec.h), the same
+encoder and SD_Writer as the IMU_COMPRESS build on the host FatFs.
+
+Without log files it generates MPU6050 counts (gravity on z, noise, bias and
+rounding as in fusion_test.c) for a few kinds of sessions, each as full-rate
+rows (IMU_FULL_RATE, 200Hz) and as per-fix rows of MAX_IMU_READINGS readings:
+- still: the tracker lying on the bench, noise only
+- running: a stride bounce of ~0.8g and a torso sway, the typical match data
+- random walk: steps of up to 200 counts per sample, as in the log_extract bench
+- white noise: every count random, the worst case of the coding
+With imu_log_N.csv files (either layout, as the logger or the simulator
+writes them) it uses their rows instead.
+
+Every data set is encoded into work_dir/imu_codec_test.imz, read back, decoded
+and formatted, and must give the CSV text byte for byte: the synthetic CSV is
+printed with the logger's snprintf formats (write_imu_buffer/write_imu_sample),
+a given log is compared against its own text. A copy cut off in the middle of
+a block must decode to a prefix of the rows. It prints the size against the
+CSV, the encode time per row and per block (and the snprintf time per row the
+encoder replaces), and the decode speed with and without the CSV formatting.
+
+Usage: imu_codec_test [-r rows] [-w work_dir] [imu_log_N.csv ...]
+Build: cc -O2 -Ihost -I. -o imu_codec_test imu_codec_test.c imu_codec.c sd_writer.c journal.c log_index.c host/ff_host.c -lm
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "ff.h"
+#include "sd_writer.h"
+#include "imu_codec.h"
+
+#define SAMPLE_PERIOD_US 5000       //200Hz
+#define FIX_PERIOD_US 1000000
+#define PER_FIX_READINGS 5          //MAX_IMU_READINGS
+#define ACCEL_1G 16384.0            //counts at +-2g
+#define GYRO_PER_DPS 131.0          //counts at +-250dps
+#define ACCEL_NOISE_COUNTS 8.0
+#define GYRO_NOISE_COUNTS 1.0
+#define TEST_FILE "imu_codec_test.imz"
+
+typedef enum {
+    SESSION_STILL,
+    SESSION_RUNNING,
+    SESSION_RANDOM_WALK,
+    SESSION_WHITE_NOISE,
+    SESSION_COUNT
+} Session_Kind;
+
+static const char *session_names[SESSION_COUNT] = {"still", "running", "random walk", "white noise"};
+
+typedef struct {
+    char name[64];
+    uint8_t readings;
+    uint32_t rows;
+    uint64_t *time_us;
+    int16_t *counts;            //rows * readings * IMU_CODEC_AXES
+    char *csv;                  //the log as the logger writes it without IMU_COMPRESS
+    size_t csv_len;
+    double snprintf_seconds;    //printing the synthetic CSV, 0 for a given log
+} Data_Set;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double gaussian() {
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static int16_t to_counts(double value) {
+    value = round(value);
+    return (int16_t)(value > 32767 ? 32767 : value < -32768 ? -32768 : value);
+}
+
+static void data_set_alloc(Data_Set *set, uint32_t rows, uint8_t readings) {
+    set->rows = rows;
+    set->readings = readings;
+    set->time_us = malloc(rows * sizeof(uint64_t));
+    set->counts = malloc((size_t)rows * readings * IMU_CODEC_AXES * sizeof(int16_t));
+    set->csv = NULL;
+    set->csv_len = 0;
+    set->snprintf_seconds = 0;
+    if (!set->time_us || !set->counts) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+}
+
+static void data_set_free(Data_Set *set) {
+    free(set->time_us);
+    free(set->counts);
+    free(set->csv);
+}
+
+//one sample of the session at time t, with a random walk kept in walk between calls
+static void sample_session(Session_Kind kind, double t, int32_t *walk, int16_t *counts) {
+    const double accel_bias[3] = {60.0, -40.0, 25.0};
+    const double gyro_bias[3] = {3.0, -2.0, 4.0};
+    switch (kind) {
+        case SESSION_STILL:
+            for (int axis = 0; axis < 3; axis++) {
+                double gravity = axis == 2 ? ACCEL_1G : 0.0;
+                counts[axis] = to_counts(gravity + accel_bias[axis] + ACCEL_NOISE_COUNTS * gaussian());
+                counts[axis + 3] = to_counts(gyro_bias[axis] + GYRO_NOISE_COUNTS * gaussian());
+            }
+            break;
+        case SESSION_RUNNING: {
+            //2.8 steps per second, the torso sways at half the step rate
+            double step = 2.0 * M_PI * 2.8 * t;
+            double sway = step / 2.0;
+            double bounce = 0.8 * sin(step) + 0.2 * sin(2.0 * step);
+            counts[0] = to_counts(0.3 * ACCEL_1G * sin(step + 0.5) + accel_bias[0] + ACCEL_NOISE_COUNTS * gaussian());
+            counts[1] = to_counts(0.25 * ACCEL_1G * sin(sway) + accel_bias[1] + ACCEL_NOISE_COUNTS * gaussian());
+            counts[2] = to_counts((1.0 + bounce) * ACCEL_1G + accel_bias[2] + ACCEL_NOISE_COUNTS * gaussian());
+            counts[3] = to_counts(40.0 * GYRO_PER_DPS * sin(sway) + gyro_bias[0] + GYRO_NOISE_COUNTS * gaussian());
+            counts[4] = to_counts(25.0 * GYRO_PER_DPS * sin(step) + gyro_bias[1] + GYRO_NOISE_COUNTS * gaussian());
+            counts[5] = to_counts(60.0 * GYRO_PER_DPS * sin(sway + 1.0) + gyro_bias[2] + GYRO_NOISE_COUNTS * gaussian());
+            break;
+        }
+        case SESSION_RANDOM_WALK:
+            for (int axis = 0; axis < IMU_CODEC_AXES; axis++) {
+                walk[axis] += rand() % 401 - 200;
+                walk[axis] = walk[axis] > 32767 ? 32767 : walk[axis] < -32768 ? -32768 : walk[axis];
+                counts[axis] = (int16_t)walk[axis];
+            }
+            break;
+        case SESSION_WHITE_NOISE:
+        default:
+            for (int axis = 0; axis < IMU_CODEC_AXES; axis++) {
+                counts[axis] = (int16_t)(rand() % 65536 - 32768);
+            }
+            break;
+    }
+}
+
+//the rows printed the way mpu6050_i2c.c prints them
+static void print_csv(Data_Set *set) {
+    size_t size = (size_t)set->rows * (set->readings == 1 ? 64 : 48 * set->readings) + 64;
+    set->csv = malloc(size);
+    if (!set->csv) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    const char *header = imu_codec_csv_header(set->readings);
+    size_t len = strlen(header);
+    memcpy(set->csv, header, len);
+
+    double start = now_seconds();
+    for (uint32_t row = 0; row < set->rows; row++) {
+        const int16_t *c = set->counts + (size_t)row * set->readings * IMU_CODEC_AXES;
+        if (set->readings == 1) {
+            len += snprintf(set->csv + len, size - len, "%" PRIu64 ",%d,%d,%d,%d,%d,%d\n", set->time_us[row],
+                            c[0], c[1], c[2], c[3], c[4], c[5]);
+            continue;
+        }
+        len += snprintf(set->csv + len, size - len, "%" PRIu64 ",IMU: ", set->time_us[row]);
+        for (uint32_t r = 0; r < set->readings; r++) {
+            if (r > 0) {
+                len += snprintf(set->csv + len, size - len, ";");
+            }
+            const int16_t *reading = c + r * IMU_CODEC_AXES;
+            len += snprintf(set->csv + len, size - len, "%d,%d,%d,%d,%d,%d", reading[0], reading[1], reading[2],
+                            reading[3], reading[4], reading[5]);
+        }
+        len += snprintf(set->csv + len, size - len, "\n");
+    }
+    set->snprintf_seconds = now_seconds() - start;
+    set->csv_len = len;
+}
+
+static void generate(Data_Set *set, Session_Kind kind, bool full_rate, uint32_t rows) {
+    data_set_alloc(set, rows, full_rate ? 1 : PER_FIX_READINGS);
+    snprintf(set->name, sizeof(set->name), "%s, %s", session_names[kind], full_rate ? "full rate" : "per fix");
+
+    int32_t walk[IMU_CODEC_AXES] = {120, -340, 16384, 0, 0, 0};
+    uint64_t time_us = 1000000;
+    int16_t *counts = set->counts;
+    for (uint32_t row = 0; row < rows; row++) {
+        set->time_us[row] = time_us;
+        for (uint32_t r = 0; r < set->readings; r++) {
+            //the per-fix readings are the last samples before the fix
+            double t = (time_us - (uint64_t)(set->readings - 1 - r) * SAMPLE_PERIOD_US) * 1e-6;
+            sample_session(kind, t, walk, counts);
+            counts += IMU_CODEC_AXES;
+        }
+        //the fixes come from the GPS with some jitter, the samples from the FIFO on a steady clock
+        time_us += full_rate ? SAMPLE_PERIOD_US : FIX_PERIOD_US + (uint64_t)(rand() % 2000);
+    }
+    print_csv(set);
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = malloc(size + 1);
+    if (data && fread(data, 1, size, file) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    if (data) {
+        data[size] = '\0';
+        *len = (size_t)size;
+    }
+    return data;
+}
+
+//a logger IMU log in either layout, false if a row does not parse
+static bool load_log(Data_Set *set, const char *path) {
+    size_t len;
+    char *text = read_file(path, &len);
+    if (!text) {
+        printf("Cannot read %s\n", path);
+        return false;
+    }
+    uint8_t readings = strncmp(text, imu_codec_csv_header(1), strlen(imu_codec_csv_header(1))) == 0
+                       ? 1 : PER_FIX_READINGS;
+    const char *header = imu_codec_csv_header(readings);
+    if (strncmp(text, header, strlen(header)) != 0) {
+        printf("%s is not an IMU log\n", path);
+        free(text);
+        return false;
+    }
+    uint32_t rows = 0;
+    for (size_t i = strlen(header); i < len; i++) {
+        rows += text[i] == '\n';
+    }
+
+    data_set_alloc(set, rows, readings);
+    snprintf(set->name, sizeof(set->name), "%s", path);
+    set->csv = text;
+    set->csv_len = len;
+
+    const char *p = text + strlen(header);
+    for (uint32_t row = 0; row < rows; row++) {
+        char *end;
+        set->time_us[row] = strtoull(p, &end, 10);
+        if (*end != ',') {
+            printf("%s: row %" PRIu32 " does not parse\n", path, row + 1);
+            return false;
+        }
+        p = end + 1;
+        if (readings != 1) {
+            if (strncmp(p, "IMU: ", 5) != 0) {
+                printf("%s: row %" PRIu32 " does not parse\n", path, row + 1);
+                return false;
+            }
+            p += 5;
+        }
+        int16_t *counts = set->counts + (size_t)row * readings * IMU_CODEC_AXES;
+        for (uint32_t i = 0; i < (uint32_t)readings * IMU_CODEC_AXES; i++) {
+            counts[i] = (int16_t)strtol(p, &end, 10);
+            char expected = i + 1 == (uint32_t)readings * IMU_CODEC_AXES ? '\n' : (i + 1) % IMU_CODEC_AXES ? ',' : ';';
+            if (end == p || *end != expected) {
+                printf("%s: row %" PRIu32 " does not parse\n", path, row + 1);
+                return false;
+            }
+            p = end + 1;
+        }
+    }
+    return true;
+}
+
+static bool encode(const Data_Set *set, IMU_Encoder *encoder, double *seconds) {
+    static SD_Writer writer;
+    SD_Writer_Config config = {0};
+    FIL file;
+    if (f_open(&file, TEST_FILE, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        printf("Cannot create %s\n", TEST_FILE);
+        return false;
+    }
+    sd_writer_init(&writer, &file, &config, 0);
+
+    FRESULT fr = imu_encoder_init(encoder, &writer, set->readings);
+    double start = now_seconds();
+    for (uint32_t row = 0; row < set->rows && fr == FR_OK; row++) {
+        fr = imu_encoder_add(encoder, set->time_us[row],
+                             set->counts + (size_t)row * set->readings * IMU_CODEC_AXES);
+    }
+    if (fr == FR_OK) {
+        fr = imu_encoder_flush(encoder);
+    }
+    *seconds = now_seconds() - start;
+    if (fr == FR_OK) {
+        fr = sd_writer_flush(&writer, 0);
+    }
+    f_close(&file);
+    if (fr != FR_OK) {
+        printf("Error writing %s: %d\n", TEST_FILE, fr);
+        return false;
+    }
+    return true;
+}
+
+//decodes the file, formats it into csv when given, returns the rows
+static uint32_t decode(const uint8_t *data, size_t len, char *csv, size_t *csv_len, uint64_t *sum) {
+    IMU_Codec_Header header;
+    if (len < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    size_t pos = sizeof(header);
+    if (csv) {
+        const char *text = imu_codec_csv_header(header.readings);
+        *csv_len = strlen(text);
+        memcpy(csv, text, *csv_len);
+    }
+
+    uint32_t rows = 0;
+    IMU_Decoder decoder;
+    int16_t counts[IMU_CODEC_MAX_READINGS * IMU_CODEC_AXES];
+    uint64_t time_us;
+    while (pos + sizeof(IMU_Codec_Block_Header) <= len) {
+        IMU_Codec_Block_Header block;
+        memcpy(&block, data + pos, sizeof(block));
+        pos += sizeof(block);
+        if (block.length == 0 || pos + block.length > len) {
+            break;
+        }
+        imu_decoder_start(&decoder, data + pos, block.length, block.rows, header.readings);
+        pos += block.length;
+        while (imu_decoder_next(&decoder, &time_us, counts)) {
+            rows++;
+            if (csv) {
+                *csv_len += imu_codec_format_row(time_us, counts, header.readings, csv + *csv_len, IMU_CODEC_MAX_TEXT);
+            }
+            else {
+                *sum += time_us + (uint16_t)counts[0] + (uint16_t)counts[header.readings * IMU_CODEC_AXES - 1];
+            }
+        }
+        if (decoder.rows_left > 0) {
+            break;
+        }
+    }
+    return rows;
+}
+
+static bool run(const Data_Set *set) {
+    IMU_Encoder encoder;
+    double encode_seconds;
+    if (!encode(set, &encoder, &encode_seconds)) {
+        return false;
+    }
+    size_t len;
+    uint8_t *data = (uint8_t *)read_file(TEST_FILE, &len);
+    char *csv = malloc(set->csv_len + IMU_CODEC_MAX_TEXT);
+    if (!data || !csv) {
+        printf("Cannot read %s back\n", TEST_FILE);
+        free(data);
+        free(csv);
+        return false;
+    }
+
+    //best of a few passes, the first one warms the caches
+    double raw_seconds = 1e9, csv_seconds = 1e9;
+    uint64_t sum = 0;
+    size_t csv_len = 0;
+    uint32_t raw_rows = 0, csv_rows = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        double start = now_seconds();
+        raw_rows = decode(data, len, NULL, NULL, &sum);
+        double t = now_seconds() - start;
+        raw_seconds = t < raw_seconds ? t : raw_seconds;
+        start = now_seconds();
+        csv_rows = decode(data, len, csv, &csv_len, NULL);
+        t = now_seconds() - start;
+        csv_seconds = t < csv_seconds ? t : csv_seconds;
+    }
+
+    bool ok = true;
+    if (raw_rows != set->rows || csv_rows != set->rows || csv_len != set->csv_len ||
+        memcmp(csv, set->csv, csv_len) != 0) {
+        size_t at = 0;
+        while (at < csv_len && at < set->csv_len && csv[at] == set->csv[at]) {
+            at++;
+        }
+        printf("%s: %" PRIu32 " of %" PRIu32 " rows, the CSV differs from byte %zu on\n", set->name, csv_rows,
+               set->rows, at);
+        ok = false;
+    }
+
+    //a torn last block: everything before it and nothing after
+    if (ok && encoder.blocks > 1) {
+        size_t cut = len - encoder.bytes_out / encoder.blocks / 2;
+        size_t cut_len = 0;
+        uint32_t cut_rows = decode(data, cut, csv, &cut_len, NULL);
+        if (cut_rows == 0 || cut_rows >= set->rows || memcmp(csv, set->csv, cut_len) != 0) {
+            printf("%s: a cut copy gives %" PRIu32 " rows that are not a prefix of the log\n", set->name, cut_rows);
+            ok = false;
+        }
+    }
+
+    double per_row_bytes = (double)encoder.bytes_out / set->rows;
+    printf("%-26s %7" PRIu32 " rows %9.1f KB CSV %8.1f KB packed %5.2fx %5.1f B/row  encode %4.0f ns/row %5.2f us/block",
+           set->name, set->rows, set->csv_len / 1e3, (len) / 1e3, (double)set->csv_len / len, per_row_bytes,
+           encode_seconds * 1e9 / set->rows, encode_seconds * 1e6 / encoder.blocks);
+    if (set->snprintf_seconds > 0) {
+        printf(" (snprintf %4.0f ns/row)", set->snprintf_seconds * 1e9 / set->rows);
+    }
+    printf("  decode %5.0f MB/s packed in, %5.0f MB/s CSV out%s\n", len / raw_seconds / 1e6,
+           set->csv_len / csv_seconds / 1e6, ok ? "" : "  FAILED");
+    free(data);
+    free(csv);
+    return ok;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-r rows] [-w work_dir] [imu_log_N.csv ...]\n", name);
+}
+
+int main(int argc, char **argv) {
+    uint32_t rows = 120000;
+    const char *work_dir = ".";
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            rows = (uint32_t)strtoul(argv[arg + 1], NULL, 10);
+        }
+        else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc) {
+            work_dir = argv[arg + 1];
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+        arg += 2;
+    }
+    if (rows == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    Data_Set sets[2 * SESSION_COUNT];
+    int count = 0;
+    int failures = 0;
+    if (arg < argc) {
+        for (; arg < argc && count < 2 * SESSION_COUNT; arg++) {
+            if (load_log(&sets[count], argv[arg])) {
+                count++;
+            }
+            else {
+                failures++;
+            }
+        }
+    }
+    else {
+        srand(1);
+        for (int kind = 0; kind < SESSION_COUNT; kind++) {
+            generate(&sets[count++], (Session_Kind)kind, true, rows);
+            generate(&sets[count++], (Session_Kind)kind, false, rows);
+        }
+    }
+
+    printf("IMU_Encoder %zu bytes of RAM, %d byte blocks\n", sizeof(IMU_Encoder), IMU_CODEC_BLOCK_SIZE);
+    //the host FatFs and the read back both work relative to it
+    if (chdir(work_dir) != 0) {
+        printf("Cannot change to %s\n", work_dir);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        failures += !run(&sets[i]);
+        data_set_free(&sets[i]);
+    }
+    printf(failures ? "FAIL: %d data sets\n" : "OK\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+/*
+File: imu_ring.c
+Author: Leonardo DaGraca
+
+Implementation of the SPSC IMU block ring
+*/
+#include "imu_ring.h"
+
+void imu_ring_init(IMU_Ring *ring, IMU_Block *storage, uint32_t block_count) {
+    ring->blocks = storage;
+    ring->mask = block_count - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->fill = 0;
+    ring->last_us = 0;
+    ring->pushed = 0;
+    ring->dropped = 0;
+    ring->high_water = 0;
+}
+
+uint32_t imu_ring_count(IMU_Ring *ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head - tail;
+}
+
+//hand the block being filled to the consumer, the next one starts empty
+static void publish(IMU_Ring *ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    ring->blocks[head & ring->mask].count = ring->fill;
+    ring->fill = 0;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    if (head + 1 - tail > ring->high_water) {
+        ring->high_water = head + 1 - tail;
+    }
+}
+
+bool imu_ring_push(IMU_Ring *ring, const IMU_Sample *sample) {
+    uint32_t n = ring->fill;
+    uint64_t delta = sample->timestamp_us - ring->last_us;
+
+    if (n > 0 && (sample->timestamp_us < ring->last_us || delta > IMU_BLOCK_MAX_DELTA_US)) {
+        publish(ring);
+        n = 0;
+    }
+
+    //the block being filled belongs to the producer, the consumer's position only matters for a new one
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (n == 0) {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - tail > ring->mask) {
+            ring->dropped++;
+            return false;
+        }
+    }
+
+    IMU_Block *block = &ring->blocks[head & ring->mask];
+    if (n == 0) {
+        block->start_us = sample->timestamp_us;
+        block->delta_us[0] = 0;
+    }
+    else {
+        block->delta_us[n] = (uint16_t)delta;
+    }
+    block->axes[0][n] = sample->read.ax;
+    block->axes[1][n] = sample->read.ay;
+    block->axes[2][n] = sample->read.az;
+    block->axes[3][n] = sample->read.gx;
+    block->axes[4][n] = sample->read.gy;
+    block->axes[5][n] = sample->read.gz;
+    ring->fill = n + 1;
+    ring->last_us = sample->timestamp_us;
+    ring->pushed++;
+
+    if (n + 1 == IMU_BLOCK_SAMPLES) {
+        publish(ring);
+    }
+    return true;
+}
+
+void imu_ring_flush(IMU_Ring *ring) {
+    if (ring->fill > 0) {
+        publish(ring);
+    }
+}
+
+const IMU_Block *imu_ring_peek(IMU_Ring *ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->blocks[tail & ring->mask];
+}
+
+void imu_ring_release(IMU_Ring *ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
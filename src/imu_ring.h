@@ -0,0 +1,78 @@
+/*
+File: imu_ring.h
+Author: Leonardo DaGraca
+
+Lock-free single-producer/single-consumer ring of IMU sample blocks, used to
+hand full-rate IMU data from the acquisition core to the SD card core.
+
+Each block holds IMU_BLOCK_SAMPLES samples as a structure of arrays: one
+int16 array per axis and the time since the previous sample as a uint16 delta,
+with the full timestamp only once per block. That is 14 bytes per sample
+instead of the 24 of an IMU_Sample (32 before IMU_Reading went to int16), so
+the same SRAM buffers about twice as many seconds of data.
+
+The producer fills the block at head in place and publishes it by advancing
+head once it is full, so the per-sample cost is a store per axis and a
+compare, with no modulo and no copy of the whole record. The consumer gets
+whole blocks (imu_ring_peek / imu_ring_release) and writes them straight from
+the ring. Like record_queue.h the producer never blocks: with every block
+taken the sample is dropped and counted.
+*/
+#ifndef IMU_RING_H
+#define IMU_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "mpu6050.h"
+
+#define IMU_BLOCK_SAMPLES 32
+#define IMU_BLOCK_AXES 6
+//a longer gap (FIFO overflow, a rate change) does not fit a delta and starts a new block
+#define IMU_BLOCK_MAX_DELTA_US 0xFFFF
+
+typedef struct {
+    uint64_t start_us;                                  //timestamp of the first sample
+    uint32_t count;                                     //set when the block is published
+    uint16_t delta_us[IMU_BLOCK_SAMPLES];               //time since the previous sample, delta_us[0] = 0
+    int16_t axes[IMU_BLOCK_AXES][IMU_BLOCK_SAMPLES];    //ax, ay, az, gx, gy, gz
+} IMU_Block;
+
+typedef struct {
+    IMU_Block *blocks;
+    uint32_t mask;              //block count - 1, the block count must be a power of two
+    atomic_uint_least32_t head; //block being filled (producer)
+    atomic_uint_least32_t tail; //next block to read (consumer)
+
+    //only written by the producer
+    uint32_t fill;              //samples in the block at head
+    uint64_t last_us;
+    uint32_t pushed;            //samples
+    uint32_t dropped;
+    uint32_t high_water;        //blocks
+} IMU_Ring;
+
+void imu_ring_init(IMU_Ring *ring, IMU_Block *storage, uint32_t block_count);
+//producer side, returns false (and counts a drop) when every block is full
+bool imu_ring_push(IMU_Ring *ring, const IMU_Sample *sample);
+//producer side, publish the partly filled block, e.g. before logging stops
+void imu_ring_flush(IMU_Ring *ring);
+//consumer side, oldest published block or NULL, stays valid until imu_ring_release()
+const IMU_Block *imu_ring_peek(IMU_Ring *ring);
+void imu_ring_release(IMU_Ring *ring);
+//published blocks waiting for the consumer
+uint32_t imu_ring_count(IMU_Ring *ring);
+
+//sample i of a block, with its timestamp rebuilt from the deltas (pass the previous one in time_us)
+static inline void imu_block_sample(const IMU_Block *block, uint32_t i, uint64_t *time_us, IMU_Sample *sample) {
+    *time_us = i == 0 ? block->start_us : *time_us + block->delta_us[i];
+    sample->timestamp_us = *time_us;
+    sample->read.ax = block->axes[0][i];
+    sample->read.ay = block->axes[1][i];
+    sample->read.az = block->axes[2][i];
+    sample->read.gx = block->axes[3][i];
+    sample->read.gy = block->axes[4][i];
+    sample->read.gz = block->axes[5][i];
+}
+
+#endif
@@ -0,0 +1,243 @@
+/*
+File: imu_ring_test.c
+Author: Leonardo DaGraca
+
+Host check and benchmark of the full-rate IMU buffer (imu_ring.h) against the
+Record_Queue of IMU_Sample it replaced.
+
+First a producer thread pushes samples with gaps and a timestamp going back
+while a consumer thread drains whole blocks, stalling now and then so the
+ring also overflows, and every sample that arrives
+is checked against the one that was pushed (drops are allowed, reordering
+and corruption are not). Then it prints the memory per sample and, in one
+thread, the push and pop rates of both buffers for the same number of
+samples, pushed in FIFO sized bursts and drained between bursts like the
+firmware does.
+
+Usage: imu_ring_test [samples]
+Build: cc -O2 -pthread -I. -Ihost -o imu_ring_test imu_ring_test.c imu_ring.c record_queue.c
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "imu_ring.h"
+#include "record_queue.h"
+
+#define RING_BLOCKS 32              //as IMU_RING_BLOCKS in main.c
+#define QUEUE_DEPTH 512             //the IMU_QUEUE_DEPTH it replaced
+#define BURST 16                    //MPU6050_FIFO_BURST_SAMPLES
+#define SAMPLE_PERIOD_US 5000       //200Hz
+
+//IMU_Sample before IMU_Reading went from int to int16_t
+typedef struct {
+    uint64_t timestamp_us;
+    int ax, ay, az, gx, gy, gz;
+} Old_IMU_Sample;
+
+static IMU_Block ring_storage[RING_BLOCKS];
+static Old_IMU_Sample queue_storage[QUEUE_DEPTH];
+
+//sample n of the test stream: a gap every 1000 samples, one step back in time at 5000
+static void make_sample(uint32_t n, IMU_Sample *sample) {
+    uint64_t time_us = 1000000 + (uint64_t)n * SAMPLE_PERIOD_US + (uint64_t)(n / 1000) * 200000;
+    if (n >= 5000) {
+        time_us -= 50000;
+    }
+    sample->timestamp_us = time_us;
+    sample->read.ax = (int16_t)(n & 0xFFFF);
+    sample->read.ay = (int16_t)(n >> 16);
+    sample->read.az = (int16_t)(16384 - (n % 97));
+    sample->read.gx = (int16_t)(n * 7);
+    sample->read.gy = (int16_t)-(int32_t)(n % 1000);
+    sample->read.gz = (int16_t)(n ^ 0x5A5A);
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    IMU_Ring ring;
+    uint32_t samples;
+    volatile int done;
+    uint32_t received;
+    uint32_t blocks;
+    uint32_t errors;
+} Thread_Test;
+
+static void *producer(void *arg) {
+    Thread_Test *test = arg;
+    for (uint32_t n = 0; n < test->samples; n++) {
+        IMU_Sample sample;
+        make_sample(n, &sample);
+        imu_ring_push(&test->ring, &sample);
+        if ((n & (BURST - 1)) == BURST - 1) {
+            sched_yield();
+        }
+    }
+    imu_ring_flush(&test->ring);
+    __atomic_store_n(&test->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    Thread_Test *test = arg;
+    int64_t last_n = -1;
+
+    while (true) {
+        int done = __atomic_load_n(&test->done, __ATOMIC_ACQUIRE);
+        const IMU_Block *block;
+        while ((block = imu_ring_peek(&test->ring)) != NULL) {
+            uint64_t time_us = 0;
+            for (uint32_t i = 0; i < block->count; i++) {
+                IMU_Sample got, expected;
+                imu_block_sample(block, i, &time_us, &got);
+                int64_t n = (uint16_t)got.read.ax | (int64_t)(uint16_t)got.read.ay << 16;
+                make_sample((uint32_t)n, &expected);
+                if (n <= last_n || memcmp(&got.read, &expected.read, sizeof(got.read)) != 0 ||
+                    got.timestamp_us != expected.timestamp_us) {
+                    if (test->errors++ < 5) {
+                        printf("  sample %" PRId64 " (after %" PRId64 ") does not match\n", n, last_n);
+                    }
+                }
+                last_n = n;
+                test->received++;
+            }
+            imu_ring_release(&test->ring);
+            //stall now and then like an SD card write, so the ring also runs full
+            if (++test->blocks % 2048 == 0) {
+                usleep(20000);
+            }
+        }
+        if (done) {
+            return NULL;
+        }
+        sched_yield();
+    }
+}
+
+static bool thread_test(uint32_t samples) {
+    Thread_Test test;
+    memset(&test, 0, sizeof(test));
+    imu_ring_init(&test.ring, ring_storage, RING_BLOCKS);
+    test.samples = samples;
+
+    pthread_t threads[2];
+    pthread_create(&threads[1], NULL, consumer, &test);
+    pthread_create(&threads[0], NULL, producer, &test);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+
+    bool ok = test.errors == 0 && test.received + test.ring.dropped == samples;
+    printf("Two threads: %" PRIu32 " pushed, %" PRIu32 " received, %" PRIu32 " dropped, %" PRIu32 " errors, high water %" PRIu32 " of %d blocks: %s\n",
+           samples, test.received, test.ring.dropped, test.errors, test.ring.high_water, RING_BLOCKS, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+//push a burst, drain it, repeat; returns seconds spent pushing and popping
+static void bench_ring(uint32_t samples, double *push_s, double *pop_s, uint64_t *checksum) {
+    IMU_Ring ring;
+    imu_ring_init(&ring, ring_storage, RING_BLOCKS);
+    IMU_Sample burst[BURST];
+    *push_s = *pop_s = 0;
+
+    for (uint32_t n = 0; n < samples; n += BURST) {
+        for (int i = 0; i < BURST; i++) {
+            make_sample(n + i, &burst[i]);
+        }
+        double start = now_seconds();
+        for (int i = 0; i < BURST; i++) {
+            imu_ring_push(&ring, &burst[i]);
+        }
+        double mid = now_seconds();
+        const IMU_Block *block;
+        while ((block = imu_ring_peek(&ring)) != NULL) {
+            uint64_t time_us = 0;
+            for (uint32_t i = 0; i < block->count; i++) {
+                IMU_Sample sample;
+                imu_block_sample(block, i, &time_us, &sample);
+                *checksum += sample.timestamp_us + (uint16_t)sample.read.gz;
+            }
+            imu_ring_release(&ring);
+        }
+        *push_s += mid - start;
+        *pop_s += now_seconds() - mid;
+    }
+
+    //the blocks cut short by the gaps leave a partial one
+    imu_ring_flush(&ring);
+    const IMU_Block *block = imu_ring_peek(&ring);
+    if (block) {
+        uint64_t time_us = 0;
+        for (uint32_t i = 0; i < block->count; i++) {
+            IMU_Sample sample;
+            imu_block_sample(block, i, &time_us, &sample);
+            *checksum += sample.timestamp_us + (uint16_t)sample.read.gz;
+        }
+        imu_ring_release(&ring);
+    }
+}
+
+static void bench_queue(uint32_t samples, double *push_s, double *pop_s, uint64_t *checksum) {
+    Record_Queue queue;
+    record_queue_init(&queue, queue_storage, sizeof(Old_IMU_Sample), QUEUE_DEPTH);
+    Old_IMU_Sample burst[BURST];
+    *push_s = *pop_s = 0;
+
+    for (uint32_t n = 0; n < samples; n += BURST) {
+        for (int i = 0; i < BURST; i++) {
+            IMU_Sample sample;
+            make_sample(n + i, &sample);
+            burst[i] = (Old_IMU_Sample){sample.timestamp_us, sample.read.ax, sample.read.ay, sample.read.az,
+                                        sample.read.gx, sample.read.gy, sample.read.gz};
+        }
+        double start = now_seconds();
+        for (int i = 0; i < BURST; i++) {
+            record_queue_push(&queue, &burst[i]);
+        }
+        double mid = now_seconds();
+        Old_IMU_Sample sample;
+        while (record_queue_pop(&queue, &sample)) {
+            *checksum += sample.timestamp_us + (uint16_t)sample.gz;
+        }
+        *push_s += mid - start;
+        *pop_s += now_seconds() - mid;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t samples = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 10000000;
+    samples -= samples % BURST;
+
+    bool ok = thread_test(samples / 10);
+
+    double ring_bytes = (double)sizeof(IMU_Block) / IMU_BLOCK_SAMPLES;
+    printf("\nMemory per sample: Record_Queue of int IMU_Sample %zu bytes, of int16 IMU_Sample %zu bytes, IMU_Ring %.1f bytes (%zu byte blocks of %d)\n",
+           sizeof(Old_IMU_Sample), sizeof(IMU_Sample), ring_bytes, sizeof(IMU_Block), IMU_BLOCK_SAMPLES);
+    printf("Seconds at 200Hz in 16KB: %.1f before, %.1f now\n",
+           16384.0 / sizeof(Old_IMU_Sample) / 200, 16384.0 / ring_bytes / 200);
+    printf("Seconds at 200Hz in 64KB (a quarter of the SRAM): %.1f before, %.1f now\n",
+           65536.0 / sizeof(Old_IMU_Sample) / 200, 65536.0 / ring_bytes / 200);
+
+    uint64_t queue_sum = 0, ring_sum = 0;
+    double queue_push, queue_pop, ring_push, ring_pop;
+    bench_queue(samples, &queue_push, &queue_pop, &queue_sum);
+    bench_ring(samples, &ring_push, &ring_pop, &ring_sum);
+
+    printf("\n%" PRIu32 " samples in bursts of %d:\n", samples, BURST);
+    printf("  Record_Queue  push %6.1f M/s  pop %6.1f M/s\n", samples / queue_push / 1e6, samples / queue_pop / 1e6);
+    printf("  IMU_Ring      push %6.1f M/s  pop %6.1f M/s\n", samples / ring_push / 1e6, samples / ring_pop / 1e6);
+    if (queue_sum != ring_sum) {
+        printf("Checksums differ: %" PRIu64 " and %" PRIu64 "\n", queue_sum, ring_sum);
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
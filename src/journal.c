@@ -0,0 +1,356 @@
+/*
+File: journal.c
+Author: Leonardo DaGraca
+
+Crash-safe append-only log (see journal.h).
+The journal is preallocated with f_expand, which needs FF_USE_EXPAND enabled in
+the ffconf.h of the FatFs library. Records go through an SD_Writer, so they are
+still written in whole sectors and synced on the same time/byte budget as the
+plain log files.
+*/
+#include <string.h>
+#include "journal.h"
+
+//CRC-32 (IEEE 802.3, reflected) with a 16 entry table, small enough for the M0+ flash cache
+static const uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static const uint8_t zeros[64];
+
+static uint32_t crc32_update(uint32_t crc, const void *data, uint32_t len) {
+    const uint8_t *p = data;
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ crc_table[crc & 0x0f];
+        crc = (crc >> 4) ^ crc_table[crc & 0x0f];
+    }
+    return crc;
+}
+
+uint32_t journal_crc32(const void *data, uint32_t len) {
+    return ~crc32_update(0xFFFFFFFF, data, len);
+}
+
+static uint32_t record_crc(uint32_t id, const Journal_Record_Header *header, const void *payload) {
+    Journal_Record_Header copy = *header;
+    copy.crc = 0;
+
+    uint32_t crc = crc32_update(0xFFFFFFFF, &id, sizeof(id));
+    crc = crc32_update(crc, &copy, sizeof(copy));
+    return ~crc32_update(crc, payload, header->length);
+}
+
+bool journal_record_valid(const uint8_t *data, uint32_t avail, uint32_t id, Journal_Record_Header *header) {
+    if (avail < sizeof(Journal_Record_Header)) {
+        return false;
+    }
+    memcpy(header, data, sizeof(*header));
+    if (header->magic != JOURNAL_RECORD_MAGIC || header->kind >= JOURNAL_KIND_COUNT ||
+        header->length > avail - sizeof(Journal_Record_Header)) {
+        return false;
+    }
+    return record_crc(id, header, data + sizeof(Journal_Record_Header)) == header->crc;
+}
+
+static FRESULT read_at(Journal *journal, uint64_t offset, void *dst, uint32_t len) {
+    UINT bytes_read;
+    FRESULT fr = f_lseek(&journal->file, offset);
+    if (fr == FR_OK) {
+        fr = f_read(&journal->file, dst, len, &bytes_read);
+    }
+    if (fr == FR_OK && bytes_read != len) {
+        fr = FR_DISK_ERR;
+    }
+    return fr;
+}
+
+//true when the segment starts with a valid record, the writer buffer is free to read into until logging starts
+static bool segment_first(Journal *journal, uint64_t segment, Journal_Record_Header *header) {
+    journal->probed_segments++;
+    return read_at(journal, segment * JOURNAL_SEGMENT_SIZE, journal->writer.buffer, JOURNAL_SEGMENT_SIZE) == FR_OK &&
+           journal_record_valid(journal->writer.buffer, JOURNAL_SEGMENT_SIZE, journal->id, header);
+}
+
+//writes the header of a new journal and preallocates its clusters in one contiguous run
+static FRESULT create_journal(Journal *journal, const char *path, uint64_t capacity, uint32_t id_seed) {
+    FRESULT fr = f_open(&journal->file, path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        return fr;
+    }
+    //a fragmented or nearly full card may not have the whole run, take the largest fraction that fits
+    fr = f_expand(&journal->file, capacity, 1);
+    while (fr == FR_DENIED && capacity / 2 >= JOURNAL_MIN_CAPACITY) {
+        capacity /= 2;
+        fr = f_expand(&journal->file, capacity, 1);
+    }
+    if (fr != FR_OK) {
+        f_close(&journal->file);
+        return fr;
+    }
+
+    //the seed only has to differ from the one of an older journal in the same clusters
+    journal->id = id_seed * 2654435761u ^ (id_seed >> 15) ^ 0x5A17C0DE;
+    journal->capacity = capacity;
+
+    uint8_t *sector = journal->writer.buffer;
+    memset(sector, 0, SD_SECTOR_SIZE);
+    Journal_File_Header header = {
+        .version = JOURNAL_VERSION,
+        .id = journal->id,
+        .segment_size = JOURNAL_SEGMENT_SIZE,
+        .capacity = capacity
+    };
+    memcpy(header.magic, JOURNAL_MAGIC, 4);
+    memcpy(sector, &header, sizeof(header));
+
+    UINT bytes_written;
+    fr = f_write(&journal->file, sector, SD_SECTOR_SIZE, &bytes_written);
+    if (fr == FR_OK && bytes_written != SD_SECTOR_SIZE) {
+        fr = FR_DISK_ERR;
+    }
+    if (fr == FR_OK) {
+        fr = f_sync(&journal->file);
+    }
+    return fr;
+}
+
+static bool read_header(Journal *journal) {
+    Journal_File_Header header;
+    if (read_at(journal, 0, &header, sizeof(header)) != FR_OK ||
+        memcmp(header.magic, JOURNAL_MAGIC, 4) != 0 || header.version != JOURNAL_VERSION ||
+        header.segment_size != JOURNAL_SEGMENT_SIZE || header.capacity > f_size(&journal->file) ||
+        header.capacity < 3 * JOURNAL_SEGMENT_SIZE) {
+        return false;
+    }
+    journal->id = header.id;
+    journal->capacity = header.capacity;
+    return true;
+}
+
+//finds the newest valid record and positions the file at the segment after it
+static FRESULT recover(Journal *journal) {
+    uint64_t segments = journal->capacity / JOURNAL_SEGMENT_SIZE;
+    uint64_t last = 0;
+    Journal_Record_Header header;
+
+    //a write torn while wrapping leaves segment 1 without a valid record, the oldest lap then starts at 2
+    uint64_t first = 1;
+    bool found = segment_first(journal, first, &header);
+    if (!found) {
+        first = 2;
+        found = segment_first(journal, first, &header);
+    }
+
+    //first records rise from segment 1 to the newest, the segments after it are unwritten or an older lap
+    if (found) {
+        uint32_t first_sequence = header.sequence;
+        uint64_t lo = first, hi = segments - 1;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo + 1) / 2;
+            if (segment_first(journal, mid, &header) && header.sequence >= first_sequence) {
+                lo = mid;
+            }
+            else {
+                hi = mid - 1;
+            }
+        }
+        last = lo;
+    }
+
+    if (last == 0) {
+        journal->offset = JOURNAL_SEGMENT_SIZE;
+        journal->sequence = 0;
+        journal->session = 1;
+        return f_lseek(&journal->file, journal->offset);
+    }
+
+    //walk the records of that segment, stale data after a torn write fails the CRC, sequence or session check
+    uint8_t *segment = journal->writer.buffer;
+    FRESULT fr = read_at(journal, last * JOURNAL_SEGMENT_SIZE, segment, JOURNAL_SEGMENT_SIZE);
+    if (fr != FR_OK) {
+        return fr;
+    }
+
+    uint32_t pos = 0;
+    uint32_t last_sequence = 0;
+    uint16_t last_session = 0;
+    while (journal_record_valid(segment + pos, JOURNAL_SEGMENT_SIZE - pos, journal->id, &header)) {
+        if (journal->recovered_records > 0 &&
+            (header.sequence != last_sequence + 1 || header.session < last_session)) {
+            break;
+        }
+        last_sequence = header.sequence;
+        last_session = header.session;
+        journal->recovered_records++;
+        pos += sizeof(header) + header.length;
+    }
+
+    //a new session even after a brownout, nothing at power-up tells how long the power was gone (journal.h)
+    journal->sequence = last_sequence + 1;
+    journal->session = last_session + 1;
+
+    //continue in the next segment, a sector that holds records of this lap is never written again
+    //so a power loss during this session cannot tear what earlier sessions logged
+    journal->offset = (last + 1 < segments ? last + 1 : 1) * JOURNAL_SEGMENT_SIZE;
+    return f_lseek(&journal->file, journal->offset);
+}
+
+FRESULT journal_open(Journal *journal, const char *path, uint64_t capacity,
+                     const SD_Writer_Config *config, uint32_t id_seed, uint64_t now_us) {
+    memset(journal, 0, sizeof(*journal));
+    sd_writer_init(&journal->writer, &journal->file, config, now_us);
+
+    FRESULT fr = f_open(&journal->file, path, FA_READ | FA_WRITE);
+    if (fr == FR_OK && !read_header(journal)) {
+        f_close(&journal->file);
+        fr = FR_NO_FILE;
+    }
+    if (fr != FR_OK) {
+        fr = create_journal(journal, path, capacity, id_seed);
+        if (fr != FR_OK) {
+            return fr;
+        }
+    }
+
+    fr = recover(journal);
+    if (fr != FR_OK) {
+        return fr;
+    }
+
+    //the session record tells the extractor where this power-up starts
+    return journal_append(journal, JOURNAL_SESSION, &now_us, sizeof(now_us));
+}
+
+static FRESULT write_zeros(Journal *journal, uint32_t len) {
+    while (len > 0) {
+        uint32_t chunk = len < sizeof(zeros) ? len : sizeof(zeros);
+        FRESULT fr = sd_writer_write(&journal->writer, zeros, chunk);
+        if (fr != FR_OK) {
+            return fr;
+        }
+        len -= chunk;
+    }
+    return FR_OK;
+}
+
+static FRESULT put_record(Journal *journal, uint8_t kind, const void *data, uint32_t len) {
+    Journal_Record_Header header = {
+        .magic = JOURNAL_RECORD_MAGIC,
+        .kind = kind,
+        .length = (uint16_t)len,
+        .session = journal->session,
+        .sequence = journal->sequence
+    };
+
+    FRESULT fr;
+    if (data) {
+        header.crc = record_crc(journal->id, &header, data);
+        fr = sd_writer_write(&journal->writer, &header, sizeof(header));
+        if (fr == FR_OK) {
+            fr = sd_writer_write(&journal->writer, data, len);
+        }
+    }
+    else {
+        //padding, the payload is all zeros
+        Journal_Record_Header copy = header;
+        uint32_t crc = crc32_update(0xFFFFFFFF, &journal->id, sizeof(journal->id));
+        crc = crc32_update(crc, &copy, sizeof(copy));
+        for (uint32_t left = len; left > 0;) {
+            uint32_t chunk = left < sizeof(zeros) ? left : sizeof(zeros);
+            crc = crc32_update(crc, zeros, chunk);
+            left -= chunk;
+        }
+        header.crc = ~crc;
+        fr = sd_writer_write(&journal->writer, &header, sizeof(header));
+        if (fr == FR_OK) {
+            fr = write_zeros(journal, len);
+        }
+    }
+
+    journal->offset += sizeof(header) + len;
+    journal->sequence++;
+    return fr;
+}
+
+//fills the rest of the segment, with a padding record if there is room for one
+static FRESULT pad_segment(Journal *journal) {
+    uint32_t room = JOURNAL_SEGMENT_SIZE - (uint32_t)(journal->offset % JOURNAL_SEGMENT_SIZE);
+    if (room >= sizeof(Journal_Record_Header)) {
+        return put_record(journal, JOURNAL_PAD, NULL, room - sizeof(Journal_Record_Header));
+    }
+    journal->offset += room;
+    return write_zeros(journal, room);
+}
+
+//the last segment is written out, logging goes on at segment 1 over the oldest records
+static FRESULT wrap(Journal *journal) {
+    FRESULT fr = sd_writer_flush(&journal->writer, journal->writer.last_sync_us);
+    if (fr == FR_OK) {
+        fr = f_lseek(&journal->file, JOURNAL_SEGMENT_SIZE);
+    }
+    if (fr != FR_OK) {
+        return fr;
+    }
+    journal->offset = JOURNAL_SEGMENT_SIZE;
+    journal->wraps++;
+    return FR_OK;
+}
+
+FRESULT journal_append(Journal *journal, uint8_t kind, const void *data, uint32_t len) {
+    if (len > JOURNAL_MAX_PAYLOAD) {
+        return FR_INVALID_PARAMETER;
+    }
+
+    FRESULT fr = FR_OK;
+    uint32_t room = JOURNAL_SEGMENT_SIZE - (uint32_t)(journal->offset % JOURNAL_SEGMENT_SIZE);
+    if (room < sizeof(Journal_Record_Header) + len) {
+        fr = pad_segment(journal);
+    }
+    if (fr == FR_OK && journal->offset >= journal->capacity / JOURNAL_SEGMENT_SIZE * JOURNAL_SEGMENT_SIZE) {
+        fr = wrap(journal);
+    }
+    if (fr == FR_OK) {
+        fr = put_record(journal, kind, data, len);
+    }
+    if (fr != FR_OK) {
+        journal->dropped++;
+    }
+    return fr;
+}
+
+FRESULT journal_write(Journal *journal, uint8_t kind, const void *data, uint32_t len) {
+    const uint8_t *src = data;
+
+    while (len > 0) {
+        //a chunk shorter than its header is not worth a record, start the next segment instead
+        uint32_t room = JOURNAL_SEGMENT_SIZE - (uint32_t)(journal->offset % JOURNAL_SEGMENT_SIZE);
+        uint32_t chunk = room > 2 * sizeof(Journal_Record_Header) ? room - sizeof(Journal_Record_Header) : JOURNAL_MAX_PAYLOAD;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        FRESULT fr = journal_append(journal, kind, src, chunk);
+        if (fr != FR_OK) {
+            return fr;
+        }
+        src += chunk;
+        len -= chunk;
+    }
+    return FR_OK;
+}
+
+FRESULT journal_commit(Journal *journal, uint64_t now_us) {
+    return sd_writer_commit(&journal->writer, now_us);
+}
+
+FRESULT journal_flush(Journal *journal, uint64_t now_us) {
+    return sd_writer_flush(&journal->writer, now_us);
+}
+
+FRESULT journal_close(Journal *journal, uint64_t now_us) {
+    FRESULT fr = journal_flush(journal, now_us);
+    FRESULT close_fr = f_close(&journal->file);
+    return fr != FR_OK ? fr : close_fr;
+}
@@ -0,0 +1,137 @@
+/*
+File: journal.h
+Author: Leonardo DaGraca
+
+Crash-safe append-only log on the SD card, compiled in with CRASH_SAFE_LOG.
+All streams of all sessions go into one journal file that is preallocated
+once as a contiguous run of clusters (f_expand), so logging only ever
+overwrites data sectors in place: the FAT chain and the file size never change
+and a power loss cannot leave a broken cluster chain behind. On a fragmented
+or nearly full card the capacity is halved until a run is found, down to
+JOURNAL_MIN_CAPACITY.
+
+Layout: segment 0 holds the Journal_File_Header in its first sector, the
+records follow from segment 1 on. A record never crosses a segment boundary,
+so every written segment starts with a record. Each record carries the
+session (one per power-up), a sequence number that grows by one per record
+and a CRC-32 over the journal id, its header and its payload.
+
+The journal is a ring: once the last segment is full, logging wraps back to
+segment 1 and overwrites the oldest segments, so a full card keeps the most
+recent sessions instead of refusing every new record. The first records of
+the written segments then rise from segment 1 up to the newest one and drop
+to the oldest lap after it (or to unwritten segments before the first wrap).
+
+Recovery after a reboot binary searches the segments for the newest one, the
+last whose first record is valid with a sequence at least that of segment 1,
+then walks the records of that segment until the CRC, the sequence or the
+session stops matching. Logging resumes at the next segment, so a sector
+holding records of the last lap is never rewritten and a torn write can only
+damage data that was not on the card yet or the oldest segment being
+overwritten. Opening the journal costs a few sector reads plus one segment no
+matter how much was logged before, and no counter file has to be rewritten at
+every boot.
+
+Every power-up starts a new session, a brownout in the middle of a run
+included. The tracker has no real-time clock and hal_time_us() starts again
+from zero, so the time of the last record cannot tell a reset a second ago
+from yesterday's run, and only GPS time can, once there is a fix. The run's
+data is still all there: a brownout splits it into two consecutive sessions,
+the second starting with a JOURNAL_SESSION record.
+
+Stream records hold consecutive chunks of a log file (GPS, IMU, clock,
+attitude, track, events, fused track, time indexes), the host tool journal_extract.c concatenates them per session back
+into the usual gps_log_N / imu_log_N / clock_log_N / attitude_log_N / track_log_N / events_N / fused_log_N files. Report records (summary, profile,
+power) hold the whole report, the last one of a session wins. Once the journal
+has wrapped, the oldest session left is missing its beginning.
+*/
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ff.h"
+#include "sd_writer.h"
+
+#define JOURNAL_MAGIC "GTJL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_RECORD_MAGIC 0x524A     //"JR"
+
+//records never cross a segment boundary, a segment is as large as a write-behind block
+#define JOURNAL_SEGMENT_SIZE SD_WRITER_BLOCK_SIZE
+#define JOURNAL_MAX_PAYLOAD (JOURNAL_SEGMENT_SIZE - sizeof(Journal_Record_Header))
+
+//smallest journal created when the card has no contiguous run for the capacity asked for
+#define JOURNAL_MIN_CAPACITY (64 * JOURNAL_SEGMENT_SIZE)
+
+//record kinds
+#define JOURNAL_PAD 0           //fills the end of a segment
+#define JOURNAL_SESSION 1       //first record of each power-up
+#define JOURNAL_GPS 2           //chunks of the GPS log
+#define JOURNAL_IMU 3           //chunks of the IMU log
+#define JOURNAL_CLOCK 4         //chunks of the clock log
+#define JOURNAL_SUMMARY 5       //whole session summary report
+#define JOURNAL_PROFILE 6       //whole stage profile report
+#define JOURNAL_POWER 7         //whole power report
+#define JOURNAL_ATTITUDE 8      //chunks of the attitude log
+#define JOURNAL_TRACK 9         //chunks of the simplified track
+#define JOURNAL_EVENTS 10       //chunks of the IMU event bursts
+#define JOURNAL_FUSED 11        //chunks of the fused GPS/IMU track
+#define JOURNAL_GPS_INDEX 12    //chunks of the GPS log's time index
+#define JOURNAL_IMU_INDEX 13    //chunks of the IMU log's time index
+#define JOURNAL_KIND_COUNT 14
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved[3];
+    uint32_t id;                //random per journal, stale records of an older journal fail the CRC
+    uint32_t segment_size;
+    uint64_t capacity;          //preallocated file size in bytes
+} Journal_File_Header;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t length;            //payload bytes
+    uint16_t session;
+    uint32_t sequence;
+    uint32_t crc;               //CRC-32 of the id, this header with crc = 0 and the payload
+} Journal_Record_Header;
+
+typedef struct Journal {
+    FIL file;
+    SD_Writer writer;           //block buffer of the journal file, its config is the sync budget
+    uint32_t id;
+    uint64_t capacity;
+    uint64_t offset;            //where the next record goes
+    uint32_t sequence;          //of the next record
+    uint16_t session;           //of this power-up
+
+    //what the last journal_open found
+    uint32_t recovered_records; //valid records in the last written segment
+    uint32_t probed_segments;   //segments read by the binary search
+    uint32_t dropped;           //records lost to write errors
+    uint32_t wraps;             //times logging went back to segment 1 since journal_open
+} Journal;
+
+//opens the journal or creates and preallocates it, then starts a new session after the newest valid record
+//without a contiguous run of capacity bytes on the card it is created with the largest half, quarter... that fits
+FRESULT journal_open(Journal *journal, const char *path, uint64_t capacity,
+                     const SD_Writer_Config *config, uint32_t id_seed, uint64_t now_us);
+//one record that is never split, len must not exceed JOURNAL_MAX_PAYLOAD
+FRESULT journal_append(Journal *journal, uint8_t kind, const void *data, uint32_t len);
+//stream data, split over as many records as needed
+FRESULT journal_write(Journal *journal, uint8_t kind, const void *data, uint32_t len);
+//call once per logged record, syncs the journal when the budget of its writer is used up
+FRESULT journal_commit(Journal *journal, uint64_t now_us);
+FRESULT journal_flush(Journal *journal, uint64_t now_us);
+FRESULT journal_close(Journal *journal, uint64_t now_us);
+
+//checks the record at the start of data (avail bytes), shared with the host extractor
+bool journal_record_valid(const uint8_t *data, uint32_t avail, uint32_t id, Journal_Record_Header *header);
+//CRC-32 of the records, also used for the IMU calibration slots
+uint32_t journal_crc32(const void *data, uint32_t len);
+
+#endif
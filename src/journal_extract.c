@@ -0,0 +1,549 @@
+/*
+File: journal_extract.c
+Author: Leonardo DaGraca
+
+Host tool for the crash-safe journal written with CRASH_SAFE_LOG (journal.h).
+
+Extract mode walks the valid records of journal.dat and writes every session
+back into the layout of the plain logger: gps_logs/gps_log_N, imu_logs/imu_log_N
+(.csv, .bin or .imz, whichever the logger wrote), gps_logs/clock_log_N.csv,
+imu_logs/attitude_log_N.csv, gps_logs/track_log_N.csv, imu_logs/events_N.csv, gps_logs/fused_log_N.csv, the time indexes gps_logs/gps_log_N.idx and
+imu_logs/imu_log_N.idx and the last summary, profile and power report of
+the session.
+
+Power loss mode (-p) tests the journal itself through the host FatFs layer. Each
+trial reopens the journal, checks that everything that had reached the card
+before the last power loss was recovered intact, then appends random stream
+data and reports until power is cut at a random byte (ff_host_cut_power_after),
+tearing the sector being written. With -f the simulated card has no free run
+larger than free_kb, so the journal falls back to a smaller capacity and
+wraps many times. Each trial then first finds where every stream starts in
+the oldest segment left before checking it. Use a RAM disk such as /dev/shm as
+work_dir.
+
+Usage: journal_extract <journal.dat> <out_dir>
+       journal_extract -p <trials> [-f <free_kb>] <work_dir>
+Build: cc -O2 -Ihost -I. -o journal_extract journal_extract.c journal.c sd_writer.c log_index.c host/ff_host.c
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "log_format.h"
+#include "imu_codec.h"
+
+#define TEST_JOURNAL "journal.dat"
+#define TEST_CAPACITY (32 * 1024 * 1024ULL)
+#define TEST_MAX_POWER_BUDGET (96 * 1024)
+#define TEST_MAX_CALLS 4096
+
+typedef void (*Record_Handler)(const Journal_Record_Header *header, const uint8_t *payload, void *context);
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} Mapped_File;
+
+static int map_file(const char *path, Mapped_File *file) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "%s: empty journal\n", path);
+        close(fd);
+        return 1;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+    file->data = data;
+    file->size = (size_t)st.st_size;
+    return 0;
+}
+
+static void unmap_file(Mapped_File *file) {
+    munmap((void *)file->data, file->size);
+}
+
+static int read_file_header(const Mapped_File *file, Journal_File_Header *header) {
+    if (file->size < sizeof(*header)) {
+        return 1;
+    }
+    memcpy(header, file->data, sizeof(*header));
+    if (memcmp(header->magic, JOURNAL_MAGIC, 4) != 0 || header->version != JOURNAL_VERSION ||
+        header->segment_size != JOURNAL_SEGMENT_SIZE || header->capacity > file->size) {
+        return 1;
+    }
+    return 0;
+}
+
+//the oldest segment of the ring: the lowest first sequence, segment 1 until the journal wraps
+static uint64_t oldest_segment(const Mapped_File *file, const Journal_File_Header *file_header) {
+    uint64_t segments = file_header->capacity / JOURNAL_SEGMENT_SIZE;
+    uint64_t oldest = 1;
+    uint32_t oldest_sequence = UINT32_MAX;
+
+    for (uint64_t segment = 1; segment < segments; segment++) {
+        Journal_Record_Header header;
+        if (journal_record_valid(file->data + segment * JOURNAL_SEGMENT_SIZE, JOURNAL_SEGMENT_SIZE, file_header->id,
+                                 &header) && header.sequence < oldest_sequence) {
+            oldest = segment;
+            oldest_sequence = header.sequence;
+        }
+    }
+    return oldest;
+}
+
+//the same chain journal_open recovers from the oldest segment around the ring:
+//consecutive sequence numbers, sessions never going back
+static uint64_t walk_journal(const Mapped_File *file, const Journal_File_Header *file_header,
+                             Record_Handler handler, void *context, uint32_t *records) {
+    uint64_t ring = file_header->capacity / JOURNAL_SEGMENT_SIZE - 1;
+    uint64_t oldest = oldest_segment(file, file_header);
+    uint64_t end = JOURNAL_SEGMENT_SIZE;
+    uint32_t last_sequence = 0;
+    uint16_t last_session = 0;
+    *records = 0;
+
+    for (uint64_t n = 0; n < ring; n++) {
+        uint64_t segment = 1 + (oldest - 1 + n) % ring;
+        const uint8_t *base = file->data + segment * JOURNAL_SEGMENT_SIZE;
+        uint32_t pos = 0;
+        bool continued = false;
+        Journal_Record_Header header;
+
+        while (journal_record_valid(base + pos, JOURNAL_SEGMENT_SIZE - pos, file_header->id, &header)) {
+            if (*records > 0 && (header.sequence != last_sequence + 1 || header.session < last_session)) {
+                break;
+            }
+            handler(&header, base + pos + sizeof(header), context);
+            last_sequence = header.sequence;
+            last_session = header.session;
+            (*records)++;
+            pos += sizeof(header) + header.length;
+            end = segment * JOURNAL_SEGMENT_SIZE + pos;
+            continued = true;
+        }
+        if (!continued) {
+            break;
+        }
+    }
+    return end;
+}
+
+typedef struct {
+    const char *out_dir;
+    uint16_t session;
+    FILE *streams[JOURNAL_KIND_COUNT];
+    uint8_t *reports[JOURNAL_KIND_COUNT];
+    uint16_t report_lengths[JOURNAL_KIND_COUNT];
+    uint32_t sessions;
+    uint64_t payload_bytes;
+} Extract_State;
+
+static void stream_path(const Extract_State *state, uint8_t kind, const uint8_t *first_bytes, char *path, size_t size) {
+    //the stream starts with a binary log header when the logger was built with LOG_FORMAT_BINARY
+    //or with a codec header for an IMU log written with IMU_COMPRESS
+    const char *ext = memcmp(first_bytes, LOG_MAGIC, 4) == 0 ? "bin" :
+                      memcmp(first_bytes, IMU_CODEC_MAGIC, 4) == 0 ? "imz" : "csv";
+    switch (kind) {
+        case JOURNAL_GPS: snprintf(path, size, "%s/gps_logs/gps_log_%u.%s", state->out_dir, state->session, ext); break;
+        case JOURNAL_IMU: snprintf(path, size, "%s/imu_logs/imu_log_%u.%s", state->out_dir, state->session, ext); break;
+        case JOURNAL_ATTITUDE: snprintf(path, size, "%s/imu_logs/attitude_log_%u.csv", state->out_dir, state->session); break;
+        case JOURNAL_TRACK: snprintf(path, size, "%s/gps_logs/track_log_%u.csv", state->out_dir, state->session); break;
+        case JOURNAL_EVENTS: snprintf(path, size, "%s/imu_logs/events_%u.csv", state->out_dir, state->session); break;
+        case JOURNAL_FUSED: snprintf(path, size, "%s/gps_logs/fused_log_%u.csv", state->out_dir, state->session); break;
+        case JOURNAL_GPS_INDEX: snprintf(path, size, "%s/gps_logs/gps_log_%u.idx", state->out_dir, state->session); break;
+        case JOURNAL_IMU_INDEX: snprintf(path, size, "%s/imu_logs/imu_log_%u.idx", state->out_dir, state->session); break;
+        default: snprintf(path, size, "%s/gps_logs/clock_log_%u.csv", state->out_dir, state->session); break;
+    }
+}
+
+static void end_session(Extract_State *state) {
+    static const char *report_names[JOURNAL_KIND_COUNT] = {
+        [JOURNAL_SUMMARY] = "summary", [JOURNAL_PROFILE] = "profile", [JOURNAL_POWER] = "power"
+    };
+
+    for (int kind = 0; kind < JOURNAL_KIND_COUNT; kind++) {
+        if (state->streams[kind]) {
+            fclose(state->streams[kind]);
+            state->streams[kind] = NULL;
+        }
+        if (state->reports[kind]) {
+            char path[600];
+            snprintf(path, sizeof(path), "%s/gps_logs/%s_%u.csv", state->out_dir, report_names[kind], state->session);
+            FILE *report = fopen(path, "wb");
+            if (report) {
+                fwrite(state->reports[kind], 1, state->report_lengths[kind], report);
+                fclose(report);
+            }
+            free(state->reports[kind]);
+            state->reports[kind] = NULL;
+        }
+    }
+}
+
+static void extract_record(const Journal_Record_Header *header, const uint8_t *payload, void *context) {
+    Extract_State *state = context;
+
+    if (header->session != state->session) {
+        end_session(state);
+        state->session = header->session;
+        state->sessions++;
+    }
+
+    switch (header->kind) {
+        case JOURNAL_GPS:
+        case JOURNAL_IMU:
+        case JOURNAL_CLOCK:
+        case JOURNAL_ATTITUDE:
+        case JOURNAL_TRACK:
+        case JOURNAL_EVENTS:
+        case JOURNAL_FUSED:
+        case JOURNAL_GPS_INDEX:
+        case JOURNAL_IMU_INDEX:
+            if (!state->streams[header->kind] && header->length >= 4) {
+                char path[600];
+                stream_path(state, header->kind, payload, path, sizeof(path));
+                state->streams[header->kind] = fopen(path, "wb");
+                if (!state->streams[header->kind]) {
+                    perror(path);
+                }
+            }
+            if (state->streams[header->kind]) {
+                fwrite(payload, 1, header->length, state->streams[header->kind]);
+            }
+            state->payload_bytes += header->length;
+            break;
+        case JOURNAL_SUMMARY:
+        case JOURNAL_PROFILE:
+        case JOURNAL_POWER:
+            //the last report of the session wins
+            free(state->reports[header->kind]);
+            state->reports[header->kind] = malloc(header->length ? header->length : 1);
+            if (state->reports[header->kind]) {
+                memcpy(state->reports[header->kind], payload, header->length);
+                state->report_lengths[header->kind] = header->length;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static int extract(const char *journal_path, const char *out_dir) {
+    Mapped_File file;
+    if (map_file(journal_path, &file) != 0) {
+        return 1;
+    }
+    Journal_File_Header header;
+    if (read_file_header(&file, &header) != 0) {
+        fprintf(stderr, "%s: not a journal or unsupported version\n", journal_path);
+        unmap_file(&file);
+        return 1;
+    }
+
+    char path[600];
+    mkdir(out_dir, 0777);
+    snprintf(path, sizeof(path), "%s/gps_logs", out_dir);
+    mkdir(path, 0777);
+    snprintf(path, sizeof(path), "%s/imu_logs", out_dir);
+    mkdir(path, 0777);
+
+    Extract_State state;
+    memset(&state, 0, sizeof(state));
+    state.out_dir = out_dir;
+    uint32_t records;
+    uint64_t end = walk_journal(&file, &header, extract_record, &state, &records);
+    end_session(&state);
+
+    printf("Journal %08" PRIx32 ": %" PRIu32 " records, %" PRIu32 " sessions, %" PRIu64 " log bytes, "
+           "oldest record in segment %" PRIu64 ", newest ends at byte %" PRIu64 " of %" PRIu64 "\n",
+           header.id, records, state.sessions, state.payload_bytes, oldest_segment(&file, &header), end,
+           header.capacity);
+    unmap_file(&file);
+    return 0;
+}
+
+//power loss test: stream bytes are a function of their position, so any damage shows up
+static uint8_t test_byte(uint8_t kind, uint64_t offset) {
+    uint64_t x = (offset + 1) * 0x9E3779B97F4A7C15ULL ^ kind * 0xC2B2AE3D27D4EB4FULL;
+    x ^= x >> 29;
+    return (uint8_t)(x * 0xBF58476D1CE4E5B9ULL >> 56);
+}
+
+#define TEST_HEAD_BYTES 32
+
+typedef struct {
+    uint64_t stream_bytes[JOURNAL_KIND_COUNT];  //stream position of the next recovered byte
+    uint32_t reports;                           //index of the next summary record
+    uint32_t sessions;
+    uint32_t bad_bytes;
+    uint32_t bad_reports;
+
+    //first pass: the first bytes of each stream and the first report, to find where a wrapped journal starts
+    uint8_t head[JOURNAL_KIND_COUNT][TEST_HEAD_BYTES];
+    uint32_t head_len[JOURNAL_KIND_COUNT];
+    uint64_t recovered[JOURNAL_KIND_COUNT];     //bytes per stream, summary records
+    uint16_t first_report_len;
+} Test_Scan;
+
+static void locate_record(const Journal_Record_Header *header, const uint8_t *payload, void *context) {
+    Test_Scan *scan = context;
+
+    if (header->kind == JOURNAL_GPS || header->kind == JOURNAL_IMU) {
+        uint32_t *len = &scan->head_len[header->kind];
+        for (uint32_t i = 0; i < header->length && *len < TEST_HEAD_BYTES; i++) {
+            scan->head[header->kind][(*len)++] = payload[i];
+        }
+        scan->recovered[header->kind] += header->length;
+    }
+    else if (header->kind == JOURNAL_SUMMARY) {
+        if (scan->recovered[JOURNAL_SUMMARY]++ == 0) {
+            scan->first_report_len = header->length;
+            memcpy(scan->head[JOURNAL_SUMMARY], payload, header->length < TEST_HEAD_BYTES ? header->length : TEST_HEAD_BYTES);
+        }
+    }
+}
+
+//stream position of the oldest recovered byte, the journal holds at most capacity bytes before the end
+static bool find_stream_base(const Test_Scan *scan, uint8_t kind, uint64_t lo, uint64_t hi, uint64_t *base) {
+    for (uint64_t offset = lo; offset <= hi; offset++) {
+        uint32_t i = 0;
+        while (i < scan->head_len[kind] && test_byte(kind, offset + i) == scan->head[kind][i]) {
+            i++;
+        }
+        if (i == scan->head_len[kind]) {
+            *base = offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool find_report_base(const Test_Scan *scan, uint32_t lo, uint32_t hi, uint32_t *base) {
+    for (uint32_t index = lo; index <= hi; index++) {
+        uint32_t len = 16 + index % 1000;
+        uint32_t i = 0;
+        while (i < len && i < TEST_HEAD_BYTES &&
+               test_byte(JOURNAL_SUMMARY, (uint64_t)index << 16 | i) == scan->head[JOURNAL_SUMMARY][i]) {
+            i++;
+        }
+        if (len == scan->first_report_len && (i == len || i == TEST_HEAD_BYTES)) {
+            *base = index;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void check_record(const Journal_Record_Header *header, const uint8_t *payload, void *context) {
+    Test_Scan *scan = context;
+
+    if (header->kind == JOURNAL_SESSION) {
+        scan->sessions++;
+    }
+    else if (header->kind == JOURNAL_GPS || header->kind == JOURNAL_IMU) {
+        for (uint32_t i = 0; i < header->length; i++) {
+            if (payload[i] != test_byte(header->kind, scan->stream_bytes[header->kind] + i)) {
+                scan->bad_bytes++;
+            }
+        }
+        scan->stream_bytes[header->kind] += header->length;
+    }
+    else if (header->kind == JOURNAL_SUMMARY) {
+        uint32_t expected_len = 16 + scan->reports % 1000;
+        if (header->length != expected_len) {
+            scan->bad_reports++;
+        }
+        for (uint32_t i = 0; i < header->length && i < expected_len; i++) {
+            if (payload[i] != test_byte(JOURNAL_SUMMARY, (uint64_t)scan->reports << 16 | i)) {
+                scan->bad_reports++;
+                break;
+            }
+        }
+        scan->reports++;
+    }
+}
+
+//what had reached the card after each append call, to know what a power loss must not lose
+typedef struct {
+    uint64_t journal_end;       //bytes appended in this trial, laps of the ring included
+    uint64_t stream_bytes[JOURNAL_KIND_COUNT];
+    uint32_t reports;
+} Test_Call;
+
+//walks the recovered journal twice: once to find where each stream starts after wraps, once to check it
+static bool scan_journal(const char *path, const Test_Call *durable, const Test_Call *written, Test_Scan *scan) {
+    Mapped_File file;
+    Journal_File_Header header;
+    if (map_file(path, &file) != 0 || read_file_header(&file, &header) != 0) {
+        return false;
+    }
+    memset(scan, 0, sizeof(*scan));
+    uint32_t records;
+    walk_journal(&file, &header, locate_record, scan, &records);
+
+    bool located = true;
+    for (int kind = JOURNAL_GPS; kind <= JOURNAL_IMU; kind++) {
+        uint64_t base = 0;
+        if (scan->recovered[kind] > 0) {
+            uint64_t lo = durable->stream_bytes[kind] > header.capacity ? durable->stream_bytes[kind] - header.capacity : 0;
+            located = located && find_stream_base(scan, (uint8_t)kind, lo, written->stream_bytes[kind], &base);
+        }
+        scan->stream_bytes[kind] = base;
+    }
+    uint32_t report_base = 0;
+    if (scan->recovered[JOURNAL_SUMMARY] > 0) {
+        uint32_t max_reports = (uint32_t)(header.capacity / (16 + sizeof(Journal_Record_Header)));
+        uint32_t lo = durable->reports > max_reports ? durable->reports - max_reports : 0;
+        located = located && find_report_base(scan, lo, written->reports, &report_base);
+    }
+    scan->reports = report_base;
+
+    walk_journal(&file, &header, check_record, scan, &records);
+    unmap_file(&file);
+    return located;
+}
+
+static int power_loss_test(int trials, const char *work_dir) {
+    static Test_Call calls[TEST_MAX_CALLS];
+    static uint8_t data[JOURNAL_MAX_PAYLOAD];
+    char path[600];
+
+    mkdir(work_dir, 0777);
+    ff_host_set_root(work_dir);
+    snprintf(path, sizeof(path), "%s/%s", work_dir, TEST_JOURNAL);
+    unlink(path);
+    srand(12345);
+
+    SD_Writer_Config config = {.max_interval_ms = 0, .max_bytes = 8 * 1024, .max_records = 0, .low_voltage = NULL};
+    Test_Call durable, written;
+    memset(&durable, 0, sizeof(durable));
+    memset(&written, 0, sizeof(written));
+    uint32_t failures = 0, max_probes = 0, max_scanned = 0, wraps = 0;
+    uint64_t lost_bytes = 0;
+
+    for (int trial = 0; trial <= trials; trial++) {
+        //power on and recover
+        ff_host_cut_power_after(-1);
+        Journal journal;
+        FRESULT fr = journal_open(&journal, TEST_JOURNAL, TEST_CAPACITY, &config, (uint32_t)rand(), trial);
+        if (fr != FR_OK) {
+            fprintf(stderr, "Trial %d: journal_open failed: %d\n", trial, fr);
+            return 1;
+        }
+        if (journal.probed_segments > max_probes) {
+            max_probes = journal.probed_segments;
+        }
+        if (journal.recovered_records > max_scanned) {
+            max_scanned = journal.recovered_records;
+        }
+
+        Test_Scan scan;
+        bool located = scan_journal(path, &durable, &written, &scan);
+
+        //a session record still in RAM at the power loss is lost like any other record
+        bool ok = located && scan.bad_bytes == 0 && scan.bad_reports == 0 && scan.sessions <= (uint32_t)trial + 1 &&
+                  journal.session <= trial + 1 && scan.reports >= durable.reports;
+        for (int kind = JOURNAL_GPS; kind <= JOURNAL_IMU; kind++) {
+            ok = ok && scan.stream_bytes[kind] >= durable.stream_bytes[kind];
+        }
+        if (!ok) {
+            fprintf(stderr, "Trial %d: recovered %" PRIu64 "/%" PRIu64 " GPS, %" PRIu64 "/%" PRIu64 " IMU bytes, "
+                    "%" PRIu32 "/%" PRIu32 " reports, %" PRIu32 " sessions, %" PRIu32 " bad bytes, %" PRIu32
+                    " bad reports%s\n", trial, scan.stream_bytes[JOURNAL_GPS], durable.stream_bytes[JOURNAL_GPS],
+                    scan.stream_bytes[JOURNAL_IMU], durable.stream_bytes[JOURNAL_IMU], scan.reports, durable.reports,
+                    scan.sessions, scan.bad_bytes, scan.bad_reports, located ? "" : ", streams not found");
+            failures++;
+        }
+        if (trial == trials) {
+            journal_close(&journal, trial);
+            printf("Power loss test: %d trials, %" PRIu32 " failures, %" PRIu64 " unsynced bytes lost, "
+                   "%" PRIu64 " KB journal wrapped %" PRIu32 " times, recovery read at most %" PRIu32 " segments and %"
+                   PRIu32 " records\n", trials, failures, lost_bytes, journal.capacity / 1024, wraps, max_probes,
+                   max_scanned);
+            break;
+        }
+
+        //whatever was recovered is where the streams continue
+        memset(&written, 0, sizeof(written));
+        memcpy(written.stream_bytes, scan.stream_bytes, sizeof(written.stream_bytes));
+        written.reports = scan.reports;
+
+        //append until the power goes
+        uint64_t ring_bytes = (journal.capacity / JOURNAL_SEGMENT_SIZE - 1) * JOURNAL_SEGMENT_SIZE;
+        uint64_t start = f_tell(&journal.file);
+        ff_host_cut_power_after(rand() % TEST_MAX_POWER_BUDGET);
+        int call_count = 0;
+        while (ff_host_powered() && call_count < TEST_MAX_CALLS) {
+            int choice = rand() % 10;
+            if (choice < 8) {
+                uint8_t kind = choice < 4 ? JOURNAL_GPS : JOURNAL_IMU;
+                uint32_t len = 1 + rand() % (choice & 1 ? 200 : 3000);
+                for (uint32_t i = 0; i < len; i++) {
+                    data[i] = test_byte(kind, written.stream_bytes[kind] + i);
+                }
+                journal_write(&journal, kind, data, len);
+                written.stream_bytes[kind] += len;
+            }
+            else {
+                uint32_t len = 16 + written.reports % 1000;
+                for (uint32_t i = 0; i < len; i++) {
+                    data[i] = test_byte(JOURNAL_SUMMARY, (uint64_t)written.reports << 16 | i);
+                }
+                journal_append(&journal, JOURNAL_SUMMARY, data, len);
+                written.reports++;
+            }
+            journal_commit(&journal, trial);
+
+            written.journal_end = journal.wraps * ring_bytes + journal.offset - start;
+            calls[call_count++] = written;
+        }
+
+        //everything appended before the last byte that reached the card must come back
+        uint64_t card_end = journal.wraps * ring_bytes + f_tell(&journal.file) - start;
+        wraps += journal.wraps;
+        f_close(&journal.file);
+        durable = written;
+        durable.journal_end = 0;
+        memcpy(durable.stream_bytes, scan.stream_bytes, sizeof(durable.stream_bytes));
+        durable.reports = scan.reports;
+        for (int i = 0; i < call_count && calls[i].journal_end <= card_end; i++) {
+            durable = calls[i];
+        }
+        lost_bytes += (written.stream_bytes[JOURNAL_GPS] - durable.stream_bytes[JOURNAL_GPS]) +
+                      (written.stream_bytes[JOURNAL_IMU] - durable.stream_bytes[JOURNAL_IMU]);
+    }
+
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[1], "-p") == 0) {
+        return power_loss_test(atoi(argv[2]), argv[3]);
+    }
+    if (argc == 6 && strcmp(argv[1], "-p") == 0 && strcmp(argv[3], "-f") == 0) {
+        ff_host_set_free_run(atoll(argv[4]) * 1024);
+        return power_loss_test(atoi(argv[2]), argv[5]);
+    }
+    if (argc == 3) {
+        return extract(argv[1], argv[2]);
+    }
+
+    fprintf(stderr, "Usage: %s <journal.dat> <out_dir>\n", argv[0]);
+    fprintf(stderr, "       %s -p <trials> [-f <free_kb>] <work_dir>\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,113 @@
+/*
+File: log_binary.c
+Author: Leonardo DaGraca
+
+Writes GPS fixes and IMU readings as fixed size binary records (see log_format.h).
+This replaces the snprintf formatting of the CSV logs when the firmware is built
+with LOG_FORMAT_BINARY. The files can be expanded back to the CSV layout on a
+computer with log_convert.c.
+*/
+#include <string.h>
+#include "log_binary.h"
+#include "profile.h"
+
+_Static_assert(LOG_IMU_SAMPLES == MAX_IMU_READINGS, "IMU record must hold the whole IMU buffer");
+
+//timestamp of the previous record in each file, used for the delta encoding
+static uint64_t gps_prev_time = 0;
+static uint64_t imu_prev_time = 0;
+
+//a gap over 71.6 minutes saturates the delta, prev_time only moves by what was written so
+//the next records catch up and log_convert still rebuilds the right times
+static uint32_t time_delta(uint64_t *prev_time, uint64_t curr_time) {
+    if (curr_time < *prev_time) {
+        return 0;
+    }
+    uint64_t delta = curr_time - *prev_time;
+    uint32_t written = delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta;
+    *prev_time += written;
+    return written;
+}
+
+static uint16_t clamp_u16(uint32_t value) {
+    return value > UINT16_MAX ? UINT16_MAX : (uint16_t)value;
+}
+
+FRESULT log_binary_write_header(SD_Writer *writer, uint8_t kind, uint64_t start_time) {
+    Log_File_Header header;
+    memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+    header.version = LOG_FORMAT_VERSION;
+    header.kind = kind;
+    header.record_size = (kind == LOG_KIND_GPS) ? sizeof(Log_GPS_Record) :
+                         (kind == LOG_KIND_IMU) ? sizeof(Log_IMU_Record) : sizeof(Log_IMU_Sample_Record);
+    header.start_time_us = start_time;
+
+    if (kind == LOG_KIND_GPS) {
+        gps_prev_time = start_time;
+    }
+    else {
+        imu_prev_time = start_time;
+    }
+
+    return sd_writer_write(writer, &header, sizeof(header));
+}
+
+//rmc or vtg may be NULL when that sentence was not received for this fix
+FRESULT log_binary_write_gps(SD_Writer *writer, uint64_t curr_time, const NMEA_RMC *rmc, const NMEA_VTG *vtg) {
+    PROFILE_START(timer);
+    Log_GPS_Record record;
+    memset(&record, 0, sizeof(record));
+    record.time_delta_us = time_delta(&gps_prev_time, curr_time);
+
+    if (rmc) {
+        record.flags |= LOG_GPS_HAS_RMC | (rmc->valid ? LOG_GPS_RMC_VALID : 0);
+        record.utc_time_ms = rmc->time_ms;
+        record.date = rmc->date;
+        record.lat_e7 = rmc->lat_e7;
+        record.lon_e7 = rmc->lon_e7;
+        record.rmc_speed_mm_s = clamp_u16(rmc->speed_mm_s);
+        record.rmc_course_cdeg = clamp_u16(rmc->course_cdeg);
+    }
+    if (vtg) {
+        record.flags |= LOG_GPS_HAS_VTG | (vtg->valid ? LOG_GPS_VTG_VALID : 0);
+        record.vtg_speed_mm_s = clamp_u16(vtg->speed_mm_s);
+        record.vtg_course_cdeg = clamp_u16(vtg->course_cdeg);
+    }
+    PROFILE_STOP(PROFILE_FORMAT, timer);
+
+    return sd_writer_write(writer, &record, sizeof(record));
+}
+
+FRESULT log_binary_write_imu(SD_Writer *writer, uint64_t curr_time, const IMU_Reading *readings) {
+    PROFILE_START(timer);
+    Log_IMU_Record record;
+    record.time_delta_us = time_delta(&imu_prev_time, curr_time);
+
+    for (int i = 0; i < LOG_IMU_SAMPLES; i++) {
+        const IMU_Reading *read = &readings[i];
+        record.samples[i][0] = (int16_t)read->ax;
+        record.samples[i][1] = (int16_t)read->ay;
+        record.samples[i][2] = (int16_t)read->az;
+        record.samples[i][3] = (int16_t)read->gx;
+        record.samples[i][4] = (int16_t)read->gy;
+        record.samples[i][5] = (int16_t)read->gz;
+    }
+    PROFILE_STOP(PROFILE_FORMAT, timer);
+
+    return sd_writer_write(writer, &record, sizeof(record));
+}
+
+FRESULT log_binary_write_imu_sample(SD_Writer *writer, const IMU_Sample *sample) {
+    PROFILE_START(timer);
+    Log_IMU_Sample_Record record;
+    record.time_delta_us = time_delta(&imu_prev_time, sample->timestamp_us);
+    record.axes[0] = (int16_t)sample->read.ax;
+    record.axes[1] = (int16_t)sample->read.ay;
+    record.axes[2] = (int16_t)sample->read.az;
+    record.axes[3] = (int16_t)sample->read.gx;
+    record.axes[4] = (int16_t)sample->read.gy;
+    record.axes[5] = (int16_t)sample->read.gz;
+    PROFILE_STOP(PROFILE_FORMAT, timer);
+
+    return sd_writer_write(writer, &record, sizeof(record));
+}
@@ -0,0 +1,16 @@
+#ifndef LOG_BINARY_H
+#define LOG_BINARY_H
+
+#include <stdint.h>
+#include "ff.h"
+#include "sd_writer.h"
+#include "log_format.h"
+#include "nmea_parser.h"
+#include "mpu6050.h"
+
+FRESULT log_binary_write_header(SD_Writer *writer, uint8_t kind, uint64_t start_time);
+FRESULT log_binary_write_gps(SD_Writer *writer, uint64_t curr_time, const NMEA_RMC *rmc, const NMEA_VTG *vtg);
+FRESULT log_binary_write_imu(SD_Writer *writer, uint64_t curr_time, const IMU_Reading *readings);
+FRESULT log_binary_write_imu_sample(SD_Writer *writer, const IMU_Sample *sample);
+
+#endif
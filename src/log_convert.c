@@ -0,0 +1,207 @@
+/*
+File: log_convert.c
+Author: Leonardo DaGraca
+
+Host tool that expands binary logs written with LOG_FORMAT_BINARY back into
+the gps_log_N.csv / imu_log_N.csv layout, so existing tooling keeps working.
+GPS records are turned back into GPRMC and GPVTG sentences with a recomputed
+checksum, IMU records into the "Timestamp,IMU: ax,ay,az,gx,gy,gz;..." rows and full-rate
+IMU sample records into "Timestamp,ax,ay,az,gx,gy,gz" rows.
+
+IMU logs written with IMU_COMPRESS (imu_log_N.imz, see imu_codec.h) are
+decoded block by block into the same rows the logger writes without it. A
+torn block at the end of the file is dropped.
+
+Usage: log_convert <input.bin|input.imz> <output.csv>
+Build: cc -O2 -Ihost -I. -o log_convert log_convert.c imu_codec.c sd_writer.c journal.c log_index.c host/ff_host.c
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "log_format.h"
+#include "imu_codec.h"
+
+//append "*XX" checksum and write the sentence as a CSV row
+static void write_sentence(FILE *out, uint64_t timestamp, const char *body) {
+    uint8_t checksum = 0;
+    for (const char *c = body; *c; c++) {
+        checksum ^= (uint8_t)*c;
+    }
+    fprintf(out, "%" PRIu64 ",%s*%02X\n", timestamp, body, checksum);
+}
+
+//1e-7 degrees back to (d)ddmm.mmmmm
+static void format_coordinate(char *dst, size_t size, int32_t value_e7, int degree_digits,
+                              char positive, char negative) {
+    char hemisphere = value_e7 < 0 ? negative : positive;
+    int64_t magnitude = value_e7 < 0 ? -(int64_t)value_e7 : value_e7;
+    int64_t degrees = magnitude / 10000000;
+    int64_t minutes_e5 = (magnitude % 10000000) * 3 / 5;
+
+    snprintf(dst, size, "%0*" PRId64 "%02" PRId64 ".%05" PRId64 ",%c", degree_digits, degrees,
+             minutes_e5 / 100000, minutes_e5 % 100000, hemisphere);
+}
+
+static void write_gps_record(FILE *out, uint64_t timestamp, const Log_GPS_Record *record) {
+    char body[120];
+
+    if (record->flags & LOG_GPS_HAS_RMC) {
+        char lat[20], lon[20];
+        uint32_t t = record->utc_time_ms;
+        format_coordinate(lat, sizeof(lat), record->lat_e7, 2, 'N', 'S');
+        format_coordinate(lon, sizeof(lon), record->lon_e7, 3, 'E', 'W');
+
+        snprintf(body, sizeof(body), "GPRMC,%02u%02u%02u.%03u,%c,%s,%s,%.3f,%.2f,%06u,,,%c",
+                 (unsigned)(t / 3600000), (unsigned)(t / 60000 % 60), (unsigned)(t / 1000 % 60),
+                 (unsigned)(t % 1000), (record->flags & LOG_GPS_RMC_VALID) ? 'A' : 'V', lat, lon,
+                 record->rmc_speed_mm_s * 3.6 / 1852.0, record->rmc_course_cdeg / 100.0,
+                 (unsigned)record->date, (record->flags & LOG_GPS_RMC_VALID) ? 'A' : 'N');
+        write_sentence(out, timestamp, body);
+    }
+
+    if (record->flags & LOG_GPS_HAS_VTG) {
+        snprintf(body, sizeof(body), "GPVTG,%.2f,T,,M,%.3f,N,%.3f,K,%c",
+                 record->vtg_course_cdeg / 100.0, record->vtg_speed_mm_s * 3.6 / 1852.0,
+                 record->vtg_speed_mm_s * 0.0036, (record->flags & LOG_GPS_VTG_VALID) ? 'A' : 'N');
+        write_sentence(out, timestamp, body);
+    }
+}
+
+static void write_imu_record(FILE *out, uint64_t timestamp, const Log_IMU_Record *record) {
+    fprintf(out, "%" PRIu64 ",IMU: ", timestamp);
+
+    for (int i = 0; i < LOG_IMU_SAMPLES; i++) {
+        fprintf(out, "%s%d,%d,%d,%d,%d,%d", i > 0 ? ";" : "",
+                record->samples[i][0], record->samples[i][1], record->samples[i][2],
+                record->samples[i][3], record->samples[i][4], record->samples[i][5]);
+    }
+    fprintf(out, "\n");
+}
+
+static long expand_packed_imu(FILE *in, FILE *out, const IMU_Codec_Header *header) {
+    static uint8_t payload[UINT16_MAX];
+    int16_t counts[IMU_CODEC_MAX_READINGS * IMU_CODEC_AXES];
+    char row[IMU_CODEC_MAX_TEXT];
+    IMU_Codec_Block_Header block;
+    long records = 0;
+
+    fputs(imu_codec_csv_header(header->readings), out);
+    while (fread(&block, sizeof(block), 1, in) == 1) {
+        if (block.length == 0 || fread(payload, 1, block.length, in) != block.length) {
+            break;
+        }
+        IMU_Decoder decoder;
+        uint64_t timestamp;
+        imu_decoder_start(&decoder, payload, block.length, block.rows, header->readings);
+        while (imu_decoder_next(&decoder, &timestamp, counts)) {
+            int len = imu_codec_format_row(timestamp, counts, header->readings, row, sizeof(row));
+            fwrite(row, 1, len, out);
+            records++;
+        }
+        if (decoder.rows_left > 0) {
+            fprintf(stderr, "Damaged block after %ld records, stopping there\n", records);
+            break;
+        }
+    }
+    return records;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <input.bin|input.imz> <output.csv>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        perror("Unable to open input file");
+        return 1;
+    }
+
+    IMU_Codec_Header packed_header;
+    if (fread(&packed_header, sizeof(packed_header), 1, in) == 1 &&
+        memcmp(packed_header.magic, IMU_CODEC_MAGIC, 4) == 0) {
+        FILE *out = fopen(argv[2], "w");
+        if (!out) {
+            perror("Unable to open output file");
+            fclose(in);
+            return 1;
+        }
+        long records = expand_packed_imu(in, out, &packed_header);
+        fclose(in);
+        fclose(out);
+        printf("Converted %ld records to %s\n", records, argv[2]);
+        return 0;
+    }
+    rewind(in);
+
+    Log_File_Header header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, LOG_MAGIC, 4) != 0) {
+        fprintf(stderr, "%s is not a binary tracker log\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+    if (header.version != LOG_FORMAT_VERSION) {
+        fprintf(stderr, "Unsupported log version %u\n", header.version);
+        fclose(in);
+        return 1;
+    }
+
+    size_t expected_size = 0;
+    switch (header.kind) {
+        case LOG_KIND_GPS: expected_size = sizeof(Log_GPS_Record); break;
+        case LOG_KIND_IMU: expected_size = sizeof(Log_IMU_Record); break;
+        case LOG_KIND_IMU_SAMPLES: expected_size = sizeof(Log_IMU_Sample_Record); break;
+    }
+    if (expected_size == 0 || header.record_size != expected_size) {
+        fprintf(stderr, "Unexpected record kind %u / size %u\n", header.kind, header.record_size);
+        fclose(in);
+        return 1;
+    }
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        perror("Unable to open output file");
+        fclose(in);
+        return 1;
+    }
+
+    uint64_t timestamp = header.start_time_us;
+    long records = 0;
+
+    if (header.kind == LOG_KIND_GPS) {
+        Log_GPS_Record record;
+        fprintf(out, "Timestamp,NMEA\n");
+        while (fread(&record, sizeof(record), 1, in) == 1) {
+            timestamp += record.time_delta_us;
+            write_gps_record(out, timestamp, &record);
+            records++;
+        }
+    }
+    else if (header.kind == LOG_KIND_IMU_SAMPLES) {
+        Log_IMU_Sample_Record record;
+        fprintf(out, "Timestamp,ax,ay,az,gx,gy,gz\n");
+        while (fread(&record, sizeof(record), 1, in) == 1) {
+            timestamp += record.time_delta_us;
+            fprintf(out, "%" PRIu64 ",%d,%d,%d,%d,%d,%d\n", timestamp, record.axes[0], record.axes[1],
+                    record.axes[2], record.axes[3], record.axes[4], record.axes[5]);
+            records++;
+        }
+    }
+    else {
+        Log_IMU_Record record;
+        fprintf(out, "Timestamp,IMU_Readings\n");
+        while (fread(&record, sizeof(record), 1, in) == 1) {
+            timestamp += record.time_delta_us;
+            write_imu_record(out, timestamp, &record);
+            records++;
+        }
+    }
+
+    fclose(in);
+    fclose(out);
+
+    printf("Converted %ld records to %s\n", records, argv[2]);
+    return 0;
+}
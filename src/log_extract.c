@@ -0,0 +1,730 @@
+/*
+File: log_extract.c
+Author: Leonardo DaGraca
+
+Host tool for the sparse time index written with LOG_INDEX (log_index.h).
+
+Range mode prints the rows of a log whose timestamp is in [from_us, to_us).
+It binary searches the index next to the log (gps_log_N.idx for
+gps_log_N.csv) for the last entry before from_us, seeks the log there and reads
+until the first row at or past to_us. Without an index, or with -n, the log is
+read from the start. Binary logs (LOG_FORMAT_BINARY) come out as a binary log
+whose header starts at the time of the first record, so log_convert.c reads it.
+The search and the reads go through the FatFs calls, the same code runs on the
+device.
+
+Join mode (-j) prints every GPS row of the range followed by the IMU row
+nearest in time, "gps_row,imu_row". Both logs are seeked through their index
+and merged in one pass.
+
+A compressed IMU log (IMU_COMPRESS, imu_codec.h) is read block by block from
+the index entry on and comes out as the rows of the CSV log.
+
+Benchmark mode (-b) writes a synthetic session of the given length into
+work_dir the way the logger does (SD_Writer and Log_Index, one commit per fix
+and per block of 32 IMU samples): the GPS log with an RMC and a VTG row per
+second and the full-rate IMU log at 200Hz, once as CSV and once compressed
+(imu_log_2.imz). Then it extracts random five minute windows from the logs
+with and without the index, checks that all give the same rows and reports the
+latency, the f_read calls and the bytes read. Use a
+RAM disk such as /dev/shm as work_dir, the timings are those of a warm cache.
+
+Usage: log_extract [-n] <log_file> <from_us> <to_us>
+       log_extract -j <gps_log.csv> <imu_log.csv|imu_log.imz> <from_us> <to_us>
+       log_extract -b [-h hours] [-w windows] <work_dir>
+Build: cc -O2 -Ihost -I. -o log_extract log_extract.c log_index.c imu_codec.c sd_writer.c journal.c host/ff_host.c
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <time.h>
+#include "ff.h"
+#include "sd_writer.h"
+#include "log_index.h"
+#include "log_format.h"
+#include "imu_codec.h"
+
+#define READ_BLOCK 4096
+#define MAX_ROW 600
+
+#define BENCH_IMU_PERIOD_US 5000
+#define BENCH_IMU_BLOCK 32
+#define BENCH_FIX_PERIOD_US 1000000
+#define BENCH_START_US 4000000
+#define BENCH_WINDOW_US (5 * 60 * 1000000ULL)
+#define BENCH_LOGS 3                //GPS, IMU and the same IMU rows compressed
+
+typedef struct {
+    FIL file;
+    FSIZE_t size;
+    uint8_t buffer[READ_BLOCK];
+    uint32_t fill;
+    uint32_t pos;
+    uint64_t bytes_read;
+    uint32_t reads;             //f_read calls on the log and its index
+} Reader;
+
+//rows or records handed out, with a hash to compare two extractions
+typedef struct {
+    FILE *out;
+    uint64_t rows;
+    uint64_t hash;
+    double first_row_time;      //now_seconds() at the first row
+} Sink;
+
+//open a host path through the FatFs layer, which resolves paths under its root
+static FRESULT open_host_file(FIL *file, const char *path, BYTE mode) {
+    ff_host_set_root(path[0] == '/' ? "" : ".");
+    return f_open(file, path, mode);
+}
+
+static FRESULT reader_open(Reader *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+    FRESULT fr = open_host_file(&reader->file, path, FA_READ);
+    if (fr == FR_OK) {
+        reader->size = f_size(&reader->file);
+    }
+    return fr;
+}
+
+static FRESULT reader_seek(Reader *reader, FSIZE_t offset) {
+    reader->fill = 0;
+    reader->pos = 0;
+    return f_lseek(&reader->file, offset);
+}
+
+static bool reader_refill(Reader *reader) {
+    UINT bytes_read = 0;
+    reader->pos = 0;
+    reader->fill = 0;
+    if (f_read(&reader->file, reader->buffer, READ_BLOCK, &bytes_read) != FR_OK) {
+        return false;
+    }
+    reader->reads++;
+    reader->bytes_read += bytes_read;
+    reader->fill = bytes_read;
+    return bytes_read > 0;
+}
+
+//copies len bytes, returns false at the end of the file
+static bool reader_bytes(Reader *reader, void *dst, uint32_t len) {
+    uint8_t *out = dst;
+    while (len > 0) {
+        if (reader->pos == reader->fill && !reader_refill(reader)) {
+            return false;
+        }
+        uint32_t chunk = reader->fill - reader->pos;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(out, reader->buffer + reader->pos, chunk);
+        reader->pos += chunk;
+        out += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+//one row with its '\n', 0 at the end of the file; longer rows are cut at size - 1
+static int reader_line(Reader *reader, char *line, int size) {
+    int len = 0;
+    while (true) {
+        if (reader->pos == reader->fill && !reader_refill(reader)) {
+            break;
+        }
+        char c = (char)reader->buffer[reader->pos++];
+        if (len < size - 1) {
+            line[len++] = c;
+        }
+        if (c == '\n') {
+            break;
+        }
+    }
+    line[len] = '\0';
+    return len;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sink_put(Sink *sink, const void *data, size_t len) {
+    if (sink->rows == 0 && sink->first_row_time == 0.0) {
+        sink->first_row_time = now_seconds();
+    }
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        sink->hash = (sink->hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    if (sink->out) {
+        fwrite(data, 1, len, sink->out);
+    }
+}
+
+//false for the header row
+static bool row_time(const char *row, uint64_t *time_us) {
+    if (!isdigit((unsigned char)row[0])) {
+        return false;
+    }
+    *time_us = strtoull(row, NULL, 10);
+    return true;
+}
+
+static void index_path(const char *log_path, char *path, size_t size) {
+    snprintf(path, size, "%s", log_path);
+    char *dot = strrchr(path, '.');
+    char *slash = strrchr(path, '/');
+    if (dot && (!slash || dot > slash)) {
+        *dot = '\0';
+    }
+    strncat(path, ".idx", size - strlen(path) - 1);
+}
+
+//log layouts extract_range() reads
+typedef enum {
+    LOG_LAYOUT_CSV,
+    LOG_LAYOUT_BINARY,          //LOG_FORMAT_BINARY records
+    LOG_LAYOUT_PACKED           //IMU_COMPRESS blocks
+} Log_Layout;
+
+//rows of a CSV log, or of an IMU_COMPRESS log decoded back into the same CSV rows
+typedef struct {
+    Reader *log;
+    Log_Layout layout;
+    uint8_t readings;
+    IMU_Decoder decoder;
+    uint8_t payload[UINT16_MAX];
+} Row_Source;
+
+//where the rows from from_us on start: the index entry before from_us, 0 (the whole log) without a usable index
+//record_size is only used for binary logs
+static FSIZE_t index_offset(Reader *log, const char *log_path, uint64_t from_us, Log_Layout layout,
+                            uint16_t record_size, uint64_t *entry_time_us) {
+    char path[600];
+    index_path(log_path, path, sizeof(path));
+    *entry_time_us = 0;
+
+    FIL index_file;
+    if (open_host_file(&index_file, path, FA_READ) != FR_OK) {
+        return 0;
+    }
+    Log_Index_Entry entry;
+    FRESULT fr = log_index_find(&index_file, from_us, &entry, &log->reads);
+    f_close(&index_file);
+    if (fr != FR_OK) {
+        fprintf(stderr, "%s is not a usable index (%d), reading the whole log\n", path, fr);
+        return 0;
+    }
+
+    //after a power loss the index may point past a log that lost its tail
+    bool valid = entry.offset <= log->size;
+    if (valid && entry.offset > 0 && layout == LOG_LAYOUT_CSV) {
+        //a CSV entry points right after a '\n'
+        char before;
+        UINT bytes_read = 0;
+        valid = f_lseek(&log->file, entry.offset - 1) == FR_OK &&
+                f_read(&log->file, &before, 1, &bytes_read) == FR_OK && bytes_read == 1 && before == '\n';
+        log->reads++;
+    }
+    else if (valid && entry.offset > 0 && layout == LOG_LAYOUT_BINARY) {
+        valid = entry.offset >= sizeof(Log_File_Header) &&
+                (entry.offset - sizeof(Log_File_Header)) % record_size == 0;
+    }
+    else if (valid && entry.offset > 0) {
+        //a block start, the block itself is checked while decoding
+        valid = entry.offset >= sizeof(IMU_Codec_Header);
+    }
+    if (!valid) {
+        fprintf(stderr, "%s does not match the log at offset %" PRIu32 ", reading the whole log\n", path, entry.offset);
+        return 0;
+    }
+    *entry_time_us = entry.time_us;
+    return entry.offset;
+}
+
+//opens the log and reads its header, false if it cannot be opened
+static bool open_log(Reader *log, const char *path, Log_Layout *layout, Log_File_Header *header,
+                     IMU_Codec_Header *packed_header) {
+    if (reader_open(log, path) != FR_OK) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return false;
+    }
+
+    //a log shorter than a header is read as CSV
+    uint8_t first[sizeof(Log_File_Header)] = {0};
+    reader_bytes(log, first, sizeof(first));
+    memcpy(header, first, sizeof(*header));
+    memcpy(packed_header, first, sizeof(*packed_header));
+    if (memcmp(first, LOG_MAGIC, 4) == 0) {
+        *layout = LOG_LAYOUT_BINARY;
+    }
+    else if (memcmp(first, IMU_CODEC_MAGIC, 4) == 0) {
+        *layout = LOG_LAYOUT_PACKED;
+    }
+    else {
+        *layout = LOG_LAYOUT_CSV;
+    }
+    return true;
+}
+
+static void source_start(Row_Source *source, Reader *log, const char *path, Log_Layout layout, uint8_t readings,
+                         uint64_t from_us, bool use_index) {
+    uint64_t entry_time_us;
+    FSIZE_t offset = use_index ? index_offset(log, path, from_us, layout, 0, &entry_time_us) : 0;
+    if (layout == LOG_LAYOUT_PACKED && offset == 0) {
+        offset = sizeof(IMU_Codec_Header);
+    }
+
+    source->log = log;
+    source->layout = layout;
+    source->readings = readings;
+    imu_decoder_start(&source->decoder, source->payload, 0, 0, readings);
+    reader_seek(log, offset);
+}
+
+//the next data row, false at the end of the log
+static bool next_row(Row_Source *source, char *row, uint64_t *time_us) {
+    if (source->layout == LOG_LAYOUT_CSV) {
+        while (reader_line(source->log, row, MAX_ROW) > 0) {
+            if (row_time(row, time_us)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int16_t counts[IMU_CODEC_MAX_READINGS * IMU_CODEC_AXES];
+    while (!imu_decoder_next(&source->decoder, time_us, counts)) {
+        if (source->decoder.rows_left > 0) {
+            fprintf(stderr, "Damaged block, stopping there\n");
+            return false;
+        }
+        //a torn or zero filled block ends the log
+        IMU_Codec_Block_Header block;
+        if (!reader_bytes(source->log, &block, sizeof(block)) || block.length == 0 ||
+            !reader_bytes(source->log, source->payload, block.length)) {
+            return false;
+        }
+        imu_decoder_start(&source->decoder, source->payload, block.length, block.rows, source->readings);
+    }
+    imu_codec_format_row(*time_us, counts, source->readings, row, MAX_ROW);
+    return true;
+}
+
+static int extract_rows(Row_Source *source, uint64_t from_us, uint64_t to_us, Sink *sink) {
+    char row[MAX_ROW];
+    uint64_t time_us;
+    while (next_row(source, row, &time_us)) {
+        if (time_us < from_us) {
+            continue;
+        }
+        if (time_us >= to_us) {
+            break;
+        }
+        sink_put(sink, row, strlen(row));
+        sink->rows++;
+    }
+    return 0;
+}
+
+static int extract_binary(Reader *log, const char *path, const Log_File_Header *header, uint64_t from_us,
+                          uint64_t to_us, bool use_index, Sink *sink) {
+    uint8_t record[256];
+    if (header->record_size < sizeof(uint32_t) || header->record_size > sizeof(record)) {
+        fprintf(stderr, "Unexpected record size %u\n", header->record_size);
+        return 1;
+    }
+
+    //the records count their time from the highest time before them, which is what the entry holds
+    uint64_t time_us = header->start_time_us;
+    FSIZE_t offset = sizeof(Log_File_Header);
+    if (use_index) {
+        uint64_t entry_time_us;
+        FSIZE_t entry_offset = index_offset(log, path, from_us, LOG_LAYOUT_BINARY, header->record_size,
+                                            &entry_time_us);
+        if (entry_offset > 0) {
+            offset = entry_offset;
+            time_us = entry_time_us;
+        }
+    }
+    reader_seek(log, offset);
+
+    while (reader_bytes(log, record, header->record_size)) {
+        uint32_t delta;
+        memcpy(&delta, record, sizeof(delta));
+        time_us += delta;
+        if (time_us < from_us) {
+            continue;
+        }
+        if (time_us >= to_us) {
+            break;
+        }
+        if (sink->rows == 0) {
+            Log_File_Header out_header = *header;
+            out_header.start_time_us = time_us - delta;
+            sink_put(sink, &out_header, sizeof(out_header));
+        }
+        sink_put(sink, record, header->record_size);
+        sink->rows++;
+    }
+    return 0;
+}
+
+static int extract_range(const char *path, uint64_t from_us, uint64_t to_us, bool use_index, Sink *sink, Reader *log) {
+    static Row_Source source;
+    Log_Layout layout;
+    Log_File_Header header;
+    IMU_Codec_Header packed_header;
+    if (!open_log(log, path, &layout, &header, &packed_header)) {
+        return 1;
+    }
+
+    int rc = 0;
+    if (layout == LOG_LAYOUT_BINARY) {
+        rc = extract_binary(log, path, &header, from_us, to_us, use_index, sink);
+    }
+    else {
+        //a compressed IMU log comes out as the rows of the CSV log
+        source_start(&source, log, path, layout, packed_header.readings, from_us, use_index);
+        rc = extract_rows(&source, from_us, to_us, sink);
+    }
+    f_close(&log->file);
+    return rc;
+}
+
+static void put_joined(Sink *sink, const char *gps_row, const char *imu_row) {
+    size_t gps_len = strlen(gps_row);
+    if (gps_len > 0 && gps_row[gps_len - 1] == '\n') {
+        gps_len--;
+    }
+    sink_put(sink, gps_row, gps_len);
+    sink_put(sink, ",", 1);
+    sink_put(sink, imu_row, strlen(imu_row));
+    sink->rows++;
+}
+
+static int join_range(const char *gps_path, const char *imu_path, uint64_t from_us, uint64_t to_us,
+                      Sink *sink, Reader *gps, Reader *imu) {
+    static Row_Source gps_rows, imu_rows;
+    Log_Layout gps_layout, imu_layout;
+    Log_File_Header header;
+    IMU_Codec_Header packed_header;
+    if (!open_log(gps, gps_path, &gps_layout, &header, &packed_header)) {
+        return 1;
+    }
+    if (!open_log(imu, imu_path, &imu_layout, &header, &packed_header)) {
+        f_close(&gps->file);
+        return 1;
+    }
+    if (gps_layout != LOG_LAYOUT_CSV || imu_layout == LOG_LAYOUT_BINARY) {
+        fprintf(stderr, "Join reads CSV logs and compressed IMU logs, expand binary logs with log_convert first\n");
+        f_close(&gps->file);
+        f_close(&imu->file);
+        return 1;
+    }
+    source_start(&gps_rows, gps, gps_path, gps_layout, 0, from_us, true);
+    source_start(&imu_rows, imu, imu_path, imu_layout, packed_header.readings, from_us, true);
+
+    //prev is the last IMU row at or before the GPS row, next the first one after it
+    static char gps_row[MAX_ROW], prev_row[MAX_ROW], next_row_text[MAX_ROW];
+    uint64_t gps_time, prev_time = 0, next_time = 0;
+    bool has_prev = false;
+    bool has_next = next_row(&imu_rows, next_row_text, &next_time);
+
+    while (next_row(&gps_rows, gps_row, &gps_time)) {
+        if (gps_time < from_us) {
+            continue;
+        }
+        if (gps_time >= to_us) {
+            break;
+        }
+        while (has_next && next_time <= gps_time) {
+            memcpy(prev_row, next_row_text, sizeof(prev_row));
+            prev_time = next_time;
+            has_prev = true;
+            has_next = next_row(&imu_rows, next_row_text, &next_time);
+        }
+        if (has_prev && (!has_next || gps_time - prev_time <= next_time - gps_time)) {
+            put_joined(sink, gps_row, prev_row);
+        }
+        else if (has_next) {
+            put_joined(sink, gps_row, next_row_text);
+        }
+    }
+    f_close(&gps->file);
+    f_close(&imu->file);
+    return 0;
+}
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t random_next() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static void write_nmea(SD_Writer *writer, uint64_t time_us, const char *body) {
+    uint8_t checksum = 0;
+    for (const char *c = body; *c; c++) {
+        checksum ^= (uint8_t)*c;
+    }
+    char row[160];
+    int len = snprintf(row, sizeof(row), "%" PRIu64 ",%s*%02X\n", time_us, body, checksum);
+    sd_writer_write(writer, row, len);
+}
+
+//a session of the given length through SD_Writer and Log_Index, returns the time of its last row
+static uint64_t write_session(double hours) {
+    static SD_Writer gps_writer, imu_writer, packed_writer;
+    static Log_Index gps_index, imu_index, packed_index;
+    static IMU_Encoder encoder;
+    FIL gps_file, imu_file, packed_file, gps_index_file, imu_index_file, packed_index_file;
+    SD_Writer_Config config = {0};
+
+    f_mkdir("gps_logs");
+    f_mkdir("imu_logs");
+    if (f_open(&gps_file, "gps_logs/gps_log_1.csv", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK ||
+        f_open(&imu_file, "imu_logs/imu_log_1.csv", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK ||
+        f_open(&gps_index_file, "gps_logs/gps_log_1.idx", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK ||
+        f_open(&imu_index_file, "imu_logs/imu_log_1.idx", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK ||
+        f_open(&packed_file, "imu_logs/imu_log_2.imz", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK ||
+        f_open(&packed_index_file, "imu_logs/imu_log_2.idx", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        fprintf(stderr, "Unable to create the session files\n");
+        exit(1);
+    }
+    sd_writer_init(&gps_writer, &gps_file, &config, 0);
+    sd_writer_init(&imu_writer, &imu_file, &config, 0);
+    log_index_init(&gps_index, &gps_index_file, &config, 0);
+    log_index_init(&imu_index, &imu_index_file, &config, 0);
+    log_index_attach(&gps_index, &gps_writer);
+    log_index_attach(&imu_index, &imu_writer);
+    //the same IMU rows compressed, as written with IMU_COMPRESS
+    sd_writer_init(&packed_writer, &packed_file, &config, 0);
+    log_index_init(&packed_index, &packed_index_file, &config, 0);
+    log_index_attach(&packed_index, &packed_writer);
+    imu_encoder_init(&encoder, &packed_writer, 1);
+    sd_writer_write(&gps_writer, "Timestamp,NMEA\n", strlen("Timestamp,NMEA\n"));
+    sd_writer_write(&imu_writer, "Timestamp,ax,ay,az,gx,gy,gz\n", strlen("Timestamp,ax,ay,az,gx,gy,gz\n"));
+
+    uint64_t end_us = BENCH_START_US + (uint64_t)(hours * 3600e6);
+    uint64_t next_fix_us = BENCH_START_US + 137;
+    int32_t axes[IMU_CODEC_AXES] = {120, -340, 16384, 0, 0, 0};
+    int16_t counts[IMU_CODEC_AXES];
+    uint32_t in_block = 0;
+    uint64_t time_us;
+    for (time_us = BENCH_START_US; time_us < end_us; time_us += BENCH_IMU_PERIOD_US) {
+        //fixes go to core 1 between the IMU blocks
+        while (next_fix_us <= time_us) {
+            uint32_t second = (uint32_t)(next_fix_us / 1000000) % 86400;
+            char body[120];
+            snprintf(body, sizeof(body), "GPRMC,%02u%02u%02u.00,A,4042.%05u,N,07400.%05u,W,%u.%03u,%u.%02u,170926,,,A",
+                     second / 3600, second / 60 % 60, second % 60, (unsigned)(random_next() % 100000),
+                     (unsigned)(random_next() % 100000), (unsigned)(random_next() % 12),
+                     (unsigned)(random_next() % 1000), (unsigned)(random_next() % 360), (unsigned)(random_next() % 100));
+            write_nmea(&gps_writer, next_fix_us, body);
+            snprintf(body, sizeof(body), "GPVTG,%u.%02u,T,,M,%u.%03u,N,%u.%03u,K,A", (unsigned)(random_next() % 360),
+                     (unsigned)(random_next() % 100), (unsigned)(random_next() % 12), (unsigned)(random_next() % 1000),
+                     (unsigned)(random_next() % 22), (unsigned)(random_next() % 1000));
+            write_nmea(&gps_writer, next_fix_us, body);
+            sd_writer_commit(&gps_writer, next_fix_us);
+            next_fix_us += BENCH_FIX_PERIOD_US;
+        }
+
+        for (int axis = 0; axis < IMU_CODEC_AXES; axis++) {
+            axes[axis] += (int32_t)(random_next() % 401) - 200;
+            axes[axis] = axes[axis] > 32767 ? 32767 : axes[axis] < -32768 ? -32768 : axes[axis];
+            counts[axis] = (int16_t)axes[axis];
+        }
+        imu_encoder_add(&encoder, time_us, counts);
+        char row[80];
+        int len = snprintf(row, sizeof(row), "%" PRIu64 ",%d,%d,%d,%d,%d,%d\n", time_us,
+                           axes[0], axes[1], axes[2], axes[3], axes[4], axes[5]);
+        sd_writer_write(&imu_writer, row, len);
+        if (++in_block == BENCH_IMU_BLOCK) {
+            sd_writer_commit(&imu_writer, time_us);
+            in_block = 0;
+        }
+    }
+    sd_writer_commit(&imu_writer, time_us - BENCH_IMU_PERIOD_US);
+
+    sd_writer_flush(&gps_writer, end_us);
+    sd_writer_flush(&imu_writer, end_us);
+    imu_encoder_flush(&encoder);
+    sd_writer_flush(&packed_writer, end_us);
+    sd_writer_flush(&gps_index.writer, end_us);
+    sd_writer_flush(&imu_index.writer, end_us);
+    sd_writer_flush(&packed_index.writer, end_us);
+    printf("Session: %.1f h, GPS log %.1f MB with %" PRIu32 " index entries, IMU log %.1f MB with %" PRIu32
+           " index entries, compressed %.1f MB with %" PRIu32 " index entries\n", hours, gps_writer.offset / 1e6,
+           gps_index.entries, imu_writer.offset / 1e6, imu_index.entries, packed_writer.offset / 1e6,
+           packed_index.entries);
+    f_close(&gps_file);
+    f_close(&imu_file);
+    f_close(&packed_file);
+    f_close(&gps_index_file);
+    f_close(&imu_index_file);
+    f_close(&packed_index_file);
+    return time_us;
+}
+
+typedef struct {
+    double seconds;
+    double max_seconds;
+    double first_row_seconds;   //until the first row of the window
+    uint64_t bytes_read;
+    uint64_t reads;
+} Bench_Stats;
+
+static void bench_add(Bench_Stats *stats, double start, const Sink *sink, uint64_t bytes_read, uint64_t reads) {
+    double seconds = now_seconds() - start;
+    stats->seconds += seconds;
+    if (seconds > stats->max_seconds) {
+        stats->max_seconds = seconds;
+    }
+    stats->first_row_seconds += sink->first_row_time - start;
+    stats->bytes_read += bytes_read;
+    stats->reads += reads;
+}
+
+static void bench_print(const char *name, const Bench_Stats *stats, uint32_t windows) {
+    printf("  %-10s first row %8.3f ms, all rows %8.3f ms mean %8.3f ms max, %9.1f KB %7.1f reads\n", name,
+           stats->first_row_seconds * 1e3 / windows, stats->seconds * 1e3 / windows, stats->max_seconds * 1e3,
+           stats->bytes_read / 1e3 / windows, (double)stats->reads / windows);
+}
+
+static int bench(const char *dir, double hours, uint32_t windows) {
+    ff_host_set_root(dir);
+    double start = now_seconds();
+    uint64_t end_us = write_session(hours);
+    printf("Written in %.1f s\n", now_seconds() - start);
+
+    //the tool's own paths are resolved from here on
+    char gps_path[600], imu_path[600], packed_path[600];
+    snprintf(gps_path, sizeof(gps_path), "%s/gps_logs/gps_log_1.csv", dir);
+    snprintf(imu_path, sizeof(imu_path), "%s/imu_logs/imu_log_1.csv", dir);
+    snprintf(packed_path, sizeof(packed_path), "%s/imu_logs/imu_log_2.imz", dir);
+    const char *paths[BENCH_LOGS] = {gps_path, imu_path, packed_path};
+    const char *names[BENCH_LOGS] = {"GPS", "IMU", "Compressed IMU"};
+
+    static Reader log, imu;
+    Bench_Stats scan[BENCH_LOGS] = {0}, indexed[BENCH_LOGS] = {0}, joined[2] = {0};
+    uint64_t rows[BENCH_LOGS] = {0};
+    int mismatches = 0;
+    for (uint32_t w = 0; w < windows; w++) {
+        uint64_t from_us = BENCH_START_US + random_next() % (end_us - BENCH_START_US - BENCH_WINDOW_US);
+        uint64_t to_us = from_us + BENCH_WINDOW_US;
+
+        uint64_t imu_hash = 0;
+        for (int f = 0; f < BENCH_LOGS; f++) {
+            Sink by_index = {0}, by_scan = {0};
+            double t0 = now_seconds();
+            extract_range(paths[f], from_us, to_us, true, &by_index, &log);
+            bench_add(&indexed[f], t0, &by_index, log.bytes_read, log.reads);
+            t0 = now_seconds();
+            extract_range(paths[f], from_us, to_us, false, &by_scan, &log);
+            bench_add(&scan[f], t0, &by_scan, log.bytes_read, log.reads);
+
+            rows[f] += by_index.rows;
+            if (by_index.rows != by_scan.rows || by_index.hash != by_scan.hash || by_index.rows == 0) {
+                mismatches++;
+            }
+            //the compressed log must give the very rows of the CSV one
+            if (f == BENCH_LOGS - 1 && by_index.hash != imu_hash) {
+                mismatches++;
+            }
+            imu_hash = by_index.hash;
+        }
+
+        Sink join[2] = {{0}, {0}};
+        for (int f = 0; f < 2; f++) {
+            double t0 = now_seconds();
+            join_range(gps_path, paths[f + 1], from_us, to_us, &join[f], &log, &imu);
+            bench_add(&joined[f], t0, &join[f], log.bytes_read + imu.bytes_read, log.reads + imu.reads);
+            if (join[f].rows != 2 * (BENCH_WINDOW_US / BENCH_FIX_PERIOD_US)) {
+                mismatches++;
+            }
+        }
+        if (join[0].hash != join[1].hash) {
+            mismatches++;
+        }
+    }
+
+    printf("\n%" PRIu32 " random %.0f min windows:\n", windows, BENCH_WINDOW_US / 60e6);
+    for (int f = 0; f < BENCH_LOGS; f++) {
+        printf("%s log, %.0f rows per window\n", names[f], (double)rows[f] / windows);
+        bench_print("full scan", &scan[f], windows);
+        bench_print("index", &indexed[f], windows);
+        printf("  index: first row %.0fx sooner, all rows %.0fx faster, %.0fx fewer bytes\n",
+               scan[f].first_row_seconds / indexed[f].first_row_seconds, scan[f].seconds / indexed[f].seconds,
+               (double)scan[f].bytes_read / indexed[f].bytes_read);
+    }
+    printf("GPS/IMU join through both indexes\n");
+    bench_print("CSV", &joined[0], windows);
+    bench_print("compressed", &joined[1], windows);
+    printf("\n%s: %d mismatching windows\n", mismatches ? "FAIL" : "OK", mismatches);
+    return mismatches ? 1 : 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n] <log_file> <from_us> <to_us>\n", name);
+    fprintf(stderr, "       %s -j <gps_log.csv> <imu_log.csv|imu_log.imz> <from_us> <to_us>\n", name);
+    fprintf(stderr, "       %s -b [-h hours] [-w windows] <work_dir>\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    static Reader log, imu;
+    Sink sink = {.out = stdout};
+
+    if (argc >= 3 && strcmp(argv[1], "-b") == 0) {
+        double hours = 3.0;
+        uint32_t windows = 20;
+        int i = 2;
+        for (; i + 1 < argc; i += 2) {
+            if (strcmp(argv[i], "-h") == 0) {
+                hours = atof(argv[i + 1]);
+            }
+            else if (strcmp(argv[i], "-w") == 0) {
+                windows = (uint32_t)atoi(argv[i + 1]);
+            }
+            else {
+                break;
+            }
+        }
+        if (i != argc - 1 || hours * 3600e6 <= 2 * BENCH_WINDOW_US || windows == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        return bench(argv[i], hours, windows);
+    }
+    if (argc == 6 && strcmp(argv[1], "-j") == 0) {
+        int rc = join_range(argv[2], argv[3], strtoull(argv[4], NULL, 10), strtoull(argv[5], NULL, 10),
+                            &sink, &log, &imu);
+        fprintf(stderr, "%" PRIu64 " rows, %" PRIu32 " reads, %" PRIu64 " bytes read\n", sink.rows,
+                log.reads + imu.reads, log.bytes_read + imu.bytes_read);
+        return rc;
+    }
+
+    bool use_index = true;
+    int first = 1;
+    if (argc == 5 && strcmp(argv[1], "-n") == 0) {
+        use_index = false;
+        first = 2;
+    }
+    if (argc - first != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    int rc = extract_range(argv[first], strtoull(argv[first + 1], NULL, 10), strtoull(argv[first + 2], NULL, 10),
+                           use_index, &sink, &log);
+    fprintf(stderr, "%" PRIu64 " rows, %" PRIu32 " reads, %" PRIu64 " bytes read\n", sink.rows, log.reads,
+            log.bytes_read);
+    return rc;
+}
@@ -0,0 +1,65 @@
+/*
+File: log_format.h
+Author: Leonardo DaGraca
+
+Binary log format shared by the firmware and the host converter (log_convert.c).
+A log file is a Log_File_Header followed by fixed size records of one kind.
+Each record stores its timestamp as the microseconds since the previous record
+(or since start_time_us for the first one), so the full 64-bit time_us_64()
+value is only written once per file.
+All fields are little endian, which matches both the RP2040 and x86 hosts.
+*/
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+
+#define LOG_MAGIC "GTLG"
+#define LOG_FORMAT_VERSION 1
+
+#define LOG_KIND_GPS 1
+#define LOG_KIND_IMU 2
+#define LOG_KIND_IMU_SAMPLES 3  //full-rate mode, one record per IMU sample
+
+#define LOG_IMU_SAMPLES 5   //matches MAX_IMU_READINGS
+#define LOG_IMU_AXES 6
+
+//Log_GPS_Record flags
+#define LOG_GPS_HAS_RMC   0x01
+#define LOG_GPS_HAS_VTG   0x02
+#define LOG_GPS_RMC_VALID 0x04
+#define LOG_GPS_VTG_VALID 0x08
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t kind;
+    uint16_t record_size;
+    uint64_t start_time_us;
+} Log_File_Header;
+
+typedef struct __attribute__((packed)) {
+    uint32_t time_delta_us;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t utc_time_ms;
+    uint32_t date;              //ddmmyy
+    int32_t lat_e7;
+    int32_t lon_e7;
+    uint16_t rmc_speed_mm_s;
+    uint16_t rmc_course_cdeg;
+    uint16_t vtg_speed_mm_s;
+    uint16_t vtg_course_cdeg;
+} Log_GPS_Record;
+
+typedef struct __attribute__((packed)) {
+    uint32_t time_delta_us;
+    int16_t samples[LOG_IMU_SAMPLES][LOG_IMU_AXES];    //ax, ay, az, gx, gy, gz oldest first
+} Log_IMU_Record;
+
+typedef struct __attribute__((packed)) {
+    uint32_t time_delta_us;
+    int16_t axes[LOG_IMU_AXES];     //ax, ay, az, gx, gy, gz
+} Log_IMU_Sample_Record;
+
+#endif
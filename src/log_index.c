@@ -0,0 +1,103 @@
+/*
+File: log_index.c
+Author: Leonardo DaGraca
+
+Sparse time index of a session log, see log_index.h.
+*/
+#include <string.h>
+#include "log_index.h"
+
+static void write_header(Log_Index *index) {
+    Log_Index_Header header;
+    memcpy(header.magic, LOG_INDEX_MAGIC, 4);
+    header.version = LOG_INDEX_VERSION;
+    header.entry_size = sizeof(Log_Index_Entry);
+    header.reserved = 0;
+    header.interval_bytes = LOG_INDEX_INTERVAL_BYTES;
+    sd_writer_write(&index->writer, &header, sizeof(header));
+}
+
+void log_index_init(Log_Index *index, FIL *file, const SD_Writer_Config *config, uint64_t now_us) {
+    memset(index, 0, sizeof(*index));
+    sd_writer_init(&index->writer, file, config, now_us);
+    write_header(index);
+}
+
+void log_index_init_journal(Log_Index *index, struct Journal *journal, uint8_t kind, uint64_t now_us) {
+    memset(index, 0, sizeof(*index));
+    sd_writer_init_journal(&index->writer, journal, kind, now_us);
+    write_header(index);
+}
+
+void log_index_attach(Log_Index *index, SD_Writer *log_writer) {
+    log_writer->index = index;
+    index->next_offset = log_writer->offset + LOG_INDEX_INTERVAL_BYTES;
+}
+
+FRESULT log_index_add(Log_Index *index, uint64_t time_us, uint32_t offset) {
+    if (time_us > index->time_us) {
+        index->time_us = time_us;
+    }
+    if (offset < index->next_offset) {
+        return FR_OK;
+    }
+
+    Log_Index_Entry entry = {.time_us = index->time_us, .offset = offset};
+    index->next_offset = offset + LOG_INDEX_INTERVAL_BYTES;
+    index->entries++;
+    FRESULT fr = sd_writer_write(&index->writer, &entry, sizeof(entry));
+    if (fr != FR_OK) {
+        return fr;
+    }
+    return sd_writer_commit(&index->writer, time_us);
+}
+
+static FRESULT read_at(FIL *file, FSIZE_t pos, void *data, UINT len, uint32_t *reads) {
+    UINT bytes_read;
+    FRESULT fr = f_lseek(file, pos);
+    if (fr == FR_OK) {
+        fr = f_read(file, data, len, &bytes_read);
+    }
+    (*reads)++;
+    if (fr == FR_OK && bytes_read != len) {
+        return FR_INT_ERR;
+    }
+    return fr;
+}
+
+FRESULT log_index_find(FIL *file, uint64_t time_us, Log_Index_Entry *entry, uint32_t *reads) {
+    Log_Index_Header header;
+    entry->time_us = 0;
+    entry->offset = 0;
+
+    FRESULT fr = read_at(file, 0, &header, sizeof(header), reads);
+    if (fr != FR_OK) {
+        return fr;
+    }
+    if (memcmp(header.magic, LOG_INDEX_MAGIC, 4) != 0 || header.entry_size != sizeof(Log_Index_Entry)) {
+        return FR_NO_FILE;
+    }
+
+    //a torn last entry is left out
+    uint32_t count = (uint32_t)((f_size(file) - sizeof(header)) / sizeof(Log_Index_Entry));
+
+    //entries [0, low) are older than time_us, [high, count) are not
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        Log_Index_Entry probe;
+        fr = read_at(file, sizeof(header) + (FSIZE_t)mid * sizeof(probe), &probe, sizeof(probe), reads);
+        if (fr != FR_OK) {
+            return fr;
+        }
+        if (probe.time_us < time_us) {
+            *entry = probe;
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return FR_OK;
+}
@@ -0,0 +1,71 @@
+/*
+File: log_index.h
+Author: Leonardo DaGraca
+
+Sparse time index written next to a session log (gps_log_N.idx next to
+gps_log_N.csv or .bin), so a time range of a multi-hour log can be found with
+a binary search over the index and one seek instead of a scan of the whole file.
+
+The log's SD_Writer counts the bytes handed to it. At the first commit after
+every LOG_INDEX_INTERVAL_BYTES of log, sd_writer_commit() appends one
+Log_Index_Entry: the highest record time committed so far and the offset
+right after that record. A record starts at the offset and every record from
+there on is at least that old. The highest rather than the last time keeps the
+entries sorted when the clock steps back, and for a binary log it is the time
+the record deltas are counted from (log_binary.c never writes a negative delta).
+
+The index goes through its own SD_Writer, into its own file or as a journal
+stream (journal.h), with the usual sync budget. At one 12 byte entry per 4KB
+block it is 0.3% of the log. After a power loss it covers at least the part of
+the log that was synced before it, a reader scans the log past the last entry.
+
+log_index_find() is the reader's binary search, through FatFs so it runs on
+the device as well as on the host (log_extract.c).
+*/
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+#include <stdint.h>
+#include "ff.h"
+#include "sd_writer.h"
+
+#define LOG_INDEX_MAGIC "GTIX"
+#define LOG_INDEX_VERSION 1
+
+//log bytes between two entries, one per SD_Writer block costs no extra write
+#ifndef LOG_INDEX_INTERVAL_BYTES
+#define LOG_INDEX_INTERVAL_BYTES SD_WRITER_BLOCK_SIZE
+#endif
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint8_t version;
+    uint8_t entry_size;
+    uint16_t reserved;
+    uint32_t interval_bytes;
+} Log_Index_Header;
+
+typedef struct __attribute__((packed)) {
+    uint64_t time_us;           //highest record time up to the offset
+    uint32_t offset;            //of the next record in the log, FAT32 files stay below 4GB
+} Log_Index_Entry;
+
+typedef struct Log_Index {
+    SD_Writer writer;           //of the index file itself
+    uint64_t time_us;           //highest time committed to the log so far
+    uint32_t next_offset;       //the next entry is due once the log reaches this offset
+    uint32_t entries;
+} Log_Index;
+
+//both write the index header, log_index_attach() then hooks the index to the log's writer
+void log_index_init(Log_Index *index, FIL *file, const SD_Writer_Config *config, uint64_t now_us);
+void log_index_init_journal(Log_Index *index, struct Journal *journal, uint8_t kind, uint64_t now_us);
+void log_index_attach(Log_Index *index, SD_Writer *log_writer);
+//called by sd_writer_commit() for every record of the log
+FRESULT log_index_add(Log_Index *index, uint64_t time_us, uint32_t offset);
+
+//reader side: the last entry older than time_us, {0, 0} if there is none
+//reads the header and ~log2(entries) entries, counted in *reads
+FRESULT log_index_find(FIL *file, uint64_t time_us, Log_Index_Entry *entry, uint32_t *reads);
+
+#endif
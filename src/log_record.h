@@ -0,0 +1,52 @@
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <stdint.h>
+#include "nmea_parser.h"
+#include "mpu6050.h"
+#include "track_metrics.h"
+#include "motion_scheduler.h"
+#include "attitude.h"
+#include "imu_calibration.h"
+#include "track_simplify.h"
+
+//Log_Record flags
+#define LOG_RECORD_HAS_RMC 0x01
+#define LOG_RECORD_HAS_VTG 0x02
+#define LOG_RECORD_SAVE_CALIBRATION 0x04  //core 1 saves calibration to the SD card
+#define LOG_RECORD_HAS_TRACK_POINT 0x08   //the simplifier kept a fix, see track_point
+
+//one GPS fix with its IMU readings, handed from the acquisition core to the SD card core
+typedef struct {
+    uint64_t timestamp;                 //arrival of the RMC sentence (or VTG if there was no RMC)
+    uint8_t flags;
+    NMEA_RMC rmc;
+    NMEA_VTG vtg;
+    char rmc_text[NMEA_MAX_SENTENCE];   //raw sentences for the CSV log
+    char vtg_text[NMEA_MAX_SENTENCE];
+    IMU_Reading imu[MAX_IMU_READINGS];  //oldest first
+
+    //GPS clock fit at timestamp (see gps_clock.h)
+    int64_t clock_offset_us;            //utc - local
+    int32_t clock_drift_ppb;
+    uint32_t clock_residual_us;
+    uint32_t clock_observations;
+
+    Track_Summary summary;              //session metrics up to this fix
+
+    //motion scheduler (MOTION_SCHEDULER builds only)
+    uint32_t sync_interval_ms;          //SD sync interval of the current motion profile, 0 = unchanged
+    Motion_State_Stats motion[MOTION_STATE_COUNT];
+
+    //attitude at this fix and the peak linear acceleration since the last one (ATTITUDE_FILTER builds only)
+    Attitude attitude;
+
+    IMU_Cal_Record calibration;         //only with LOG_RECORD_SAVE_CALIBRATION
+
+    //simplified track (TRACK_SIMPLIFY builds only)
+    Track_Point track_point;            //only with LOG_RECORD_HAS_TRACK_POINT, an earlier fix than this one
+    uint32_t track_fixes;               //valid fixes so far
+    uint32_t track_kept;
+} Log_Record;
+
+#endif
@@ -14,9 +14,77 @@ onto a MicroSD card. Using the power and high frequency updates of the GPS modul
 we are able to capture movements accurately. Leveraging the GPS module with the IMU allows
 us to capture sudden rapid movements that are key to calculate more advanced metrics.
 
+The MPU6050 offsets saved by the previous session are applied at power-up and refined in the
+background whenever the device rests (imu_calibration.c), so logging starts as soon as the SD card
+is mounted instead of after a blocking calibration.
+
 The IMU samples at a higher frequency than the GPS. To remedy this a circular buffer is used to 
 maintain the last 5 IMU readings for each GPS reading.
 
+Built with IMU_FULL_RATE the IMU log instead gets every sample the MPU6050 produces, each with
+its own timestamp, streamed to the SD card through a ring of int16 sample blocks (imu_ring.h).
+
+All board access goes through hal.h, so the same application logic also builds natively as the
+host simulator (hal_host.c), which replays a recorded track instead of reading the sensors.
+
+Core 0 handles acquisition (UART GPS data and I2C IMU readings) and core 1 handles formatting
+and SD card I/O. Each fix is passed between the cores through a lock-free queue, so an f_sync
+stall on the SD card no longer stops IMU sampling or NMEA reception.
+
+Rows are stamped with the time the fix's RMC sentence started arriving ('$' byte) and IMU samples
+with the time they were sampled. A clock estimator fitted to the RMC times (or to a PPS edge if
+GPS_PPS_PIN is defined) maps hal_time_us() to GPS UTC, and its offset and drift are written to
+gps_logs/clock_log_N.csv so IMU samples can be interpolated onto fix times afterwards.
+
+Distance, speed, pace, sprints and movement intensity are tracked live (track_metrics.c) and a
+one line session summary is rewritten to gps_logs/summary_N.csv every minute.
+
+Built with MOTION_SCHEDULER the accelerometer classifies the wearer as stationary, walking, running
+or in an impact (motion_scheduler.c). Each state has its own IMU rate, GPS solution rate (UBX
+CFG-RATE), SD sync interval and sleep time between loop passes, and the time, duty cycle and samples
+per state are rewritten to gps_logs/power_N.csv every minute.
+
+Built with PROFILE_STAGES the time spent in each stage of the hot path (profile.h) is rewritten
+to gps_logs/profile_N.csv and printed with the summary.
+
+Built with ATTITUDE_FILTER every IMU sample also goes through a fixed-point Madgwick filter on
+core 0 (attitude.c). The orientation, roll/pitch/yaw, gravity-free linear acceleration and its
+peak since the previous fix are written with each fix to imu_logs/attitude_log_N.csv.
+
+Built with TRACK_SIMPLIFY every valid fix also goes through the streaming track simplifier
+(track_simplify.c), and only the fixes needed to keep the track within TRACK_SIMPLIFY_TOLERANCE_MM
+are written to gps_logs/track_log_N.csv, so long sessions can be mapped without the full GPS log.
+The fixes kept out of the fixes seen is printed with the summary.
+
+Built with EVENT_CAPTURE every IMU sample also goes through a trigger engine (event_capture.c):
+an acceleration, jerk or angular rate above its threshold, or a confirmed sprint, commits the last
+EVENT_PRE_SAMPLES samples and the tail after the trigger at the full sample rate, with the nearest
+fix, to imu_logs/events_N.csv. Core 1 writes the burst while core 0 keeps logging.
+
+Built with GPS_UBX_CONFIG the GT-U7 is configured over UBX before logging starts (gps_config.c):
+only RMC and VTG are left on, UART1 moves to GPS_CONFIG_BAUD_RATE and the receiver computes up to 10
+fixes per second. Every step waits for the receiver's ACK and falls back to the previous setting, so
+a receiver that does not answer keeps logging at 9600 baud and 1Hz.
+
+Built with GPS_IMU_FUSION (needs ATTITUDE_FILTER) every IMU sample also moves an extended Kalman
+filter on core 0 (track_fusion.c) forward with the gravity-free acceleration of the attitude
+filter, and every valid RMC corrects it with its position, speed and course. Its position and
+velocity at every FUSION_OUTPUT_EVERY-th sample go in blocks to core 1, which writes them to
+gps_logs/fused_log_N.csv: a track at the IMU rate instead of one point per fix.
+
+Built with LOG_INDEX the GPS and IMU logs get a sparse time index next to them (log_index.c),
+gps_logs/gps_log_N.idx and imu_logs/imu_log_N.idx with the time and file offset of about every 4KB
+of log. log_extract.c finds a time range of a multi-hour session with a binary search and one seek,
+and joins the GPS and IMU rows by time.
+
+Built with IMU_COMPRESS the IMU rows are delta coded into blocks of varints (imu_codec.c)
+instead of formatted as text, imu_logs/imu_log_N.imz. log_convert.c expands it to the same CSV.
+
+Built with CRASH_SAFE_LOG nothing is created with FA_CREATE_ALWAYS: every log and report goes
+as checksummed records into one preallocated journal file (journal.h), the session number comes
+from the journal instead of session_counter.txt and a power loss costs at most the unsynced tail.
+The journal is a ring, a full one overwrites the oldest sessions. journal_extract.c turns the journal back into the files above.
+
 This program assumes the following hardware configuration:
 GPS Module
 | GPS   | UART1 | GPIO  | Pin   | 
@@ -50,50 +118,224 @@ MicroSD Module
 #include <string.h>
 #include <stdlib.h>
 #include "mpu6050.h"
-#include "pico/stdlib.h"
-#include "hardware/uart.h"
+#include "nmea_rx.h"
+#include "nmea_parser.h"
+#include "log_binary.h"
+#include "sd_writer.h"
+#include "log_record.h"
+#include "record_queue.h"
+#include "imu_ring.h"
+#include "gps_clock.h"
+#include "track_metrics.h"
+#include "hal.h"
+#include "profile.h"
+#include "motion_scheduler.h"
+#include "ubx.h"
+#include "journal.h"
+#include "attitude.h"
+#include "imu_calibration.h"
+#include "track_simplify.h"
+#include "event_capture.h"
+#include "gps_config.h"
+#include "track_fusion.h"
+#include "log_index.h"
+#include "imu_codec.h"
 #include "ff.h"
-#include "sd_card.h"
 #include <inttypes.h> 
 
 
-#define UART_ID uart1
+#define UART_ID 1
 #define BAUD_RATE 9600
 #define UART_TX_PIN 4
 #define UART_RX_PIN 5
+//define GPS_PPS_PIN as the GPIO wired to the GT-U7 PPS output to align the clock to the PPS edge
+//#define GPS_PPS_PIN 6
 #define GPS_DIR "gps_logs"
 #define IMU_DIR "imu_logs"
 
+//LOG_FORMAT_BINARY writes fixed size records (log_format.h) instead of CSV text
+#ifdef LOG_FORMAT_BINARY
+#define LOG_FILE_EXT "bin"
+#else
+#define LOG_FILE_EXT "csv"
+#endif
+
+//IMU_COMPRESS writes the IMU log as delta coded blocks (imu_codec.h) in either format
+#ifdef IMU_COMPRESS
+#define IMU_FILE_EXT "imz"
+_Static_assert(sizeof(IMU_Reading) == IMU_CODEC_AXES * sizeof(int16_t), "IMU readings are encoded as int16 arrays");
+#else
+#define IMU_FILE_EXT LOG_FILE_EXT
+#endif
+
+//SD sync budget, data is written in SD_WRITER_BLOCK_SIZE blocks in between
+#define LOG_SYNC_INTERVAL_MS 5000
+#define LOG_SYNC_BYTES (32 * 1024)
+
+//VSYS is measured through a 1/3 divider on ADC3, flush the logs when the battery gets low
+#define VSYS_ADC_PIN 29
+#define VSYS_ADC_INPUT 3
+#define VSYS_LOW_MV 3500
+
+//how often the session summary file is rewritten
+#define SUMMARY_INTERVAL_US (60 * 1000000ULL)
+#define SUMMARY_HEADER "Fixes,Distance_m,Moving_s,Avg_kmh,Max_kmh,Pace_s_per_km,Sprints,IMU_Samples,Intensity_mg,Intensity_per_min\n"
+
+//fixes waiting for core 1, must be a power of two
+#define LOG_QUEUE_DEPTH 16
+
+//IMU sample blocks waiting for core 1 in full-rate mode, must be a power of two
+//32 blocks of 32 samples (15KB) is 5s at 200Hz to ride out slow SD card writes
+#define IMU_RING_BLOCKS 32
+
+//completed event bursts waiting for core 1 (8KB each), must be a power of two
+#define EVENT_QUEUE_DEPTH 2
+
+//fused track points waiting for core 1 in blocks of FUSION_BLOCK_POINTS (1KB each), must be a power of two
+//16 blocks is 2.5s at 200Hz, the track is written at every FUSION_OUTPUT_EVERY-th IMU sample
+#define FUSION_QUEUE_DEPTH 16
+#define FUSION_OUTPUT_EVERY 1
+
+#if defined(GPS_IMU_FUSION) && !defined(ATTITUDE_FILTER)
+#error "GPS_IMU_FUSION needs the linear acceleration of ATTITUDE_FILTER"
+#endif
+
+//preallocated once, at about 1MB per hour of CSV logs (30MB with IMU_FULL_RATE)
+//once full it wraps and overwrites the oldest sessions
+#define JOURNAL_PATH "journal.dat"
+#define JOURNAL_CAPACITY (256 * 1024 * 1024ULL)
+
 FATFS fs;
+#ifdef CRASH_SAFE_LOG
+Journal journal;
+#endif
 FIL gps_file;
 FIL imu_file;
+FIL clock_file;
+FIL summary_file;
+#ifdef PROFILE_STAGES
+FIL profile_file;
+#endif
+#ifdef MOTION_SCHEDULER
+FIL power_file;
+#endif
+#ifdef ATTITUDE_FILTER
+FIL attitude_file;
+SD_Writer attitude_writer;
+#endif
+#ifdef TRACK_SIMPLIFY
+FIL track_file;
+SD_Writer track_writer;
+#endif
+#ifdef EVENT_CAPTURE
+FIL events_file;
+SD_Writer events_writer;
+#endif
+#ifdef GPS_IMU_FUSION
+FIL fused_file;
+SD_Writer fused_writer;
+#endif
+#ifdef LOG_INDEX
+FIL gps_index_file;
+FIL imu_index_file;
+Log_Index gps_index;
+Log_Index imu_index;
+#endif
+SD_Writer gps_writer;
+SD_Writer imu_writer;
+SD_Writer clock_writer;
 FRESULT fr;
 
+static Log_Record log_queue_storage[LOG_QUEUE_DEPTH];
+static Record_Queue log_queue;
+
+#ifdef IMU_FULL_RATE
+static IMU_Block imu_ring_storage[IMU_RING_BLOCKS];
+static IMU_Ring imu_ring;
+#endif
+
+#ifdef IMU_COMPRESS
+static IMU_Encoder imu_encoder;     //used by core 1 only
+#endif
+
+#ifdef EVENT_CAPTURE
+static Event_Capture event_capture;
+static Event_Burst event_queue_storage[EVENT_QUEUE_DEPTH];
+static Record_Queue event_queue;
+#endif
+
+#ifdef GPS_IMU_FUSION
+static Track_Fusion fusion;
+static Track_Fusion_Block fusion_block;     //being filled by core 0
+static Track_Fusion_Block fusion_queue_storage[FUSION_QUEUE_DEPTH];
+static Record_Queue fusion_queue;
+#endif
+
+#ifdef MOTION_SCHEDULER
+static bool gps_rate_control = true;       //the receiver takes CFG-RATE
+static uint16_t gps_period_ms;              //the period it was last set to
+#endif
+
+#ifdef GPS_PPS_PIN
+static volatile uint64_t pps_time = 0;
+
+static void on_pps_edge() {
+    pps_time = hal_time_us();
+}
+#endif
+
+//set by core 0 when logging ends, core 1 drains its queues and returns
+static volatile bool logging_stopped = false;
+
+#if defined(PROFILE_STAGES) && defined(ATTITUDE_FILTER)
+//attitude samples timed on core 0, and those of bursts over ATTITUDE_BUDGET_US per sample
+static volatile uint32_t attitude_timed_samples = 0;
+static volatile uint32_t attitude_over_budget = 0;
+#endif
+
 void create_log_directory();
 int get_session_counter();
 void get_unique_filename(char *filename, int session, int is_imu);
 uint64_t generate_timestamp();
+bool vsys_is_low();
+void core1_main();
+uint32_t imu_samples_lost();
+void write_log_record(const Log_Record *record);
+void write_summary(const Track_Summary *summary);
+#ifdef EVENT_CAPTURE
+void write_event_burst(const Event_Burst *burst);
+#endif
+#ifdef GPS_IMU_FUSION
+void write_fusion_block(const Track_Fusion_Block *block);
+#endif
+void write_profile();
+#ifdef MOTION_SCHEDULER
+void apply_motion_profile(const Motion_Profile *profile);
+void write_power_report(const Motion_State_Stats *stats);
+#endif
 
 
 int main() {
-    stdio_init_all();
+    hal_init();
 
-    i2c_init(I2C_PORT, 400 * 1000);
-    gpio_set_function(SDA_PIN, GPIO_FUNC_I2C);
-    gpio_set_function(SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(SDA_PIN);
-    gpio_pull_up(SCL_PIN);
+    hal_i2c_init(I2C_PORT, 400 * 1000, SDA_PIN, SCL_PIN);
 
     mpu6050_init();
-    calibrate_mpu6050();
 
-    uart_init(UART_ID, BAUD_RATE);
-    gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
-    gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
+    nmea_rx_init(UART_ID, BAUD_RATE, UART_TX_PIN, UART_RX_PIN);
+
+#ifdef GPS_UBX_CONFIG
+    //leaves UART1 at the rate the receiver was moved to
+    GPS_Config_Result gps_config;
+    gps_config_run(UART_ID, &gps_config);
+    char gps_config_line[200];
+    gps_config_format(&gps_config, gps_config_line, sizeof(gps_config_line));
+    printf("GPS receiver: %s\n", gps_config_line);
+#endif
 
     printf("Initializing SD card....\n");
 
-    if (!sd_init_driver()) {
+    if (!hal_storage_init()) {
         printf("ERROR: Could not initialize SD card\n");
         return -1;
     }
@@ -106,13 +348,78 @@ int main() {
         return -1;
     }
     
+    //offsets of the last session, refined while logging
+    IMU_Calibration imu_cal;
+    imu_calibration_init(&imu_cal, generate_timestamp());
+    if (imu_calibration_load(&imu_cal)) {
+        mpu6050_set_offsets(imu_cal.applied_accel, imu_cal.applied_gyro);
+        printf("IMU offsets loaded: Accel X: %d, Y: %d, Z: %d, Gyro X: %d, Y: %d, Z: %d\n",
+               imu_cal.applied_accel[0], imu_cal.applied_accel[1], imu_cal.applied_accel[2],
+               imu_cal.applied_gyro[0], imu_cal.applied_gyro[1], imu_cal.applied_gyro[2]);
+    }
+    else {
+        printf("No saved IMU calibration, offsets are learnt while the device rests\n");
+    }
+    //the FIFO filled up while mounting the card, start logging from fresh samples
+    mpu6050_fifo_reset();
+
+    hal_adc_init(VSYS_ADC_PIN);
+
+    //buffer log data and only sync when the budget is used up
+    SD_Writer_Config sync_config = {
+        .max_interval_ms = LOG_SYNC_INTERVAL_MS,
+        .max_bytes = LOG_SYNC_BYTES,
+        .max_records = 0,
+        .low_voltage = vsys_is_low
+    };
+    uint64_t start_time = generate_timestamp();
+
+#ifdef CRASH_SAFE_LOG
+    //resume after the last valid record, the ADC noise only has to make a new journal id unlikely to repeat
+    uint32_t journal_seed = (uint32_t)start_time ^ ((uint32_t)hal_adc_read(VSYS_ADC_INPUT) << 16);
+    fr = journal_open(&journal, JOURNAL_PATH, JOURNAL_CAPACITY, &sync_config, journal_seed, start_time);
+    if (fr != FR_OK) {
+        printf("Error opening the journal: %d\n", fr);
+        return -1;
+    }
+    printf("Journal session %u resumes at byte %" PRIu64 " of %" PRIu64 " (%" PRIu32 " segments probed, %" PRIu32
+           " records scanned)\n", journal.session, journal.offset, journal.capacity, journal.probed_segments,
+           journal.recovered_records);
+    if (journal.capacity < JOURNAL_CAPACITY) {
+        printf("No contiguous %" PRIu64 " MB free on the card, the journal only holds %" PRIu64 " KB\n",
+               (uint64_t)(JOURNAL_CAPACITY >> 20), journal.capacity >> 10);
+    }
+    sd_writer_init_journal(&gps_writer, &journal, JOURNAL_GPS, start_time);
+    sd_writer_init_journal(&imu_writer, &journal, JOURNAL_IMU, start_time);
+    sd_writer_init_journal(&clock_writer, &journal, JOURNAL_CLOCK, start_time);
+#ifdef ATTITUDE_FILTER
+    sd_writer_init_journal(&attitude_writer, &journal, JOURNAL_ATTITUDE, start_time);
+#endif
+#ifdef TRACK_SIMPLIFY
+    sd_writer_init_journal(&track_writer, &journal, JOURNAL_TRACK, start_time);
+#endif
+#ifdef EVENT_CAPTURE
+    sd_writer_init_journal(&events_writer, &journal, JOURNAL_EVENTS, start_time);
+#endif
+#ifdef GPS_IMU_FUSION
+    sd_writer_init_journal(&fused_writer, &journal, JOURNAL_FUSED, start_time);
+#endif
+#ifdef LOG_INDEX
+    log_index_init_journal(&gps_index, &journal, JOURNAL_GPS_INDEX, start_time);
+    log_index_init_journal(&imu_index, &journal, JOURNAL_IMU_INDEX, start_time);
+#endif
+#else
     //init directory and filename
     create_log_directory();
     char gps_filename[50];
     char imu_filename[50];
+    char clock_filename[50];
+    char summary_filename[50];
     int session = get_session_counter();
     get_unique_filename(gps_filename, session, 0);
     get_unique_filename(imu_filename, session, 1);
+    sprintf(clock_filename, "%s/clock_log_%d.csv", GPS_DIR, session);
+    sprintf(summary_filename, "%s/summary_%d.csv", GPS_DIR, session);
 
     //open log files
     fr = f_open(&gps_file, gps_filename, FA_WRITE | FA_CREATE_ALWAYS);
@@ -128,96 +435,907 @@ int main() {
         return -1;
     }
 
-    //write CSV headers
-    f_write(&gps_file, "Timestamp,NMEA\n", strlen("Timestamp,NMEA\n"), NULL);
-    f_write(&imu_file, "Timestamp,IMU_Readings\n", strlen("Timestamp,IMU_Readings\n"), NULL);
+    fr = f_open(&clock_file, clock_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening clock log file: %d\n", fr);
+        f_close(&gps_file);
+        f_close(&imu_file);
+        return -1;
+    }
+
+    fr = f_open(&summary_file, summary_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening summary file: %d\n", fr);
+        f_close(&gps_file);
+        f_close(&imu_file);
+        f_close(&clock_file);
+        return -1;
+    }
+
+#ifdef PROFILE_STAGES
+    char profile_filename[50];
+    sprintf(profile_filename, "%s/profile_%d.csv", GPS_DIR, session);
+    fr = f_open(&profile_file, profile_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening profile file: %d\n", fr);
+    }
+#endif
+
+#ifdef MOTION_SCHEDULER
+    char power_filename[50];
+    sprintf(power_filename, "%s/power_%d.csv", GPS_DIR, session);
+    fr = f_open(&power_file, power_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening power report file: %d\n", fr);
+    }
+#endif
+
+#ifdef ATTITUDE_FILTER
+    char attitude_filename[50];
+    sprintf(attitude_filename, "%s/attitude_log_%d.csv", IMU_DIR, session);
+    fr = f_open(&attitude_file, attitude_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening attitude log file: %d\n", fr);
+    }
+    sd_writer_init(&attitude_writer, &attitude_file, &sync_config, start_time);
+#endif
+
+#ifdef TRACK_SIMPLIFY
+    char track_filename[50];
+    sprintf(track_filename, "%s/track_log_%d.csv", GPS_DIR, session);
+    fr = f_open(&track_file, track_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening track log file: %d\n", fr);
+    }
+    sd_writer_init(&track_writer, &track_file, &sync_config, start_time);
+#endif
+
+#ifdef EVENT_CAPTURE
+    char events_filename[50];
+    sprintf(events_filename, "%s/events_%d.csv", IMU_DIR, session);
+    fr = f_open(&events_file, events_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening events file: %d\n", fr);
+    }
+    sd_writer_init(&events_writer, &events_file, &sync_config, start_time);
+#endif
+
+#ifdef GPS_IMU_FUSION
+    char fused_filename[50];
+    sprintf(fused_filename, "%s/fused_log_%d.csv", GPS_DIR, session);
+    fr = f_open(&fused_file, fused_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening fused track file: %d\n", fr);
+    }
+    sd_writer_init(&fused_writer, &fused_file, &sync_config, start_time);
+#endif
+
+#ifdef LOG_INDEX
+    char gps_index_filename[50];
+    char imu_index_filename[50];
+    sprintf(gps_index_filename, "%s/gps_log_%d.idx", GPS_DIR, session);
+    sprintf(imu_index_filename, "%s/imu_log_%d.idx", IMU_DIR, session);
+    fr = f_open(&gps_index_file, gps_index_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening GPS index file: %d\n", fr);
+    }
+    fr = f_open(&imu_index_file, imu_index_filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        printf("Error opening IMU index file: %d\n", fr);
+    }
+    log_index_init(&gps_index, &gps_index_file, &sync_config, start_time);
+    log_index_init(&imu_index, &imu_index_file, &sync_config, start_time);
+#endif
+
+    sd_writer_init(&gps_writer, &gps_file, &sync_config, start_time);
+    sd_writer_init(&imu_writer, &imu_file, &sync_config, start_time);
+    sd_writer_init(&clock_writer, &clock_file, &sync_config, start_time);
 
     printf("Logging to file %s\n", gps_filename);
     printf("Logging to file %s\n", imu_filename);
+#endif
+
+#ifdef LOG_INDEX
+    //the index counts the log from its first byte, headers included
+    log_index_attach(&gps_index, &gps_writer);
+    log_index_attach(&imu_index, &imu_writer);
+#endif
+
+    sd_writer_write(&clock_writer, "Timestamp,UTC_Offset_us,Drift_ppb,Residual_us,Observations\n",
+                    strlen("Timestamp,UTC_Offset_us,Drift_ppb,Residual_us,Observations\n"));
+#ifdef ATTITUDE_FILTER
+    sd_writer_write(&attitude_writer, ATTITUDE_CSV_HEADER, strlen(ATTITUDE_CSV_HEADER));
+#endif
+#ifdef TRACK_SIMPLIFY
+    sd_writer_write(&track_writer, TRACK_CSV_HEADER, strlen(TRACK_CSV_HEADER));
+#endif
+#ifdef EVENT_CAPTURE
+    sd_writer_write(&events_writer, EVENT_CSV_HEADER, strlen(EVENT_CSV_HEADER));
+#endif
+#ifdef GPS_IMU_FUSION
+    sd_writer_write(&fused_writer, FUSION_CSV_HEADER, strlen(FUSION_CSV_HEADER));
+#endif
+
+#ifdef LOG_FORMAT_BINARY
+    //write binary file headers
+    log_binary_write_header(&gps_writer, LOG_KIND_GPS, start_time);
+#ifndef IMU_COMPRESS
+#ifdef IMU_FULL_RATE
+    log_binary_write_header(&imu_writer, LOG_KIND_IMU_SAMPLES, start_time);
+#else
+    log_binary_write_header(&imu_writer, LOG_KIND_IMU, start_time);
+#endif
+#endif
+#else
+    //write CSV headers
+    sd_writer_write(&gps_writer, "Timestamp,NMEA\n", strlen("Timestamp,NMEA\n"));
+#ifndef IMU_COMPRESS
+#ifdef IMU_FULL_RATE
+    sd_writer_write(&imu_writer, "Timestamp,ax,ay,az,gx,gy,gz\n", strlen("Timestamp,ax,ay,az,gx,gy,gz\n"));
+#else
+    sd_writer_write(&imu_writer, "Timestamp,IMU_Readings\n", strlen("Timestamp,IMU_Readings\n"));
+#endif
+#endif
+#endif
+
+#ifdef IMU_COMPRESS
+    //the encoder writes its own header, log_convert.c restores the CSV header
+#ifdef IMU_FULL_RATE
+    imu_encoder_init(&imu_encoder, &imu_writer, 1);
+#else
+    imu_encoder_init(&imu_encoder, &imu_writer, MAX_IMU_READINGS);
+#endif
+#endif
+
+    //core 1 takes over the SD card from here
+    record_queue_init(&log_queue, log_queue_storage, sizeof(Log_Record), LOG_QUEUE_DEPTH);
+#ifdef IMU_FULL_RATE
+    imu_ring_init(&imu_ring, imu_ring_storage, IMU_RING_BLOCKS);
+#endif
+#ifdef EVENT_CAPTURE
+    record_queue_init(&event_queue, event_queue_storage, sizeof(Event_Burst), EVENT_QUEUE_DEPTH);
+    Event_Trigger_Config event_config = {EVENT_ACCEL_MG, EVENT_JERK_G_S, EVENT_GYRO_DPS};
+    event_capture_init(&event_capture, &event_config);
+    uint32_t sprints_seen = 0;
+#endif
+#ifdef GPS_IMU_FUSION
+    record_queue_init(&fusion_queue, fusion_queue_storage, sizeof(Track_Fusion_Block), FUSION_QUEUE_DEPTH);
+    track_fusion_init(&fusion);
+    uint32_t fusion_samples = 0;
+#endif
+    hal_core1_launch(core1_main);
+
+    //fix being assembled from the GPS sentences
+    Log_Record record;
+    memset(&record, 0, sizeof(record));
+
+    NMEA_Parser nmea_parser;
+    nmea_parser_init(&nmea_parser);
+    uint64_t sentence_time = 0;
+    uint64_t rmc_time = 0;
+    uint64_t vtg_time = 0;
+
+    GPS_Clock gps_clock;
+    gps_clock_init(&gps_clock);
 
-    //buffer to read sentences from UART GPS signal
-    char gprmc_buff[100] = {0};
-    char gpvtg_buff[100] = {0};
-    unsigned char is_gprmc_received = 0;
-    unsigned char is_gpvtg_received = 0;
+    Track_Metrics metrics;
+    track_metrics_init(&metrics);
+
+#ifdef MOTION_SCHEDULER
+    Motion_Scheduler scheduler;
+#ifdef GPS_UBX_CONFIG
+    //running and impact keep the period gps_config set, a receiver that did not answer UBX stays at 1Hz
+    gps_rate_control = gps_config.ubx;
+    gps_period_ms = gps_config.period_ms;
+#else
+    gps_period_ms = 1000;
+#endif
+#ifdef EVENT_CAPTURE
+    //a fall from standing still starts in the 25Hz profile, the capture keeps the IMU at its full rate
+    uint16_t min_imu_rate_hz = MPU6050_SAMPLE_RATE_HZ;
+#else
+    uint16_t min_imu_rate_hz = 0;
+#endif
+    motion_scheduler_init(&scheduler, generate_timestamp(), gps_period_ms, min_imu_rate_hz);
+    apply_motion_profile(motion_scheduler_profile(&scheduler));
+    bool motion_pending = false;
+#endif
+
+#ifdef ATTITUDE_FILTER
+    Attitude attitude;
+    attitude_init(&attitude);
+#endif
+
+#ifdef TRACK_SIMPLIFY
+    Track_Simplifier simplifier;
+    track_simplifier_init(&simplifier, TRACK_SIMPLIFY_TOLERANCE_MM);
+#endif
+
+#ifdef GPS_PPS_PIN
+    hal_pps_init(GPS_PPS_PIN, on_pps_edge);
+#endif
 
     printf("GPS Test: Waiting for data...\n");
 
-    while (true) {
-        process_imu_buffer();
-
-        //read gps data
-        if (uart_is_readable(UART_ID)) {
-            char dat = uart_getc(UART_ID);
-            
-            static char sentence_code[5] = {0};
-            static char gps_buff[100] = {0};
-            static int gps_index = 0;
-
-            if (dat == '$') {
-                //reset for new sentence
-                memset(sentence_code, 0, sizeof(sentence_code));
-                memset(gps_buff, 0, sizeof(gps_buff));
-                gps_index = 0;
-            } else if (dat == '\r') {
-                gps_buff[gps_index] = '\0';
-                if (strncmp(sentence_code, "RMC", 3) == 0) {
-                    strncpy(gprmc_buff, gps_buff, sizeof(gprmc_buff) - 1);
-                    gprmc_buff[sizeof(gprmc_buff) - 1] = '\0';
-                    is_gprmc_received = 1;
+    uint32_t imu_lost_reported = 0;
+    bool imu_started = false;
+
+    while (hal_running()) {
+        PROFILE_START(loop_timer);
+
+        IMU_Sample imu_samples[MPU6050_FIFO_BURST_SAMPLES];
+        PROFILE_START(imu_timer);
+        int imu_count = process_imu_buffer(imu_samples, MPU6050_FIFO_BURST_SAMPLES);
+        PROFILE_STOP(PROFILE_IMU, imu_timer);
+        for (int i = 0; i < imu_count; i++) {
+            track_metrics_add_imu(&metrics, imu_samples[i].read.ax, imu_samples[i].read.ay, imu_samples[i].read.az);
+            imu_calibration_add(&imu_cal, imu_samples[i].timestamp_us, &imu_samples[i].read);
+        }
+        //new offsets apply from the next FIFO read, the calibration knows which ones each sample had
+        int16_t accel_offsets[3], gyro_offsets[3];
+        if (imu_calibration_take(&imu_cal, accel_offsets, gyro_offsets)) {
+            mpu6050_set_offsets(accel_offsets, gyro_offsets);
+        }
+        if (imu_count > 0 && !imu_started) {
+            printf("IMU logging started %" PRIu64 " ms after power-up\n", imu_samples[0].timestamp_us / 1000);
+            imu_started = true;
+        }
+#ifdef ATTITUDE_FILTER
+#ifdef GPS_IMU_FUSION
+        //horizontal linear acceleration of each sample for the fusion below
+        float fusion_accel[MPU6050_FIFO_BURST_SAMPLES][2];
+#endif
+        if (imu_count > 0) {
+            PROFILE_START(attitude_timer);
+            for (int i = 0; i < imu_count; i++) {
+                const IMU_Reading *r = &imu_samples[i].read;
+                attitude_update(&attitude, imu_samples[i].timestamp_us, r->ax, r->ay, r->az, r->gx, r->gy, r->gz);
+#ifdef GPS_IMU_FUSION
+                track_fusion_attitude_accel(&attitude, fusion_accel[i]);
+#endif
+            }
+            PROFILE_STOP(PROFILE_ATTITUDE, attitude_timer);
+#ifdef PROFILE_STAGES
+            if (hal_perf_time_us() - attitude_timer > (uint32_t)imu_count * ATTITUDE_BUDGET_US) {
+                attitude_over_budget += imu_count;
+            }
+            attitude_timed_samples += imu_count;
+#endif
+        }
+#endif
+#ifdef GPS_IMU_FUSION
+        if (imu_count > 0) {
+            PROFILE_START(fusion_timer);
+            for (int i = 0; i < imu_count; i++) {
+                track_fusion_predict(&fusion, imu_samples[i].timestamp_us, fusion_accel[i]);
+                if (++fusion_samples < FUSION_OUTPUT_EVERY ||
+                    !track_fusion_point(&fusion, &fusion_block.points[fusion_block.count])) {
+                    continue;
                 }
-                else if (strncmp(sentence_code, "VTG", 3) == 0) {
-                    strncpy(gpvtg_buff, gps_buff, sizeof(gpvtg_buff) - 1);
-                    gpvtg_buff[sizeof(gpvtg_buff) - 1] = '\0';
-                    is_gpvtg_received = 1;
+                fusion_samples = 0;
+                //a full queue drops the block and counts it, like the fixes
+                if (++fusion_block.count == FUSION_BLOCK_POINTS) {
+                    if (record_queue_push(&fusion_queue, &fusion_block)) {
+                        hal_event_signal();
+                    }
+                    fusion_block.count = 0;
                 }
-            } else if (gps_index < sizeof(gps_buff) - 1) {
-                //collect sentence data
-                gps_buff[gps_index++] = dat;
+            }
+            PROFILE_STOP(PROFILE_FUSION, fusion_timer);
+        }
+#endif
+#ifdef MOTION_SCHEDULER
+        bool motion_changed = false;
+        for (int i = 0; i < imu_count; i++) {
+            motion_changed |= motion_scheduler_add_imu(&scheduler, imu_samples[i].timestamp_us, imu_samples[i].read.ax,
+                                                       imu_samples[i].read.ay, imu_samples[i].read.az);
+        }
+        //the new IMU rate resets the FIFO, wait for a pass that emptied it so no sample is thrown away
+        //(after an impact these are the samples right after it, the tail of the event burst)
+        motion_pending |= motion_changed;
+        if (motion_pending && imu_count < MPU6050_FIFO_BURST_SAMPLES) {
+            apply_motion_profile(motion_scheduler_profile(&scheduler));
+            motion_pending = false;
+        }
+#endif
+#ifdef EVENT_CAPTURE
+        for (int i = 0; i < imu_count; i++) {
+            if (event_capture_add(&event_capture, &imu_samples[i])) {
+                if (record_queue_push(&event_queue, &event_capture.burst)) {
+                    hal_event_signal();
+                }
+                else {
+                    printf("Event queue full, events dropped: %" PRIu32 "\n", event_queue.dropped);
+                }
+            }
+        }
+#endif
+#ifdef IMU_FULL_RATE
+        for (int i = 0; i < imu_count; i++) {
+            imu_ring_push(&imu_ring, &imu_samples[i]);
+        }
+        //core 1 only has work once a block is complete
+        if (imu_ring_count(&imu_ring) > 0) {
+            hal_event_signal();
+        }
+#endif
+
+        //drain gps data received by the UART interrupt
+        char rx_chunk[64];
+        uint32_t rx_times[64];
+        size_t rx_len = nmea_rx_read(rx_chunk, rx_times, sizeof(rx_chunk));
+
+        PROFILE_START(nmea_timer);
+        for (size_t i = 0; i < rx_len; i++) {
+            NMEA_Sentence sentence;
+            if (rx_chunk[i] == '$') {
+                sentence_time = nmea_rx_time_to_64(rx_times[i]);
+            }
+            if (!nmea_parser_feed(&nmea_parser, rx_chunk[i], &sentence)) {
+                continue;
+            }
+
+            //only checksum-valid sentences get here, keep the raw text for the CSV log
+            if (sentence.type == NMEA_TYPE_RMC) {
+                snprintf(record.rmc_text, sizeof(record.rmc_text), "%s", nmea_parser_text(&nmea_parser));
+                record.rmc = sentence.rmc;
+                record.flags |= LOG_RECORD_HAS_RMC;
+                rmc_time = sentence_time;
+                track_metrics_add_fix(&metrics, sentence_time, &sentence.rmc);
+#ifdef EVENT_CAPTURE
+                //a sprint is confirmed after TRACK_SPRINT_MIN_MS, the pre-trigger ring holds its start
+                if (metrics.summary.sprints != sprints_seen) {
+                    event_capture_trigger(&event_capture, EVENT_TRIGGER_EXTERNAL);
+                    sprints_seen = metrics.summary.sprints;
+                }
+#endif
+#ifdef MOTION_SCHEDULER
+                motion_scheduler_add_fix(&scheduler);
+#endif
 
-                //update sentence code (only the first 3 characters after "$")
-                if (gps_index >= 3 && gps_index <= 6) {
-                    sentence_code[gps_index - 3] = dat;
+                if (sentence.rmc.valid) {
+#ifdef GPS_PPS_PIN
+                    //the PPS edge marks the start of the second this RMC reports, faster fixes fall in between
+                    uint64_t pps = pps_time;
+                    if (pps && sentence_time - pps < 1000000 && sentence.rmc.time_ms % 1000 == 0) {
+                        gps_clock_add(&gps_clock, pps, gps_utc_from_rmc(&sentence.rmc));
+                    }
+#else
+                    gps_clock_add(&gps_clock, sentence_time, gps_utc_from_rmc(&sentence.rmc));
+#endif
+#ifdef EVENT_CAPTURE
+                    event_capture_add_fix(&event_capture, sentence_time, sentence.rmc.lat_e7, sentence.rmc.lon_e7,
+                                          sentence.rmc.speed_mm_s);
+#endif
+#ifdef GPS_IMU_FUSION
+                    //RMC carries the same speed and course as the VTG that follows it
+                    track_fusion_add_fix(&fusion, sentence_time, sentence.rmc.lat_e7, sentence.rmc.lon_e7,
+                                         sentence.rmc.speed_mm_s, sentence.rmc.course_cdeg);
+#endif
+#ifdef TRACK_SIMPLIFY
+                    Track_Point point = {sentence_time, sentence.rmc.lat_e7, sentence.rmc.lon_e7};
+                    if (track_simplifier_add(&simplifier, &point, &record.track_point)) {
+                        record.flags |= LOG_RECORD_HAS_TRACK_POINT;
+                    }
+#endif
                 }
             }
+            else if (sentence.type == NMEA_TYPE_VTG) {
+                snprintf(record.vtg_text, sizeof(record.vtg_text), "%s", nmea_parser_text(&nmea_parser));
+                record.vtg = sentence.vtg;
+                record.flags |= LOG_RECORD_HAS_VTG;
+                vtg_time = sentence_time;
+            }
         }
-        if (is_gprmc_received || is_gpvtg_received) {
-            printf("Writing to SD card...\n");
-            uint64_t curr_timestamp = generate_timestamp();
-
-            if (is_gprmc_received) {
-                printf("GPRMC: %s\n", gprmc_buff);
-                char time_stamp_rms[200];
-                snprintf(time_stamp_rms, sizeof(time_stamp_rms),
-                        "%" PRIu64 ",%s\n", curr_timestamp, gprmc_buff);
-
-                UINT bytes_written;
-                fr = f_write(&gps_file, time_stamp_rms, strlen(time_stamp_rms), &bytes_written);
+        if (rx_len > 0) {
+            PROFILE_STOP(PROFILE_NMEA, nmea_timer);
+        }
+
+        if (record.flags) {
+            //stamp the fix with the arrival of its RMC sentence rather than the time it is written
+            record.timestamp = (record.flags & LOG_RECORD_HAS_RMC) ? rmc_time : vtg_time;
+            record.clock_observations = gps_clock.observations;
+            if (gps_clock.observations > 0) {
+                record.clock_offset_us = gps_clock_offset_at(&gps_clock, record.timestamp);
+                record.clock_drift_ppb = (int32_t)(gps_clock.drift * 1e9);
+                record.clock_residual_us = (uint32_t)gps_clock.residual_us;
+            }
+            record.summary = metrics.summary;
+            copy_imu_buffer(record.imu);
+#ifdef MOTION_SCHEDULER
+            motion_scheduler_update(&scheduler, generate_timestamp());
+            record.sync_interval_ms = motion_scheduler_profile(&scheduler)->sync_interval_ms;
+            memcpy(record.motion, scheduler.stats, sizeof(record.motion));
+#endif
+#ifdef ATTITUDE_FILTER
+            record.attitude = attitude;
+            attitude_reset_peak(&attitude);
+#endif
+#ifdef TRACK_SIMPLIFY
+            record.track_fixes = simplifier.points_in;
+            record.track_kept = simplifier.points_out;
+#endif
+            if (imu_calibration_save_due(&imu_cal, record.timestamp, false, &record.calibration)) {
+                record.flags |= LOG_RECORD_SAVE_CALIBRATION;
             }
-            if (is_gpvtg_received) {
-                printf("GPVTG: %s\n", gpvtg_buff);
-                char time_stamp_vtg[200];
-                snprintf(time_stamp_vtg, sizeof(time_stamp_vtg),
-                        "%" PRIu64 ",%s\n", curr_timestamp, gpvtg_buff);
-                UINT bytes_written;
-                fr = f_write(&gps_file, time_stamp_vtg, strlen(time_stamp_vtg), &bytes_written);
+
+            //never wait for core 1, a full queue drops the fix and counts it
+            if (record_queue_push(&log_queue, &record)) {
+                hal_event_signal();
+            }
+            else {
+                printf("Log queue full, fixes dropped: %" PRIu32 "\n", log_queue.dropped);
+            }
+            record.flags = 0;
+
+            NMEA_RX_Stats rx_stats;
+            nmea_rx_get_stats(&rx_stats);
+            if (rx_stats.overruns || rx_stats.dropped) {
+                printf("GPS RX lost bytes: overruns %" PRIu32 ", dropped %" PRIu32 "\n",
+                       rx_stats.overruns, rx_stats.dropped);
+            }
+
+            uint32_t imu_lost = imu_samples_lost();
+            if (imu_lost != imu_lost_reported) {
+                printf("IMU samples lost: %" PRIu32 " (%" PRIu32 " FIFO overflows, %" PRIu32 " I2C transfers for %" PRIu32
+                       " samples)\n", imu_lost, mpu6050_stats.fifo_overflows, mpu6050_stats.i2c_transfers,
+                       mpu6050_stats.samples);
+                imu_lost_reported = imu_lost;
             }
+        }
 
-            printf("Data written to the SD card.\n");
-            write_imu_buffer(&imu_file, curr_timestamp);
-            f_sync(&imu_file);
-            f_sync(&gps_file); //ensure data is flushed to the SD card
+        PROFILE_STOP(PROFILE_LOOP, loop_timer);
 
-            is_gprmc_received = 0;
-            is_gpvtg_received = 0;
+#ifdef MOTION_SCHEDULER
+        //sleep until the next interrupt unless the FIFO or the UART ring still holds data
+        motion_scheduler_update(&scheduler, generate_timestamp());
+        if (rx_len < sizeof(rx_chunk) && imu_count < MPU6050_FIFO_BURST_SAMPLES) {
+            motion_scheduler_add_idle(&scheduler, hal_idle_us(motion_scheduler_profile(&scheduler)->idle_us));
         }
+#endif
+    }
+
+    //only reached when the simulator runs out of recorded data
+#ifdef IMU_FULL_RATE
+    imu_ring_flush(&imu_ring);
+#endif
+#ifdef EVENT_CAPTURE
+    if (event_capture_flush(&event_capture)) {
+        record_queue_push(&event_queue, &event_capture.burst);
+    }
+#endif
+#ifdef GPS_IMU_FUSION
+    if (fusion_block.count > 0) {
+        record_queue_push(&fusion_queue, &fusion_block);
+    }
+#endif
+    logging_stopped = true;
+    hal_event_signal();
+    hal_core1_join();
+
+    IMU_Cal_Record cal_record;
+    if (imu_calibration_save_due(&imu_cal, generate_timestamp(), true, &cal_record)) {
+        imu_calibration_save(&cal_record);
+    }
+#ifdef TRACK_SIMPLIFY
+    //core 1 has stopped, the last fix of the track goes straight to the writer
+    Track_Point last_point;
+    if (track_simplifier_finish(&simplifier, &last_point)) {
+        char track_row[64];
+        int track_len = track_point_format(&last_point, track_row, sizeof(track_row));
+        sd_writer_write(&track_writer, track_row, track_len);
     }
+    printf("Track: %" PRIu32 " of %" PRIu32 " fixes kept\n", simplifier.points_out, simplifier.points_in);
+#endif
+#ifdef EVENT_CAPTURE
+    printf("Events: %" PRIu32 " captured, %" PRIu32 " dropped\n", event_capture.events, event_queue.dropped);
+#endif
+#ifdef GPS_IMU_FUSION
+    printf("Fusion: %" PRIu32 " samples, %" PRIu32 " fixes, heading offset %s, %" PRIu32 " rejected, %" PRIu32
+           " restarts, %" PRIu32 " gaps, %" PRIu32 " blocks dropped\n", fusion.predictions, fusion.fixes,
+           fusion.aligned ? "found" : "not found", fusion.rejected, fusion.restarts, fusion.gaps, fusion_queue.dropped);
+#endif
+    printf("IMU: %" PRIu32 " samples, %" PRIu32 " I2C transfers, %" PRIu32 " FIFO overflows\n", mpu6050_stats.samples,
+           mpu6050_stats.i2c_transfers, mpu6050_stats.fifo_overflows);
+    write_summary(&metrics.summary);
+    write_profile();
+#ifdef MOTION_SCHEDULER
+    motion_scheduler_update(&scheduler, generate_timestamp());
+    write_power_report(scheduler.stats);
+#endif
+#ifdef IMU_COMPRESS
+    imu_encoder_flush(&imu_encoder);
+    printf("IMU log: %" PRIu32 " rows in %" PRIu32 " blocks, %" PRIu64 " bytes\n", imu_encoder.rows_in,
+           imu_encoder.blocks, imu_encoder.bytes_out);
+#endif
+    sd_writer_flush(&gps_writer, generate_timestamp());
+    sd_writer_flush(&imu_writer, generate_timestamp());
+    sd_writer_flush(&clock_writer, generate_timestamp());
+#ifdef ATTITUDE_FILTER
+    sd_writer_flush(&attitude_writer, generate_timestamp());
+#endif
+#ifdef TRACK_SIMPLIFY
+    sd_writer_flush(&track_writer, generate_timestamp());
+#endif
+#ifdef EVENT_CAPTURE
+    sd_writer_flush(&events_writer, generate_timestamp());
+#endif
+#ifdef GPS_IMU_FUSION
+    sd_writer_flush(&fused_writer, generate_timestamp());
+#endif
+#ifdef LOG_INDEX
+    sd_writer_flush(&gps_index.writer, generate_timestamp());
+    sd_writer_flush(&imu_index.writer, generate_timestamp());
+    printf("Index: %" PRIu32 " GPS and %" PRIu32 " IMU entries\n", gps_index.entries, imu_index.entries);
+#endif
+#ifdef CRASH_SAFE_LOG
+    journal_close(&journal, generate_timestamp());
+#else
     f_close(&gps_file);
     f_close(&imu_file);
+    f_close(&clock_file);
+    f_close(&summary_file);
+#ifdef PROFILE_STAGES
+    f_close(&profile_file);
+#endif
+#ifdef MOTION_SCHEDULER
+    f_close(&power_file);
+#endif
+#ifdef ATTITUDE_FILTER
+    f_close(&attitude_file);
+#endif
+#ifdef TRACK_SIMPLIFY
+    f_close(&track_file);
+#endif
+#ifdef EVENT_CAPTURE
+    f_close(&events_file);
+#endif
+#ifdef GPS_IMU_FUSION
+    f_close(&fused_file);
+#endif
+#ifdef LOG_INDEX
+    f_close(&gps_index_file);
+    f_close(&imu_index_file);
+#endif
+#endif
     f_unmount("0:");
     return 0;
 }
 
+//core 1: format queued fixes and write them to the SD card
+void core1_main() {
+    static Log_Record record;
+#ifdef EVENT_CAPTURE
+    static Event_Burst burst;
+#endif
+#ifdef GPS_IMU_FUSION
+    static Track_Fusion_Block block_copy;
+#endif
+
+    while (true) {
+        bool idle = true;
+
+#ifdef IMU_FULL_RATE
+        //whole blocks are written straight from the ring
+        const IMU_Block *block;
+        uint64_t last_sample_time = 0;
+        while ((block = imu_ring_peek(&imu_ring)) != NULL) {
+            for (uint32_t i = 0; i < block->count; i++) {
+                IMU_Sample sample;
+                imu_block_sample(block, i, &last_sample_time, &sample);
+#ifdef IMU_COMPRESS
+                FRESULT imu_fr = imu_encoder_add(&imu_encoder, sample.timestamp_us, (const int16_t *)&sample.read);
+                if (imu_fr != FR_OK) {
+                    printf("Error writing IMU sample to the file: %d\n", imu_fr);
+                }
+#else
+                write_imu_sample(&imu_writer, &sample);
+#endif
+            }
+            imu_ring_release(&imu_ring);
+            idle = false;
+        }
+        //with IMU_COMPRESS the encoder commits its own blocks
+#ifndef IMU_COMPRESS
+        if (!idle) {
+            sd_writer_commit(&imu_writer, last_sample_time);
+        }
+#endif
+#endif
+
+        if (record_queue_pop(&log_queue, &record)) {
+            PROFILE_START(record_timer);
+            write_log_record(&record);
+            PROFILE_STOP(PROFILE_RECORD, record_timer);
+            idle = false;
+        }
+
+#ifdef GPS_IMU_FUSION
+        while (record_queue_pop(&fusion_queue, &block_copy)) {
+            write_fusion_block(&block_copy);
+            idle = false;
+        }
+#endif
+
+#ifdef EVENT_CAPTURE
+        //the fixes and IMU blocks above go first, a burst is ~30KB of text
+        if (idle && record_queue_pop(&event_queue, &burst)) {
+            write_event_burst(&burst);
+            idle = false;
+        }
+#endif
+
+        if (idle) {
+            if (logging_stopped) {
+                return;
+            }
+            hal_event_wait(); //woken by hal_event_signal() from core 0
+        }
+    }
+}
+
+//samples dropped by a full queue or a rate change plus an estimate of those lost to FIFO overflows
+uint32_t imu_samples_lost() {
+    uint32_t lost = mpu6050_stats.fifo_overflows * (MPU6050_FIFO_SIZE / MPU6050_FIFO_SAMPLE_BYTES);
+    lost += mpu6050_stats.fifo_discarded;
+#ifdef IMU_FULL_RATE
+    lost += imu_ring.dropped;
+#endif
+    return lost;
+}
+
+void write_log_record(const Log_Record *record) {
+    bool has_rmc = record->flags & LOG_RECORD_HAS_RMC;
+    bool has_vtg = record->flags & LOG_RECORD_HAS_VTG;
+
+    printf("Writing to SD card...\n");
+
+    //the motion profile decides how much data a power loss may cost
+    if (record->sync_interval_ms) {
+        gps_writer.config.max_interval_ms = record->sync_interval_ms;
+        imu_writer.config.max_interval_ms = record->sync_interval_ms;
+        clock_writer.config.max_interval_ms = record->sync_interval_ms;
+#ifdef ATTITUDE_FILTER
+        attitude_writer.config.max_interval_ms = record->sync_interval_ms;
+#endif
+#ifdef TRACK_SIMPLIFY
+        track_writer.config.max_interval_ms = record->sync_interval_ms;
+#endif
+#ifdef EVENT_CAPTURE
+        events_writer.config.max_interval_ms = record->sync_interval_ms;
+#endif
+#ifdef GPS_IMU_FUSION
+        fused_writer.config.max_interval_ms = record->sync_interval_ms;
+#endif
+#ifdef LOG_INDEX
+        gps_index.writer.config.max_interval_ms = record->sync_interval_ms;
+        imu_index.writer.config.max_interval_ms = record->sync_interval_ms;
+#endif
+#ifdef CRASH_SAFE_LOG
+        journal.writer.config.max_interval_ms = record->sync_interval_ms;
+#endif
+    }
+
+#ifdef LOG_FORMAT_BINARY
+    fr = log_binary_write_gps(&gps_writer, record->timestamp,
+                              has_rmc ? &record->rmc : NULL,
+                              has_vtg ? &record->vtg : NULL);
+#else
+    if (has_rmc) {
+        printf("GPRMC: %s\n", record->rmc_text);
+        char time_stamp_rms[200];
+        PROFILE_START(format_timer);
+        snprintf(time_stamp_rms, sizeof(time_stamp_rms),
+                "%" PRIu64 ",%s\n", record->timestamp, record->rmc_text);
+        PROFILE_STOP(PROFILE_FORMAT, format_timer);
+        fr = sd_writer_write(&gps_writer, time_stamp_rms, strlen(time_stamp_rms));
+    }
+    if (has_vtg) {
+        printf("GPVTG: %s\n", record->vtg_text);
+        char time_stamp_vtg[200];
+        PROFILE_START(format_timer);
+        snprintf(time_stamp_vtg, sizeof(time_stamp_vtg),
+                "%" PRIu64 ",%s\n", record->timestamp, record->vtg_text);
+        PROFILE_STOP(PROFILE_FORMAT, format_timer);
+        fr = sd_writer_write(&gps_writer, time_stamp_vtg, strlen(time_stamp_vtg));
+    }
+#endif
+
+#if defined(IMU_COMPRESS) && !defined(IMU_FULL_RATE)
+    FRESULT imu_fr = imu_encoder_add(&imu_encoder, record->timestamp, (const int16_t *)record->imu);
+    if (imu_fr != FR_OK) {
+        printf("Error writing IMU data to the file: %d\n", imu_fr);
+    }
+#elif !defined(IMU_FULL_RATE)
+    write_imu_buffer(&imu_writer, record->timestamp, record->imu);
+    sd_writer_commit(&imu_writer, record->timestamp);
+#endif
+    printf("Data buffered for the SD card.\n");
+
+    //clock fit at the time of this fix: utc = timestamp + offset + drift * (t - timestamp)
+    if (record->clock_observations > 0) {
+        char clock_row[100];
+        int len = snprintf(clock_row, sizeof(clock_row), "%" PRIu64 ",%" PRId64 ",%" PRId32 ",%" PRIu32 ",%" PRIu32 "\n",
+                           record->timestamp, record->clock_offset_us, record->clock_drift_ppb,
+                           record->clock_residual_us, record->clock_observations);
+        sd_writer_write(&clock_writer, clock_row, len);
+        sd_writer_commit(&clock_writer, record->timestamp);
+    }
+
+#ifdef ATTITUDE_FILTER
+    char attitude_row[200];
+    PROFILE_START(attitude_format_timer);
+    int attitude_len = attitude_format(&record->attitude, record->timestamp, attitude_row, sizeof(attitude_row));
+    PROFILE_STOP(PROFILE_FORMAT, attitude_format_timer);
+    sd_writer_write(&attitude_writer, attitude_row, attitude_len);
+    sd_writer_commit(&attitude_writer, record->timestamp);
+#endif
+
+#ifdef TRACK_SIMPLIFY
+    if (record->flags & LOG_RECORD_HAS_TRACK_POINT) {
+        char track_row[64];
+        int track_len = track_point_format(&record->track_point, track_row, sizeof(track_row));
+        sd_writer_write(&track_writer, track_row, track_len);
+        sd_writer_commit(&track_writer, record->timestamp);
+    }
+#endif
+
+    if (record->flags & LOG_RECORD_SAVE_CALIBRATION) {
+        fr = imu_calibration_save(&record->calibration);
+        if (fr != FR_OK) {
+            printf("Error saving the IMU calibration: %d\n", fr);
+        }
+    }
+
+    //writes full blocks and syncs once the time/byte budget is used up
+    sd_writer_commit(&gps_writer, record->timestamp);
+
+    static uint64_t last_summary_time = 0;
+    if (record->timestamp - last_summary_time >= SUMMARY_INTERVAL_US) {
+        write_summary(&record->summary);
+        write_profile();
+#ifdef MOTION_SCHEDULER
+        write_power_report(record->motion);
+#endif
+#ifdef TRACK_SIMPLIFY
+        if (record->track_kept > 0) {
+            printf("Track: %" PRIu32 " of %" PRIu32 " fixes kept (%" PRIu32 ".%" PRIu32 ":1)\n", record->track_kept,
+                   record->track_fixes, record->track_fixes / record->track_kept,
+                   record->track_fixes * 10 / record->track_kept % 10);
+        }
+#endif
+        last_summary_time = record->timestamp;
+    }
+}
+
+#ifdef EVENT_CAPTURE
+//the event row, then one row per sample
+void write_event_burst(const Event_Burst *burst) {
+    char row[160];
+    int len = event_burst_format_header(burst, row, sizeof(row));
+    sd_writer_write(&events_writer, row, len);
+    for (uint32_t i = 0; i < burst->count; i++) {
+        len = event_burst_format_sample(burst, i, row, sizeof(row));
+        sd_writer_write(&events_writer, row, len);
+    }
+    sd_writer_commit(&events_writer, burst->trigger_us);
+    printf("Event %" PRIu32 " written: %" PRIu32 " samples\n", burst->number, burst->count);
+}
+#endif
+
+#ifdef GPS_IMU_FUSION
+//one row per fused track point
+void write_fusion_block(const Track_Fusion_Block *block) {
+    char row[100];
+    for (uint32_t i = 0; i < block->count; i++) {
+        PROFILE_START(fusion_format_timer);
+        int len = track_fusion_format(&block->points[i], row, sizeof(row));
+        PROFILE_STOP(PROFILE_FORMAT, fusion_format_timer);
+        sd_writer_write(&fused_writer, row, len);
+    }
+    if (block->count > 0) {
+        sd_writer_commit(&fused_writer, block->points[block->count - 1].time_us);
+    }
+}
+#endif
+
+//rewrite the one line session summary in place
+void write_summary(const Track_Summary *summary) {
+    char row[200];
+    int len = track_metrics_format(summary, row, sizeof(row));
+
+#ifdef CRASH_SAFE_LOG
+    //reports are appended whole, the extractor keeps the last one of the session
+    char report[sizeof(SUMMARY_HEADER) + sizeof(row)];
+    int report_len = snprintf(report, sizeof(report), "%s%.*s", SUMMARY_HEADER, len, row);
+    journal_append(&journal, JOURNAL_SUMMARY, report, report_len);
+    journal_commit(&journal, generate_timestamp());
+#else
+    f_lseek(&summary_file, 0);
+    f_write(&summary_file, SUMMARY_HEADER, strlen(SUMMARY_HEADER), NULL);
+    f_write(&summary_file, row, len, NULL);
+    f_truncate(&summary_file);
+    f_sync(&summary_file);
+#endif
+
+    //a full or failing card must not go unnoticed
+    uint32_t write_errors = gps_writer.errors + imu_writer.errors + clock_writer.errors;
+#ifdef CRASH_SAFE_LOG
+    printf("Journal: %" PRIu32 " records dropped, %" PRIu32 " write errors, wrapped %" PRIu32 " times\n",
+           journal.dropped, journal.writer.errors + write_errors, journal.wraps);
+#else
+    if (write_errors > 0) {
+        printf("SD write errors: %" PRIu32 "\n", write_errors);
+    }
+#endif
+}
+
+//rewrite the stage timing report in place and print it
+void write_profile() {
+#ifdef PROFILE_STAGES
+    static char report[PROFILE_REPORT_SIZE];
+    int len = profile_format(report, sizeof(report));
+    if (len >= (int)sizeof(report)) {
+        len = sizeof(report) - 1;
+    }
+#ifdef ATTITUDE_FILTER
+    len += snprintf(report + len, sizeof(report) - len, "attitude over %d us per sample: %" PRIu32 " of %" PRIu32
+                    " samples\n", ATTITUDE_BUDGET_US, attitude_over_budget, attitude_timed_samples);
+    if (len >= (int)sizeof(report)) {
+        len = sizeof(report) - 1;
+    }
+#endif
+
+    printf("%s", report);
+#ifdef CRASH_SAFE_LOG
+    journal_append(&journal, JOURNAL_PROFILE, report, len);
+    journal_commit(&journal, generate_timestamp());
+#else
+    f_lseek(&profile_file, 0);
+    f_write(&profile_file, report, len, NULL);
+    f_truncate(&profile_file);
+    f_sync(&profile_file);
+#endif
+#endif
+}
+
+#ifdef MOTION_SCHEDULER
+//switch the IMU and GPS rates to the profile of the new motion state
+void apply_motion_profile(const Motion_Profile *profile) {
+    mpu6050_set_sample_rate(profile->imu_rate_hz);
+
+    if (gps_rate_control && profile->gps_period_ms != gps_period_ms) {
+        uint8_t frame[UBX_CFG_RATE_FRAME_SIZE];
+        size_t len = ubx_cfg_rate(frame, profile->gps_period_ms);
+        hal_uart_write(UART_ID, frame, len);
+        gps_period_ms = profile->gps_period_ms;
+    }
+
+    printf("Motion profile: IMU %u Hz, GPS every %u ms, sync every %" PRIu32 " ms\n",
+           profile->imu_rate_hz, gps_period_ms, profile->sync_interval_ms);
+}
+
+//rewrite the per-state time, duty cycle and sample counts in place
+void write_power_report(const Motion_State_Stats *stats) {
+    char report[400];
+    int len = motion_scheduler_format(stats, report, sizeof(report));
+    if (len >= (int)sizeof(report)) {
+        len = sizeof(report) - 1;
+    }
+
+    printf("%s", report);
+#ifdef CRASH_SAFE_LOG
+    journal_append(&journal, JOURNAL_POWER, report, len);
+    journal_commit(&journal, generate_timestamp());
+#else
+    f_lseek(&power_file, 0);
+    f_write(&power_file, report, len, NULL);
+    f_truncate(&power_file);
+    f_sync(&power_file);
+#endif
+}
+#endif
+
 void create_log_directory() {
     fr = f_mkdir(GPS_DIR);
     if (fr == FR_OK || fr == FR_EXIST) {
@@ -238,7 +1356,7 @@ void create_log_directory() {
 
 int get_session_counter() {
     FIL counter_file;
-    char counter_str[10] = {0};
+    char counter_str[12] = {0};
     int counter = 1;
 
     if (f_open(&counter_file, "session_counter.txt", FA_READ) == FR_OK) {
@@ -249,7 +1367,7 @@ int get_session_counter() {
 
     counter++;
     if (f_open(&counter_file, "session_counter.txt", FA_WRITE | FA_CREATE_ALWAYS) == FR_OK) {
-        sprintf(counter_str, "%d", counter);
+        snprintf(counter_str, sizeof(counter_str), "%d", counter);
         f_write(&counter_file, counter_str, strlen(counter_str), NULL);
         f_sync(&counter_file);
         f_close(&counter_file);
@@ -260,13 +1378,18 @@ int get_session_counter() {
 
 void get_unique_filename(char *filename, int session, int is_imu) {
     if (is_imu) {
-        sprintf(filename, "%s/imu_log_%d.csv", IMU_DIR, session);
+        sprintf(filename, "%s/imu_log_%d.%s", IMU_DIR, session, IMU_FILE_EXT);
     }
     else {
-        sprintf(filename, "%s/gps_log_%d.csv", GPS_DIR, session);
+        sprintf(filename, "%s/gps_log_%d.%s", GPS_DIR, session, LOG_FILE_EXT);
     }
 }
 
 uint64_t generate_timestamp() {
-    return time_us_64();
+    return hal_time_us();
+}
+
+bool vsys_is_low() {
+    uint32_t vsys_mv = (uint32_t)hal_adc_read(VSYS_ADC_INPUT) * 3 * 3300 / 4096;
+    return vsys_mv < VSYS_LOW_MV;
 }
\ No newline at end of file
@@ -0,0 +1,167 @@
+/*
+File: motion_scheduler.c
+Author: Leonardo DaGraca
+
+Motion classification and per-state sampling profiles, see motion_scheduler.h.
+The deviation of |a| from 1g is taken to first order as (|a|^2 - 1g^2) / 2g so
+no square root is needed per sample. Stepping up to a busier state happens
+after one window, stepping down only after MOTION_SETTLE_WINDOWS calm windows,
+so a short pause does not drop the GPS and IMU rates in the middle of a run.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "motion_scheduler.h"
+
+//the 25 and 100Hz IMU rates are raised by motion_scheduler_init() when the event capture needs the
+//full rate, event_test misses 72% of impacts at 25Hz and a fall from standing starts at that rate
+//GPS periods for a receiver at its default 1Hz, motion_scheduler_init() gives the running and impact
+//states the period gps_config set (down to 100ms) and keeps the calmer states no faster than it
+const Motion_Profile motion_profiles[MOTION_STATE_COUNT] = {
+    [MOTION_STATIONARY] = {.imu_rate_hz = 25,  .gps_period_ms = 5000, .sync_interval_ms = 30000, .idle_us = 100000},
+    [MOTION_WALKING]    = {.imu_rate_hz = 100, .gps_period_ms = 2000, .sync_interval_ms = 10000, .idle_us = 40000},
+    [MOTION_RUNNING]    = {.imu_rate_hz = 200, .gps_period_ms = 1000, .sync_interval_ms = 5000,  .idle_us = 20000},
+    [MOTION_IMPACT]     = {.imu_rate_hz = 500, .gps_period_ms = 1000, .sync_interval_ms = 2000,  .idle_us = 5000},
+};
+
+static const char *state_names[MOTION_STATE_COUNT] = {
+    "stationary", "walking", "running", "impact"
+};
+
+void motion_scheduler_init(Motion_Scheduler *scheduler, uint64_t now_us, uint16_t gps_period_ms,
+                           uint16_t min_imu_rate_hz) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    for (int state = 0; state < MOTION_STATE_COUNT; state++) {
+        scheduler->profiles[state] = motion_profiles[state];
+        if (state >= MOTION_RUNNING || motion_profiles[state].gps_period_ms < gps_period_ms) {
+            scheduler->profiles[state].gps_period_ms = gps_period_ms;
+        }
+        if (motion_profiles[state].imu_rate_hz < min_imu_rate_hz) {
+            scheduler->profiles[state].imu_rate_hz = min_imu_rate_hz;
+        }
+    }
+    scheduler->state = MOTION_RUNNING; //start at full fidelity until the first windows are in
+    scheduler->window_state = MOTION_RUNNING;
+    scheduler->window_start_us = now_us;
+    scheduler->last_update_us = now_us;
+    scheduler->stats[scheduler->state].entries = 1;
+}
+
+void motion_scheduler_update(Motion_Scheduler *scheduler, uint64_t now_us) {
+    if (now_us > scheduler->last_update_us) {
+        scheduler->stats[scheduler->state].time_us += now_us - scheduler->last_update_us;
+        scheduler->last_update_us = now_us;
+    }
+}
+
+static bool set_state(Motion_Scheduler *scheduler, Motion_State state, uint64_t time_us) {
+    scheduler->calm_windows = 0;
+    if (state == scheduler->state) {
+        return false;
+    }
+
+    motion_scheduler_update(scheduler, time_us);
+    scheduler->state = state;
+    scheduler->stats[state].entries++;
+    return true;
+}
+
+static Motion_State classify_window(const Motion_Scheduler *scheduler) {
+    uint64_t mean = scheduler->window_samples ? scheduler->window_deviation / scheduler->window_samples : 0;
+
+    if (mean < MOTION_WALKING_COUNTS) {
+        return MOTION_STATIONARY;
+    }
+    if (mean < MOTION_RUNNING_COUNTS) {
+        return MOTION_WALKING;
+    }
+    return MOTION_RUNNING;
+}
+
+//offset-corrected accelerometer counts, returns true when the state (and so the profile) changed
+bool motion_scheduler_add_imu(Motion_Scheduler *scheduler, uint64_t time_us, int32_t ax, int32_t ay, int32_t az) {
+    int64_t magnitude_sq = (int64_t)ax * ax + (int64_t)ay * ay + (int64_t)az * az;
+    int64_t deviation = (magnitude_sq - (int64_t)MPU6050_ACCEL_1G * MPU6050_ACCEL_1G) / (2 * MPU6050_ACCEL_1G);
+
+    scheduler->window_deviation += deviation < 0 ? -deviation : deviation;
+    scheduler->window_samples++;
+    scheduler->stats[scheduler->state].imu_samples++;
+
+    if (magnitude_sq >= (int64_t)MOTION_IMPACT_COUNTS * MOTION_IMPACT_COUNTS) {
+        scheduler->impact_time_us = time_us;
+        if (scheduler->state != MOTION_IMPACT) {
+            return set_state(scheduler, MOTION_IMPACT, time_us);
+        }
+    }
+
+    if (time_us - scheduler->window_start_us < MOTION_WINDOW_US) {
+        return false;
+    }
+
+    Motion_State target = classify_window(scheduler);
+    scheduler->window_state = target;
+    scheduler->window_start_us = time_us;
+    scheduler->window_deviation = 0;
+    scheduler->window_samples = 0;
+
+    if (scheduler->state == MOTION_IMPACT) {
+        if (time_us - scheduler->impact_time_us < MOTION_IMPACT_HOLD_US) {
+            return false;
+        }
+        return set_state(scheduler, target, time_us);
+    }
+
+    if (target > scheduler->state) {
+        return set_state(scheduler, target, time_us);
+    }
+    if (target < scheduler->state) {
+        if (++scheduler->calm_windows >= MOTION_SETTLE_WINDOWS) {
+            return set_state(scheduler, target, time_us);
+        }
+        return false;
+    }
+
+    scheduler->calm_windows = 0;
+    return false;
+}
+
+void motion_scheduler_add_fix(Motion_Scheduler *scheduler) {
+    scheduler->stats[scheduler->state].fixes++;
+}
+
+void motion_scheduler_add_idle(Motion_Scheduler *scheduler, uint64_t idle_us) {
+    scheduler->stats[scheduler->state].idle_us += idle_us;
+}
+
+const Motion_Profile *motion_scheduler_profile(const Motion_Scheduler *scheduler) {
+    return &scheduler->profiles[scheduler->state];
+}
+
+static int format_row(char *buf, size_t size, const char *name, const Motion_State_Stats *s) {
+    //estimated core 0 duty cycle: the share of the time it was not asleep
+    uint32_t duty_permille = s->time_us ? (uint32_t)((s->time_us - s->idle_us) * 1000 / s->time_us) : 0;
+
+    return snprintf(buf, size, "%s,%" PRIu64 ",%" PRIu32 ".%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n",
+                    name, s->time_us / 1000000, duty_permille / 10, duty_permille % 10,
+                    s->imu_samples, s->fixes, s->entries);
+}
+
+//per-state report with a total row, returns the length like snprintf
+int motion_scheduler_format(const Motion_State_Stats *stats, char *buf, size_t size) {
+    Motion_State_Stats total;
+    memset(&total, 0, sizeof(total));
+
+    int len = snprintf(buf, size, "State,Time_s,Duty_pct,IMU_Samples,Fixes,Entries\n");
+    for (int i = 0; i < MOTION_STATE_COUNT && len < (int)size; i++) {
+        len += format_row(buf + len, size - len, state_names[i], &stats[i]);
+        total.time_us += stats[i].time_us;
+        total.idle_us += stats[i].idle_us;
+        total.imu_samples += stats[i].imu_samples;
+        total.fixes += stats[i].fixes;
+        total.entries += stats[i].entries;
+    }
+    if (len < (int)size) {
+        len += format_row(buf + len, size - len, "total", &total);
+    }
+    return len;
+}
@@ -0,0 +1,80 @@
+/*
+File: motion_scheduler.h
+Author: Leonardo DaGraca
+
+Classifies the wearer's motion from the accelerometer and picks the sampling
+profile for it: IMU rate, GPS solution rate, SD sync interval and how long
+core 0 may sleep between loop passes. Also keeps the time, sleep time and
+sample counts spent in each state so the duty cycle can be reported.
+*/
+#ifndef MOTION_SCHEDULER_H
+#define MOTION_SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mpu6050_scale.h"
+
+#define MOTION_WINDOW_US 1000000        //accelerometer window classified at a time
+#define MOTION_SETTLE_WINDOWS 5         //calmer windows in a row before stepping down a state
+#define MOTION_IMPACT_HOLD_US 3000000   //time kept in the impact state after the last impact
+
+//mean deviation of |a| from 1g per window, in MPU6050 counts
+#define MOTION_WALKING_COUNTS (MPU6050_ACCEL_1G * 3 / 100)
+#define MOTION_RUNNING_COUNTS (MPU6050_ACCEL_1G * 35 / 100)
+//peak |a| for an impact (3.5g), above the ~3g of a hard landing in a run
+#define MOTION_IMPACT_COUNTS (7 * MPU6050_ACCEL_1G / 2)
+
+typedef enum {
+    MOTION_STATIONARY = 0,
+    MOTION_WALKING,
+    MOTION_RUNNING,
+    MOTION_IMPACT,
+    MOTION_STATE_COUNT
+} Motion_State;
+
+typedef struct {
+    uint16_t imu_rate_hz;
+    uint16_t gps_period_ms;
+    uint32_t sync_interval_ms;
+    uint32_t idle_us;           //longest sleep between loop passes
+} Motion_Profile;
+
+typedef struct {
+    uint64_t time_us;           //time spent in the state
+    uint64_t idle_us;           //part of it core 0 was asleep
+    uint32_t imu_samples;
+    uint32_t fixes;
+    uint32_t entries;
+} Motion_State_Stats;
+
+typedef struct {
+    Motion_State state;
+    Motion_State window_state;  //class of the last complete window
+    uint32_t calm_windows;      //windows in a row classified below the current state
+    uint64_t impact_time_us;
+
+    uint64_t window_start_us;
+    uint64_t window_deviation;
+    uint32_t window_samples;
+    uint64_t window_peak_sq;
+
+    uint64_t last_update_us;
+    Motion_State_Stats stats[MOTION_STATE_COUNT];
+    Motion_Profile profiles[MOTION_STATE_COUNT];    //motion_profiles with the receiver's GPS period
+} Motion_Scheduler;
+
+extern const Motion_Profile motion_profiles[MOTION_STATE_COUNT];
+
+//gps_period_ms is the shortest navigation period the receiver was set to (1000 at its default),
+//no profile samples the IMU slower than min_imu_rate_hz
+void motion_scheduler_init(Motion_Scheduler *scheduler, uint64_t now_us, uint16_t gps_period_ms,
+                           uint16_t min_imu_rate_hz);
+bool motion_scheduler_add_imu(Motion_Scheduler *scheduler, uint64_t time_us, int32_t ax, int32_t ay, int32_t az);
+void motion_scheduler_add_fix(Motion_Scheduler *scheduler);
+void motion_scheduler_add_idle(Motion_Scheduler *scheduler, uint64_t idle_us);
+void motion_scheduler_update(Motion_Scheduler *scheduler, uint64_t now_us);
+const Motion_Profile *motion_scheduler_profile(const Motion_Scheduler *scheduler);
+int motion_scheduler_format(const Motion_State_Stats *stats, char *buf, size_t size);
+
+#endif
@@ -2,11 +2,13 @@
 #define MPU6050_H
 
 #include <stdint.h>
-#include "hardware/i2c.h"
+#include "hal.h"
 #include "ff.h"
+#include "sd_writer.h"
+#include "mpu6050_scale.h"
 
 //I2C pins for Raspberry Pi Pico
-#define I2C_PORT i2c0
+#define I2C_PORT 0
 #define SDA_PIN 0
 #define SCL_PIN 1
 
@@ -14,25 +16,74 @@
 #define MPU6050_ADDR 0x68
 
 //MPU6050 registers
-#define MPU6050_REG_PWR_MGMT_1 0x6B
+#define MPU6050_REG_SMPLRT_DIV 0x19
+#define MPU6050_REG_CONFIG 0x1A
+#define MPU6050_REG_GYRO_CONFIG 0x1B
+#define MPU6050_REG_ACCEL_CONFIG 0x1C
+#define MPU6050_REG_FIFO_EN 0x23
+#define MPU6050_REG_INT_ENABLE 0x38
+#define MPU6050_REG_INT_STATUS 0x3A
 #define MPU6050_REG_ACCEL_XOUT_H 0x3B
 #define MPU6050_REG_GYRO_XOUT_H 0x43
+#define MPU6050_REG_USER_CTRL 0x6A
+#define MPU6050_REG_PWR_MGMT_1 0x6B
+#define MPU6050_REG_FIFO_COUNTH 0x72
+#define MPU6050_REG_FIFO_R_W 0x74
+
+//register bits
+#define MPU6050_FIFO_EN_ACCEL_GYRO 0x78     //XG, YG, ZG and ACCEL into the FIFO
+#define MPU6050_USER_CTRL_FIFO_EN 0x40
+#define MPU6050_USER_CTRL_FIFO_RESET 0x04
+#define MPU6050_INT_FIFO_OFLOW 0x10
+
+//sample rate = 1kHz / (1 + SMPLRT_DIV) with the DLPF enabled
+//MPU6050_SAMPLE_RATE_HZ is the rate set by mpu6050_init(), mpu6050_set_sample_rate() changes it
+#define MPU6050_SAMPLE_RATE_HZ 200
+#define MPU6050_SAMPLE_PERIOD_US (1000000 / MPU6050_SAMPLE_RATE_HZ)
+#define MPU6050_DLPF_CFG 3                  //44Hz accel / 42Hz gyro bandwidth
+#define MPU6050_FIFO_SIZE 1024
+#define MPU6050_FIFO_SAMPLE_BYTES 12        //accel xyz + gyro xyz, big endian
+#define MPU6050_FIFO_BURST_SAMPLES 16       //samples read per FIFO burst transaction
+
 #define MAX_IMU_READINGS 5
 
+//offset-corrected counts, int16 like the sensor registers (see imu_ring.h for the full-rate buffer)
 typedef struct {
-    int ax, ay, az, gx, gy, gz;
+    int16_t ax, ay, az, gx, gy, gz;
 } IMU_Reading;
 
+//one IMU reading with the time it was sampled, used by the full-rate logging mode
+typedef struct {
+    uint64_t timestamp_us;
+    IMU_Reading read;
+} IMU_Sample;
+
+typedef struct {
+    uint32_t i2c_transfers;     //hal_i2c_write / hal_i2c_read calls
+    uint32_t samples;           //samples read from the FIFO
+    uint32_t fifo_overflows;    //FIFO overflowed and was reset, samples were lost
+    uint32_t fifo_discarded;    //samples still in the FIFO when a rate change reset it
+} MPU6050_Stats;
+
 extern IMU_Reading imu_buffer[MAX_IMU_READINGS];
 extern int imu_buffer_index;
+extern MPU6050_Stats mpu6050_stats;
+extern uint32_t mpu6050_sample_period_us;
 
 void mpu6050_init();
 int16_t read_raw_data(uint8_t reg);
-void calibrate_mpu6050();
+void mpu6050_read_burst(int16_t raw[7]);
+void mpu6050_fifo_reset();
+void mpu6050_set_sample_rate(uint32_t rate_hz);
+int mpu6050_read_fifo(IMU_Sample *dst, int max_samples);
+//raw counts subtracted from every reading from now on
+void mpu6050_set_offsets(const int16_t accel[3], const int16_t gyro[3]);
 void read_sensor_data_corrected(int16_t *accel_x, int16_t *accel_y, int16_t *accel_z,
                                 int16_t *gyro_x, int16_t *gyro_y, int16_t *gyro_z);
 IMU_Reading read_imu();
-void process_imu_buffer();
-void write_imu_buffer(FIL *file, uint64_t curr_time);
+int process_imu_buffer(IMU_Sample *samples, int max_samples);
+void copy_imu_buffer(IMU_Reading *dst);
+void write_imu_buffer(SD_Writer *writer, uint64_t curr_time, const IMU_Reading *readings);
+void write_imu_sample(SD_Writer *writer, const IMU_Sample *sample);
 
 #endif
\ No newline at end of file
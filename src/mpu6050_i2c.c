@@ -7,99 +7,150 @@ Implementation of IMU functions
 #include <stdio.h>
 #include <string.h>
 #include "mpu6050.h"
-#include "pico/stdlib.h"
-#include "hardware/i2c.h"
+#include "log_binary.h"
+#include "profile.h"
 #include <inttypes.h>
 
 IMU_Reading imu_buffer[MAX_IMU_READINGS];
 int imu_buffer_index = 0;
+MPU6050_Stats mpu6050_stats = {0};
+uint32_t mpu6050_sample_period_us = MPU6050_SAMPLE_PERIOD_US;
+//the FIFO was empty at the last read, no sample can be in it before this time
+static uint64_t fifo_next_sample_us = 0;
 
-void mpu6050_init() {
-    uint8_t buf[2];
+static void write_register(uint8_t reg, uint8_t value) {
+    uint8_t buf[2] = {reg, value};
+    hal_i2c_write(I2C_PORT, MPU6050_ADDR, buf, 2, false);
+    mpu6050_stats.i2c_transfers++;
+}
 
+//read len consecutive registers (or len bytes of FIFO_R_W) in one transaction
+static void read_registers(uint8_t reg, uint8_t *buf, size_t len) {
+    hal_i2c_write(I2C_PORT, MPU6050_ADDR, &reg, 1, true);
+    hal_i2c_read(I2C_PORT, MPU6050_ADDR, buf, len, false);
+    mpu6050_stats.i2c_transfers += 2;
+}
+
+void mpu6050_init() {
     //Wake up the MPU6050
-    buf[0] = MPU6050_REG_PWR_MGMT_1;
-    buf[1] = 0x00;
-    i2c_write_blocking(I2C_PORT, MPU6050_ADDR, buf, 2, false);
+    write_register(MPU6050_REG_PWR_MGMT_1, 0x00);
+
+    //Set accelerometer sensitivity to +/- 8g (mpu6050_scale.h)
+    write_register(MPU6050_REG_ACCEL_CONFIG, MPU6050_ACCEL_FS_SEL << 3);
 
-    //Set accelerometer sensitivity to +/- 2g (default)
-    buf[0] = 0x1C;
-    buf[1] = 0x00;
-    i2c_write_blocking(I2C_PORT, MPU6050_ADDR, buf, 2, false);
+    //Set gyroscope sensitivity to +/- 1000°/s (mpu6050_scale.h)
+    write_register(MPU6050_REG_GYRO_CONFIG, MPU6050_GYRO_FS_SEL << 3);
 
-    //Set gyroscope sensitivity to +/- 250°/s (default)
-    buf[0] = 0x1B;
-    buf[1] = 0x00;
-    i2c_write_blocking(I2C_PORT, MPU6050_ADDR, buf, 2, false);
+    //Digital low pass filter and sample rate
+    write_register(MPU6050_REG_CONFIG, MPU6050_DLPF_CFG);
+    write_register(MPU6050_REG_SMPLRT_DIV, 1000 / MPU6050_SAMPLE_RATE_HZ - 1);
+    mpu6050_sample_period_us = MPU6050_SAMPLE_PERIOD_US;
+
+    //Let the sensor queue accel and gyro samples in its FIFO
+    write_register(MPU6050_REG_FIFO_EN, MPU6050_FIFO_EN_ACCEL_GYRO);
+    write_register(MPU6050_REG_INT_ENABLE, MPU6050_INT_FIFO_OFLOW);
+    mpu6050_fifo_reset();
 }
 
 //function to read raw data from a register
 int16_t read_raw_data(uint8_t reg) {
     uint8_t buf[2];
 
-    i2c_write_blocking(I2C_PORT, MPU6050_ADDR, &reg, 1, true);
-    i2c_read_blocking(I2C_PORT, MPU6050_ADDR, buf, 2, false);
+    read_registers(reg, buf, 2);
 
     //Combine high and low bytes
     return (int16_t)(buf[0] << 8 | buf[1]);
 }
 
-//offsets
-int16_t accel_x_offset = 0, accel_y_offset = 0, accel_z_offset = 0;
-int16_t gyro_x_offset = 0, gyro_y_offset = 0, gyro_z_offset = 0;
+//read accel xyz, temperature and gyro xyz in a single 14 byte transaction
+void mpu6050_read_burst(int16_t raw[7]) {
+    uint8_t buf[14];
 
-//calibrating IMU offsets using 2000 samples
-void calibrate_mpu6050() {
-    int32_t accel_x_sum = 0, accel_y_sum = 0, accel_z_sum = 0;
-    int32_t gyro_x_sum = 0, gyro_y_sum = 0, gyro_z_sum = 0;
-    int num_samples = 2000;
+    read_registers(MPU6050_REG_ACCEL_XOUT_H, buf, sizeof(buf));
 
-    printf("Calibrating MPU6050. Please keep the device stationary...\n");
+    for (int i = 0; i < 7; i++) {
+        raw[i] = (int16_t)(buf[2 * i] << 8 | buf[2 * i + 1]);
+    }
+}
 
-    for (int i = 0; i < num_samples; i++) {
-        //Read raw accelerometer data
-        int16_t accel_x = read_raw_data(MPU6050_REG_ACCEL_XOUT_H);
-        int16_t accel_y = read_raw_data(MPU6050_REG_ACCEL_XOUT_H + 2);
-        int16_t accel_z = read_raw_data(MPU6050_REG_ACCEL_XOUT_H + 4);
+void mpu6050_fifo_reset() {
+    write_register(MPU6050_REG_USER_CTRL, MPU6050_USER_CTRL_FIFO_RESET);
+    write_register(MPU6050_REG_USER_CTRL, MPU6050_USER_CTRL_FIFO_EN);
+    fifo_next_sample_us = 0;
+}
 
-        //Read raw gyroscope data
-        int16_t gyro_x = read_raw_data(MPU6050_REG_GYRO_XOUT_H);
-        int16_t gyro_y = read_raw_data(MPU6050_REG_GYRO_XOUT_H + 2);
-        int16_t gyro_z = read_raw_data(MPU6050_REG_GYRO_XOUT_H + 4);
+//change the sample rate (1000Hz divided by a whole number)
+//the FIFO is reset so it never mixes samples of the two rates: call it right after a FIFO read that emptied
+//it, the samples still in it are discarded and counted in mpu6050_stats.fifo_discarded
+void mpu6050_set_sample_rate(uint32_t rate_hz) {
+    uint32_t divider = 1000 / rate_hz;
+    if (divider < 1) {
+        divider = 1;
+    }
+    if (divider > 256) {
+        divider = 256;
+    }
 
-        accel_x_sum += accel_x;
-        accel_y_sum += accel_y;
-        accel_z_sum += accel_z;
-        gyro_x_sum += gyro_x;
-        gyro_y_sum += gyro_y;
-        gyro_z_sum += gyro_z;
+    uint8_t count_buf[2];
+    read_registers(MPU6050_REG_FIFO_COUNTH, count_buf, 2);
+    mpu6050_stats.fifo_discarded += (count_buf[0] << 8 | count_buf[1]) / MPU6050_FIFO_SAMPLE_BYTES;
 
-        sleep_ms(2); //delay for stability
+    write_register(MPU6050_REG_SMPLRT_DIV, (uint8_t)(divider - 1));
+    mpu6050_sample_period_us = divider * 1000;
+    mpu6050_fifo_reset();
+}
+
+//offsets subtracted from every reading, set by the online calibration (imu_calibration.h)
+static int16_t accel_x_offset = 0, accel_y_offset = 0, accel_z_offset = 0;
+static int16_t gyro_x_offset = 0, gyro_y_offset = 0, gyro_z_offset = 0;
+
+void mpu6050_set_offsets(const int16_t accel[3], const int16_t gyro[3]) {
+    accel_x_offset = accel[0];
+    accel_y_offset = accel[1];
+    accel_z_offset = accel[2];
+    gyro_x_offset = gyro[0];
+    gyro_y_offset = gyro[1];
+    gyro_z_offset = gyro[2];
+}
+
+//big endian register value minus its offset, clipped like the sensor clips at full scale
+static int16_t corrected_value(const uint8_t *value, int16_t offset) {
+    int32_t corrected = (int16_t)(value[0] << 8 | value[1]) - offset;
+    if (corrected > INT16_MAX) {
+        return INT16_MAX;
     }
+    if (corrected < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)corrected;
+}
 
-    //Calculate offsets
-    accel_x_offset = accel_x_sum / num_samples;
-    accel_y_offset = accel_y_sum / num_samples;
-    accel_z_offset = (accel_z_sum / num_samples) - 16384; //Adjust for gravity
-    gyro_x_offset = gyro_x_sum / num_samples;
-    gyro_y_offset = gyro_y_sum / num_samples;
-    gyro_z_offset = gyro_z_sum / num_samples;
+static IMU_Reading corrected_reading(const uint8_t *sample) {
+    IMU_Reading read;
 
-    printf("Calibration complete:\n");
-    printf("Accel Offsets: X: %d, Y: %d, Z: %d\n", accel_x_offset, accel_y_offset, accel_z_offset);
-    printf("Gyro Offsets: X: %d, Y: %d, Z: %d\n", gyro_x_offset, gyro_y_offset, gyro_z_offset);
+    read.ax = corrected_value(sample, accel_x_offset);
+    read.ay = corrected_value(sample + 2, accel_y_offset);
+    read.az = corrected_value(sample + 4, accel_z_offset);
+    read.gx = corrected_value(sample + 6, gyro_x_offset);
+    read.gy = corrected_value(sample + 8, gyro_y_offset);
+    read.gz = corrected_value(sample + 10, gyro_z_offset);
+
+    return read;
 }
 
 //process the current IMU data and correct it using the offset values
 void read_sensor_data_corrected(int16_t *accel_x, int16_t *accel_y, int16_t *accel_z,
                                 int16_t *gyro_x, int16_t *gyro_y, int16_t *gyro_z) {
-    *accel_x = read_raw_data(MPU6050_REG_ACCEL_XOUT_H) - accel_x_offset;
-    *accel_y = read_raw_data(MPU6050_REG_ACCEL_XOUT_H + 2) - accel_y_offset;
-    *accel_z = read_raw_data(MPU6050_REG_ACCEL_XOUT_H + 4) - accel_z_offset;
+    int16_t raw[7];
+    mpu6050_read_burst(raw);
+
+    *accel_x = raw[0] - accel_x_offset;
+    *accel_y = raw[1] - accel_y_offset;
+    *accel_z = raw[2] - accel_z_offset;
 
-    *gyro_x = read_raw_data(MPU6050_REG_GYRO_XOUT_H) - gyro_x_offset;
-    *gyro_y = read_raw_data(MPU6050_REG_GYRO_XOUT_H + 2) - gyro_y_offset;
-    *gyro_z = read_raw_data(MPU6050_REG_GYRO_XOUT_H + 4) - gyro_z_offset;
+    *gyro_x = raw[4] - gyro_x_offset;
+    *gyro_y = raw[5] - gyro_y_offset;
+    *gyro_z = raw[6] - gyro_z_offset;
 }
 
 IMU_Reading read_imu() {
@@ -118,18 +169,101 @@ IMU_Reading read_imu() {
     return read;
 }
 
-void process_imu_buffer() {
-    IMU_Reading read = read_imu();
-    imu_buffer[imu_buffer_index] = read;
-    imu_buffer_index = (imu_buffer_index + 1) % MAX_IMU_READINGS; 
+//read up to max_samples offset-corrected samples from the FIFO, returns how many were read
+//samples are timestamped by counting back one sample period from the newest one in the FIFO
+int mpu6050_read_fifo(IMU_Sample *dst, int max_samples) {
+    //a loop polling faster than the sample rate would spend four transactions per empty poll
+    if (hal_time_us() < fifo_next_sample_us) {
+        return 0;
+    }
+
+    uint8_t status;
+    read_registers(MPU6050_REG_INT_STATUS, &status, 1);
+    if (status & MPU6050_INT_FIFO_OFLOW) {
+        //the FIFO wrapped, its contents are no longer sample aligned
+        mpu6050_stats.fifo_overflows++;
+        mpu6050_fifo_reset();
+        return 0;
+    }
+
+    uint8_t count_buf[2];
+    read_registers(MPU6050_REG_FIFO_COUNTH, count_buf, 2);
+    uint64_t now = hal_time_us();
+    int available = (count_buf[0] << 8 | count_buf[1]) / MPU6050_FIFO_SAMPLE_BYTES;
+    int total = available < max_samples ? available : max_samples;
+
+    int read_count = 0;
+    uint8_t burst[MPU6050_FIFO_BURST_SAMPLES * MPU6050_FIFO_SAMPLE_BYTES];
+
+    while (read_count < total) {
+        int chunk = total - read_count;
+        if (chunk > MPU6050_FIFO_BURST_SAMPLES) {
+            chunk = MPU6050_FIFO_BURST_SAMPLES;
+        }
+
+        read_registers(MPU6050_REG_FIFO_R_W, burst, chunk * MPU6050_FIFO_SAMPLE_BYTES);
+        for (int i = 0; i < chunk; i++) {
+            dst[read_count].timestamp_us = now - (uint64_t)(available - 1 - read_count) * mpu6050_sample_period_us;
+            dst[read_count].read = corrected_reading(burst + i * MPU6050_FIFO_SAMPLE_BYTES);
+            read_count++;
+        }
+    }
+
+    //once drained, the next sample comes at most one period after this read
+    fifo_next_sample_us = read_count == available ? now + mpu6050_sample_period_us : 0;
+    mpu6050_stats.samples += read_count;
+    return read_count;
+}
+
+//drain up to max_samples from the FIFO into the circular buffer
+//the samples are also copied to samples (if not NULL) for full-rate logging
+int process_imu_buffer(IMU_Sample *samples, int max_samples) {
+    IMU_Sample reads[MPU6050_FIFO_BURST_SAMPLES];
+    int total = 0;
+    int count;
+
+    do {
+        int want = max_samples - total;
+        if (want > MPU6050_FIFO_BURST_SAMPLES) {
+            want = MPU6050_FIFO_BURST_SAMPLES;
+        }
+
+        count = mpu6050_read_fifo(reads, want);
+        for (int i = 0; i < count; i++) {
+            imu_buffer[imu_buffer_index] = reads[i].read;
+            if (++imu_buffer_index == MAX_IMU_READINGS) {
+                imu_buffer_index = 0;
+            }
+            if (samples) {
+                samples[total] = reads[i];
+            }
+            total++;
+        }
+    } while (count == MPU6050_FIFO_BURST_SAMPLES && total < max_samples);
+
+    return total;
 }
 
-void write_imu_buffer(FIL *file, uint64_t curr_time) {
+//copy the circular buffer into dst, oldest reading first
+void copy_imu_buffer(IMU_Reading *dst) {
+    for (int i = 0; i < MAX_IMU_READINGS; i++) {
+        dst[i] = imu_buffer[(imu_buffer_index + i) % MAX_IMU_READINGS];
+    }
+}
+
+//readings holds MAX_IMU_READINGS entries, oldest first (see copy_imu_buffer)
+void write_imu_buffer(SD_Writer *writer, uint64_t curr_time, const IMU_Reading *readings) {
+#ifdef LOG_FORMAT_BINARY
+    FRESULT fr = log_binary_write_imu(writer, curr_time, readings);
+    if (fr != FR_OK) {
+        printf("Error writing IMU data to the file: %d\n", fr);
+    }
+#else
+    PROFILE_START(timer);
     char time_stamp_imu[500];
     int line_offset = snprintf(time_stamp_imu, sizeof(time_stamp_imu), "%" PRIu64 ",IMU: ", curr_time);
 
     for (int i = 0; i < MAX_IMU_READINGS; i++) {
-        int index = (imu_buffer_index + i) % MAX_IMU_READINGS; //adjust index for circular buffer
         //add semicolon after each reading
         if (i > 0) {
             line_offset += snprintf(time_stamp_imu + line_offset,
@@ -139,18 +273,37 @@ void write_imu_buffer(FIL *file, uint64_t curr_time) {
         line_offset += snprintf(time_stamp_imu + line_offset, 
                                 sizeof(time_stamp_imu) - line_offset, 
                                 "%d,%d,%d,%d,%d,%d", 
-                                imu_buffer[index].ax, imu_buffer[index].ay, imu_buffer[index].az, 
-                                imu_buffer[index].gx, imu_buffer[index].gy, imu_buffer[index].gz);
+                                readings[i].ax, readings[i].ay, readings[i].az, 
+                                readings[i].gx, readings[i].gy, readings[i].gz);
     }
 
     //add newline
     line_offset += snprintf(time_stamp_imu + line_offset, 
                             sizeof(time_stamp_imu) - line_offset, 
                             "\n");
-    UINT bytes_written;
-    FRESULT fr = f_write(file, time_stamp_imu, strlen(time_stamp_imu), &bytes_written);
+    PROFILE_STOP(PROFILE_FORMAT, timer);
+    FRESULT fr = sd_writer_write(writer, time_stamp_imu, strlen(time_stamp_imu));
     if (fr != FR_OK) {
         printf("Error writing IMU data to the file: %d\n", fr);
         return;
     }
+#endif
+}
+
+//full-rate mode: one row (or binary record) per sample with its own timestamp
+void write_imu_sample(SD_Writer *writer, const IMU_Sample *sample) {
+#ifdef LOG_FORMAT_BINARY
+    FRESULT fr = log_binary_write_imu_sample(writer, sample);
+#else
+    PROFILE_START(timer);
+    char row[80];
+    int len = snprintf(row, sizeof(row), "%" PRIu64 ",%d,%d,%d,%d,%d,%d\n", sample->timestamp_us,
+                       sample->read.ax, sample->read.ay, sample->read.az,
+                       sample->read.gx, sample->read.gy, sample->read.gz);
+    PROFILE_STOP(PROFILE_FORMAT, timer);
+    FRESULT fr = sd_writer_write(writer, row, len);
+#endif
+    if (fr != FR_OK) {
+        printf("Error writing IMU sample to the file: %d\n", fr);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,23 @@
+/*
+File: mpu6050_scale.h
+Author: Leonardo DaGraca
+
+Full scale ranges set by mpu6050_init() and the counts they give. Kept apart
+from mpu6050.h so the modules that work in raw counts (motion scheduler,
+event capture, attitude filter, calibration, track metrics) and their host
+tests take the scale from one place without pulling in the driver.
+*/
+#ifndef MPU6050_SCALE_H
+#define MPU6050_SCALE_H
+
+//AFS_SEL 2, +-8g: an impact or a fall along one axis no longer clips at 2g
+#define MPU6050_ACCEL_FS_SEL 2
+//FS_SEL 2, +-1000 deg/s: a tumbling fall turns well past 250 deg/s
+#define MPU6050_GYRO_FS_SEL 2
+
+//counts per g, 16384 at +-2g and half as many for each wider range
+#define MPU6050_ACCEL_1G (16384 >> MPU6050_ACCEL_FS_SEL)
+//counts per 1000 deg/s, 131 per deg/s at +-250 deg/s is no longer a whole number at the wider ranges
+#define MPU6050_GYRO_COUNTS_PER_KDPS (131000 >> MPU6050_GYRO_FS_SEL)
+
+#endif
@@ -0,0 +1,424 @@
+/*
+File: mpu6050_test.c
+Author: Leonardo DaGraca
+
+Host check of the MPU6050 driver (mpu6050_i2c.c) against a mock of the
+sensor's register map on a simulated I2C bus.
+
+The test supplies hal_i2c_write / hal_i2c_read and the clock. The mock keeps
+the registers the driver uses, produces a sample every 1ms * (1 + SMPLRT_DIV)
+and queues it in a 1KB FIFO while FIFO_EN and USER_CTRL allow it, sets the
+overflow bit of INT_STATUS when the FIFO wraps, and serves ACCEL_XOUT_H..
+GYRO_ZOUT_L, INT_STATUS, FIFO_COUNT and FIFO_R_W reads. Every transaction
+moves the clock by its time on a 400kHz bus (9 bits per byte plus the
+address byte, start and stop), so the driver's timestamps and the samples it
+can keep up with come out as on the board.
+
+It reads the same sensor three ways and prints the I2C transactions, bus
+bytes and bus time per sample and the highest sample rate the bus could
+carry: one read_raw_data() per axis as the driver started out, one 14 byte
+burst per sample, and the FIFO drained by process_imu_buffer() from a loop
+that spins without pause up to one that runs every 80ms. It fails if a FIFO
+sample is lost, repeated or wrong, if a timestamp is off by more than a
+sample period, if the driver's mpu6050_stats.i2c_transfers differs from the
+transactions the mock saw, or if the FIFO reads take more transactions per
+sample than the bounds below. Last it stalls the reader for a second so the
+FIFO overflows, and checks the overflow is counted and the samples after
+the reset are right again, and changes the rate behind a stalled reader to
+check the samples the FIFO reset throws away are counted, and that none are
+when the rate changes after a pass that emptied the FIFO as the main loop does.
+
+Usage: mpu6050_test [-s seconds]
+Build: cc -O2 -I. -Ihost -o mpu6050_test mpu6050_test.c mpu6050_i2c.c sd_writer.c journal.c log_index.c host/ff_host.c
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "mpu6050.h"
+#include "hal.h"
+
+#define BUS_HZ 400000
+#define READ_AXES 6                         //read_raw_data() calls per sample before the burst read
+//a FIFO drained 16 samples at a time needs status, count and one burst per block, plus the
+//status and count that find it empty: below one per sample, against 2 for the burst and 12 per register
+#define MAX_BLOCK_TRANSFERS_PER_SAMPLE 1.0
+//a loop spinning faster than the sample rate reads once per sample: status, count and one burst
+#define MAX_SPIN_TRANSFERS_PER_SAMPLE 6.0
+#define SPIN_LOOP_US 50                     //main loop iteration without I2C traffic
+
+static uint64_t now_ns = 0;
+
+//hal.h, as far as mpu6050_i2c.c uses it
+uint64_t hal_time_us() {
+    return now_ns / 1000;
+}
+
+typedef struct {
+    uint8_t regs[128];
+    uint8_t reg_ptr;
+    uint8_t fifo[MPU6050_FIFO_SIZE];
+    uint32_t fifo_head;
+    uint32_t fifo_count;
+    uint64_t next_sample_ns;
+    uint32_t sample_index;                  //samples produced since the start
+    uint32_t transactions;
+    uint64_t bus_bytes;
+    uint64_t bus_ns;
+} Mock_MPU6050;
+
+static Mock_MPU6050 mock;
+
+//sample n encodes its index so the reader can check order and content
+static void make_sample(uint32_t n, int16_t values[6]) {
+    values[0] = (int16_t)(n & 0x7FFF);
+    values[1] = (int16_t)(n >> 15);
+    values[2] = 16384;
+    values[3] = (int16_t)(n * 3);
+    values[4] = (int16_t)-(int32_t)(n % 1000);
+    values[5] = (int16_t)(n ^ 0x1234);
+}
+
+static uint64_t sample_period_ns() {
+    return 1000000ull * (1 + mock.regs[MPU6050_REG_SMPLRT_DIV]);
+}
+
+static void put_big_endian(uint8_t *dst, int16_t value) {
+    dst[0] = (uint8_t)((uint16_t)value >> 8);
+    dst[1] = (uint8_t)value;
+}
+
+//produce every sample due by now
+static void mock_advance() {
+    while (mock.next_sample_ns <= now_ns) {
+        int16_t values[6];
+        make_sample(mock.sample_index, values);
+        uint8_t *out = &mock.regs[MPU6050_REG_ACCEL_XOUT_H];
+        for (int i = 0; i < 3; i++) {
+            put_big_endian(out + 2 * i, values[i]);
+            put_big_endian(out + 8 + 2 * i, values[3 + i]);
+        }
+        put_big_endian(out + 6, 3000);      //temperature
+
+        bool fifo_on = (mock.regs[MPU6050_REG_USER_CTRL] & MPU6050_USER_CTRL_FIFO_EN) &&
+                       mock.regs[MPU6050_REG_FIFO_EN] == MPU6050_FIFO_EN_ACCEL_GYRO;
+        if (fifo_on) {
+            for (int i = 0; i < MPU6050_FIFO_SAMPLE_BYTES; i++) {
+                uint8_t byte = i < 6 ? out[i] : out[i + 2];
+                if (mock.fifo_count == MPU6050_FIFO_SIZE) {
+                    //the oldest byte is overwritten, the FIFO loses its sample alignment
+                    mock.regs[MPU6050_REG_INT_STATUS] |= MPU6050_INT_FIFO_OFLOW;
+                    mock.fifo_count--;
+                }
+                mock.fifo[(mock.fifo_head + mock.fifo_count) % MPU6050_FIFO_SIZE] = byte;
+                mock.fifo_count++;
+            }
+        }
+        mock.sample_index++;
+        mock.next_sample_ns += sample_period_ns();
+    }
+}
+
+//each transaction: start, address byte, data bytes, stop
+static void bus_transaction(size_t len) {
+    uint64_t bits = 9 * (1 + len) + 2;
+    uint64_t ns = bits * 1000000000ull / BUS_HZ;
+    mock.transactions++;
+    mock.bus_bytes += 1 + len;
+    mock.bus_ns += ns;
+    now_ns += ns;
+    mock_advance();
+}
+
+int hal_i2c_write(uint32_t index, uint8_t addr, const uint8_t *src, size_t len, bool nostop) {
+    bus_transaction(len);
+    if (addr != MPU6050_ADDR || len == 0) {
+        return -1;
+    }
+    mock.reg_ptr = src[0];
+    if (len == 2) {
+        uint8_t reg = src[0];
+        mock.regs[reg] = src[1];
+        if (reg == MPU6050_REG_USER_CTRL && (src[1] & MPU6050_USER_CTRL_FIFO_RESET)) {
+            mock.fifo_head = 0;
+            mock.fifo_count = 0;
+            mock.regs[reg] &= ~MPU6050_USER_CTRL_FIFO_RESET;
+        }
+    }
+    return (int)len;
+}
+
+int hal_i2c_read(uint32_t index, uint8_t addr, uint8_t *dst, size_t len, bool nostop) {
+    bus_transaction(len);
+    if (addr != MPU6050_ADDR) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        switch (mock.reg_ptr) {
+            case MPU6050_REG_FIFO_R_W:
+                //FIFO_R_W does not auto-increment
+                dst[i] = mock.fifo_count ? mock.fifo[mock.fifo_head] : 0xFF;
+                if (mock.fifo_count) {
+                    mock.fifo_head = (mock.fifo_head + 1) % MPU6050_FIFO_SIZE;
+                    mock.fifo_count--;
+                }
+                continue;
+            case MPU6050_REG_FIFO_COUNTH:
+                dst[i] = (uint8_t)(mock.fifo_count >> 8);
+                break;
+            case MPU6050_REG_FIFO_COUNTH + 1:
+                dst[i] = (uint8_t)mock.fifo_count;
+                break;
+            case MPU6050_REG_INT_STATUS:
+                //cleared by reading it
+                dst[i] = mock.regs[MPU6050_REG_INT_STATUS];
+                mock.regs[MPU6050_REG_INT_STATUS] = 0;
+                break;
+            default:
+                dst[i] = mock.regs[mock.reg_ptr];
+                break;
+        }
+        mock.reg_ptr++;
+    }
+    return (int)len;
+}
+
+static void mock_init() {
+    memset(&mock, 0, sizeof(mock));
+    now_ns = 0;
+    mpu6050_init();
+    //the first sample comes one period after the FIFO was reset
+    mock.sample_index = 0;
+    mock.next_sample_ns = now_ns + sample_period_ns();
+    memset(&mpu6050_stats, 0, sizeof(mpu6050_stats));
+    mock.transactions = 0;
+    mock.bus_bytes = 0;
+    mock.bus_ns = 0;
+}
+
+typedef struct {
+    uint32_t samples;
+    uint32_t lost;
+    uint32_t wrong;
+    uint32_t late;
+    uint32_t expected;       //index of the next sample
+    bool quiet;              //a gap is expected, do not print it
+} Checker;
+
+//the sample the mock produced at index n was due at (n + 1) periods after mock_init
+static void check_sample(Checker *check, const IMU_Sample *sample, uint64_t origin_ns) {
+    uint32_t n = (uint32_t)(uint16_t)sample->read.ax | (uint32_t)(uint16_t)sample->read.ay << 15;
+    int16_t values[6];
+    make_sample(n, values);
+    IMU_Reading expected = {values[0], values[1], values[2], values[3], values[4], values[5]};
+    if (memcmp(&sample->read, &expected, sizeof(expected)) != 0) {
+        if (check->wrong++ < 5) {
+            printf("  sample %" PRIu32 " has wrong values\n", n);
+        }
+        return;
+    }
+    if (n != check->expected) {
+        if (check->lost++ < 5 && !check->quiet) {
+            printf("  sample %" PRIu32 " where %" PRIu32 " was expected\n", n, check->expected);
+        }
+    }
+    int64_t due_us = (int64_t)((origin_ns + (uint64_t)(n + 1) * sample_period_ns()) / 1000);
+    int64_t error_us = (int64_t)sample->timestamp_us - due_us;
+    if (error_us < 0) {
+        error_us = -error_us;
+    }
+    if (error_us > (int64_t)(sample_period_ns() / 1000)) {
+        if (check->late++ < 5) {
+            printf("  sample %" PRIu32 " stamped %" PRId64 " us off\n", n, error_us);
+        }
+    }
+    check->expected = n + 1;
+    check->samples++;
+}
+
+static void print_cost(const char *name, uint32_t samples) {
+    double per_sample_ns = (double)mock.bus_ns / samples;
+    printf("  %-22s %6.2f transactions %6.1f bytes %7.1f us per sample, bus carries %6.0f Hz\n", name,
+           (double)mock.transactions / samples, (double)mock.bus_bytes / samples, per_sample_ns / 1000,
+           1e9 / per_sample_ns);
+}
+
+//the driver as it started: one write and one 2 byte read per axis
+static void run_registers(uint32_t samples) {
+    mock_init();
+    for (uint32_t i = 0; i < samples; i++) {
+        for (int axis = 0; axis < READ_AXES; axis++) {
+            uint8_t reg = axis < 3 ? MPU6050_REG_ACCEL_XOUT_H + 2 * axis : MPU6050_REG_GYRO_XOUT_H + 2 * (axis - 3);
+            read_raw_data(reg);
+        }
+    }
+    print_cost("per register", samples);
+}
+
+static void run_burst(uint32_t samples) {
+    mock_init();
+    for (uint32_t i = 0; i < samples; i++) {
+        int16_t raw[7];
+        mpu6050_read_burst(raw);
+    }
+    print_cost("14 byte burst", samples);
+}
+
+//drain the FIFO every loop_us like the main loop, returns false on a failed check
+static bool run_fifo(uint32_t rate_hz, uint32_t loop_us, uint32_t seconds, double max_transfers) {
+    mock_init();
+    if (rate_hz != MPU6050_SAMPLE_RATE_HZ) {
+        mpu6050_set_sample_rate(rate_hz);
+        mock.next_sample_ns = now_ns + sample_period_ns();
+        mock.sample_index = 0;
+        mock.transactions = 0;
+        mock.bus_bytes = 0;
+        mock.bus_ns = 0;
+        memset(&mpu6050_stats, 0, sizeof(mpu6050_stats));
+    }
+    uint64_t origin_ns = mock.next_sample_ns - sample_period_ns();
+
+    Checker check = {0};
+    uint64_t end_ns = now_ns + (uint64_t)seconds * 1000000000ull;
+    uint64_t next_loop_ns = now_ns;
+    while (now_ns < end_ns) {
+        if (now_ns < next_loop_ns) {
+            now_ns = next_loop_ns;
+            mock_advance();
+        }
+        next_loop_ns += (uint64_t)loop_us * 1000;
+        IMU_Sample samples[MPU6050_FIFO_BURST_SAMPLES * 4];
+        int count = process_imu_buffer(samples, MPU6050_FIFO_BURST_SAMPLES * 4);
+        for (int i = 0; i < count; i++) {
+            check_sample(&check, &samples[i], origin_ns);
+        }
+    }
+
+    char name[48];
+    snprintf(name, sizeof(name), "FIFO %4" PRIu32 " Hz, every %5.2f ms", rate_hz, loop_us / 1000.0);
+    print_cost(name, check.samples ? check.samples : 1);
+
+    uint32_t behind = mock.sample_index - check.expected;
+    bool ok = check.lost == 0 && check.wrong == 0 && check.late == 0 && mpu6050_stats.fifo_overflows == 0 &&
+              behind <= (uint32_t)(loop_us * 1000ull / sample_period_ns()) + 1;
+    if (mpu6050_stats.i2c_transfers != mock.transactions) {
+        printf("  FAIL: the driver counted %" PRIu32 " transfers, the bus saw %" PRIu32 "\n",
+               mpu6050_stats.i2c_transfers, mock.transactions);
+        ok = false;
+    }
+    if (max_transfers > 0 && (double)mock.transactions / check.samples > max_transfers) {
+        printf("  FAIL: more than %.2f transactions per sample\n", max_transfers);
+        ok = false;
+    }
+    if (!ok) {
+        printf("  FAIL: %" PRIu32 " read, %" PRIu32 " out of order, %" PRIu32 " wrong, %" PRIu32 " mistimed, %" PRIu32
+               " overflows, %" PRIu32 " left in the FIFO\n", check.samples, check.lost, check.wrong, check.late,
+               mpu6050_stats.fifo_overflows, behind);
+    }
+    return ok;
+}
+
+//the reader stops for a second, the FIFO overflows and is reset
+static bool run_overflow() {
+    mock_init();
+    uint64_t origin_ns = mock.next_sample_ns - sample_period_ns();
+    Checker check = {.quiet = true};
+    IMU_Sample samples[MPU6050_FIFO_BURST_SAMPLES * 4];
+
+    for (int phase = 0; phase < 3; phase++) {
+        uint64_t end_ns = now_ns + 500000000ull;
+        while (now_ns < end_ns) {
+            now_ns += 20000000ull;
+            mock_advance();
+            int count = process_imu_buffer(samples, MPU6050_FIFO_BURST_SAMPLES * 4);
+            for (int i = 0; i < count; i++) {
+                check_sample(&check, &samples[i], origin_ns);
+            }
+        }
+        if (phase == 0) {
+            now_ns += 1000000000ull;
+            mock_advance();
+        }
+    }
+
+    //the one gap is reported as out of order, everything else must be right
+    bool ok = mpu6050_stats.fifo_overflows == 1 && check.lost == 1 && check.wrong == 0 && check.late == 0;
+    printf("Stalled reader: %" PRIu32 " FIFO overflow, %" PRIu32 " samples read, %" PRIu32 " produced, %s\n",
+           mpu6050_stats.fifo_overflows, check.samples, mock.sample_index, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+//a motion state change behind a stalled reader: the rate is changed at once, then as the main loop does
+//after a pass that emptied the FIFO, and every sample produced before it must be read or counted as discarded
+static bool run_rate_change() {
+    bool ok = true;
+    uint32_t discarded[2];
+    for (int deferred = 0; deferred < 2; deferred++) {
+        mock_init();
+        mpu6050_set_sample_rate(200);
+        mock.next_sample_ns = now_ns + sample_period_ns();
+        mock.sample_index = 0;
+        memset(&mpu6050_stats, 0, sizeof(mpu6050_stats));
+        uint64_t origin_ns = mock.next_sample_ns - sample_period_ns();
+        Checker check = {0};
+        IMU_Sample samples[MPU6050_FIFO_BURST_SAMPLES];
+
+        //40 samples wait, each 50ms pass reads 16 of them and 10 more arrive
+        now_ns += 200000000ull;
+        mock_advance();
+        uint32_t produced = 0;
+        bool pending = true;
+        while (pending) {
+            int count = process_imu_buffer(samples, MPU6050_FIFO_BURST_SAMPLES);
+            for (int i = 0; i < count; i++) {
+                check_sample(&check, &samples[i], origin_ns);
+            }
+            if (!deferred || count < MPU6050_FIFO_BURST_SAMPLES) {
+                produced = mock.sample_index;
+                mpu6050_set_sample_rate(1000);
+                pending = false;
+            }
+            else {
+                now_ns += 50000000ull;
+                mock_advance();
+            }
+        }
+
+        //a sample may land while the count is read, it is discarded but not in produced
+        discarded[deferred] = mpu6050_stats.fifo_discarded;
+        uint32_t accounted = check.samples + discarded[deferred];
+        ok &= check.lost == 0 && check.wrong == 0 && check.late == 0 && accounted >= produced &&
+              accounted <= produced + 1;
+    }
+    ok &= discarded[0] > MPU6050_FIFO_BURST_SAMPLES && discarded[1] <= 1;
+    printf("Rate change behind a stalled reader: %" PRIu32 " samples discarded at once, %" PRIu32
+           " after a drained pass, %s\n", discarded[0], discarded[1], ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    uint32_t seconds = 10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seconds = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-s seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("I2C cost at %d kHz:\n", BUS_HZ / 1000);
+    run_registers(1000);
+    run_burst(1000);
+    bool ok = run_fifo(200, SPIN_LOOP_US, seconds, MAX_SPIN_TRANSFERS_PER_SAMPLE);
+    ok &= run_fifo(200, 5000, seconds, 0);
+    ok &= run_fifo(200, 20000, seconds, 0);
+    ok &= run_fifo(200, 80000, seconds, MAX_BLOCK_TRANSFERS_PER_SAMPLE);
+    ok &= run_fifo(1000, 16000, seconds, MAX_BLOCK_TRANSFERS_PER_SAMPLE);
+    ok &= run_overflow();
+    ok &= run_rate_change();
+
+    printf(ok ? "OK\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
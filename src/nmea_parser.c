@@ -0,0 +1,328 @@
+/*
+File: nmea_parser.c
+Author: Leonardo DaGraca
+
+Streaming NMEA 0183 parser.
+Bytes are fed one at a time (or as a span) into a small state machine that
+validates the *XX checksum and records where each comma separated field
+starts. Fields are decoded straight out of the sentence buffer without
+copying them, and RMC, VTG, GGA and GSA sentences are converted into typed
+structs using fixed-point integers so no floating point is needed on the Pico.
+*/
+#include <string.h>
+#include <stdint.h>
+#include "nmea_parser.h"
+
+//longest number a field may hold, (d)ddmm.mmmmm has 10, longer ones would overflow the scaled value
+#define MAX_SIGNIFICANT_DIGITS 12
+
+enum {
+    STATE_WAIT_START = 0,
+    STATE_BODY,
+    STATE_CHECKSUM_HI,
+    STATE_CHECKSUM_LO
+};
+
+typedef struct {
+    const char *ptr;
+    uint8_t len;
+} NMEA_Field;
+
+void nmea_parser_init(NMEA_Parser *parser) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = STATE_WAIT_START;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static NMEA_Field get_field(const NMEA_Parser *parser, int index) {
+    NMEA_Field field = {0};
+    if (index < parser->field_count) {
+        field.ptr = parser->buff + parser->field_start[index];
+        field.len = parser->field_start[index + 1] - parser->field_start[index] - 1;
+    }
+    return field;
+}
+
+//parse a decimal field into an integer scaled by 10^decimals, extra digits are truncated
+//fields with more than MAX_SIGNIFICANT_DIGITS digits or a result outside int32 are refused
+static bool parse_scaled(NMEA_Field field, int decimals, int64_t *out) {
+    int64_t value = 0;
+    int frac_digits = -1;
+    int significant = 0;
+    bool negative = false;
+    bool any_digit = false;
+
+    for (int i = 0; i < field.len; i++) {
+        char c = field.ptr[i];
+        if (c == '-' && i == 0) {
+            negative = true;
+        } else if (c == '.' && frac_digits < 0) {
+            frac_digits = 0;
+        } else if (c >= '0' && c <= '9') {
+            if (frac_digits >= decimals) {
+                continue;
+            }
+            if (value > 0 || c != '0') {
+                if (++significant > MAX_SIGNIFICANT_DIGITS) {
+                    return false;
+                }
+            }
+            value = value * 10 + (c - '0');
+            if (frac_digits >= 0) {
+                frac_digits++;
+            }
+            any_digit = true;
+        } else {
+            return false;
+        }
+    }
+
+    if (!any_digit) {
+        return false;
+    }
+    for (int i = frac_digits < 0 ? 0 : frac_digits; i < decimals; i++) {
+        value *= 10;
+    }
+    //every caller keeps the result in 32 bits
+    if (value > INT32_MAX) {
+        return false;
+    }
+
+    *out = negative ? -value : value;
+    return true;
+}
+
+static uint32_t parse_uint(NMEA_Field field) {
+    int64_t value;
+    return (parse_scaled(field, 0, &value) && value > 0) ? (uint32_t)value : 0;
+}
+
+//hhmmss.sss to milliseconds since midnight
+static uint32_t parse_time(NMEA_Field field) {
+    int64_t v;
+    if (!parse_scaled(field, 3, &v)) {
+        return 0;
+    }
+    uint32_t hours = (uint32_t)(v / 10000000);
+    uint32_t minutes = (uint32_t)(v / 100000 % 100);
+    uint32_t sec_ms = (uint32_t)(v % 100000);
+    return hours * 3600000 + minutes * 60000 + sec_ms;
+}
+
+//(d)ddmm.mmmmm plus hemisphere to 1e-7 degrees
+static int32_t parse_coordinate(NMEA_Field field, NMEA_Field hemisphere) {
+    int64_t v;
+    if (!parse_scaled(field, 5, &v)) {
+        return 0;
+    }
+    int64_t degrees = v / 10000000;
+    int64_t minutes_e5 = v % 10000000;
+    int64_t value = degrees * 10000000 + (minutes_e5 * 100 + 30) / 60;
+
+    if (hemisphere.len > 0 && (hemisphere.ptr[0] == 'S' || hemisphere.ptr[0] == 'W')) {
+        value = -value;
+    }
+    return (int32_t)value;
+}
+
+static uint32_t parse_knots(NMEA_Field field) {
+    int64_t milli_knots;
+    if (!parse_scaled(field, 3, &milli_knots) || milli_knots < 0) {
+        return 0;
+    }
+    return (uint32_t)((milli_knots * 1852 + 1800) / 3600);
+}
+
+static uint32_t parse_kmh(NMEA_Field field) {
+    int64_t milli_kmh;
+    if (!parse_scaled(field, 3, &milli_kmh) || milli_kmh < 0) {
+        return 0;
+    }
+    return (uint32_t)((milli_kmh * 10 + 18) / 36);
+}
+
+static uint16_t parse_centi(NMEA_Field field) {
+    int64_t value;
+    if (!parse_scaled(field, 2, &value) || value < 0) {
+        return 0;
+    }
+    return value > UINT16_MAX ? UINT16_MAX : (uint16_t)value;
+}
+
+static uint32_t parse_angle(NMEA_Field field) {
+    int64_t value;
+    return (parse_scaled(field, 2, &value) && value > 0) ? (uint32_t)value : 0;
+}
+
+static void decode_rmc(const NMEA_Parser *p, NMEA_RMC *rmc) {
+    NMEA_Field status = get_field(p, 2);
+    rmc->time_ms = parse_time(get_field(p, 1));
+    rmc->valid = status.len > 0 && status.ptr[0] == 'A';
+    rmc->lat_e7 = parse_coordinate(get_field(p, 3), get_field(p, 4));
+    rmc->lon_e7 = parse_coordinate(get_field(p, 5), get_field(p, 6));
+    rmc->speed_mm_s = parse_knots(get_field(p, 7));
+    rmc->course_cdeg = parse_angle(get_field(p, 8));
+    rmc->date = parse_uint(get_field(p, 9));
+}
+
+static void decode_vtg(const NMEA_Parser *p, NMEA_VTG *vtg) {
+    NMEA_Field mode = get_field(p, 9);
+    vtg->course_cdeg = parse_angle(get_field(p, 1));
+    vtg->speed_mm_s = parse_kmh(get_field(p, 7));
+    vtg->valid = mode.len == 0 || mode.ptr[0] != 'N';
+}
+
+static void decode_gga(const NMEA_Parser *p, NMEA_GGA *gga) {
+    int64_t altitude_mm;
+    gga->time_ms = parse_time(get_field(p, 1));
+    gga->lat_e7 = parse_coordinate(get_field(p, 2), get_field(p, 3));
+    gga->lon_e7 = parse_coordinate(get_field(p, 4), get_field(p, 5));
+    gga->fix_quality = (uint8_t)parse_uint(get_field(p, 6));
+    gga->satellites = (uint8_t)parse_uint(get_field(p, 7));
+    gga->hdop_centi = parse_centi(get_field(p, 8));
+    gga->altitude_mm = parse_scaled(get_field(p, 9), 3, &altitude_mm) ? (int32_t)altitude_mm : 0;
+}
+
+static void decode_gsa(const NMEA_Parser *p, NMEA_GSA *gsa) {
+    gsa->fix_type = (uint8_t)parse_uint(get_field(p, 2));
+    gsa->num_sats = 0;
+    for (int i = 0; i < NMEA_GSA_MAX_SATS; i++) {
+        uint32_t prn = parse_uint(get_field(p, 3 + i));
+        if (prn) {
+            gsa->sats[gsa->num_sats++] = (uint8_t)prn;
+        }
+    }
+    gsa->pdop_centi = parse_centi(get_field(p, 15));
+    gsa->hdop_centi = parse_centi(get_field(p, 16));
+    gsa->vdop_centi = parse_centi(get_field(p, 17));
+}
+
+//sentence type is the 3 characters after the 2 character talker id (GPRMC, GNRMC, ...)
+static NMEA_Type sentence_type(const NMEA_Parser *p) {
+    NMEA_Field address = get_field(p, 0);
+    if (address.len != 5) {
+        return NMEA_TYPE_UNKNOWN;
+    }
+
+    const char *code = address.ptr + 2;
+    if (memcmp(code, "RMC", 3) == 0) return NMEA_TYPE_RMC;
+    if (memcmp(code, "VTG", 3) == 0) return NMEA_TYPE_VTG;
+    if (memcmp(code, "GGA", 3) == 0) return NMEA_TYPE_GGA;
+    if (memcmp(code, "GSA", 3) == 0) return NMEA_TYPE_GSA;
+    return NMEA_TYPE_UNKNOWN;
+}
+
+static void decode_sentence(const NMEA_Parser *p, NMEA_Sentence *out) {
+    memset(out, 0, sizeof(*out));
+    out->type = sentence_type(p);
+
+    switch (out->type) {
+        case NMEA_TYPE_RMC: decode_rmc(p, &out->rmc); break;
+        case NMEA_TYPE_VTG: decode_vtg(p, &out->vtg); break;
+        case NMEA_TYPE_GGA: decode_gga(p, &out->gga); break;
+        case NMEA_TYPE_GSA: decode_gsa(p, &out->gsa); break;
+        default: break;
+    }
+}
+
+//returns true once a sentence with a valid checksum has been decoded into out
+bool nmea_parser_feed(NMEA_Parser *parser, char c, NMEA_Sentence *out) {
+    if (c == '$') {
+        //a '$' always starts a new sentence, even in the middle of a broken one
+        parser->state = STATE_BODY;
+        parser->len = 0;
+        parser->checksum = 0;
+        parser->field_count = 1;
+        parser->field_start[0] = 0;
+        return false;
+    }
+
+    switch (parser->state) {
+        case STATE_BODY:
+            if (c == '*') {
+                parser->field_start[parser->field_count] = parser->len + 1;
+                parser->state = STATE_CHECKSUM_HI;
+            } else if (c == '\r' || c == '\n') {
+                //sentences without a checksum are rejected
+                parser->checksum_errors++;
+                parser->state = STATE_WAIT_START;
+                return false;
+            } else if (c == ',') {
+                if (parser->field_count >= NMEA_MAX_FIELDS) {
+                    parser->overflow_errors++;
+                    parser->state = STATE_WAIT_START;
+                    return false;
+                }
+                parser->field_start[parser->field_count++] = parser->len + 1;
+            }
+            parser->checksum ^= (c == '*') ? 0 : (uint8_t)c;
+            break;
+        case STATE_CHECKSUM_HI:
+        case STATE_CHECKSUM_LO: {
+            int digit = hex_value(c);
+            if (digit < 0) {
+                parser->checksum_errors++;
+                parser->state = STATE_WAIT_START;
+                return false;
+            }
+            if (parser->state == STATE_CHECKSUM_HI) {
+                parser->expected = (uint8_t)(digit << 4);
+                parser->state = STATE_CHECKSUM_LO;
+                break;
+            }
+            parser->expected |= (uint8_t)digit;
+            //the last digit and the terminator need two more bytes
+            if (parser->len + 2 > NMEA_MAX_SENTENCE) {
+                parser->overflow_errors++;
+                parser->state = STATE_WAIT_START;
+                return false;
+            }
+            parser->buff[parser->len++] = c;
+            parser->buff[parser->len] = '\0';
+            parser->state = STATE_WAIT_START;
+
+            if (parser->expected != parser->checksum) {
+                parser->checksum_errors++;
+                return false;
+            }
+            parser->sentences++;
+            decode_sentence(parser, out);
+            return true;
+        }
+        default:
+            return false;
+    }
+
+    //store the character, leaving room for the terminator
+    if (parser->len >= NMEA_MAX_SENTENCE - 1) {
+        parser->overflow_errors++;
+        parser->state = STATE_WAIT_START;
+        return false;
+    }
+    parser->buff[parser->len++] = c;
+    return false;
+}
+
+//feeds bytes until a sentence completes, consumed is set to the number of bytes used
+bool nmea_parser_feed_span(NMEA_Parser *parser, const char *data, size_t len,
+                           size_t *consumed, NMEA_Sentence *out) {
+    for (size_t i = 0; i < len; i++) {
+        if (nmea_parser_feed(parser, data[i], out)) {
+            *consumed = i + 1;
+            return true;
+        }
+    }
+    *consumed = len;
+    return false;
+}
+
+//raw text of the last decoded sentence without the '$', e.g. "GPRMC,...*4F"
+const char *nmea_parser_text(const NMEA_Parser *parser) {
+    return parser->buff;
+}
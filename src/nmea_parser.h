@@ -0,0 +1,87 @@
+#ifndef NMEA_PARSER_H
+#define NMEA_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//longest NMEA 0183 sentence is 82 characters including "$" and "\r\n"
+#define NMEA_MAX_SENTENCE 83
+#define NMEA_MAX_FIELDS 24
+#define NMEA_GSA_MAX_SATS 12
+
+typedef enum {
+    NMEA_TYPE_UNKNOWN = 0,
+    NMEA_TYPE_RMC,
+    NMEA_TYPE_VTG,
+    NMEA_TYPE_GGA,
+    NMEA_TYPE_GSA
+} NMEA_Type;
+
+//positions are fixed-point in 1e-7 degrees, speeds in mm/s and angles in 0.01 degrees
+typedef struct {
+    uint32_t time_ms;       //UTC time of day in milliseconds
+    uint32_t date;          //ddmmyy as sent by the receiver
+    int32_t lat_e7;
+    int32_t lon_e7;
+    uint32_t speed_mm_s;
+    uint32_t course_cdeg;
+    bool valid;             //status field is 'A'
+} NMEA_RMC;
+
+typedef struct {
+    uint32_t course_cdeg;   //true course over ground
+    uint32_t speed_mm_s;
+    bool valid;             //mode indicator is not 'N'
+} NMEA_VTG;
+
+typedef struct {
+    uint32_t time_ms;
+    int32_t lat_e7;
+    int32_t lon_e7;
+    int32_t altitude_mm;
+    uint16_t hdop_centi;
+    uint8_t fix_quality;    //0 = no fix, 1 = GPS, 2 = DGPS
+    uint8_t satellites;
+} NMEA_GGA;
+
+typedef struct {
+    uint8_t fix_type;       //1 = no fix, 2 = 2D, 3 = 3D
+    uint8_t num_sats;
+    uint8_t sats[NMEA_GSA_MAX_SATS];
+    uint16_t pdop_centi;
+    uint16_t hdop_centi;
+    uint16_t vdop_centi;
+} NMEA_GSA;
+
+typedef struct {
+    NMEA_Type type;
+    union {
+        NMEA_RMC rmc;
+        NMEA_VTG vtg;
+        NMEA_GGA gga;
+        NMEA_GSA gsa;
+    };
+} NMEA_Sentence;
+
+typedef struct {
+    char buff[NMEA_MAX_SENTENCE];   //sentence text without the leading '$'
+    uint8_t len;
+    uint8_t state;
+    uint8_t checksum;               //running XOR of the sentence body
+    uint8_t expected;               //checksum received after '*'
+    uint8_t field_start[NMEA_MAX_FIELDS + 1]; //offset of each comma separated field in buff
+    uint8_t field_count;
+
+    uint32_t sentences;             //sentences with a valid checksum
+    uint32_t checksum_errors;
+    uint32_t overflow_errors;       //sentences longer than the buffer or with too many fields
+} NMEA_Parser;
+
+void nmea_parser_init(NMEA_Parser *parser);
+bool nmea_parser_feed(NMEA_Parser *parser, char c, NMEA_Sentence *out);
+bool nmea_parser_feed_span(NMEA_Parser *parser, const char *data, size_t len,
+                           size_t *consumed, NMEA_Sentence *out);
+const char *nmea_parser_text(const NMEA_Parser *parser);
+
+#endif
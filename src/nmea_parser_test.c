@@ -0,0 +1,441 @@
+/*
+File: nmea_parser_test.c
+Author: Leonardo DaGraca
+
+Host check and benchmark of the streaming NMEA parser (nmea_parser.h).
+
+The checks feed known sentences byte by byte and compare the decoded RMC,
+VTG, GGA and GSA fields, then the error paths: a wrong or missing checksum,
+a '$' in the middle of a sentence, numbers too long for their field, too
+many fields, and sentence bodies of
+every length from 60 to 120 characters with a valid checksum. The long ones
+must be counted as overflows, and the text handed out must always fit the
+NMEA_MAX_SENTENCE buffers of Log_Record. Last, a stream with corrupted bytes
+is fed in random spans and must give the same sentences as byte by byte.
+
+The benchmark parses a stream of sentences, the GT-U7 factory output (RMC,
+VTG, GGA, GSA and three GSV per fix) or the sentences of the given
+gps_log_N.csv or raw NMEA file repeated, and prints sentences per second and
+the cost per byte. For comparison it runs the loop main.c used before the
+parser, which copied the RMC and VTG text without checking or decoding it.
+On the board the PROFILE_NMEA stage of PROFILE_STAGES measures the same work.
+
+Usage: nmea_parser_test [-n sentences] [gps_log_N.csv | nmea.txt]
+Build: cc -O2 -I. -o nmea_parser_test nmea_parser_test.c nmea_parser.c
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include "nmea_parser.h"
+
+#define LONG_MIN_BODY 60
+#define LONG_MAX_BODY 120
+//longest body the parser takes: the body, '*', two digits and the terminator fill the buffer
+#define LONGEST_BODY (NMEA_MAX_SENTENCE - 4)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//"$body*hh\r\n" into dst, returns its length
+static int make_sentence(char *dst, size_t size, const char *body) {
+    uint8_t checksum = 0;
+    for (const char *c = body; *c; c++) {
+        checksum ^= (uint8_t)*c;
+    }
+    return snprintf(dst, size, "$%s*%02X\r\n", body, checksum);
+}
+
+//feeds text byte by byte, returns how many sentences were decoded, the last one in out
+static int feed_text(NMEA_Parser *parser, const char *text, NMEA_Sentence *out) {
+    int decoded = 0;
+    for (const char *c = text; *c; c++) {
+        decoded += nmea_parser_feed(parser, *c, out);
+    }
+    return decoded;
+}
+
+static bool parse_one(const char *body, NMEA_Sentence *out) {
+    NMEA_Parser parser;
+    char sentence[256];
+    nmea_parser_init(&parser);
+    make_sentence(sentence, sizeof(sentence), body);
+    return feed_text(&parser, sentence, out) == 1;
+}
+
+static void check_decoding() {
+    NMEA_Sentence s;
+
+    CHECK(parse_one("GPRMC,123519.00,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W", &s), "RMC not decoded");
+    CHECK(s.type == NMEA_TYPE_RMC && s.rmc.valid, "RMC type %d valid %d", s.type, s.rmc.valid);
+    CHECK(s.rmc.time_ms == 45319000, "RMC time %" PRIu32, s.rmc.time_ms);
+    CHECK(s.rmc.lat_e7 == 481173000 && s.rmc.lon_e7 == 115166667, "RMC position %" PRId32 " %" PRId32,
+          s.rmc.lat_e7, s.rmc.lon_e7);
+    CHECK(s.rmc.speed_mm_s == 11524 && s.rmc.course_cdeg == 8440, "RMC speed %" PRIu32 " course %" PRIu32,
+          s.rmc.speed_mm_s, s.rmc.course_cdeg);
+    CHECK(s.rmc.date == 230394, "RMC date %" PRIu32, s.rmc.date);
+
+    CHECK(parse_one("GNRMC,000001.50,V,3345.12345,S,15112.45678,W,,,010124,,,N", &s), "southern RMC not decoded");
+    CHECK(!s.rmc.valid && s.rmc.time_ms == 1500, "void RMC valid %d time %" PRIu32, s.rmc.valid, s.rmc.time_ms);
+    CHECK(s.rmc.lat_e7 == -337520575 && s.rmc.lon_e7 == -1512076130, "southern RMC position %" PRId32 " %" PRId32,
+          s.rmc.lat_e7, s.rmc.lon_e7);
+
+    CHECK(parse_one("GPVTG,084.4,T,,M,022.4,N,041.5,K,A", &s), "VTG not decoded");
+    CHECK(s.type == NMEA_TYPE_VTG && s.vtg.valid, "VTG type %d valid %d", s.type, s.vtg.valid);
+    CHECK(s.vtg.course_cdeg == 8440 && s.vtg.speed_mm_s == 11528, "VTG course %" PRIu32 " speed %" PRIu32,
+          s.vtg.course_cdeg, s.vtg.speed_mm_s);
+
+    CHECK(parse_one("GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,", &s), "GGA not decoded");
+    CHECK(s.type == NMEA_TYPE_GGA && s.gga.time_ms == 45319000, "GGA type %d time %" PRIu32, s.type, s.gga.time_ms);
+    CHECK(s.gga.fix_quality == 1 && s.gga.satellites == 8 && s.gga.hdop_centi == 90, "GGA fix %u sats %u hdop %u",
+          s.gga.fix_quality, s.gga.satellites, s.gga.hdop_centi);
+    CHECK(s.gga.altitude_mm == 545400, "GGA altitude %" PRId32, s.gga.altitude_mm);
+
+    CHECK(parse_one("GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1", &s), "GSA not decoded");
+    CHECK(s.type == NMEA_TYPE_GSA && s.gsa.fix_type == 3 && s.gsa.num_sats == 5, "GSA type %d fix %u sats %u",
+          s.type, s.gsa.fix_type, s.gsa.num_sats);
+    CHECK(s.gsa.sats[0] == 4 && s.gsa.sats[4] == 24, "GSA PRNs %u %u", s.gsa.sats[0], s.gsa.sats[4]);
+    CHECK(s.gsa.pdop_centi == 250 && s.gsa.hdop_centi == 130 && s.gsa.vdop_centi == 210, "GSA DOP %u %u %u",
+          s.gsa.pdop_centi, s.gsa.hdop_centi, s.gsa.vdop_centi);
+
+    CHECK(parse_one("GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00", &s) &&
+          s.type == NMEA_TYPE_UNKNOWN, "GSV is checked but not decoded");
+}
+
+static void check_errors() {
+    NMEA_Parser parser;
+    NMEA_Sentence s;
+    char sentence[256];
+
+    //checksum off by one, then lowercase hex digits
+    nmea_parser_init(&parser);
+    int len = make_sentence(sentence, sizeof(sentence), "GPVTG,084.4,T,,M,022.4,N,041.5,K,A");
+    sentence[len - 3] = sentence[len - 3] == '0' ? '1' : '0';
+    CHECK(feed_text(&parser, sentence, &s) == 0 && parser.checksum_errors == 1, "wrong checksum taken");
+    make_sentence(sentence, sizeof(sentence), "GPVTG,084.4,T,,M,022.4,N,041.5,K,A");
+    for (char *c = strchr(sentence, '*'); *c; c++) {
+        *c = (*c >= 'A' && *c <= 'F') ? (char)(*c - 'A' + 'a') : *c;
+    }
+    CHECK(feed_text(&parser, sentence, &s) == 1, "lowercase checksum refused");
+
+    nmea_parser_init(&parser);
+    CHECK(feed_text(&parser, "$GPVTG,084.4,T,,M,022.4,N,041.5,K,A\r\n", &s) == 0 && parser.checksum_errors == 1,
+          "sentence without checksum taken");
+
+    //a '$' drops the broken sentence and starts over
+    nmea_parser_init(&parser);
+    make_sentence(sentence, sizeof(sentence), "GPVTG,084.4,T,,M,022.4,N,041.5,K,A");
+    char restart[300];
+    snprintf(restart, sizeof(restart), "$GPRMC,1235%s", sentence);
+    CHECK(feed_text(&parser, restart, &s) == 1 && s.type == NMEA_TYPE_VTG, "no restart at '$'");
+
+    //a number too long for its field is refused, not overflowed, a long fraction is only cut off
+    CHECK(parse_one("GPRMC,123519,A,4807.0380000000,N,01131.000,E,9999999999999,42949673,230394,,W", &s) &&
+          s.rmc.lat_e7 == 481173000 && s.rmc.speed_mm_s == 0 && s.rmc.course_cdeg == 0,
+          "long fields: position %" PRId32 " speed %" PRIu32 " course %" PRIu32, s.rmc.lat_e7, s.rmc.speed_mm_s,
+          s.rmc.course_cdeg);
+
+    nmea_parser_init(&parser);
+    make_sentence(sentence, sizeof(sentence), "GPXXX,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24");
+    CHECK(feed_text(&parser, sentence, &s) == 0 && parser.overflow_errors == 1, "too many fields taken");
+}
+
+//every body length around the limit, each followed by a valid sentence
+static void check_long_sentences() {
+    NMEA_Parser parser;
+    NMEA_Sentence s;
+    char body[LONG_MAX_BODY + 1];
+    char sentence[LONG_MAX_BODY + 16];
+    char next[128];
+    make_sentence(next, sizeof(next), "GPVTG,084.4,T,,M,022.4,N,041.5,K,A");
+
+    nmea_parser_init(&parser);
+    uint32_t overflows = 0;
+    for (int len = LONG_MIN_BODY; len <= LONG_MAX_BODY; len++) {
+        memcpy(body, "GPRMC,", 6);
+        memset(body + 6, 'A', len - 6);
+        body[len] = '\0';
+        make_sentence(sentence, sizeof(sentence), body);
+
+        bool taken = feed_text(&parser, sentence, &s) == 1;
+        overflows += len > LONGEST_BODY;
+        CHECK(taken == (len <= LONGEST_BODY), "body of %d characters %s", len, taken ? "taken" : "refused");
+        CHECK(strlen(nmea_parser_text(&parser)) < NMEA_MAX_SENTENCE, "body of %d characters: text of %zu bytes",
+              len, strlen(nmea_parser_text(&parser)));
+        CHECK(parser.overflow_errors == overflows, "body of %d characters: %" PRIu32 " overflows, expected %" PRIu32,
+              len, parser.overflow_errors, overflows);
+        CHECK(feed_text(&parser, next, &s) == 1 && s.type == NMEA_TYPE_VTG && s.vtg.speed_mm_s == 11528,
+              "sentence after a body of %d characters lost", len);
+    }
+}
+
+//GT-U7 factory output for one fix, bodies without '$' and checksum
+static const char *factory_fix[] = {
+    "GPRMC,%02d%02d%02d.00,A,4807.%05d,N,01131.%05d,E,%d.%03d,%d.%02d,230394,,,A",
+    "GPVTG,%d.%02d,T,,M,%d.%03d,N,%d.%03d,K,A",
+    "GPGGA,%02d%02d%02d.00,4807.%05d,N,01131.%05d,E,1,08,0.91,545.4,M,46.9,M,,",
+    "GPGSA,A,3,04,05,09,12,24,25,29,31,,,,,1.72,0.91,1.46",
+    "GPGSV,3,1,11,04,60,107,32,05,21,045,28,09,38,283,30,12,12,318,22",
+    "GPGSV,3,2,11,24,55,150,35,25,27,211,31,29,09,066,18,31,44,078,33",
+    "GPGSV,3,3,11,02,05,190,,16,03,330,,26,01,008,"
+};
+#define FACTORY_SENTENCES (sizeof(factory_fix) / sizeof(factory_fix[0]))
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+    uint32_t sentences;
+} Stream;
+
+static void stream_add(Stream *stream, const char *body) {
+    if (stream->len + NMEA_MAX_SENTENCE + 64 > stream->size) {
+        stream->size = stream->size ? stream->size * 2 : 1 << 20;
+        stream->data = realloc(stream->data, stream->size);
+        if (!stream->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    stream->len += make_sentence(stream->data + stream->len, stream->size - stream->len, body);
+    stream->sentences++;
+}
+
+static void generate_stream(Stream *stream, uint32_t sentences) {
+    char body[128];
+    for (uint32_t fix = 0; stream->sentences < sentences; fix++) {
+        int t = fix % 86400;
+        int lat = (3800 + fix * 7) % 100000;
+        int lon = (100 + fix * 11) % 100000;
+        int knots_milli = 2000 + fix * 37 % 9000;
+        int course_centi = fix * 131 % 36000;
+        for (size_t i = 0; i < FACTORY_SENTENCES && stream->sentences < sentences; i++) {
+            switch (i) {
+                case 0:
+                    snprintf(body, sizeof(body), factory_fix[i], t / 3600, t / 60 % 60, t % 60, lat, lon,
+                             knots_milli / 1000, knots_milli % 1000, course_centi / 100, course_centi % 100);
+                    break;
+                case 1: {
+                    int kmh_milli = knots_milli * 1852 / 1000;
+                    snprintf(body, sizeof(body), factory_fix[i], course_centi / 100, course_centi % 100,
+                             knots_milli / 1000, knots_milli % 1000, kmh_milli / 1000, kmh_milli % 1000);
+                    break;
+                }
+                case 2:
+                    snprintf(body, sizeof(body), factory_fix[i], t / 3600, t / 60 % 60, t % 60, lat, lon);
+                    break;
+                default:
+                    snprintf(body, sizeof(body), "%s", factory_fix[i]);
+                    break;
+            }
+            stream_add(stream, body);
+        }
+    }
+}
+
+//the sentences of a logger CSV ("timestamp,GPRMC,...*hh") or a raw NMEA file, repeated up to sentences
+static bool load_stream(Stream *stream, const char *path, uint32_t sentences) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Cannot read %s\n", path);
+        return false;
+    }
+    Stream once = {0};
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char *start = strchr(line, '$');
+        if (!start) {
+            char *comma = strchr(line, ',');
+            start = comma && comma[1] == 'G' ? comma + 1 : NULL;
+        }
+        else {
+            start++;
+        }
+        char *star = start ? strchr(start, '*') : NULL;
+        if (!star) {
+            continue;
+        }
+        *star = '\0';
+        stream_add(&once, start);
+    }
+    fclose(file);
+    if (once.sentences == 0) {
+        printf("No NMEA sentences in %s\n", path);
+        return false;
+    }
+    while (stream->sentences < sentences) {
+        if (stream->len + once.len + 1 > stream->size) {
+            stream->size = (stream->len + once.len + 1) * 2;
+            stream->data = realloc(stream->data, stream->size);
+            if (!stream->data) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+        }
+        memcpy(stream->data + stream->len, once.data, once.len);
+        stream->len += once.len;
+        stream->sentences += once.sentences;
+    }
+    free(once.data);
+    return true;
+}
+
+//corrupted bytes in random spans must give the same sentences as byte by byte
+static void check_spans(const Stream *source) {
+    size_t len = source->len < (1 << 20) ? source->len : (1 << 20);
+    char *data = malloc(len);
+    memcpy(data, source->data, len);
+    srand(7);
+    for (int i = 0; i < 200; i++) {
+        data[rand() % len] = (char)(rand() % 256);
+    }
+
+    NMEA_Parser bytewise, spans;
+    NMEA_Sentence a, b;
+    nmea_parser_init(&bytewise);
+    nmea_parser_init(&spans);
+    uint64_t sum_bytewise = 0, sum_spans = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (nmea_parser_feed(&bytewise, data[i], &a)) {
+            sum_bytewise = sum_bytewise * 31 + a.type + a.rmc.time_ms;
+        }
+    }
+    size_t pos = 0;
+    while (pos < len) {
+        size_t span = 1 + rand() % 200;
+        span = span < len - pos ? span : len - pos;
+        size_t consumed;
+        if (nmea_parser_feed_span(&spans, data + pos, span, &consumed, &b)) {
+            sum_spans = sum_spans * 31 + b.type + b.rmc.time_ms;
+        }
+        pos += consumed;
+    }
+    CHECK(bytewise.sentences == spans.sentences && sum_bytewise == sum_spans,
+          "spans gave %" PRIu32 " sentences, bytes %" PRIu32, spans.sentences, bytewise.sentences);
+    CHECK(bytewise.checksum_errors + bytewise.overflow_errors > 0, "the corruption was not seen");
+    free(data);
+}
+
+//main.c before the parser: copy RMC and VTG up to '\r', no checksum, no fields
+static uint32_t old_loop(const char *data, size_t len) {
+    static char gprmc_buff[100], gpvtg_buff[100];
+    char sentence_code[5] = {0};
+    char gps_buff[100] = {0};
+    size_t gps_index = 0;
+    uint32_t received = 0;
+    for (size_t i = 0; i < len; i++) {
+        char dat = data[i];
+        if (dat == '$') {
+            memset(sentence_code, 0, sizeof(sentence_code));
+            memset(gps_buff, 0, sizeof(gps_buff));
+            gps_index = 0;
+        } else if (dat == '\r') {
+            gps_buff[gps_index] = '\0';
+            if (strncmp(sentence_code, "RMC", 3) == 0) {
+                memcpy(gprmc_buff, gps_buff, sizeof(gps_buff));
+                received++;
+            }
+            else if (strncmp(sentence_code, "VTG", 3) == 0) {
+                memcpy(gpvtg_buff, gps_buff, sizeof(gps_buff));
+                received++;
+            }
+        } else if (gps_index < sizeof(gps_buff) - 1) {
+            gps_buff[gps_index++] = dat;
+            if (gps_index >= 3 && gps_index <= 6) {
+                sentence_code[gps_index - 3] = dat;
+            }
+        }
+    }
+    return received;
+}
+
+static void benchmark(const Stream *stream) {
+    NMEA_Parser parser;
+    NMEA_Sentence s;
+    double best = 1e9, best_old = 1e9;
+    uint32_t rmc = 0, old_rmc_vtg = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        nmea_parser_init(&parser);
+        rmc = 0;
+        double start = now_seconds();
+        size_t pos = 0;
+        while (pos < stream->len) {
+            size_t consumed;
+            if (nmea_parser_feed_span(&parser, stream->data + pos, stream->len - pos, &consumed, &s)) {
+                rmc += s.type == NMEA_TYPE_RMC;
+            }
+            pos += consumed;
+        }
+        double t = now_seconds() - start;
+        best = t < best ? t : best;
+
+        start = now_seconds();
+        old_rmc_vtg = old_loop(stream->data, stream->len);
+        t = now_seconds() - start;
+        best_old = t < best_old ? t : best_old;
+    }
+    CHECK(parser.sentences == stream->sentences, "%" PRIu32 " of %" PRIu32 " sentences decoded", parser.sentences,
+          stream->sentences);
+
+    printf("%" PRIu32 " sentences, %.1f MB, %" PRIu32 " RMC:\n", stream->sentences, stream->len / 1e6, rmc);
+    printf("  nmea_parser  %6.2f M sentences/s  %6.1f MB/s  %5.2f ns/byte  %6.1f ns/sentence\n",
+           stream->sentences / best / 1e6, stream->len / best / 1e6, best * 1e9 / stream->len,
+           best * 1e9 / stream->sentences);
+    printf("  old loop     %6.2f M sentences/s  %6.1f MB/s  %5.2f ns/byte  (%" PRIu32 " RMC/VTG copied, nothing checked)\n",
+           stream->sentences / best_old / 1e6, stream->len / best_old / 1e6, best_old * 1e9 / stream->len,
+           old_rmc_vtg);
+}
+
+int main(int argc, char **argv) {
+    uint32_t sentences = 2000000;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            sentences = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-n sentences] [gps_log_N.csv | nmea.txt]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    check_decoding();
+    check_errors();
+    check_long_sentences();
+
+    Stream stream = {0};
+    if (path) {
+        if (!load_stream(&stream, path, sentences)) {
+            return 1;
+        }
+    }
+    else {
+        generate_stream(&stream, sentences > 0 ? sentences : 1);
+    }
+    check_spans(&stream);
+    benchmark(&stream);
+    free(stream.data);
+
+    printf(failures ? "FAIL: %d checks\n" : "OK\n", failures);
+    return failures ? 1 : 0;
+}
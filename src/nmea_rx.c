@@ -0,0 +1,93 @@
+/*
+File: nmea_rx.c
+Author: Leonardo DaGraca
+
+Interrupt driven UART receive path for the GPS module.
+The UART RX interrupt (hal_uart_init) moves every byte out of the hardware FIFO into a
+lock-free ring buffer, so NMEA data is no longer lost while the main loop
+is busy with I2C reads or SD card writes. The main loop drains the ring
+with nmea_rx_read().
+
+The interrupt also records hal_time_us_32() whenever a '$' arrives, in a table
+indexed by ring position, so every sentence can be stamped with the moment
+it started arriving rather than the moment the main loop got around to it.
+*/
+#include "nmea_rx.h"
+#include "byte_ring.h"
+#include "hal.h"
+
+static uint8_t rx_storage[NMEA_RX_BUFFER_SIZE];
+static Byte_Ring rx_ring;
+static uint32_t rx_dollar_time[NMEA_RX_BUFFER_SIZE]; //only valid at positions holding a '$'
+
+//counters are only written by the interrupt handler
+static volatile uint32_t rx_received = 0;
+static volatile uint32_t rx_overruns = 0;
+static volatile uint32_t rx_dropped = 0;
+static volatile uint32_t rx_errors = 0;
+static uint32_t rx_high_water = 0;
+
+static void on_uart_rx(uint8_t byte, uint32_t errors) {
+    if (errors & HAL_UART_OVERRUN) {
+        rx_overruns++;
+    }
+    if (errors & HAL_UART_ERROR) {
+        rx_errors++;
+        return;
+    }
+
+    //only the consumer frees slots meanwhile, so a byte that finds room here is stored below
+    //and its '$' time goes to the slot it lands in, never into one the consumer still reads
+    if (byte_ring_count(&rx_ring) > rx_ring.mask) {
+        rx_dropped++;
+        return;
+    }
+    if (byte == '$') {
+        uint32_t head = atomic_load_explicit(&rx_ring.head, memory_order_relaxed);
+        rx_dollar_time[head & rx_ring.mask] = hal_time_us_32();
+    }
+
+    byte_ring_push(&rx_ring, byte);
+    rx_received++;
+}
+
+void nmea_rx_init(uint32_t uart_index, uint32_t baud_rate, uint32_t tx_pin, uint32_t rx_pin) {
+    byte_ring_init(&rx_ring, rx_storage, NMEA_RX_BUFFER_SIZE);
+    hal_uart_init(uart_index, baud_rate, tx_pin, rx_pin, on_uart_rx);
+}
+
+//dollar_times[i] holds the hal_time_us_32() arrival time of dst[i] when it is a '$' (may be NULL)
+size_t nmea_rx_read(char *dst, uint32_t *dollar_times, size_t max_len) {
+    uint32_t level = byte_ring_count(&rx_ring);
+    if (level > rx_high_water) {
+        rx_high_water = level;
+    }
+
+    //read the '$' times before the slots are freed, the interrupt may refill them right after
+    uint32_t tail = atomic_load_explicit(&rx_ring.tail, memory_order_relaxed);
+    size_t count = byte_ring_peek(&rx_ring, (uint8_t *)dst, max_len);
+
+    if (dollar_times) {
+        for (size_t i = 0; i < count; i++) {
+            if (dst[i] == '$') {
+                dollar_times[i] = rx_dollar_time[(tail + i) & rx_ring.mask];
+            }
+        }
+    }
+    byte_ring_commit(&rx_ring, count);
+    return count;
+}
+
+//extend a recent hal_time_us_32() value to the 64-bit clock
+uint64_t nmea_rx_time_to_64(uint32_t time_us_32) {
+    uint64_t now = hal_time_us();
+    return now - (uint32_t)((uint32_t)now - time_us_32);
+}
+
+void nmea_rx_get_stats(NMEA_RX_Stats *stats) {
+    stats->received = rx_received;
+    stats->overruns = rx_overruns;
+    stats->dropped = rx_dropped;
+    stats->errors = rx_errors;
+    stats->high_water = rx_high_water;
+}
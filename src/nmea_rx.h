@@ -0,0 +1,24 @@
+#ifndef NMEA_RX_H
+#define NMEA_RX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//size of the UART receive ring (must be a power of two)
+//1024 bytes holds ~44ms of data at 230400 baud
+#define NMEA_RX_BUFFER_SIZE 1024
+
+typedef struct {
+    uint32_t received;  //bytes stored in the ring
+    uint32_t overruns;  //bytes lost in the UART hardware FIFO before the IRQ ran
+    uint32_t dropped;   //bytes lost because the ring was full
+    uint32_t errors;    //framing, parity and break errors
+    uint32_t high_water; //highest ring fill level seen by the consumer
+} NMEA_RX_Stats;
+
+void nmea_rx_init(uint32_t uart_index, uint32_t baud_rate, uint32_t tx_pin, uint32_t rx_pin);
+size_t nmea_rx_read(char *dst, uint32_t *dollar_times, size_t max_len);
+uint64_t nmea_rx_time_to_64(uint32_t time_us_32);
+void nmea_rx_get_stats(NMEA_RX_Stats *stats);
+
+#endif
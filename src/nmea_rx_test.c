@@ -0,0 +1,321 @@
+/*
+File: nmea_rx_test.c
+Author: Leonardo DaGraca
+
+Host harness of the interrupt driven GPS receive path (nmea_rx.h, byte_ring.h).
+
+The first part runs on a simulated clock, once at 115200 and once at 230400
+baud. The GPS sends an NMEA stream back to back for the whole run, the GT-U7
+factory output or the sentences of the given gps_log_N.csv or raw NMEA file
+repeated, which is the most the line can carry. Each byte reaches the UART
+handler the moment its stop bit ends. The main loop is modelled as it drains
+the ring in main.c: one nmea_rx_read() of 64 bytes per iteration, iterations
+of 0.2 to 2ms, and once a second a stall (20ms by default) for a slow SD card
+or a long printf. Every byte must come out of the ring in order, every '$'
+with the time it arrived, and the NMEA parser must take every sentence. No
+byte may be dropped, and the highest ring level is printed next to how much
+longer the main loop could have stalled before the ring filled.
+
+The second part drives the handler from a second thread as fast as the ring
+accepts bytes while the main thread drains it, so the ring runs full and the
+handler refills slots the moment they are freed. It checks the order of the
+bytes and the '$' times on real concurrency.
+
+Usage: nmea_rx_test [-s seconds] [-p stall_ms] [-b thread_bytes] [gps_log_N.csv | nmea.txt]
+Build: cc -O2 -I. -o nmea_rx_test nmea_rx_test.c nmea_rx.c nmea_parser.c -lpthread
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "nmea_rx.h"
+#include "nmea_parser.h"
+#include "hal.h"
+
+#define READ_CHUNK 64           //bytes per nmea_rx_read() in main.c
+#define LOOP_MIN_US 200
+#define LOOP_MAX_US 2000
+#define STALL_EVERY_US 1000000
+
+static uint64_t now_us = 0;
+static HAL_UART_Rx_Handler rx_handler = NULL;
+
+//hal.h, as far as nmea_rx.c uses it
+uint64_t hal_time_us() {
+    return now_us;
+}
+
+uint32_t hal_time_us_32() {
+    return (uint32_t)now_us;
+}
+
+void hal_uart_init(uint32_t index, uint32_t baud_rate, uint32_t tx_pin, uint32_t rx_pin,
+                   HAL_UART_Rx_Handler handler) {
+    rx_handler = handler;
+}
+
+//the GT-U7 factory output for one fix, without '$' and checksum
+static const char *factory_fix[] = {
+    "GPRMC,123519.00,A,4807.03812,N,01131.00045,E,0.213,84.40,230394,,,A",
+    "GPVTG,84.40,T,,M,0.213,N,0.394,K,A",
+    "GPGGA,123519.00,4807.03812,N,01131.00045,E,1,08,0.91,545.4,M,46.9,M,,",
+    "GPGSA,A,3,04,05,09,12,24,25,29,31,,,,,1.72,0.91,1.46",
+    "GPGSV,3,1,11,04,60,107,32,05,21,045,28,09,38,283,30,12,12,318,22",
+    "GPGSV,3,2,11,24,55,150,35,25,27,211,31,29,09,066,18,31,44,078,33",
+    "GPGSV,3,3,11,02,05,190,,16,03,330,,26,01,008,",
+    "GPGLL,4807.03812,N,01131.00045,E,123519.00,A,A"
+};
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+    uint32_t sentences;
+} Stream;
+
+static void stream_add(Stream *stream, const char *body) {
+    if (stream->len + NMEA_MAX_SENTENCE + 64 > stream->size) {
+        stream->size = stream->size ? stream->size * 2 : 4096;
+        stream->data = realloc(stream->data, stream->size);
+        if (!stream->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    uint8_t checksum = 0;
+    for (const char *c = body; *c; c++) {
+        checksum ^= (uint8_t)*c;
+    }
+    stream->len += snprintf(stream->data + stream->len, stream->size - stream->len, "$%s*%02X\r\n", body, checksum);
+    stream->sentences++;
+}
+
+//sentences of a logger CSV ("timestamp,GPRMC,...*hh") or a raw NMEA file
+static bool load_stream(Stream *stream, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Cannot read %s\n", path);
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char *start = strchr(line, '$');
+        if (!start) {
+            char *comma = strchr(line, ',');
+            start = comma && comma[1] == 'G' ? comma + 1 : NULL;
+        }
+        else {
+            start++;
+        }
+        char *star = start ? strchr(start, '*') : NULL;
+        if (!star || star - start >= NMEA_MAX_SENTENCE - 4) {
+            continue;
+        }
+        *star = '\0';
+        stream_add(stream, start);
+    }
+    fclose(file);
+    if (stream->sentences == 0) {
+        printf("No NMEA sentences in %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+//end of the stop bit of byte index, in microseconds after the line started
+static uint64_t arrival_us(uint64_t index, uint32_t baud_rate) {
+    return (index + 1) * 10 * 1000000 / baud_rate;
+}
+
+static bool run_baud(const Stream *stream, uint32_t baud_rate, uint32_t seconds, uint32_t stall_ms) {
+    NMEA_RX_Stats before, after;
+    nmea_rx_get_stats(&before);
+    now_us = 0;
+    nmea_rx_init(0, baud_rate, 0, 1);
+
+    NMEA_Parser parser;
+    nmea_parser_init(&parser);
+    srand(baud_rate);
+
+    uint64_t total = (uint64_t)seconds * baud_rate / 10;
+    uint64_t sent = 0, read = 0;
+    uint32_t mismatches = 0, wrong_times = 0, high_water = 0;
+    uint64_t next_stall_us = STALL_EVERY_US;
+    while (read < total) {
+        //one main loop iteration, the line keeps delivering meanwhile
+        uint64_t loop_end = now_us + LOOP_MIN_US + rand() % (LOOP_MAX_US - LOOP_MIN_US + 1);
+        if (loop_end >= next_stall_us) {
+            loop_end += (uint64_t)stall_ms * 1000;
+            next_stall_us += STALL_EVERY_US;
+        }
+        while (sent < total && arrival_us(sent, baud_rate) <= loop_end) {
+            now_us = arrival_us(sent, baud_rate);
+            rx_handler((uint8_t)stream->data[sent % stream->len], 0);
+            sent++;
+        }
+        now_us = loop_end;
+
+        if (sent - read > high_water) {
+            high_water = (uint32_t)(sent - read);
+        }
+        char chunk[READ_CHUNK];
+        uint32_t times[READ_CHUNK];
+        size_t len = nmea_rx_read(chunk, times, sizeof(chunk));
+        for (size_t i = 0; i < len; i++, read++) {
+            mismatches += chunk[i] != stream->data[read % stream->len];
+            if (chunk[i] == '$') {
+                wrong_times += times[i] != (uint32_t)arrival_us(read, baud_rate);
+            }
+            NMEA_Sentence sentence;
+            nmea_parser_feed(&parser, chunk[i], &sentence);
+        }
+        if (len == 0 && sent == total) {
+            break;
+        }
+    }
+    nmea_rx_get_stats(&after);
+
+    uint32_t dropped = after.dropped - before.dropped;
+    uint32_t received = after.received - before.received;
+    uint64_t expected_sentences = total / stream->len * stream->sentences;
+    double bytes_per_ms = baud_rate / 10000.0;
+    printf("%6" PRIu32 " baud: %" PRIu64 " bytes in %" PRIu32 " s, %" PRIu32 " received, %" PRIu32
+           " dropped, %" PRIu32 " sentences, %" PRIu32 " checksum errors\n",
+           baud_rate, total, seconds, received, dropped, parser.sentences, parser.checksum_errors);
+    if (high_water <= NMEA_RX_BUFFER_SIZE) {
+        printf("             ring high water %" PRIu32 " of %d bytes (%.1f ms), %.1f ms of stall left\n",
+               high_water, NMEA_RX_BUFFER_SIZE, high_water / bytes_per_ms,
+               (NMEA_RX_BUFFER_SIZE - high_water) / bytes_per_ms);
+    }
+    else {
+        printf("             the main loop fell %" PRIu32 " bytes (%.1f ms) behind, the ring holds %d\n",
+               high_water, high_water / bytes_per_ms, NMEA_RX_BUFFER_SIZE);
+    }
+
+    bool ok = true;
+    if (dropped != 0 || received != total || read != total) {
+        printf("FAIL: %" PRIu32 " bytes dropped, %" PRIu64 " of %" PRIu64 " read\n", dropped, read, total);
+        ok = false;
+    }
+    if (mismatches != 0 || wrong_times != 0) {
+        printf("FAIL: %" PRIu32 " bytes out of order, %" PRIu32 " wrong '$' times\n", mismatches, wrong_times);
+        ok = false;
+    }
+    if (parser.sentences < expected_sentences || parser.checksum_errors != 0 || parser.overflow_errors != 0) {
+        printf("FAIL: %" PRIu32 " of %" PRIu64 " sentences parsed\n", parser.sentences, expected_sentences);
+        ok = false;
+    }
+    return ok;
+}
+
+typedef struct {
+    const Stream *stream;
+    uint64_t bytes;
+    uint64_t retries;
+} Thread_Run;
+
+//the interrupt: a byte the full ring refuses is offered again, the times stay the byte index
+static void *producer(void *arg) {
+    Thread_Run *run = arg;
+    NMEA_RX_Stats stats;
+    nmea_rx_get_stats(&stats);
+    uint32_t dropped = stats.dropped;
+    for (uint64_t i = 0; i < run->bytes; i++) {
+        now_us = i;
+        for (;;) {
+            rx_handler((uint8_t)run->stream->data[i % run->stream->len], 0);
+            nmea_rx_get_stats(&stats);
+            if (stats.dropped == dropped) {
+                break;
+            }
+            dropped = stats.dropped;
+            run->retries++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static bool run_threads(const Stream *stream, uint64_t bytes) {
+    nmea_rx_init(0, 230400, 0, 1);
+    Thread_Run run = {stream, bytes, 0};
+    pthread_t thread;
+    pthread_create(&thread, NULL, producer, &run);
+
+    uint64_t read = 0, dollars = 0;
+    uint32_t mismatches = 0, wrong_times = 0;
+    while (read < bytes) {
+        char chunk[READ_CHUNK];
+        uint32_t times[READ_CHUNK];
+        size_t len = nmea_rx_read(chunk, times, sizeof(chunk));
+        if (len == 0) {
+            sched_yield();
+        }
+        for (size_t i = 0; i < len; i++, read++) {
+            mismatches += chunk[i] != stream->data[read % stream->len];
+            if (chunk[i] == '$') {
+                wrong_times += times[i] != (uint32_t)read;
+                dollars++;
+            }
+        }
+    }
+    pthread_join(thread, NULL);
+
+    printf("threads: %" PRIu64 " bytes, %" PRIu64 " '$', %" PRIu64 " pushes refused by the full ring\n",
+           bytes, dollars, run.retries);
+    if (mismatches != 0 || wrong_times != 0) {
+        printf("FAIL: %" PRIu32 " bytes out of order, %" PRIu32 " wrong '$' times\n", mismatches, wrong_times);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint32_t seconds = 60;
+    uint32_t stall_ms = 20;
+    uint64_t thread_bytes = 20000000;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seconds = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            stall_ms = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            thread_bytes = strtoull(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-s seconds] [-p stall_ms] [-b thread_bytes] [gps_log_N.csv | nmea.txt]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    Stream stream = {0};
+    if (path) {
+        if (!load_stream(&stream, path)) {
+            return 1;
+        }
+    }
+    else {
+        for (size_t i = 0; i < sizeof(factory_fix) / sizeof(factory_fix[0]); i++) {
+            stream_add(&stream, factory_fix[i]);
+        }
+    }
+
+    bool ok = run_baud(&stream, 115200, seconds, stall_ms);
+    ok &= run_baud(&stream, 230400, seconds, stall_ms);
+    ok &= run_threads(&stream, thread_bytes);
+    free(stream.data);
+
+    printf(ok ? "OK\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+/*
+File: profile.c
+Author: Leonardo DaGraca
+
+Stage statistics for profile.h and the CSV report written to
+gps_logs/profile_N.csv and stdio. The simulator prints the same report, so
+host and device runs can be compared line by line.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "profile.h"
+
+Profile_Stats profile_stats[PROFILE_STAGE_COUNT];
+
+static const char *stage_names[PROFILE_STAGE_COUNT] = {
+    "loop", "imu_read", "nmea_parse", "log_record", "format", "f_write", "f_sync", "attitude", "fusion"
+};
+
+void profile_add(Profile_Stage stage, uint32_t elapsed_us) {
+    Profile_Stats *stats = &profile_stats[stage];
+
+    if (stats->count == 0 || elapsed_us < stats->min_us) {
+        stats->min_us = elapsed_us;
+    }
+    if (elapsed_us > stats->max_us) {
+        stats->max_us = elapsed_us;
+    }
+    stats->count++;
+    stats->total_us += elapsed_us;
+
+    int bucket = elapsed_us ? 32 - __builtin_clz(elapsed_us) : 0;
+    if (bucket >= PROFILE_HISTOGRAM_BUCKETS) {
+        bucket = PROFILE_HISTOGRAM_BUCKETS - 1;
+    }
+    stats->histogram[bucket]++;
+}
+
+void profile_reset() {
+    memset(profile_stats, 0, sizeof(profile_stats));
+}
+
+//header plus one row per stage, returns the length like snprintf
+int profile_format(char *buf, size_t size) {
+    int len = snprintf(buf, size, "Stage,Count,Mean_us,Min_us,Max_us,Total_ms");
+    for (int i = 0; i < PROFILE_HISTOGRAM_BUCKETS && len < (int)size; i++) {
+        if (i == PROFILE_HISTOGRAM_BUCKETS - 1) {
+            len += snprintf(buf + len, size - len, ",>=%luus", 1UL << (i - 1));
+        }
+        else {
+            len += snprintf(buf + len, size - len, ",<%luus", 1UL << i);
+        }
+    }
+    if (len < (int)size) {
+        len += snprintf(buf + len, size - len, "\n");
+    }
+
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT && len < (int)size; stage++) {
+        Profile_Stats stats = profile_stats[stage];
+        //mean with two decimals, most stages take a few microseconds at most
+        uint64_t mean_centi = stats.count ? stats.total_us * 100 / stats.count : 0;
+
+        len += snprintf(buf + len, size - len, "%s,%" PRIu32 ",%" PRIu64 ".%02" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%" PRIu64,
+                        stage_names[stage], stats.count, mean_centi / 100, mean_centi % 100,
+                        stats.min_us, stats.max_us, stats.total_us / 1000);
+        for (int i = 0; i < PROFILE_HISTOGRAM_BUCKETS && len < (int)size; i++) {
+            len += snprintf(buf + len, size - len, ",%" PRIu32, stats.histogram[i]);
+        }
+        if (len < (int)size) {
+            len += snprintf(buf + len, size - len, "\n");
+        }
+    }
+    return len;
+}
@@ -0,0 +1,61 @@
+/*
+File: profile.h
+Author: Leonardo DaGraca
+
+Per-stage timing of the logging hot path, compiled in with PROFILE_STAGES.
+A stage is timed with PROFILE_START(t) ... PROFILE_STOP(stage, t), which
+records the elapsed microseconds in a min/max/mean and a log2 histogram.
+Without PROFILE_STAGES both macros compile to nothing.
+
+Each stage must only be timed from one core. The report may be formatted from
+either core, a stage being updated at the same time can be off by one sample.
+*/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+
+typedef enum {
+    PROFILE_LOOP = 0,   //core 0: one pass of the acquisition loop
+    PROFILE_IMU,        //core 0: process_imu_buffer, the FIFO reads over I2C
+    PROFILE_NMEA,       //core 0: NMEA assembly of one received chunk
+    PROFILE_RECORD,     //core 1: writing one fix, everything below included
+    PROFILE_FORMAT,     //core 1: snprintf of a CSV row or encoding of a binary record
+    PROFILE_SD_WRITE,   //core 1: one f_write of the write-behind buffer
+    PROFILE_SD_SYNC,    //core 1: one f_sync
+    PROFILE_ATTITUDE,   //core 0: attitude_update of one FIFO burst (ATTITUDE_FILTER builds)
+    PROFILE_FUSION,     //core 0: track_fusion_predict of one FIFO burst (GPS_IMU_FUSION builds)
+    PROFILE_STAGE_COUNT
+} Profile_Stage;
+
+//bucket 0 counts 0us, bucket n counts 2^(n-1) to 2^n - 1 us, the last bucket everything above
+#define PROFILE_HISTOGRAM_BUCKETS 16
+
+//large enough for profile_format() with every counter at its maximum
+#define PROFILE_REPORT_SIZE 2048
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t histogram[PROFILE_HISTOGRAM_BUCKETS];
+} Profile_Stats;
+
+extern Profile_Stats profile_stats[PROFILE_STAGE_COUNT];
+
+#ifdef PROFILE_STAGES
+#define PROFILE_START(timer) uint32_t timer = hal_perf_time_us()
+#define PROFILE_STOP(stage, timer) profile_add((stage), hal_perf_time_us() - (timer))
+#else
+#define PROFILE_START(timer)
+#define PROFILE_STOP(stage, timer)
+#endif
+
+void profile_add(Profile_Stage stage, uint32_t elapsed_us);
+void profile_reset();
+int profile_format(char *buf, size_t size);
+
+#endif
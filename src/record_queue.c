@@ -0,0 +1,60 @@
+/*
+File: record_queue.c
+Author: Leonardo DaGraca
+
+Implementation of the SPSC record queue
+*/
+#include <string.h>
+#include "record_queue.h"
+
+void record_queue_init(Record_Queue *queue, void *storage, size_t slot_size, uint32_t capacity) {
+    queue->slots = storage;
+    queue->slot_size = slot_size;
+    queue->mask = capacity - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->pushed = 0;
+    queue->dropped = 0;
+    queue->high_water = 0;
+}
+
+uint32_t record_queue_count(Record_Queue *queue) {
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    return head - tail;
+}
+
+//producer side, returns false (and counts a drop) when the queue is full
+bool record_queue_push(Record_Queue *queue, const void *record) {
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    uint32_t level = head - tail;
+
+    if (level > queue->mask) {
+        queue->dropped++;
+        return false;
+    }
+
+    memcpy(queue->slots + (head & queue->mask) * queue->slot_size, record, queue->slot_size);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    queue->pushed++;
+    if (level + 1 > queue->high_water) {
+        queue->high_water = level + 1;
+    }
+    return true;
+}
+
+//consumer side, returns false when the queue is empty
+bool record_queue_pop(Record_Queue *queue, void *record) {
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+
+    memcpy(record, queue->slots + (tail & queue->mask) * queue->slot_size, queue->slot_size);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
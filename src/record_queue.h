@@ -0,0 +1,38 @@
+/*
+File: record_queue.h
+Author: Leonardo DaGraca
+
+Bounded lock-free single-producer/single-consumer queue of fixed size records.
+Used to hand records from the acquisition core to the SD card core. Like
+byte_ring.h only the producer writes head and only the consumer writes tail,
+so it works between the two RP2040 cores (or two host threads) without locks.
+The producer never blocks: when the queue is full the record is dropped and
+counted, so a slow SD card can never stall sensor acquisition.
+*/
+#ifndef RECORD_QUEUE_H
+#define RECORD_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct {
+    uint8_t *slots;
+    size_t slot_size;
+    uint32_t mask;              //capacity - 1, capacity must be a power of two
+    atomic_uint_least32_t head; //next slot to fill (producer)
+    atomic_uint_least32_t tail; //next slot to read (consumer)
+
+    //backpressure statistics, only written by the producer
+    uint32_t pushed;
+    uint32_t dropped;
+    uint32_t high_water;
+} Record_Queue;
+
+void record_queue_init(Record_Queue *queue, void *storage, size_t slot_size, uint32_t capacity);
+bool record_queue_push(Record_Queue *queue, const void *record);
+bool record_queue_pop(Record_Queue *queue, void *record);
+uint32_t record_queue_count(Record_Queue *queue);
+
+#endif
@@ -0,0 +1,155 @@
+/*
+File: record_queue_test.c
+Author: Leonardo DaGraca
+
+Host check of the record queue (record_queue.h) between two threads standing
+in for the two cores, at the depth and record size of the fix queue in main.c.
+
+In the first run the producer waits while the queue is full, so every record
+must arrive: the consumer checks that the sequence numbers come in order
+with none missing or repeated and that no record was torn. In the second run
+the producer never waits, as core 0 does, while the consumer stalls now and
+then like an f_sync. Records may then be dropped, but the ones that arrive
+must still be in order and intact, and received plus dropped must add up to
+what was pushed, with the high water mark reaching the queue depth.
+
+Usage: record_queue_test [records]
+Build: cc -O2 -pthread -I. -o record_queue_test record_queue_test.c record_queue.c
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "record_queue.h"
+
+#define QUEUE_DEPTH 16              //as LOG_QUEUE_DEPTH in main.c
+#define RECORD_WORDS 62             //256 bytes, about a Log_Record
+#define STALL_EVERY 20000           //records between consumer stalls in the second run
+#define STALL_US 20000
+
+typedef struct {
+    uint32_t seq;
+    uint32_t check;
+    uint32_t words[RECORD_WORDS];
+} Test_Record;
+
+static Test_Record queue_storage[QUEUE_DEPTH];
+
+typedef struct {
+    Record_Queue queue;
+    uint32_t records;
+    bool wait_when_full;
+    volatile int done;
+    uint32_t received;
+    uint32_t out_of_order;
+    uint32_t torn;
+} Thread_Test;
+
+static void make_record(uint32_t seq, Test_Record *record) {
+    record->seq = seq;
+    record->check = seq * 2654435761u;
+    for (int i = 0; i < RECORD_WORDS; i++) {
+        record->words[i] = record->check ^ (uint32_t)i;
+    }
+}
+
+static bool record_intact(const Test_Record *record) {
+    if (record->check != record->seq * 2654435761u) {
+        return false;
+    }
+    for (int i = 0; i < RECORD_WORDS; i++) {
+        if (record->words[i] != (record->check ^ (uint32_t)i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *producer(void *arg) {
+    Thread_Test *test = arg;
+    Test_Record record;
+    for (uint32_t seq = 0; seq < test->records; seq++) {
+        make_record(seq, &record);
+        if (test->wait_when_full) {
+            while (record_queue_count(&test->queue) > test->queue.mask) {
+                sched_yield();
+            }
+        }
+        record_queue_push(&test->queue, &record);
+        if ((seq & 15) == 15) {
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&test->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    Thread_Test *test = arg;
+    int64_t last_seq = -1;
+    Test_Record record;
+
+    while (true) {
+        int done = __atomic_load_n(&test->done, __ATOMIC_ACQUIRE);
+        while (record_queue_pop(&test->queue, &record)) {
+            //without drops every record is the next one
+            bool in_order = test->wait_when_full ? record.seq == last_seq + 1 : record.seq > last_seq;
+            if (!in_order && test->out_of_order++ < 5) {
+                printf("  record %" PRIu32 " after %" PRId64 "\n", record.seq, last_seq);
+            }
+            if (!record_intact(&record) && test->torn++ < 5) {
+                printf("  record %" PRIu32 " is torn\n", record.seq);
+            }
+            last_seq = record.seq;
+            if (++test->received % STALL_EVERY == 0 && !test->wait_when_full) {
+                usleep(STALL_US);
+            }
+        }
+        if (done) {
+            return NULL;
+        }
+        sched_yield();
+    }
+}
+
+static bool thread_test(uint32_t records, bool wait_when_full) {
+    Thread_Test test;
+    memset(&test, 0, sizeof(test));
+    record_queue_init(&test.queue, queue_storage, sizeof(Test_Record), QUEUE_DEPTH);
+    test.records = records;
+    test.wait_when_full = wait_when_full;
+
+    pthread_t threads[2];
+    pthread_create(&threads[1], NULL, consumer, &test);
+    pthread_create(&threads[0], NULL, producer, &test);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+
+    const Record_Queue *queue = &test.queue;
+    bool ok = test.out_of_order == 0 && test.torn == 0 && test.received == queue->pushed &&
+              queue->pushed + queue->dropped == records && queue->high_water <= QUEUE_DEPTH;
+    if (wait_when_full) {
+        ok &= test.received == records;
+    }
+    else {
+        ok &= queue->dropped == 0 || queue->high_water == QUEUE_DEPTH;
+    }
+    printf("%s: %" PRIu32 " pushed, %" PRIu32 " received, %" PRIu32 " dropped, %" PRIu32 " out of order, %" PRIu32
+           " torn, high water %" PRIu32 " of %d: %s\n",
+           wait_when_full ? "Producer waits" : "Producer never waits", records, test.received, queue->dropped,
+           test.out_of_order, test.torn, queue->high_water, QUEUE_DEPTH, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1000000;
+
+    bool ok = thread_test(records, true);
+    ok &= thread_test(records, false);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+/*
+File: sd_writer.c
+Author: Leonardo DaGraca
+
+Write-behind buffer between the loggers and FatFs.
+Calling f_write and f_sync for every fix makes FatFs update the FAT and the
+directory entry each time, which dominates SD card latency and power. Records
+are collected in a RAM block instead and written with one f_write once the
+block is full. f_sync only runs when the configured time, byte or record
+budget is used up. Buffered data is only ever written in whole sectors
+(except by sd_writer_flush), so the file position stays sector aligned and
+FatFs can send the data straight to the card without copying it.
+
+A writer initialised with sd_writer_init_journal writes into the crash-safe
+journal (journal.h) instead of its own file: each commit turns the data
+buffered since the last one into a journal record, and syncing is left to the
+journal's own writer.
+
+A writer with a time index attached (log_index_attach) passes the time and the
+log offset of every commit to it, the index picks the ones it keeps.
+*/
+#include <string.h>
+#include "sd_writer.h"
+#include "journal.h"
+#include "log_index.h"
+#include "profile.h"
+
+void sd_writer_init(SD_Writer *writer, FIL *file, const SD_Writer_Config *config, uint64_t now_us) {
+    memset(writer, 0, sizeof(*writer));
+    writer->file = file;
+    writer->config = *config;
+    writer->last_sync_us = now_us;
+}
+
+void sd_writer_init_journal(SD_Writer *writer, struct Journal *journal, uint8_t kind, uint64_t now_us) {
+    memset(writer, 0, sizeof(*writer));
+    writer->journal = journal;
+    writer->journal_kind = kind;
+    writer->last_sync_us = now_us;
+}
+
+static FRESULT write_out(SD_Writer *writer, uint32_t len) {
+    if (writer->journal) {
+        //the journal counts what it cannot take, the buffer is handed over either way
+        FRESULT fr = journal_write(writer->journal, writer->journal_kind, writer->buffer, len);
+        if (fr != FR_OK) {
+            writer->errors++;
+        }
+        writer->writes++;
+        writer->fill -= len;
+        memmove(writer->buffer, writer->buffer + len, writer->fill);
+        return fr;
+    }
+
+    UINT bytes_written = 0;
+    PROFILE_START(timer);
+    FRESULT fr = f_write(writer->file, writer->buffer, len, &bytes_written);
+    PROFILE_STOP(PROFILE_SD_WRITE, timer);
+
+    writer->writes++;
+    writer->sectors += (len + SD_SECTOR_SIZE - 1) / SD_SECTOR_SIZE;
+    if (fr != FR_OK || bytes_written != len) {
+        writer->errors++;
+        fr = fr != FR_OK ? fr : FR_DISK_ERR;
+        //what reached the file leaves the buffer, the rest is written again next time
+        len = bytes_written;
+    }
+
+    //keep whatever did not fit in the write at the start of the buffer
+    writer->fill -= len;
+    memmove(writer->buffer, writer->buffer + len, writer->fill);
+    return fr;
+}
+
+static FRESULT sync_file(SD_Writer *writer, uint64_t now_us) {
+    PROFILE_START(timer);
+    FRESULT fr = f_sync(writer->file);
+    PROFILE_STOP(PROFILE_SD_SYNC, timer);
+    writer->syncs++;
+    if (fr != FR_OK) {
+        writer->errors++;
+    }
+
+    writer->bytes_since_sync = 0;
+    writer->records_since_sync = 0;
+    writer->last_sync_us = now_us;
+    return fr;
+}
+
+FRESULT sd_writer_write(SD_Writer *writer, const void *data, uint32_t len) {
+    const uint8_t *src = data;
+
+    //a full buffer that cannot be written drops the rest of the data, offset only counts what was buffered
+    while (len > 0) {
+        uint32_t space = SD_WRITER_BLOCK_SIZE - writer->fill;
+        uint32_t chunk = len < space ? len : space;
+
+        memcpy(writer->buffer + writer->fill, src, chunk);
+        writer->fill += chunk;
+        writer->offset += chunk;
+        writer->bytes_since_sync += chunk;
+        src += chunk;
+        len -= chunk;
+
+        if (writer->fill == SD_WRITER_BLOCK_SIZE) {
+            FRESULT fr = write_out(writer, SD_WRITER_BLOCK_SIZE);
+            if (fr != FR_OK) {
+                return fr;
+            }
+        }
+    }
+    return FR_OK;
+}
+
+//call once per logged record, syncs the file when the budget is used up
+FRESULT sd_writer_commit(SD_Writer *writer, uint64_t now_us) {
+    const SD_Writer_Config *config = &writer->config;
+    writer->records_since_sync++;
+
+    if (writer->index) {
+        //the index write is counted as an error of the index writer, the log goes on either way
+        log_index_add(writer->index, now_us, writer->offset);
+    }
+
+    if (writer->journal) {
+        if (writer->fill > 0) {
+            FRESULT fr = write_out(writer, writer->fill);
+            if (fr != FR_OK) {
+                return fr;
+            }
+        }
+        return journal_commit(writer->journal, now_us);
+    }
+
+    if (config->low_voltage && config->low_voltage()) {
+        return sd_writer_flush(writer, now_us);
+    }
+
+    bool due = (config->max_records && writer->records_since_sync >= config->max_records) ||
+               (config->max_bytes && writer->bytes_since_sync >= config->max_bytes) ||
+               (config->max_interval_ms && now_us - writer->last_sync_us >= (uint64_t)config->max_interval_ms * 1000);
+    if (!due) {
+        return FR_OK;
+    }
+
+    //write the whole sectors collected so far, the partial tail waits for the next block
+    uint32_t aligned = writer->fill - (writer->fill % SD_SECTOR_SIZE);
+    if (aligned > 0) {
+        FRESULT fr = write_out(writer, aligned);
+        if (fr != FR_OK) {
+            return fr;
+        }
+    }
+    return sync_file(writer, now_us);
+}
+
+//write everything that is buffered, including a partial sector, and sync
+FRESULT sd_writer_flush(SD_Writer *writer, uint64_t now_us) {
+    if (writer->fill > 0) {
+        FRESULT fr = write_out(writer, writer->fill);
+        if (fr != FR_OK) {
+            return fr;
+        }
+    }
+    if (writer->journal) {
+        return journal_flush(writer->journal, now_us);
+    }
+    return sync_file(writer, now_us);
+}
@@ -0,0 +1,52 @@
+#ifndef SD_WRITER_H
+#define SD_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ff.h"
+
+#define SD_SECTOR_SIZE 512
+
+//bytes buffered per file before they are written out with one f_write
+//must be a multiple of SD_SECTOR_SIZE, ideally the card's cluster size
+#ifndef SD_WRITER_BLOCK_SIZE
+#define SD_WRITER_BLOCK_SIZE 4096
+#endif
+
+typedef struct {
+    uint32_t max_interval_ms;   //sync at least this often (0 = no time limit)
+    uint32_t max_bytes;         //sync after this many bytes since the last sync (0 = no limit)
+    uint32_t max_records;       //sync after this many records since the last sync (0 = no limit)
+    bool (*low_voltage)(void);  //optional, flush everything when this returns true
+} SD_Writer_Config;
+
+struct Journal;
+struct Log_Index;
+
+typedef struct {
+    FIL *file;
+    struct Journal *journal;    //stream mode: blocks become journal records instead of file writes
+    uint8_t journal_kind;
+    SD_Writer_Config config;
+    uint8_t buffer[SD_WRITER_BLOCK_SIZE];
+    uint32_t fill;
+    uint32_t offset;            //bytes written to the log so far, the buffered ones included
+    struct Log_Index *index;    //optional sparse time index of the log (log_index.h)
+
+    uint32_t bytes_since_sync;
+    uint32_t records_since_sync;
+    uint64_t last_sync_us;
+
+    uint32_t writes;            //f_write calls
+    uint32_t sectors;           //sectors handed to f_write
+    uint32_t syncs;             //f_sync calls
+    uint32_t errors;
+} SD_Writer;
+
+void sd_writer_init(SD_Writer *writer, FIL *file, const SD_Writer_Config *config, uint64_t now_us);
+void sd_writer_init_journal(SD_Writer *writer, struct Journal *journal, uint8_t kind, uint64_t now_us);
+FRESULT sd_writer_write(SD_Writer *writer, const void *data, uint32_t len);
+FRESULT sd_writer_commit(SD_Writer *writer, uint64_t now_us);
+FRESULT sd_writer_flush(SD_Writer *writer, uint64_t now_us);
+
+#endif
@@ -0,0 +1,282 @@
+/*
+File: sd_writer_test.c
+Author: Leonardo DaGraca
+
+Host benchmark of the write-behind SD writer (sd_writer.h) against the
+write pattern main.c had before it, on the FatFs stand-in (host/ff_host.c).
+
+An hour of logging is replayed, at 1 and at 10 fixes per second. Each fix
+is an RMC and a VTG line for the GPS log and a line of five IMU readings for
+the IMU log, formatted like main.c and write_imu_buffer(). Before, every fix
+was one f_write per line and an f_sync of both files. Now the lines go
+through an SD_Writer per file with the sync budget of main.c (5s or 32KB).
+For each it prints the f_write and f_sync calls and the sectors the card
+programs per hour, counted by ff_host.c the way FatFs writes them: a data
+sector once complete, the partial sector at every sync, and the directory
+entry and FAT sectors a sync rewrites.
+
+It fails if the two ways leave different files, or if the writer does not
+need at least five times fewer f_write calls and fewer syncs and sector
+writes than before. Last, the card fails part way into a block twice and
+comes back, and the file must hold every byte the writer took exactly once,
+with the writer's offset equal to its length. Point it at a RAM disk (/dev/shm) to keep the real
+fsync() calls of the old pattern fast.
+
+Usage: sd_writer_test [-h hours] [dir]
+Build: cc -O2 -I. -Ihost -o sd_writer_test sd_writer_test.c sd_writer.c journal.c log_index.c host/ff_host.c
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include "ff.h"
+#include "sd_writer.h"
+
+#define SYNC_INTERVAL_MS 5000           //LOG_SYNC_INTERVAL_MS in main.c
+#define SYNC_BYTES (32 * 1024)          //LOG_SYNC_BYTES in main.c
+#define IMU_READINGS 5                  //MAX_IMU_READINGS
+#define MIN_WRITE_RATIO 5
+
+typedef struct {
+    uint32_t writes;
+    uint32_t syncs;
+    uint32_t data_sectors;
+    uint32_t meta_sectors;
+} Run_Result;
+
+//the lines main.c logs for fix n
+static void format_fix(uint32_t n, uint64_t time_us, char *rmc, char *vtg, char *imu, size_t size) {
+    int t = (int)(n / 10 % 86400);
+    snprintf(rmc, size, "%" PRIu64 ",GPRMC,%02d%02d%02d.%d0,A,4807.%05" PRIu32 ",N,01131.%05" PRIu32
+             ",E,0.%03" PRIu32 ",84.40,230394,,,A*%02" PRIX32 "\n", time_us, t / 3600, t / 60 % 60, t % 60,
+             (int)(n % 10), 3800 + n % 90000, 100 + n * 3 % 90000, n % 1000, n & 0xFF);
+    snprintf(vtg, size, "%" PRIu64 ",GPVTG,84.40,T,,M,0.%03" PRIu32 ",N,0.%03" PRIu32 ",K,A*%02" PRIX32 "\n",
+             time_us, n % 1000, n * 2 % 1000, n & 0xFF);
+    int len = snprintf(imu, size, "%" PRIu64 ",IMU: ", time_us);
+    for (int i = 0; i < IMU_READINGS; i++) {
+        int seed = (int)(n * IMU_READINGS + i);
+        len += snprintf(imu + len, size - len, "%s%d,%d,%d,%d,%d,%d", i ? ";" : "", seed % 700 - 350,
+                        seed % 500 - 250, 16384 - seed % 300, seed % 90 - 45, seed % 70 - 35, seed % 50 - 25);
+    }
+    snprintf(imu + len, size - len, "\n");
+}
+
+static bool open_logs(const char *name, FIL *gps, FIL *imu) {
+    char path[64];
+    snprintf(path, sizeof(path), "gps_%s.csv", name);
+    FRESULT fr = f_open(gps, path, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr == FR_OK) {
+        snprintf(path, sizeof(path), "imu_%s.csv", name);
+        fr = f_open(imu, path, FA_WRITE | FA_CREATE_ALWAYS);
+    }
+    if (fr != FR_OK) {
+        printf("Cannot create the %s logs: %d\n", name, fr);
+        return false;
+    }
+    return true;
+}
+
+static void take_stats(Run_Result *result) {
+    FF_Host_Stats stats;
+    ff_host_get_stats(&stats);
+    result->writes = stats.writes;
+    result->syncs = stats.syncs;
+    result->data_sectors = stats.data_sectors;
+    result->meta_sectors = stats.meta_sectors;
+}
+
+//main.c before the writer: every line written as it comes, both files synced at every fix
+static bool run_before(uint32_t fixes, uint32_t fix_period_us, Run_Result *result) {
+    FIL gps, imu;
+    if (!open_logs("before", &gps, &imu)) {
+        return false;
+    }
+    ff_host_reset_stats();
+    char rmc[128], vtg[128], line[512];
+    UINT written;
+    for (uint32_t n = 0; n < fixes; n++) {
+        format_fix(n, (uint64_t)n * fix_period_us, rmc, vtg, line, sizeof(rmc));
+        f_write(&gps, rmc, strlen(rmc), &written);
+        f_write(&gps, vtg, strlen(vtg), &written);
+        f_write(&imu, line, strlen(line), &written);
+        f_sync(&gps);
+        f_sync(&imu);
+    }
+    f_close(&gps);
+    f_close(&imu);
+    take_stats(result);
+    return true;
+}
+
+static bool run_writer(uint32_t fixes, uint32_t fix_period_us, Run_Result *result) {
+    FIL gps, imu;
+    if (!open_logs("writer", &gps, &imu)) {
+        return false;
+    }
+    ff_host_reset_stats();
+    SD_Writer_Config config = {
+        .max_interval_ms = SYNC_INTERVAL_MS,
+        .max_bytes = SYNC_BYTES,
+        .max_records = 0,
+        .low_voltage = NULL
+    };
+    SD_Writer gps_writer, imu_writer;
+    sd_writer_init(&gps_writer, &gps, &config, 0);
+    sd_writer_init(&imu_writer, &imu, &config, 0);
+
+    char rmc[128], vtg[128], line[512];
+    uint64_t time_us = 0;
+    for (uint32_t n = 0; n < fixes; n++) {
+        time_us = (uint64_t)n * fix_period_us;
+        format_fix(n, time_us, rmc, vtg, line, sizeof(rmc));
+        sd_writer_write(&gps_writer, rmc, strlen(rmc));
+        sd_writer_write(&gps_writer, vtg, strlen(vtg));
+        sd_writer_write(&imu_writer, line, strlen(line));
+        sd_writer_commit(&gps_writer, time_us);
+        sd_writer_commit(&imu_writer, time_us);
+    }
+    sd_writer_flush(&gps_writer, time_us);
+    sd_writer_flush(&imu_writer, time_us);
+    f_close(&gps);
+    f_close(&imu);
+    take_stats(result);
+    return gps_writer.errors == 0 && imu_writer.errors == 0;
+}
+
+static bool same_file(const char *a, const char *b) {
+    FIL fa, fb;
+    if (f_open(&fa, a, FA_READ) != FR_OK) {
+        return false;
+    }
+    if (f_open(&fb, b, FA_READ) != FR_OK) {
+        f_close(&fa);
+        return false;
+    }
+    bool same = f_size(&fa) == f_size(&fb);
+    char ba[4096], bb[4096];
+    UINT ra = 1, rb;
+    while (same && ra > 0) {
+        f_read(&fa, ba, sizeof(ba), &ra);
+        f_read(&fb, bb, sizeof(bb), &rb);
+        same = ra == rb && memcmp(ba, bb, ra) == 0;
+    }
+    f_close(&fa);
+    f_close(&fb);
+    return same;
+}
+
+//the card fails part way into a block and comes back: the file must hold exactly what the writer
+//took, once and in order, and the writer's offset (the time index position) must be its length
+static bool run_short_write() {
+    FIL file;
+    if (f_open(&file, "short_write.log", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+        printf("Cannot create short_write.log\n");
+        return false;
+    }
+    SD_Writer_Config config = {.max_interval_ms = SYNC_INTERVAL_MS, .max_bytes = SYNC_BYTES};
+    SD_Writer writer;
+    sd_writer_init(&writer, &file, &config, 0);
+
+    static char expected[64 * 1024];
+    uint32_t expected_len = 0, failed = 0;
+    char line[256];
+    for (uint32_t n = 0; n < 400; n++) {
+        if (n == 100 || n == 250) {
+            //the next block write gets 1000 bytes through
+            ff_host_cut_power_after(1000);
+        }
+        if (n == 200 || n == 330) {
+            ff_host_cut_power_after(-1);
+        }
+        int len = snprintf(line, sizeof(line), "%05" PRIu32 ",%0*d\n", n, (int)(n % 150) + 1, 0);
+        uint32_t offset = writer.offset;
+        if (sd_writer_write(&writer, line, (uint32_t)len) != FR_OK) {
+            failed++;
+        }
+        memcpy(expected + expected_len, line, writer.offset - offset);
+        expected_len += writer.offset - offset;
+        sd_writer_commit(&writer, (uint64_t)n * 100000);
+    }
+    sd_writer_flush(&writer, 40000000);
+    f_close(&file);
+
+    bool ok = failed > 0 && writer.offset == expected_len;
+    FIL check;
+    static char actual[64 * 1024];
+    UINT read = 0;
+    if (f_open(&check, "short_write.log", FA_READ) == FR_OK) {
+        ok &= f_size(&check) == expected_len;
+        f_read(&check, actual, sizeof(actual), &read);
+        f_close(&check);
+    }
+    ok &= read == expected_len && memcmp(actual, expected, expected_len) == 0;
+    printf("Failing card: %" PRIu32 " writes refused, %" PRIu32 " bytes taken, %u in the file, offset %" PRIu32 ", %s\n",
+           failed, expected_len, read, writer.offset, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static void print_result(const char *name, const Run_Result *r, double hours) {
+    printf("  %-7s %9.0f f_write %8.0f f_sync %9.0f data sectors %8.0f FAT/dir sectors %9.0f sector writes\n", name,
+           r->writes / hours, r->syncs / hours, r->data_sectors / hours, r->meta_sectors / hours,
+           (r->data_sectors + r->meta_sectors) / hours);
+}
+
+static bool run_rate(uint32_t fix_hz, double hours) {
+    uint32_t fixes = (uint32_t)(hours * 3600 * fix_hz);
+    uint32_t period_us = 1000000 / fix_hz;
+    Run_Result before, writer;
+    if (!run_before(fixes, period_us, &before) || !run_writer(fixes, period_us, &writer)) {
+        printf("FAIL: write errors\n");
+        return false;
+    }
+
+    printf("%" PRIu32 " fix/s, per hour:\n", fix_hz);
+    print_result("before", &before, hours);
+    print_result("writer", &writer, hours);
+
+    bool ok = true;
+    if (!same_file("gps_before.csv", "gps_writer.csv") || !same_file("imu_before.csv", "imu_writer.csv")) {
+        printf("FAIL: the logs differ\n");
+        ok = false;
+    }
+    if (writer.writes * MIN_WRITE_RATIO > before.writes || writer.syncs >= before.syncs ||
+        writer.data_sectors + writer.meta_sectors >= before.data_sectors + before.meta_sectors) {
+        printf("FAIL: the writer does not save writes, syncs and sectors\n");
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    double hours = 1;
+    const char *dir = ".";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+            hours = atof(argv[++i]);
+        }
+        else if (argv[i][0] != '-') {
+            dir = argv[i];
+        }
+        else {
+            fprintf(stderr, "Usage: %s [-h hours] [dir]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (hours <= 0) {
+        hours = 1;
+    }
+
+    ff_host_set_root(dir);
+    FATFS fs;
+    if (f_mount(&fs, "", 1) != FR_OK) {
+        printf("Cannot use %s\n", dir);
+        return 1;
+    }
+
+    bool ok = run_rate(1, hours);
+    ok &= run_rate(10, hours);
+    ok &= run_short_write();
+    printf(ok ? "OK\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
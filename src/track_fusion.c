@@ -0,0 +1,304 @@
+/*
+File: track_fusion.c
+Author: Leonardo DaGraca
+
+GPS/IMU extended Kalman filter, see track_fusion.h. With a the attitude frame
+acceleration rotated by the heading offset psi,
+  a_e = cos(psi) ax - sin(psi) ay,  a_n = sin(psi) ax + cos(psi) ay
+one step of dt is
+  e += ve dt + a_e dt^2 / 2,  ve += a_e dt  (north the same with a_n)
+and its Jacobian F is the identity plus dt at (e, ve) and (n, vn) and the
+column d/dpsi = [-a_n dt^2 / 2, a_e dt^2 / 2, -a_n dt, a_e dt, 1]. F P F^T is
+done in place with those few entries: rows e and n take from rows ve, vn and
+psi before these change, rows ve and vn only from psi, which F leaves as is,
+then the same over the columns.
+
+Every measurement observes one state directly, so the update is four scalar
+updates with no matrix inverse: K = P[:, i] / (P[i][i] + r), P -= K P[i, :].
+*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "track_fusion.h"
+#include "geo.h"
+
+#define Q30_ONE (1 << 30)
+#define PI_F 3.14159265f
+#define STANDARD_GRAVITY 9.80665f
+
+static float wrap_pi(float angle) {
+    while (angle > PI_F) {
+        angle -= 2.0f * PI_F;
+    }
+    while (angle < -PI_F) {
+        angle += 2.0f * PI_F;
+    }
+    return angle;
+}
+
+static void set_yaw(Track_Fusion *fusion, float yaw) {
+    fusion->x[FUSION_YAW] = wrap_pi(yaw);
+    fusion->yaw_cos = cosf(fusion->x[FUSION_YAW]);
+    fusion->yaw_sin = sinf(fusion->x[FUSION_YAW]);
+}
+
+void track_fusion_init(Track_Fusion *fusion) {
+    memset(fusion, 0, sizeof(*fusion));
+    set_yaw(fusion, 0.0f);
+}
+
+void track_fusion_attitude_accel(const Attitude *attitude, float accel[2]) {
+    //first two rows of the rotation matrix of q, each product in Q30
+    int64_t q0 = attitude->q[0], q1 = attitude->q[1], q2 = attitude->q[2], q3 = attitude->q[3];
+    float r00 = (float)(Q30_ONE - 2 * ((q2 * q2 + q3 * q3) >> 30)) / Q30_ONE;
+    float r01 = (float)(2 * ((q1 * q2 - q0 * q3) >> 30)) / Q30_ONE;
+    float r02 = (float)(2 * ((q1 * q3 + q0 * q2) >> 30)) / Q30_ONE;
+    float r10 = (float)(2 * ((q1 * q2 + q0 * q3) >> 30)) / Q30_ONE;
+    float r11 = (float)(Q30_ONE - 2 * ((q1 * q1 + q3 * q3) >> 30)) / Q30_ONE;
+    float r12 = (float)(2 * ((q2 * q3 - q0 * q1) >> 30)) / Q30_ONE;
+
+    const int32_t *lin = attitude->linear_mg;
+    accel[0] = (r00 * lin[0] + r01 * lin[1] + r02 * lin[2]) * (STANDARD_GRAVITY / 1000.0f);
+    accel[1] = (r10 * lin[0] + r11 * lin[1] + r12 * lin[2]) * (STANDARD_GRAVITY / 1000.0f);
+}
+
+static void propagate(Track_Fusion *fusion, float dt, const float accel[2], float accel_noise) {
+    float *x = fusion->x;
+    float (*p)[FUSION_STATES] = fusion->p;
+
+    float a_e = 0.0f, a_n = 0.0f;
+    if (accel) {
+        float c = fusion->yaw_cos, s = fusion->yaw_sin;
+        a_e = c * accel[0] - s * accel[1];
+        a_n = s * accel[0] + c * accel[1];
+    }
+
+    float half_dt2 = 0.5f * dt * dt;
+    x[FUSION_E] += x[FUSION_VE] * dt + a_e * half_dt2;
+    x[FUSION_N] += x[FUSION_VN] * dt + a_n * half_dt2;
+    x[FUSION_VE] += a_e * dt;
+    x[FUSION_VN] += a_n * dt;
+
+    //the psi column of F, zero without acceleration
+    float f_e = -a_n * half_dt2, f_n = a_e * half_dt2, f_ve = -a_n * dt, f_vn = a_e * dt;
+
+    //F P
+    for (int j = 0; j < FUSION_STATES; j++) {
+        p[FUSION_E][j] += dt * p[FUSION_VE][j] + f_e * p[FUSION_YAW][j];
+        p[FUSION_N][j] += dt * p[FUSION_VN][j] + f_n * p[FUSION_YAW][j];
+        p[FUSION_VE][j] += f_ve * p[FUSION_YAW][j];
+        p[FUSION_VN][j] += f_vn * p[FUSION_YAW][j];
+    }
+    //(F P) F^T
+    for (int i = 0; i < FUSION_STATES; i++) {
+        p[i][FUSION_E] += dt * p[i][FUSION_VE] + f_e * p[i][FUSION_YAW];
+        p[i][FUSION_N] += dt * p[i][FUSION_VN] + f_n * p[i][FUSION_YAW];
+        p[i][FUSION_VE] += f_ve * p[i][FUSION_YAW];
+        p[i][FUSION_VN] += f_vn * p[i][FUSION_YAW];
+    }
+
+    //white acceleration noise integrated over the step, per axis
+    float q = accel_noise * accel_noise;
+    float q_pp = q * dt * dt * dt * (1.0f / 3.0f), q_pv = q * half_dt2, q_vv = q * dt;
+    p[FUSION_E][FUSION_E] += q_pp;
+    p[FUSION_N][FUSION_N] += q_pp;
+    p[FUSION_E][FUSION_VE] += q_pv;
+    p[FUSION_VE][FUSION_E] += q_pv;
+    p[FUSION_N][FUSION_VN] += q_pv;
+    p[FUSION_VN][FUSION_N] += q_pv;
+    p[FUSION_VE][FUSION_VE] += q_vv;
+    p[FUSION_VN][FUSION_VN] += q_vv;
+    p[FUSION_YAW][FUSION_YAW] += FUSION_YAW_DRIFT * FUSION_YAW_DRIFT * dt;
+}
+
+void track_fusion_predict(Track_Fusion *fusion, uint64_t time_us, const float accel[2]) {
+    if (!fusion->has_origin || time_us <= fusion->time_us) {
+        return;
+    }
+    uint64_t dt_us = time_us - fusion->time_us;
+    fusion->time_us = time_us;
+    fusion->predictions++;
+
+    if (dt_us > FUSION_MAX_DT_US) {
+        //the acceleration over the gap is unknown, only carry the velocity
+        fusion->gaps++;
+        propagate(fusion, (float)dt_us * 1e-6f, NULL, FUSION_ACCEL_NOISE_UNALIGNED);
+        return;
+    }
+
+    float dt = (float)dt_us * 1e-6f;
+    fusion->attitude_dv[0] += accel[0] * dt;
+    fusion->attitude_dv[1] += accel[1] * dt;
+    if (fusion->aligned) {
+        propagate(fusion, dt, accel, FUSION_ACCEL_NOISE);
+    }
+    else {
+        propagate(fusion, dt, NULL, FUSION_ACCEL_NOISE_UNALIGNED);
+    }
+}
+
+//one scalar measurement z of state i with variance r, false if it is outside the gate
+static bool update(Track_Fusion *fusion, int i, float z, float r) {
+    float *x = fusion->x;
+    float (*p)[FUSION_STATES] = fusion->p;
+
+    float innovation = z - x[i];
+    float s = p[i][i] + r;
+    if (innovation * innovation > FUSION_GATE_SIGMA * FUSION_GATE_SIGMA * s) {
+        fusion->rejected++;
+        return false;
+    }
+
+    float k[FUSION_STATES];
+    float row[FUSION_STATES];
+    float inv_s = 1.0f / s;
+    for (int j = 0; j < FUSION_STATES; j++) {
+        k[j] = p[j][i] * inv_s;
+        row[j] = p[i][j];
+    }
+    for (int a = 0; a < FUSION_STATES; a++) {
+        x[a] += k[a] * innovation;
+        for (int b = 0; b < FUSION_STATES; b++) {
+            p[a][b] -= k[a] * row[b];
+        }
+    }
+    if (k[FUSION_YAW] != 0.0f) {
+        set_yaw(fusion, x[FUSION_YAW]);
+    }
+    return true;
+}
+
+//position and velocity from the fix with their prior variances, the heading offset is kept
+static void start_at(Track_Fusion *fusion, float east, float north, const float v[2]) {
+    float yaw = fusion->x[FUSION_YAW];
+    float yaw_var = fusion->aligned ? fusion->p[FUSION_YAW][FUSION_YAW] : PI_F * PI_F;
+    memset(fusion->x, 0, sizeof(fusion->x));
+    memset(fusion->p, 0, sizeof(fusion->p));
+
+    fusion->x[FUSION_E] = east;
+    fusion->x[FUSION_N] = north;
+    fusion->x[FUSION_VE] = v[0];
+    fusion->x[FUSION_VN] = v[1];
+    set_yaw(fusion, yaw);
+    fusion->p[FUSION_E][FUSION_E] = FUSION_GPS_POSITION_SIGMA * FUSION_GPS_POSITION_SIGMA;
+    fusion->p[FUSION_N][FUSION_N] = FUSION_GPS_POSITION_SIGMA * FUSION_GPS_POSITION_SIGMA;
+    fusion->p[FUSION_VE][FUSION_VE] = 1.0f;
+    fusion->p[FUSION_VN][FUSION_VN] = 1.0f;
+    fusion->p[FUSION_YAW][FUSION_YAW] = yaw_var;
+}
+
+//heading offset from the velocity changes between this fix and the last one
+static void align(Track_Fusion *fusion, const float v[2]) {
+    float gps_dv[2] = {v[0] - fusion->last_gps_v[0], v[1] - fusion->last_gps_v[1]};
+    const float *att_dv = fusion->attitude_dv;
+
+    //gps_dv = e^(i psi) attitude_dv as complex numbers east + i north, psi is the angle of their product
+    fusion->align_re += gps_dv[0] * att_dv[0] + gps_dv[1] * att_dv[1];
+    fusion->align_im += gps_dv[1] * att_dv[0] - gps_dv[0] * att_dv[1];
+    fusion->align_gps_sq += gps_dv[0] * gps_dv[0] + gps_dv[1] * gps_dv[1];
+    fusion->align_attitude_sq += att_dv[0] * att_dv[0] + att_dv[1] * att_dv[1];
+
+    if (fusion->align_gps_sq < FUSION_ALIGN_DV * FUSION_ALIGN_DV) {
+        return;
+    }
+    float product_sq = fusion->align_re * fusion->align_re + fusion->align_im * fusion->align_im;
+    float coherence_sq = FUSION_ALIGN_COHERENCE * FUSION_ALIGN_COHERENCE;
+    if (product_sq < coherence_sq * fusion->align_gps_sq * fusion->align_attitude_sq) {
+        return;
+    }
+
+    fusion->aligned = true;
+    set_yaw(fusion, atan2f(fusion->align_im, fusion->align_re));
+    for (int i = 0; i < FUSION_STATES; i++) {
+        fusion->p[i][FUSION_YAW] = 0.0f;
+        fusion->p[FUSION_YAW][i] = 0.0f;
+    }
+    //the leftover error is mostly the GPS speed noise over the velocity change
+    float yaw_sigma = FUSION_GPS_VELOCITY_SIGMA / sqrtf(fusion->align_gps_sq);
+    fusion->p[FUSION_YAW][FUSION_YAW] = yaw_sigma * yaw_sigma;
+}
+
+void track_fusion_add_fix(Track_Fusion *fusion, uint64_t time_us, int32_t lat_e7, int32_t lon_e7,
+                          uint32_t speed_mm_s, uint32_t course_cdeg) {
+    float speed = (float)speed_mm_s * 1e-3f;
+    float course = (float)course_cdeg * (PI_F / 18000.0f);
+    //course over ground is clockwise from north
+    float v[2] = {speed * sinf(course), speed * cosf(course)};
+
+    if (!fusion->has_origin) {
+        fusion->has_origin = true;
+        fusion->origin_lat_e7 = lat_e7;
+        fusion->origin_lon_e7 = lon_e7;
+        fusion->origin_cos_q30 = geo_cos_q30(lat_e7);
+        fusion->time_us = time_us;
+        start_at(fusion, 0.0f, 0.0f, v);
+    }
+    else {
+        if (time_us > fusion->time_us) {
+            //fix after the last IMU sample
+            propagate(fusion, (float)(time_us - fusion->time_us) * 1e-6f, NULL,
+                      fusion->aligned ? FUSION_ACCEL_NOISE : FUSION_ACCEL_NOISE_UNALIGNED);
+            fusion->time_us = time_us;
+        }
+        if (!fusion->aligned && fusion->has_gps_v) {
+            align(fusion, v);
+        }
+
+        int64_t x_mm, y_mm;
+        geo_offset_mm(fusion->origin_lat_e7, fusion->origin_lon_e7, fusion->origin_cos_q30, lat_e7, lon_e7,
+                      &x_mm, &y_mm);
+        float east = (float)x_mm * 1e-3f, north = (float)y_mm * 1e-3f;
+        float r_position = FUSION_GPS_POSITION_SIGMA * FUSION_GPS_POSITION_SIGMA;
+        bool east_ok = update(fusion, FUSION_E, east, r_position);
+        bool north_ok = update(fusion, FUSION_N, north, r_position);
+
+        if (east_ok || north_ok) {
+            fusion->rejected_in_row = 0;
+        }
+        else if (++fusion->rejected_in_row >= FUSION_RESTART_FIXES) {
+            //the filter lost the track (a long gap, a bad heading offset), the GPS is right
+            fusion->restarts++;
+            fusion->rejected_in_row = 0;
+            start_at(fusion, east, north, v);
+        }
+
+        float r_velocity = FUSION_GPS_VELOCITY_SIGMA * FUSION_GPS_VELOCITY_SIGMA;
+        if (speed < FUSION_MIN_COURSE_SPEED) {
+            r_velocity += 1.0f;
+        }
+        update(fusion, FUSION_VE, v[0], r_velocity);
+        update(fusion, FUSION_VN, v[1], r_velocity);
+    }
+
+    fusion->last_gps_v[0] = v[0];
+    fusion->last_gps_v[1] = v[1];
+    fusion->has_gps_v = true;
+    fusion->attitude_dv[0] = 0.0f;
+    fusion->attitude_dv[1] = 0.0f;
+    fusion->fixes++;
+}
+
+bool track_fusion_point(const Track_Fusion *fusion, Track_Fusion_Point *point) {
+    if (!fusion->has_origin) {
+        return false;
+    }
+    const float *x = fusion->x;
+    point->time_us = fusion->time_us;
+    geo_position_from_offset(fusion->origin_lat_e7, fusion->origin_lon_e7, fusion->origin_cos_q30,
+                             (int64_t)(x[FUSION_E] * 1000.0f), (int64_t)(x[FUSION_N] * 1000.0f),
+                             &point->lat_e7, &point->lon_e7);
+    point->east_mm_s = (int32_t)(x[FUSION_VE] * 1000.0f);
+    point->north_mm_s = (int32_t)(x[FUSION_VN] * 1000.0f);
+    point->sigma_mm = (uint32_t)(sqrtf(fusion->p[FUSION_E][FUSION_E] + fusion->p[FUSION_N][FUSION_N]) * 1000.0f);
+    point->aligned = fusion->aligned;
+    return true;
+}
+
+int track_fusion_format(const Track_Fusion_Point *point, char *buf, size_t size) {
+    char lat[16], lon[16];
+    geo_format_e7(point->lat_e7, lat, sizeof(lat));
+    geo_format_e7(point->lon_e7, lon, sizeof(lon));
+    return snprintf(buf, size, "%" PRIu64 ",%s,%s,%" PRId32 ",%" PRId32 ",%" PRIu32 ",%d\n", point->time_us, lat, lon,
+                    point->east_mm_s, point->north_mm_s, point->sigma_mm, point->aligned ? 1 : 0);
+}
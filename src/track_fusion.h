@@ -0,0 +1,132 @@
+/*
+File: track_fusion.h
+Author: Leonardo DaGraca
+
+GPS/IMU dead reckoning: an extended Kalman filter that carries the position
+forward with every IMU sample between the fixes, so the track has the IMU
+rate instead of one point per fix.
+
+State: east and north position (m from the first fix), east and north velocity
+(m/s) and the heading offset (rad) between the attitude filter's earth frame
+and true north. The attitude filter (attitude.h) has no magnetometer, so its
+heading starts at an arbitrary angle and drifts slowly. The offset is what
+rotates its horizontal linear acceleration onto east/north. It is the one
+nonlinear part of the model, and the EKF refines it from every fix as the GPS
+velocity shows where the acceleration actually went.
+
+- track_fusion_predict() for every IMU sample integrates the acceleration
+  (rotated by the offset) into velocity and position and propagates the
+  covariance. The structure of the model is written out, so a sample costs
+  ~90 float multiplies and ~80 adds, with no matrix library, division or
+  trigonometry (the sine and cosine of the offset only change with a fix).
+- track_fusion_add_fix() applies the RMC position, and the velocity from its
+  speed and course over ground, as four scalar updates. A measurement more
+  than FUSION_GATE_SIGMA standard deviations from the prediction is skipped.
+
+Until the offset is known the prediction runs without the acceleration (a
+constant velocity model with a large process noise). The offset is first
+found from the velocity changes between fixes: the change measured by the GPS
+is the change integrated from the attitude frame acceleration rotated by the
+offset. It is taken once their correlation is clear over FUSION_ALIGN_DV of
+velocity change.
+
+Single precision throughout: positions relative to the first fix keep mm
+resolution over tens of km, the M0+ runs it through the SDK's float routines.
+The RMC arrival time is taken as the time of the fix.
+*/
+#ifndef TRACK_FUSION_H
+#define TRACK_FUSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "attitude.h"
+
+#define FUSION_STATES 5
+#define FUSION_E 0                  //east position, m
+#define FUSION_N 1                  //north position, m
+#define FUSION_VE 2                 //east velocity, m/s
+#define FUSION_VN 3                 //north velocity, m/s
+#define FUSION_YAW 4                //attitude frame -> east/north, rad counterclockwise
+
+//noise model, tuned with fusion_test.c
+#define FUSION_ACCEL_NOISE 0.6f             //m/s^2, tilt error and stride noise in the linear acceleration
+#define FUSION_ACCEL_NOISE_UNALIGNED 3.0f   //m/s^2, before the heading offset is known
+#define FUSION_YAW_DRIFT 0.003f             //rad/sqrt(s), heading drift of the attitude filter
+#define FUSION_GPS_POSITION_SIGMA 2.5f      //m
+#define FUSION_GPS_VELOCITY_SIGMA 0.3f      //m/s per axis
+#define FUSION_MIN_COURSE_SPEED 1.0f        //m/s, the course below this is mostly noise
+#define FUSION_GATE_SIGMA 5.0f
+#define FUSION_RESTART_FIXES 3
+
+//velocity change seen by both sensors before the heading offset is trusted, and how well it must agree
+#define FUSION_ALIGN_DV 6.0f                //m/s
+#define FUSION_ALIGN_COHERENCE 0.8f
+
+//samples further apart than this are a gap (FIFO overflow), the time is bridged without acceleration
+#define FUSION_MAX_DT_US 50000
+
+#define FUSION_CSV_HEADER "Timestamp,Latitude,Longitude,East_mm_s,North_mm_s,Sigma_mm,Aligned\n"
+
+typedef struct {
+    uint64_t time_us;
+    int32_t lat_e7;
+    int32_t lon_e7;
+    int32_t east_mm_s;
+    int32_t north_mm_s;
+    uint32_t sigma_mm;          //one standard deviation of the horizontal position
+    bool aligned;
+} Track_Fusion_Point;
+
+//points handed from core 0 to core 1 in GPS_IMU_FUSION builds, 160ms at 200Hz
+#define FUSION_BLOCK_POINTS 32
+
+typedef struct {
+    uint32_t count;
+    Track_Fusion_Point points[FUSION_BLOCK_POINTS];
+} Track_Fusion_Block;
+
+typedef struct {
+    float x[FUSION_STATES];
+    float p[FUSION_STATES][FUSION_STATES];
+    float yaw_cos;              //of x[FUSION_YAW]
+    float yaw_sin;
+    uint64_t time_us;           //of the state
+
+    bool has_origin;            //first fix seen, the filter runs from here
+    int32_t origin_lat_e7;
+    int32_t origin_lon_e7;
+    uint32_t origin_cos_q30;
+
+    //heading offset bootstrap: velocity change since the last fix in the attitude frame and the
+    //sum of gps_dv * conj(attitude_dv) over the fixes so far
+    bool aligned;
+    float attitude_dv[2];
+    float last_gps_v[2];
+    bool has_gps_v;
+    float align_re;
+    float align_im;
+    float align_gps_sq;
+    float align_attitude_sq;
+
+    uint32_t predictions;
+    uint32_t fixes;
+    uint32_t rejected;          //scalar measurements outside the gate
+    uint32_t restarts;          //the filter was put back on the fix after FUSION_RESTART_FIXES rejected positions
+    uint32_t gaps;
+    uint8_t rejected_in_row;
+} Track_Fusion;
+
+void track_fusion_init(Track_Fusion *fusion);
+//horizontal linear acceleration of the last sample in the attitude's earth frame, m/s^2
+void track_fusion_attitude_accel(const Attitude *attitude, float accel[2]);
+void track_fusion_predict(Track_Fusion *fusion, uint64_t time_us, const float accel[2]);
+//a valid RMC fix, speed and course as in NMEA_RMC
+void track_fusion_add_fix(Track_Fusion *fusion, uint64_t time_us, int32_t lat_e7, int32_t lon_e7,
+                          uint32_t speed_mm_s, uint32_t course_cdeg);
+//the current state as a track point, false before the first fix
+bool track_fusion_point(const Track_Fusion *fusion, Track_Fusion_Point *point);
+//one FUSION_CSV_HEADER row
+int track_fusion_format(const Track_Fusion_Point *point, char *buf, size_t size);
+
+#endif
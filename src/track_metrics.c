@@ -0,0 +1,111 @@
+/*
+File: track_metrics.c
+Author: Leonardo DaGraca
+
+Streaming session metrics: distance, speed, pace, sprints and movement intensity.
+Fixes and IMU samples are consumed as they arrive and only running totals are
+kept, so there is no allocation and no file access. The same source is built
+into the firmware and into the host tool gps_metrics.c. Distances come from the
+integer-only geo_distance_mm_fast() and all totals are integers, so both
+produce bit-for-bit the same numbers from the same input.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "track_metrics.h"
+#include "geo.h"
+
+void track_metrics_init(Track_Metrics *metrics) {
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+static void update_derived(Track_Metrics *metrics) {
+    Track_Summary *s = &metrics->summary;
+
+    if (s->moving_time_us > 0) {
+        s->avg_speed_mm_s = (uint32_t)(s->distance_mm * 1000000 / s->moving_time_us);
+    }
+    s->pace_s_per_km = s->avg_speed_mm_s ? 1000000 / s->avg_speed_mm_s : 0;
+
+    s->intensity_mg = metrics->intensity_counts * 1000 / TRACK_ACCEL_1G;
+    if (s->elapsed_us > 0) {
+        s->intensity_per_min = (uint32_t)(s->intensity_mg * 60000000 / s->elapsed_us);
+    }
+}
+
+//time_us is the local timestamp of the fix, only valid fixes count towards the totals
+void track_metrics_add_fix(Track_Metrics *metrics, uint64_t time_us, const NMEA_RMC *rmc) {
+    Track_Summary *s = &metrics->summary;
+    if (!rmc->valid) {
+        return;
+    }
+
+    s->fixes++;
+    s->speed_mm_s = rmc->speed_mm_s;
+    if (rmc->speed_mm_s > s->max_speed_mm_s) {
+        s->max_speed_mm_s = rmc->speed_mm_s;
+    }
+
+    if (!metrics->has_fix) {
+        metrics->first_fix_us = time_us;
+    }
+    else {
+        uint64_t dt = time_us - metrics->prev_fix_us;
+        bool moving = rmc->speed_mm_s >= TRACK_MOVING_SPEED_MM_S;
+
+        if (moving && dt <= TRACK_MAX_GAP_US) {
+            s->distance_mm += geo_distance_mm_fast(metrics->prev_lat_e7, metrics->prev_lon_e7,
+                                                   rmc->lat_e7, rmc->lon_e7);
+            s->moving_time_us += dt;
+        }
+    }
+
+    //count a sprint once the speed has stayed above the threshold long enough
+    if (rmc->speed_mm_s >= TRACK_SPRINT_SPEED_MM_S) {
+        if (!metrics->in_sprint) {
+            metrics->in_sprint = true;
+            metrics->sprint_counted = false;
+            metrics->sprint_start_us = time_us;
+        }
+        if (!metrics->sprint_counted && time_us - metrics->sprint_start_us >= TRACK_SPRINT_MIN_MS * 1000ULL) {
+            s->sprints++;
+            metrics->sprint_counted = true;
+        }
+    }
+    else {
+        metrics->in_sprint = false;
+    }
+
+    metrics->has_fix = true;
+    metrics->prev_lat_e7 = rmc->lat_e7;
+    metrics->prev_lon_e7 = rmc->lon_e7;
+    metrics->prev_fix_us = time_us;
+    s->elapsed_us = time_us - metrics->first_fix_us;
+    update_derived(metrics);
+}
+
+//offset-corrected accelerometer counts, intensity accumulates the change between samples
+void track_metrics_add_imu(Track_Metrics *metrics, int32_t ax, int32_t ay, int32_t az) {
+    if (metrics->has_imu) {
+        int64_t dx = ax - metrics->prev_ax;
+        int64_t dy = ay - metrics->prev_ay;
+        int64_t dz = az - metrics->prev_az;
+        metrics->intensity_counts += geo_isqrt_u64((uint64_t)(dx * dx + dy * dy + dz * dz));
+    }
+
+    metrics->has_imu = true;
+    metrics->prev_ax = ax;
+    metrics->prev_ay = ay;
+    metrics->prev_az = az;
+    metrics->summary.imu_samples++;
+}
+
+//one line summary: header "Fixes,Distance_m,Moving_s,Avg_kmh,Max_kmh,Pace_s_per_km,Sprints,IMU_Samples,Intensity_mg,Intensity_per_min"
+int track_metrics_format(const Track_Summary *s, char *buf, size_t size) {
+    return snprintf(buf, size, "%" PRIu32 ",%" PRIu64 ".%03" PRIu64 ",%" PRIu64 ",%" PRIu32 ".%02" PRIu32
+                    ",%" PRIu32 ".%02" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu64 ",%" PRIu64 ",%" PRIu32 "\n",
+                    s->fixes, s->distance_mm / 1000, s->distance_mm % 1000, s->moving_time_us / 1000000,
+                    s->avg_speed_mm_s * 36 / 10000, s->avg_speed_mm_s * 36 / 100 % 100,
+                    s->max_speed_mm_s * 36 / 10000, s->max_speed_mm_s * 36 / 100 % 100,
+                    s->pace_s_per_km, s->sprints, s->imu_samples, s->intensity_mg, s->intensity_per_min);
+}
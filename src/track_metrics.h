@@ -0,0 +1,56 @@
+#ifndef TRACK_METRICS_H
+#define TRACK_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "nmea_parser.h"
+#include "mpu6050_scale.h"
+
+//segments slower than this are treated as GPS jitter while standing still
+#define TRACK_MOVING_SPEED_MM_S 500
+//a sprint is at least TRACK_SPRINT_MIN_MS above 5.5 m/s (19.8 km/h)
+#define TRACK_SPRINT_SPEED_MM_S 5500
+#define TRACK_SPRINT_MIN_MS 1000
+//gaps longer than this between fixes are not counted as moving time
+#define TRACK_MAX_GAP_US 5000000
+#define TRACK_ACCEL_1G MPU6050_ACCEL_1G
+
+typedef struct {
+    uint64_t distance_mm;
+    uint64_t moving_time_us;
+    uint64_t elapsed_us;
+    uint32_t speed_mm_s;        //latest reported speed
+    uint32_t max_speed_mm_s;
+    uint32_t avg_speed_mm_s;    //distance / moving time
+    uint32_t pace_s_per_km;     //from the average speed, 0 until moving
+    uint32_t sprints;
+    uint32_t fixes;
+    uint64_t imu_samples;
+    uint64_t intensity_mg;      //accumulated change of acceleration (PlayerLoad style)
+    uint32_t intensity_per_min;
+} Track_Summary;
+
+typedef struct {
+    Track_Summary summary;
+
+    bool has_fix;
+    int32_t prev_lat_e7;
+    int32_t prev_lon_e7;
+    uint64_t prev_fix_us;
+    uint64_t first_fix_us;
+    uint64_t sprint_start_us;
+    bool in_sprint;
+    bool sprint_counted;
+
+    bool has_imu;
+    int32_t prev_ax, prev_ay, prev_az;
+    uint64_t intensity_counts;
+} Track_Metrics;
+
+void track_metrics_init(Track_Metrics *metrics);
+void track_metrics_add_fix(Track_Metrics *metrics, uint64_t time_us, const NMEA_RMC *rmc);
+void track_metrics_add_imu(Track_Metrics *metrics, int32_t ax, int32_t ay, int32_t az);
+int track_metrics_format(const Track_Summary *summary, char *buf, size_t size);
+
+#endif
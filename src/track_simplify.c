@@ -0,0 +1,167 @@
+/*
+File: track_simplify.c
+Author: Leonardo DaGraca
+
+Streaming and Douglas-Peucker track simplification, see track_simplify.h.
+*/
+#include <stdio.h>
+#include <inttypes.h>
+#include "track_simplify.h"
+#include "geo.h"
+
+//offsets are clamped here so the 64-bit dot and cross products cannot overflow
+#define MAX_OFFSET_MM 1000000000LL
+
+static int64_t clamp_offset(int64_t mm) {
+    if (mm > MAX_OFFSET_MM) {
+        return MAX_OFFSET_MM;
+    }
+    if (mm < -MAX_OFFSET_MM) {
+        return -MAX_OFFSET_MM;
+    }
+    return mm;
+}
+
+static uint32_t length_mm(int64_t x, int64_t y) {
+    uint64_t length = geo_isqrt_u64((uint64_t)(x * x + y * y));
+    return length > UINT32_MAX ? UINT32_MAX : (uint32_t)length;
+}
+
+void track_segment_init(Track_Segment *segment, const Track_Point *start, const Track_Point *end) {
+    segment->lat_e7 = start->lat_e7;
+    segment->lon_e7 = start->lon_e7;
+    segment->cos_q30 = geo_cos_q30(start->lat_e7);
+
+    int64_t x, y;
+    geo_offset_mm(start->lat_e7, start->lon_e7, segment->cos_q30, end->lat_e7, end->lon_e7, &x, &y);
+    segment->dx_mm = clamp_offset(x);
+    segment->dy_mm = clamp_offset(y);
+    segment->length_sq = segment->dx_mm * segment->dx_mm + segment->dy_mm * segment->dy_mm;
+    segment->length_mm = geo_isqrt_u64((uint64_t)segment->length_sq);
+}
+
+uint32_t track_segment_distance_mm(const Track_Segment *segment, const Track_Point *point) {
+    int64_t x, y;
+    geo_offset_mm(segment->lat_e7, segment->lon_e7, segment->cos_q30, point->lat_e7, point->lon_e7, &x, &y);
+    x = clamp_offset(x);
+    y = clamp_offset(y);
+
+    //beyond either end the nearest point of the segment is that end
+    int64_t dot = x * segment->dx_mm + y * segment->dy_mm;
+    if (segment->length_mm == 0 || dot <= 0) {
+        return length_mm(x, y);
+    }
+    if (dot >= segment->length_sq) {
+        return length_mm(x - segment->dx_mm, y - segment->dy_mm);
+    }
+
+    int64_t cross = x * segment->dy_mm - y * segment->dx_mm;
+    uint64_t distance = (uint64_t)(cross < 0 ? -cross : cross) / segment->length_mm;
+    return distance > UINT32_MAX ? UINT32_MAX : (uint32_t)distance;
+}
+
+void track_simplifier_init(Track_Simplifier *simplifier, uint32_t tolerance_mm) {
+    simplifier->tolerance_mm = tolerance_mm;
+    simplifier->has_anchor = false;
+    simplifier->count = 0;
+    simplifier->points_in = 0;
+    simplifier->points_out = 0;
+}
+
+//would every fix in the window stay within the tolerance if the line went from the anchor to point
+static bool window_fits(const Track_Simplifier *simplifier, const Track_Point *point) {
+    Track_Segment segment;
+    track_segment_init(&segment, &simplifier->anchor, point);
+    for (uint32_t i = 0; i < simplifier->count; i++) {
+        if (track_segment_distance_mm(&segment, &simplifier->window[i]) > simplifier->tolerance_mm) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool track_simplifier_add(Track_Simplifier *simplifier, const Track_Point *point, Track_Point *kept) {
+    simplifier->points_in++;
+
+    if (!simplifier->has_anchor) {
+        simplifier->anchor = *point;
+        simplifier->has_anchor = true;
+        simplifier->points_out++;
+        *kept = *point;
+        return true;
+    }
+
+    if (simplifier->count < TRACK_SIMPLIFY_WINDOW && window_fits(simplifier, point)) {
+        simplifier->window[simplifier->count++] = *point;
+        return false;
+    }
+
+    //the last fix of the window still had every fix before it within the tolerance, keep it
+    simplifier->anchor = simplifier->window[simplifier->count - 1];
+    simplifier->window[0] = *point;
+    simplifier->count = 1;
+    simplifier->points_out++;
+    *kept = simplifier->anchor;
+    return true;
+}
+
+bool track_simplifier_finish(Track_Simplifier *simplifier, Track_Point *kept) {
+    if (simplifier->count == 0) {
+        return false;
+    }
+    simplifier->anchor = simplifier->window[simplifier->count - 1];
+    simplifier->count = 0;
+    simplifier->points_out++;
+    *kept = simplifier->anchor;
+    return true;
+}
+
+//the ranges between kept points are refined left to right, so no recursion or stack is needed
+size_t track_simplify_dp(const Track_Point *points, size_t count, uint32_t tolerance_mm, uint8_t *keep) {
+    if (count == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        keep[i] = 0;
+    }
+    keep[0] = 1;
+    keep[count - 1] = 1;
+    size_t kept = count > 1 ? 2 : 1;
+
+    size_t first = 0;
+    while (first + 1 < count) {
+        size_t last = first + 1;
+        while (!keep[last]) {
+            last++;
+        }
+
+        Track_Segment segment;
+        track_segment_init(&segment, &points[first], &points[last]);
+        uint32_t max_distance = 0;
+        size_t split = first;
+        for (size_t i = first + 1; i < last; i++) {
+            uint32_t distance = track_segment_distance_mm(&segment, &points[i]);
+            if (distance > max_distance) {
+                max_distance = distance;
+                split = i;
+            }
+        }
+
+        if (max_distance > tolerance_mm) {
+            //refine first..split next, split..last after it
+            keep[split] = 1;
+            kept++;
+        }
+        else {
+            first = last;
+        }
+    }
+    return kept;
+}
+
+int track_point_format(const Track_Point *point, char *buf, size_t size) {
+    char lat[16], lon[16];
+    geo_format_e7(point->lat_e7, lat, sizeof(lat));
+    geo_format_e7(point->lon_e7, lon, sizeof(lon));
+    return snprintf(buf, size, "%" PRIu64 ",%s,%s\n", point->time_us, lat, lon);
+}
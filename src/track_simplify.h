@@ -0,0 +1,86 @@
+/*
+File: track_simplify.h
+Author: Leonardo DaGraca
+
+Track simplification: drops fixes that lie within a tolerance (in millimetres)
+of the straight line through the fixes that are kept, so long sessions can be
+drawn and processed from a fraction of the points.
+
+Two algorithms share the same integer distance kernel (geo_offset_mm() on the
+local plane at the segment start, no floating point):
+- Track_Simplifier is the streaming "opening window" version for the firmware.
+  It keeps an anchor and up to TRACK_SIMPLIFY_WINDOW fixes after it, and a new
+  fix is checked against every fix in the window. When one of them would end up
+  further than the tolerance from the line anchor -> new fix, the previous fix
+  is kept and becomes the new anchor. Memory is fixed and a kept fix is known
+  one fix after it arrives.
+- track_simplify_dp() is Douglas-Peucker over a whole track for the host
+  tools: keep the fix furthest from the line first -> last if it is beyond the
+  tolerance and repeat on both halves. It usually keeps fewer fixes for the
+  same tolerance because it sees the whole track.
+
+With both, every dropped fix is within the tolerance of the segment between
+the kept fixes on either side of it.
+*/
+#ifndef TRACK_SIMPLIFY_H
+#define TRACK_SIMPLIFY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//fixes the streaming simplifier can look back over, a straight run longer than this keeps a fix anyway
+#define TRACK_SIMPLIFY_WINDOW 32
+
+//default tolerance of the firmware, about the GPS noise of the GT-U7
+#ifndef TRACK_SIMPLIFY_TOLERANCE_MM
+#define TRACK_SIMPLIFY_TOLERANCE_MM 2000
+#endif
+
+#define TRACK_CSV_HEADER "Timestamp,Latitude,Longitude\n"
+
+typedef struct {
+    uint64_t time_us;
+    int32_t lat_e7;
+    int32_t lon_e7;
+} Track_Point;
+
+//segment on the local plane at the latitude of its start, in millimetres
+typedef struct {
+    int32_t lat_e7;
+    int32_t lon_e7;
+    uint32_t cos_q30;
+    int64_t dx_mm;              //end relative to start
+    int64_t dy_mm;
+    int64_t length_sq;
+    uint64_t length_mm;
+} Track_Segment;
+
+typedef struct {
+    uint32_t tolerance_mm;
+    bool has_anchor;
+    Track_Point anchor;                         //last kept fix
+    Track_Point window[TRACK_SIMPLIFY_WINDOW];  //fixes since the anchor, oldest first
+    uint32_t count;
+
+    uint32_t points_in;
+    uint32_t points_out;
+} Track_Simplifier;
+
+void track_segment_init(Track_Segment *segment, const Track_Point *start, const Track_Point *end);
+//distance of a point from the segment (not the infinite line), saturates for points over ~1000 km away
+uint32_t track_segment_distance_mm(const Track_Segment *segment, const Track_Point *point);
+
+void track_simplifier_init(Track_Simplifier *simplifier, uint32_t tolerance_mm);
+//returns true with the fix to keep in *kept (a fix before this one, or the very first fix)
+bool track_simplifier_add(Track_Simplifier *simplifier, const Track_Point *point, Track_Point *kept);
+//end of the track, returns true with the last fix if it was not kept yet
+bool track_simplifier_finish(Track_Simplifier *simplifier, Track_Point *kept);
+
+//Douglas-Peucker, sets keep[i] for the points to keep and returns how many, no memory beyond keep
+size_t track_simplify_dp(const Track_Point *points, size_t count, uint32_t tolerance_mm, uint8_t *keep);
+
+//"timestamp,lat,lon\n" in decimal degrees
+int track_point_format(const Track_Point *point, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+File: ubx.c
+Author: Leonardo DaGraca
+
+UBX frame encoding, see ubx.h.
+*/
+#include <string.h>
+#include "ubx.h"
+
+//dst must hold len + UBX_FRAME_OVERHEAD bytes, returns the frame size
+size_t ubx_build(uint8_t *dst, uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t len) {
+    dst[0] = UBX_SYNC_1;
+    dst[1] = UBX_SYNC_2;
+    dst[2] = msg_class;
+    dst[3] = msg_id;
+    dst[4] = (uint8_t)len;
+    dst[5] = (uint8_t)(len >> 8);
+    if (len > 0) {
+        memcpy(dst + 6, payload, len);
+    }
+
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < 6 + (size_t)len; i++) {
+        ck_a += dst[i];
+        ck_b += ck_a;
+    }
+    dst[6 + len] = ck_a;
+    dst[7 + len] = ck_b;
+    return len + UBX_FRAME_OVERHEAD;
+}
+
+//CFG-RATE: one navigation solution (and NMEA set) every period_ms, aligned to GPS time
+size_t ubx_cfg_rate(uint8_t *dst, uint16_t period_ms) {
+    uint8_t payload[6] = {
+        (uint8_t)period_ms, (uint8_t)(period_ms >> 8),
+        1, 0,   //navRate: one measurement per solution
+        1, 0    //timeRef: GPS time
+    };
+    return ubx_build(dst, UBX_CLASS_CFG, UBX_CFG_RATE, payload, sizeof(payload));
+}
+
+//CFG-MSG: send msg_class/msg_id on the port the command arrives on every rate solutions, 0 turns it off
+size_t ubx_cfg_msg(uint8_t *dst, uint8_t msg_class, uint8_t msg_id, uint8_t rate) {
+    uint8_t payload[3] = {msg_class, msg_id, rate};
+    return ubx_build(dst, UBX_CLASS_CFG, UBX_CFG_MSG, payload, sizeof(payload));
+}
+
+//CFG-PRT for a UART port: 8 data bits, no parity, 1 stop bit at baud_rate
+size_t ubx_cfg_prt_uart(uint8_t *dst, uint8_t port, uint32_t baud_rate, uint16_t in_protocols, uint16_t out_protocols) {
+    uint32_t mode = 0x000008D0;
+    uint8_t payload[20] = {
+        port, 0,
+        0, 0,   //txReady off
+        (uint8_t)mode, (uint8_t)(mode >> 8), (uint8_t)(mode >> 16), (uint8_t)(mode >> 24),
+        (uint8_t)baud_rate, (uint8_t)(baud_rate >> 8), (uint8_t)(baud_rate >> 16), (uint8_t)(baud_rate >> 24),
+        (uint8_t)in_protocols, (uint8_t)(in_protocols >> 8),
+        (uint8_t)out_protocols, (uint8_t)(out_protocols >> 8),
+        0, 0,   //flags
+        0, 0
+    };
+    return ubx_build(dst, UBX_CLASS_CFG, UBX_CFG_PRT, payload, sizeof(payload));
+}
+
+enum {
+    STATE_SYNC_1 = 0,
+    STATE_SYNC_2,
+    STATE_CLASS,
+    STATE_ID,
+    STATE_LEN_LO,
+    STATE_LEN_HI,
+    STATE_PAYLOAD,
+    STATE_CK_A,
+    STATE_CK_B
+};
+
+void ubx_parser_init(UBX_Parser *parser) {
+    memset(parser, 0, sizeof(*parser));
+}
+
+bool ubx_parser_feed(UBX_Parser *parser, uint8_t byte) {
+    //class, id, length and payload go into the checksum
+    if (parser->state >= STATE_CLASS && parser->state <= STATE_PAYLOAD) {
+        parser->ck_a += byte;
+        parser->ck_b += parser->ck_a;
+    }
+
+    switch (parser->state) {
+        case STATE_SYNC_1:
+            if (byte == UBX_SYNC_1) {
+                parser->state = STATE_SYNC_2;
+            }
+            break;
+        case STATE_SYNC_2:
+            if (byte == UBX_SYNC_2) {
+                parser->ck_a = 0;
+                parser->ck_b = 0;
+                parser->state = STATE_CLASS;
+            }
+            else if (byte != UBX_SYNC_1) {
+                parser->state = STATE_SYNC_1;
+            }
+            break;
+        case STATE_CLASS:
+            parser->msg_class = byte;
+            parser->state = STATE_ID;
+            break;
+        case STATE_ID:
+            parser->msg_id = byte;
+            parser->state = STATE_LEN_LO;
+            break;
+        case STATE_LEN_LO:
+            parser->len = byte;
+            parser->state = STATE_LEN_HI;
+            break;
+        case STATE_LEN_HI:
+            parser->len |= (uint16_t)(byte << 8);
+            parser->pos = 0;
+            //a length this long is a damaged header, resync instead of skipping seconds of data
+            if (parser->len > UBX_MAX_PAYLOAD) {
+                parser->checksum_errors++;
+                parser->state = STATE_SYNC_1;
+                break;
+            }
+            parser->state = parser->len > 0 ? STATE_PAYLOAD : STATE_CK_A;
+            break;
+        case STATE_PAYLOAD:
+            if (parser->pos < UBX_PARSER_PAYLOAD) {
+                parser->payload[parser->pos] = byte;
+            }
+            if (++parser->pos == parser->len) {
+                parser->state = STATE_CK_A;
+            }
+            break;
+        case STATE_CK_A:
+            if (byte != parser->ck_a) {
+                parser->checksum_errors++;
+                parser->state = STATE_SYNC_1;
+                break;
+            }
+            parser->state = STATE_CK_B;
+            break;
+        case STATE_CK_B:
+            parser->state = STATE_SYNC_1;
+            if (byte != parser->ck_b) {
+                parser->checksum_errors++;
+                return false;
+            }
+            parser->frames++;
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,74 @@
+/*
+File: ubx.h
+Author: Leonardo DaGraca
+
+Builds u-blox UBX binary frames for configuring the GT-U7 (a u-blox 7 receiver)
+and parses the frames it answers with (ACK-ACK / ACK-NAK).
+Frame: 0xB5 0x62, class, id, little endian payload length, payload, and a
+two byte Fletcher checksum over class through payload.
+*/
+#ifndef UBX_H
+#define UBX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define UBX_SYNC_1 0xB5
+#define UBX_SYNC_2 0x62
+#define UBX_FRAME_OVERHEAD 8    //sync, class, id, length and checksum
+
+#define UBX_CLASS_ACK 0x05
+#define UBX_ACK_NAK 0x00
+#define UBX_ACK_ACK 0x01
+
+#define UBX_CLASS_CFG 0x06
+#define UBX_CFG_PRT 0x00
+#define UBX_CFG_MSG 0x01
+#define UBX_CFG_RATE 0x08
+
+//standard NMEA messages, class and id as used by CFG-MSG
+#define UBX_CLASS_NMEA 0xF0
+#define UBX_NMEA_GGA 0x00
+#define UBX_NMEA_GLL 0x01
+#define UBX_NMEA_GSA 0x02
+#define UBX_NMEA_GSV 0x03
+#define UBX_NMEA_RMC 0x04
+#define UBX_NMEA_VTG 0x05
+
+//CFG-PRT protocol masks
+#define UBX_PROTO_UBX 0x01
+#define UBX_PROTO_NMEA 0x02
+
+#define UBX_CFG_RATE_FRAME_SIZE (UBX_FRAME_OVERHEAD + 6)
+#define UBX_CFG_MSG_FRAME_SIZE (UBX_FRAME_OVERHEAD + 3)
+#define UBX_CFG_PRT_FRAME_SIZE (UBX_FRAME_OVERHEAD + 20)
+
+//payload bytes kept by the parser, longer frames are checked but their payload is cut
+#define UBX_PARSER_PAYLOAD 64
+//longest payload the parser accepts, NAV-SVINFO with 32 channels (the longest u-blox 7 output) is 392
+#define UBX_MAX_PAYLOAD 1024
+
+typedef struct {
+    uint8_t state;
+    uint8_t msg_class;
+    uint8_t msg_id;
+    uint16_t len;
+    uint16_t pos;
+    uint8_t ck_a;
+    uint8_t ck_b;
+    uint8_t payload[UBX_PARSER_PAYLOAD];
+    uint32_t frames;
+    uint32_t checksum_errors;
+} UBX_Parser;
+
+size_t ubx_build(uint8_t *dst, uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t len);
+size_t ubx_cfg_rate(uint8_t *dst, uint16_t period_ms);
+size_t ubx_cfg_msg(uint8_t *dst, uint8_t msg_class, uint8_t msg_id, uint8_t rate);
+size_t ubx_cfg_prt_uart(uint8_t *dst, uint8_t port, uint32_t baud_rate, uint16_t in_protocols, uint16_t out_protocols);
+
+void ubx_parser_init(UBX_Parser *parser);
+//returns true when a frame with a valid checksum is complete, any other byte (NMEA text) is skipped
+bool ubx_parser_feed(UBX_Parser *parser, uint8_t byte);
+
+#endif